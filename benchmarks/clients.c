@@ -0,0 +1,188 @@
+/* Measure how a server copes with many concurrent clients
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Usage: clients FILE [MAX-CLIENTS [SECONDS]]
+
+   For 1, 2, 4, ... MAX-CLIENTS threads, have every thread open FILE
+   on its own and read it from the start over and over for SECONDS
+   seconds, and print the number of requests served per second with
+   the median and 99th percentile of their latency.  Each read is one
+   io_read RPC, so this mostly measures how the server dispatches
+   requests.  A trivfs translator makes a good subject:
+
+     settrans -ac /tmp/hello /hurd/hello-mt
+     clients /tmp/hello 64
+     settrans -fg /tmp/hello
+     settrans -ac /tmp/hello /hurd/hello-mt --max-threads=4
+     clients /tmp/hello 64  */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Latencies are counted in buckets of 1 microsecond up to this.  */
+#define MAX_LATENCY	100000
+
+static const char *file;
+static int seconds = 5;
+
+static pthread_barrier_t start_barrier;
+static volatile int stop;
+
+struct client
+{
+  pthread_t thread;
+  unsigned long requests;
+  unsigned long *latencies;	/* Histogram, in microseconds */
+};
+
+static unsigned long
+now_usecs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void *
+client (void *arg)
+{
+  struct client *c = arg;
+  char buf[64];
+  unsigned long start, latency;
+  int fd;
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    error (1, errno, "%s", file);
+
+  pthread_barrier_wait (&start_barrier);
+
+  while (! stop)
+    {
+      start = now_usecs ();
+      if (pread (fd, buf, sizeof buf, 0) < 0)
+	error (1, errno, "pread");
+      latency = now_usecs () - start;
+
+      c->latencies[latency < MAX_LATENCY ? latency : MAX_LATENCY]++;
+      c->requests++;
+    }
+
+  close (fd);
+  return NULL;
+}
+
+/* Return the latency below which FRACTION of the COUNT requests in
+   HISTOGRAM were served.  */
+static unsigned long
+percentile (unsigned long *histogram, unsigned long count, double fraction)
+{
+  unsigned long seen = 0, i;
+
+  for (i = 0; i < MAX_LATENCY; i++)
+    {
+      seen += histogram[i];
+      if (seen >= count * fraction)
+	break;
+    }
+  return i;
+}
+
+static void
+run (int nclients)
+{
+  struct client *clients;
+  unsigned long *histogram;
+  unsigned long requests = 0;
+  unsigned long start, elapsed;
+  int i, j, err;
+
+  clients = calloc (nclients, sizeof *clients);
+  histogram = calloc (MAX_LATENCY + 1, sizeof *histogram);
+  if (clients == NULL || histogram == NULL)
+    error (1, errno, "calloc");
+
+  stop = 0;
+  pthread_barrier_init (&start_barrier, NULL, nclients + 1);
+  for (i = 0; i < nclients; i++)
+    {
+      clients[i].latencies = calloc (MAX_LATENCY + 1, sizeof *histogram);
+      if (clients[i].latencies == NULL)
+	error (1, errno, "calloc");
+      err = pthread_create (&clients[i].thread, NULL, client, &clients[i]);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  pthread_barrier_wait (&start_barrier);
+  start = now_usecs ();
+  sleep (seconds);
+  stop = 1;
+
+  for (i = 0; i < nclients; i++)
+    {
+      pthread_join (clients[i].thread, NULL);
+      requests += clients[i].requests;
+      for (j = 0; j <= MAX_LATENCY; j++)
+	histogram[j] += clients[i].latencies[j];
+      free (clients[i].latencies);
+    }
+  elapsed = now_usecs () - start;
+  pthread_barrier_destroy (&start_barrier);
+
+  printf ("%7d %12.0f %8lu %8lu\n", nclients,
+	  requests / (elapsed / 1e6),
+	  percentile (histogram, requests, 0.5),
+	  percentile (histogram, requests, 0.99));
+
+  free (histogram);
+  free (clients);
+}
+
+int
+main (int argc, char **argv)
+{
+  int max_clients = 64;
+  int nclients;
+
+  if (argc < 2 || argc > 4)
+    {
+      fprintf (stderr, "Usage: %s FILE [MAX-CLIENTS [SECONDS]]\n", argv[0]);
+      exit (1);
+    }
+  file = argv[1];
+  if (argc > 2)
+    max_clients = atoi (argv[2]);
+  if (argc > 3)
+    seconds = atoi (argv[3]);
+  if (max_clients < 1 || seconds < 1)
+    error (1, 0, "arguments must be positive");
+
+  printf ("%s: %d seconds per run, latencies in microseconds\n",
+	  file, seconds);
+  printf ("clients   requests/s      p50      p99\n");
+  for (nclients = 1; nclients <= max_clients; nclients *= 2)
+    run (nclients);
+
+  return 0;
+}
@@ -0,0 +1,143 @@
+/* Compare the layouts of libihash tables
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Usage: ihash [ITEMS [ROUNDS]]
+
+   Insert ITEMS keys into a table, look each of them up, look up as
+   many keys that are not there, and remove them all again, ROUNDS
+   times, for each combination of table flags.  Print the number of
+   operations per second for each step, the longest time a single
+   insertion took, and the memory the table took when full.  The keys
+   are spaced like port names, which the identity hash maps to
+   neighbouring slots.  */
+
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <hurd/ihash.h>
+
+static size_t nitems = 1000000;
+static int rounds = 5;
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The I-th key.  Mach hands out port names with a generation number
+   in the low byte.  */
+static inline hurd_ihash_key_t
+key (size_t i)
+{
+  return (i + 1) << 8 | 3;
+}
+
+/* The I-th key which is not in the table.  */
+static inline hurd_ihash_key_t
+missing_key (size_t i)
+{
+  return (i + 1) << 8 | 7;
+}
+
+static void
+run (const char *name, unsigned int flags)
+{
+  struct hurd_ihash ht;
+  double t, t1, insert = 0, find = 0, miss = 0, remove = 0, worst = 0;
+  size_t i, memory = 0;
+  int round;
+
+  for (round = 0; round < rounds; round++)
+    {
+      hurd_ihash_init (&ht, HURD_IHASH_NO_LOCP);
+      hurd_ihash_set_flags (&ht, flags);
+
+      t = now ();
+      for (i = 0; i < nitems; i++)
+	{
+	  t1 = now ();
+	  if (hurd_ihash_add (&ht, key (i), (void *) key (i)))
+	    error (1, 0, "hurd_ihash_add failed");
+	  t1 = now () - t1;
+	  if (t1 > worst)
+	    worst = t1;
+	}
+      insert += now () - t;
+
+      memory = (ht.size + ht.old_size) * sizeof ht.items[0];
+      if (flags & HURD_IHASH_CONTROL_BYTES)
+	memory += ht.size + HURD_IHASH_GROUP - 1
+		  + (ht.old_size ? ht.old_size + HURD_IHASH_GROUP - 1 : 0);
+
+      t = now ();
+      for (i = 0; i < nitems; i++)
+	if (hurd_ihash_find (&ht, key (i)) != (void *) key (i))
+	  error (1, 0, "key %zu went missing", i);
+      find += now () - t;
+
+      t = now ();
+      for (i = 0; i < nitems; i++)
+	if (hurd_ihash_find (&ht, missing_key (i)))
+	  error (1, 0, "found a key never added");
+      miss += now () - t;
+
+      t = now ();
+      for (i = 0; i < nitems; i++)
+	if (! hurd_ihash_remove (&ht, key (i)))
+	  error (1, 0, "key %zu could not be removed", i);
+      remove += now () - t;
+
+      if (ht.nr_items != 0)
+	error (1, 0, "%zu items left", ht.nr_items);
+      hurd_ihash_destroy (&ht);
+    }
+
+  printf ("%-12s %10.0f %10.0f %10.0f %10.0f %10.0f %10zu\n", name,
+	  nitems * rounds / insert, nitems * rounds / find,
+	  nitems * rounds / miss, nitems * rounds / remove,
+	  worst * 1e6, memory / 1024);
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 3)
+    {
+      fprintf (stderr, "Usage: %s [ITEMS [ROUNDS]]\n", argv[0]);
+      exit (1);
+    }
+  if (argc > 1)
+    nitems = atol (argv[1]);
+  if (argc > 2)
+    rounds = atoi (argv[2]);
+  if (nitems < 1 || rounds < 1)
+    error (1, 0, "arguments must be positive");
+
+  printf ("%zu items, %d rounds, operations per second\n", nitems, rounds);
+  printf ("flags            insert       find       miss     remove"
+	  "  worst/us  memory/KiB\n");
+  run ("none", 0);
+  run ("control", HURD_IHASH_CONTROL_BYTES);
+  run ("incremental", HURD_IHASH_INCREMENTAL);
+  run ("both", HURD_IHASH_CONTROL_BYTES | HURD_IHASH_INCREMENTAL);
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+/* Measure how reads of one file by several threads scale
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Usage: readers FILE [MAX-THREADS [CHUNK-SIZE [PASSES]]]
+
+   For 1, 2, 4, ... MAX-THREADS threads, have every thread read all of
+   FILE with pread in CHUNK-SIZE pieces, PASSES times, each thread
+   starting at a different place, and print the total throughput.  Run
+   it once beforehand to get FILE into the page cache, or the numbers
+   measure the disk instead.  */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static int fd;
+static off_t file_size;
+static size_t chunk_size = 64 * 1024;
+static int passes = 4;
+
+static pthread_barrier_t start_barrier;
+
+struct reader
+{
+  pthread_t thread;
+  off_t start;
+  unsigned long long bytes;
+};
+
+static void *
+reader (void *arg)
+{
+  struct reader *r = arg;
+  char *buf;
+  off_t done, off;
+  int pass;
+  ssize_t n;
+
+  buf = malloc (chunk_size);
+  if (buf == NULL)
+    error (1, errno, "malloc");
+
+  pthread_barrier_wait (&start_barrier);
+
+  for (pass = 0; pass < passes; pass++)
+    for (done = 0; done < file_size; done += n)
+      {
+	off = (r->start + done) % file_size;
+	n = pread (fd, buf, chunk_size, off);
+	if (n < 0)
+	  error (1, errno, "pread");
+	if (n == 0)
+	  /* Wrap around to the beginning.  */
+	  n = file_size - off;
+	else
+	  r->bytes += n;
+      }
+
+  free (buf);
+  return NULL;
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run (int nthreads)
+{
+  struct reader *readers;
+  unsigned long long bytes = 0;
+  double start, elapsed;
+  int i, err;
+
+  readers = calloc (nthreads, sizeof *readers);
+  if (readers == NULL)
+    error (1, errno, "calloc");
+
+  pthread_barrier_init (&start_barrier, NULL, nthreads + 1);
+  for (i = 0; i < nthreads; i++)
+    {
+      readers[i].start = (file_size / nthreads) * i;
+      err = pthread_create (&readers[i].thread, NULL, reader, &readers[i]);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  pthread_barrier_wait (&start_barrier);
+  start = now ();
+  for (i = 0; i < nthreads; i++)
+    {
+      pthread_join (readers[i].thread, NULL);
+      bytes += readers[i].bytes;
+    }
+  elapsed = now () - start;
+  pthread_barrier_destroy (&start_barrier);
+  free (readers);
+
+  return bytes / elapsed / (1024 * 1024);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct stat st;
+  int max_threads = 8;
+  int nthreads;
+  double base = 0, rate;
+
+  if (argc < 2 || argc > 5)
+    {
+      fprintf (stderr,
+	       "Usage: %s FILE [MAX-THREADS [CHUNK-SIZE [PASSES]]]\n",
+	       argv[0]);
+      exit (1);
+    }
+  if (argc > 2)
+    max_threads = atoi (argv[2]);
+  if (argc > 3)
+    chunk_size = atol (argv[3]);
+  if (argc > 4)
+    passes = atoi (argv[4]);
+  if (max_threads < 1 || chunk_size < 1 || passes < 1)
+    error (1, 0, "arguments must be positive");
+
+  fd = open (argv[1], O_RDONLY);
+  if (fd < 0)
+    error (1, errno, "%s", argv[1]);
+  if (fstat (fd, &st))
+    error (1, errno, "%s", argv[1]);
+  file_size = st.st_size;
+  if (file_size == 0)
+    error (1, 0, "%s: empty file", argv[1]);
+
+  printf ("%s: %lld bytes, %zu byte reads, %d passes\n",
+	  argv[1], (long long) file_size, chunk_size, passes);
+  printf ("threads      MiB/s  speedup\n");
+  for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+    {
+      rate = run (nthreads);
+      if (nthreads == 1)
+	base = rate;
+      printf ("%7d %10.1f %8.2f\n", nthreads, rate, rate / base);
+    }
+
+  close (fd);
+  return 0;
+}
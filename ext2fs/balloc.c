@@ -44,15 +44,175 @@
 #include "ext2fs.h"
 #include "bitmap.c"
 
-/* Returns a pointer to the first occurrence of CH in the buffer BUF of len
-   LEN, or BUF + LEN if CH doesn't occur.  */
-static inline void *
-memscan (void *buf, unsigned char ch, size_t len)
+#define in_range(b, first, len) ((b) >= (first) && (b) <= (first) + (len) - 1)
+
+/* The largest run of free blocks of a group, as bit numbers in its
+   bitmap.  */
+struct group_run
+{
+  int valid;			/* The rest is only meaningful if true */
+  unsigned int start;
+  unsigned int len;
+};
+
+/* The largest free run of each group, computed when needed and kept up
+   to date as blocks are allocated and freed, so that groups can be
+   picked without scanning their bitmaps.  Protected by global_lock.  */
+static struct group_run *group_runs;
+
+/* Blocks promised to files for delayed allocation, which other
+   allocations must leave alone.  Protected by global_lock.  */
+static block_t reserved_blocks;
+
+/* Return the number of blocks in GROUP.  */
+static inline unsigned int
+group_size (unsigned long group)
 {
-  return memchr (buf, ch, len) ?: buf + len;
+  block_t first = group * sblock->s_blocks_per_group
+    + sblock->s_first_data_block;
+
+  if (sblock->s_blocks_count - first < sblock->s_blocks_per_group)
+    return sblock->s_blocks_count - first;
+  return sblock->s_blocks_per_group;
 }
 
-#define in_range(b, first, len) ((b) >= (first) && (b) <= (first) + (len) - 1)
+/* Return the first bit of MAP (of SIZE bits) at or after OFFSET that is
+   clear, or SIZE if none is.  */
+static unsigned int
+next_free_bit (unsigned char *map, unsigned int size, unsigned int offset)
+{
+  while (offset < size && (offset & 7) && test_bit (offset, map))
+    offset++;
+  if (offset < size && !(offset & 7))
+    while (offset + 8 <= size && map[offset >> 3] == 0xff)
+      offset += 8;
+  while (offset < size && test_bit (offset, map))
+    offset++;
+  return offset;
+}
+
+/* Return the first bit of MAP (of SIZE bits) at or after OFFSET that is
+   set, or SIZE if none is.  */
+static unsigned int
+next_used_bit (unsigned char *map, unsigned int size, unsigned int offset)
+{
+  while (offset < size && (offset & 7) && !test_bit (offset, map))
+    offset++;
+  if (offset < size && !(offset & 7))
+    while (offset + 8 <= size && map[offset >> 3] == 0)
+      offset += 8;
+  while (offset < size && !test_bit (offset, map))
+    offset++;
+  return offset;
+}
+
+/* Return the largest free run of GROUP, whose block bitmap is MAP (or
+   which is read if MAP is null), scanning the bitmap if it isn't known.
+   global_lock must be held.  */
+static struct group_run *
+group_run (unsigned long group, unsigned char *map)
+{
+  struct group_run *run;
+
+  if (! group_runs)
+    {
+      group_runs = calloc (groups_count, sizeof *group_runs);
+      if (! group_runs)
+	ext2_panic ("can't allocate free block summaries");
+    }
+
+  run = &group_runs[group];
+  if (! run->valid)
+    {
+      unsigned char *bh = map;
+      unsigned int size = group_size (group);
+      unsigned int start, end;
+
+      if (! bh)
+	bh = disk_cache_block_ref (group_desc (group)->bg_block_bitmap);
+
+      run->start = run->len = 0;
+      for (start = next_free_bit (bh, size, 0);
+	   start < size;
+	   start = next_free_bit (bh, size, end))
+	{
+	  end = next_used_bit (bh, size, start);
+	  if (end - start > run->len)
+	    {
+	      run->start = start;
+	      run->len = end - start;
+	    }
+	}
+      run->valid = 1;
+
+      if (! map)
+	disk_cache_block_deref (bh);
+    }
+
+  return run;
+}
+
+/* Note that COUNT blocks from bit BIT of GROUP, whose bitmap is MAP,
+   were just freed.  global_lock must be held.  */
+static void
+group_run_freed (unsigned long group, unsigned char *map,
+		 unsigned int bit, unsigned int count)
+{
+  struct group_run *run;
+  unsigned int start, end;
+
+  if (! group_runs || ! group_runs[group].valid)
+    return;
+  run = &group_runs[group];
+
+  /* Find the free run the freed blocks joined.  */
+  for (start = bit; start > 0 && !test_bit (start - 1, map); start--)
+    ;
+  end = next_used_bit (map, group_size (group), bit + count);
+  if (end - start > run->len)
+    {
+      run->start = start;
+      run->len = end - start;
+    }
+}
+
+/* Note that COUNT blocks from bit BIT of GROUP were just allocated.
+   global_lock must be held.  */
+static void
+group_run_used (unsigned long group, unsigned int bit, unsigned int count)
+{
+  struct group_run *run;
+
+  if (! group_runs || ! group_runs[group].valid)
+    return;
+  run = &group_runs[group];
+
+  /* If the largest run was cut, some other one may now be larger.  */
+  if (bit < run->start + run->len && bit + count > run->start)
+    run->valid = 0;
+}
+
+/* Return the start of the first free run of at least WANT blocks in MAP
+   (the bitmap of GROUP) at or after bit OFFSET, or failing that, of the
+   largest one RUN.  */
+static unsigned int
+find_run (unsigned long group, unsigned char *map, unsigned int offset,
+	  unsigned int want, struct group_run *run)
+{
+  unsigned int size = group_size (group);
+  unsigned int start, end;
+
+  for (start = next_free_bit (map, size, offset);
+       start < size;
+       start = next_free_bit (map, size, end))
+    {
+      end = next_used_bit (map, size, start);
+      if (end - start >= want)
+	return start;
+    }
+
+  return run->start;
+}
 
 void
 ext2_free_blocks (block_t block, unsigned long count)
@@ -76,6 +236,8 @@ ext2_free_blocks (block_t block, unsigned long count)
 
   ext2_debug ("freeing block %u[%lu]", block, count);
 
+  journal_revoke (block, count);
+
   do
     {
       unsigned long int gcount = count;
@@ -112,6 +274,7 @@ ext2_free_blocks (block_t block, unsigned long count)
 	      sblock->s_free_blocks_count++;
 	    }
 	}
+      group_run_freed (block_group, bh, bit, gcount);
 
       record_global_poke (bh);
       disk_cache_block_ref_ptr (gdp);
@@ -129,265 +292,250 @@ ext2_free_blocks (block_t block, unsigned long count)
 }
 
 /*
- * ext2_new_block uses a goal block to assist allocation.  If the goal is
- * free, or there is a free block within 32 blocks of the goal, that block
- * is allocated.  Otherwise a forward search is made for a free block; within
- * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
+ * ext2_new_blocks uses a goal block to assist allocation.  If the goal is
+ * free, or there is a free block within 32 blocks of the goal, the run of
+ * free blocks starting there is used, to keep files contiguous.  Otherwise
+ * the first group, starting with the goal's, with a free run of the
+ * requested length is used (searching forward from the goal in its own
+ * group); if there is no such run, the longest one anywhere is used.
  */
 block_t
-ext2_new_block (block_t goal,
-		block_t prealloc_goal,
-		block_t *prealloc_count, block_t *prealloc_block)
+ext2_new_blocks (block_t goal, block_t *count, int reserved)
 {
   unsigned char *bh = NULL;
-  unsigned char *p, *r;
-  int i, j, k, tmp;
-  unsigned long lmap;
   struct ext2_group_desc *gdp;
+  struct group_run *run;
+  unsigned long i, best;
+  unsigned int j, k, size, len, want = *count;
+  block_t avail, tmp;
 
-#ifdef EXT2FS_DEBUG
-  static int goal_hits = 0, goal_attempts = 0;
-#endif
+  assert_backtrace (want > 0);
 
   pthread_spin_lock (&global_lock);
 
-#ifdef XXX /* Auth check to use reserved blocks  */
-  if (sblock->s_free_blocks_count <= sblock->s_r_blocks_count &&
-      (!fsuser () && (sb->u.ext2_sb.s_resuid != current->fsuid) &&
-       (sb->u.ext2_sb.s_resgid == 0 ||
-	!in_group_p (sb->u.ext2_sb.s_resgid))))
+  ext2_debug ("goal=%u[%u]", goal, want);
+
+  /* Leave blocks promised for delayed allocation alone, unless these are
+     those.  */
+  avail = sblock->s_free_blocks_count;
+  if (! reserved)
+    avail = avail > reserved_blocks ? avail - reserved_blocks : 0;
+  if (avail == 0)
     {
       pthread_spin_unlock (&global_lock);
       return 0;
     }
-#endif
-
-  ext2_debug ("goal=%u", goal);
+  if (want > avail)
+    want = avail;
+  if (want > sblock->s_blocks_per_group)
+    want = sblock->s_blocks_per_group;
 
 repeat:
   assert_backtrace (bh == NULL);
+
   /*
-     * First, test whether the goal block is free.
+   * First, test whether the goal block, or one shortly after it, is free.
    */
   if (goal < sblock->s_first_data_block || goal >= sblock->s_blocks_count)
     goal = sblock->s_first_data_block;
   i = (goal - sblock->s_first_data_block) / sblock->s_blocks_per_group;
+  j = (goal - sblock->s_first_data_block) % sblock->s_blocks_per_group;
   gdp = group_desc (i);
   if (gdp->bg_free_blocks_count > 0)
     {
-      j = ((goal - sblock->s_first_data_block) % sblock->s_blocks_per_group);
-#ifdef EXT2FS_DEBUG
-      if (j)
-	goal_attempts++;
-#endif
+      size = group_size (i);
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
 
-      ext2_debug ("goal is at %d:%d", i, j);
-
-      if (!test_bit (j, bh))
-	{
-#ifdef EXT2FS_DEBUG
-	  goal_hits++;
-	  ext2_debug ("goal bit allocated!");
-#endif
-	  goto got_block;
-	}
-      if (j)
-	{
-	  /*
-	     * The goal was occupied; search forward for a free
-	     * block within the next 32 blocks
-	   */
-	  if ((j & 31) == 31)
-	    lmap = 0;
-	  else
-	    lmap = ((((unsigned long *) bh)[j >> 5]) >>
-		    ((j & 31) + 1));
-	  if (j < sblock->s_blocks_per_group - 32)
-	    lmap |= (((unsigned long *) bh)[(j >> 5) + 1]) <<
-	      (31 - (j & 31));
-	  else
-	    lmap |= 0xffffffff << (31 - (j & 31));
-	  if (lmap != 0xffffffffl)
-	    {
-	      k = ffz (lmap) + 1;
-	      if ((j + k) < sblock->s_blocks_per_group)
-		{
-		  j += k;
-		  goto got_block;
-		}
-	    }
-	}
-
-      ext2_debug ("bit not found near goal");
+      ext2_debug ("goal is at %lu:%u", i, j);
 
-      /*
-       * There has been no free block found in the near vicinity
-       * of the goal: do a search forward through the block groups,
-       * searching in each group first for an entire free byte in
-       * the bitmap and then for any free bit.
-       *
-       * Search first in the remainder of the current group; then,
-       * cyclicly search through the rest of the groups.
-       */
-      p = bh + (j >> 3);
-      r = memscan (p, 0, (sblock->s_blocks_per_group - j + 7) >> 3);
-      k = (r - bh) << 3;
-      if (k < sblock->s_blocks_per_group)
-	{
-	  j = k;
-	  goto search_back;
-	}
-      k = find_next_zero_bit ((unsigned long *) bh,
-			      sblock->s_blocks_per_group,
-			      j);
-      if (k < sblock->s_blocks_per_group)
+      k = next_free_bit (bh, size, j);
+      if (k < size && k - j < 32)
 	{
 	  j = k;
 	  goto got_block;
 	}
 
-      disk_cache_block_deref (bh);
-      bh = NULL;
+      ext2_debug ("bit not found near goal");
     }
 
-  ext2_debug ("bit not found in block group %d", i);
-
   /*
-     * Now search the rest of the groups.  We assume that
-     * i and gdp correctly point to the last group visited.
+   * Then look for a group with a long enough run, from the goal group
+   * onwards, keeping note of the longest run seen in case there is none.
    */
-  for (k = 0; k < groups_count; k++)
+  best = groups_count;
+  len = 0;
+  for (k = 0; k < groups_count; k++, i = (i + 1) % groups_count)
     {
-      i++;
-      if (i >= groups_count)
-	i = 0;
+      /* Only the goal group's bitmap is at hand already.  */
+      unsigned char *map = k == 0 ? bh : NULL;
+
       gdp = group_desc (i);
-      if (gdp->bg_free_blocks_count > 0)
-	break;
-    }
-  if (k >= groups_count)
-    {
-      pthread_spin_unlock (&global_lock);
-      return 0;
+      if (gdp->bg_free_blocks_count > 0
+	  && (gdp->bg_free_blocks_count >= want
+	      || gdp->bg_free_blocks_count > len))
+	{
+	  run = group_run (i, map);
+	  if (run->len >= want)
+	    {
+	      if (! map)
+		bh = disk_cache_block_ref (gdp->bg_block_bitmap);
+	      j = find_run (i, bh, map ? j : 0, want, run);
+	      goto got_block;
+	    }
+	  if (run->len > len)
+	    {
+	      best = i;
+	      len = run->len;
+	    }
+	}
+
+      if (map)
+	disk_cache_block_deref (bh);
     }
-  assert_backtrace (bh == NULL);
-  bh = disk_cache_block_ref (gdp->bg_block_bitmap);
-  r = memscan (bh, 0, sblock->s_blocks_per_group >> 3);
-  j = (r - bh) << 3;
-  if (j < sblock->s_blocks_per_group)
-    goto search_back;
-  else
-    j = find_first_zero_bit ((unsigned long *) bh,
-			     sblock->s_blocks_per_group);
-  if (j >= sblock->s_blocks_per_group)
+
+  if (best == groups_count)
     {
-      disk_cache_block_deref (bh);
-      bh = NULL;
-      ext2_error ("free blocks count corrupted for block group %d", i);
+      ext2_error ("free blocks count corrupted");
       pthread_spin_unlock (&global_lock);
       return 0;
     }
 
-search_back:
-  assert_backtrace (bh != NULL);
-  /*
-     * We have succeeded in finding a free byte in the block
-     * bitmap.  Now search backwards up to 7 bits to find the
-     * start of this group of free blocks.
-   */
-  for (k = 0; k < 7 && j > 0 && !test_bit (j - 1, bh); k++, j--);
+  i = best;
+  gdp = group_desc (i);
+  bh = disk_cache_block_ref (gdp->bg_block_bitmap);
+  j = group_run (i, bh)->start;
 
 got_block:
   assert_backtrace (bh != NULL);
 
-  ext2_debug ("using block group %d (%d)", i, gdp->bg_free_blocks_count);
-
-  tmp = j + i * sblock->s_blocks_per_group + sblock->s_first_data_block;
+  ext2_debug ("using block group %lu (%d)", i, gdp->bg_free_blocks_count);
 
-  if (tmp == gdp->bg_block_bitmap ||
-      tmp == gdp->bg_inode_bitmap ||
-      in_range (tmp, gdp->bg_inode_table, itb_per_group))
-    ext2_panic ("allocating block in system zone; block = %u", tmp);
-
-  if (set_bit (j, bh))
+  size = group_size (i);
+  len = next_used_bit (bh, size, j) - j;
+  if (len > want)
+    len = want;
+  if (len == 0)
     {
-      ext2_warning ("bit already set for block %d", j);
+      ext2_warning ("bit already set for block %u", j);
       disk_cache_block_deref (bh);
       bh = NULL;
+      if (group_runs)
+	group_runs[i].valid = 0;
       goto repeat;
     }
 
+  tmp = j + i * sblock->s_blocks_per_group + sblock->s_first_data_block;
+
+  if (in_range (gdp->bg_block_bitmap, tmp, len) ||
+      in_range (gdp->bg_inode_bitmap, tmp, len) ||
+      in_range (tmp, gdp->bg_inode_table, itb_per_group) ||
+      in_range (gdp->bg_inode_table, tmp, len))
+    ext2_panic ("allocating blocks in system zone; block = %u[%u]", tmp, len);
+
+  for (k = 0; k < len; k++)
+    set_bit (j + k, bh);
+
   /* Since due to bletcherousness block-modified bits are never turned off
-     when writing disk-pager pages, make sure they are here, in case this
-     block is being allocated to a file (see pager.c).  */
+     when writing disk-pager pages, make sure they are here, in case these
+     blocks are being allocated to a file (see pager.c).  */
   if (modified_global_blocks)
     {
       pthread_spin_lock (&modified_global_blocks_lock);
-      clear_bit (tmp, modified_global_blocks);
+      for (k = 0; k < len; k++)
+	clear_bit (tmp + k, modified_global_blocks);
       pthread_spin_unlock (&modified_global_blocks_lock);
     }
 
-  ext2_debug ("found bit %d", j);
+  ext2_debug ("found bits %u[%u]", j, len);
+
+  group_run_used (i, j, len);
+
+  record_global_poke (bh);
+  bh = NULL;
+
+  gdp->bg_free_blocks_count -= len;
+  disk_cache_block_ref_ptr (gdp);
+  record_global_poke (gdp);
+
+  sblock->s_free_blocks_count -= len;
+  sblock_dirty = 1;
+
+  assert_backtrace (bh == NULL);
+  pthread_spin_unlock (&global_lock);
+  alloc_sync (0);
+
+  *count = len;
+  return tmp;
+}
+
+/* Allocate a block as close to GOAL as possible, and return it, or 0 if
+   the disk is full.  If PREALLOC_GOAL is non-zero, also try to allocate
+   that many blocks following it, returning the first in *PREALLOC_BLOCK
+   and how many there are in *PREALLOC_COUNT.  */
+block_t
+ext2_new_block (block_t goal,
+		block_t prealloc_goal,
+		block_t *prealloc_count, block_t *prealloc_block)
+{
+  block_t count = 1, block;
+
+#ifdef EXT2_PREALLOCATE
+  count += prealloc_goal;
+#endif
+
+  block = ext2_new_blocks (goal, &count, 0);
 
-  /*
-     * Do block preallocation now if required.
-   */
 #ifdef EXT2_PREALLOCATE
   if (prealloc_goal)
     {
-      *prealloc_count = 0;
-      *prealloc_block = tmp + 1;
-      for (k = 1;
-	   k < prealloc_goal && (j + k) < sblock->s_blocks_per_group; k++)
-	{
-	  if (set_bit (j + k, bh))
-	    break;
-	  (*prealloc_count)++;
-
-	  /* (See comment before the clear_bit above) */
-	  if (modified_global_blocks)
-	    {
-	      pthread_spin_lock (&modified_global_blocks_lock);
-	      clear_bit (tmp + k, modified_global_blocks);
-	      pthread_spin_unlock (&modified_global_blocks_lock);
-	    }
-	}
-      gdp->bg_free_blocks_count -= *prealloc_count;
-      sblock->s_free_blocks_count -= *prealloc_count;
+      *prealloc_count = block ? count - 1 : 0;
+      *prealloc_block = block + 1;
       ext2_debug ("preallocated a further %u bits", *prealloc_count);
     }
 #endif
 
-  j = tmp;
+  return block;
+}
 
-  record_global_poke (bh);
-  bh = NULL;
+/* Reserve COUNT blocks for delayed allocation.  Return ENOSPC if there
+   aren't that many free blocks not already reserved.  */
+error_t
+ext2_reserve_blocks (block_t count)
+{
+  error_t err = 0;
 
-  if (j >= sblock->s_blocks_count)
-    {
-      ext2_error ("block >= blocks count - block_group = %d, block=%d", i, j);
-      j = 0;
-      goto sync_out;
-    }
+  pthread_spin_lock (&global_lock);
+  if (sblock->s_free_blocks_count < reserved_blocks
+      || sblock->s_free_blocks_count - reserved_blocks < count)
+    err = ENOSPC;
+  else
+    reserved_blocks += count;
+  pthread_spin_unlock (&global_lock);
 
-  ext2_debug ("allocating block %d; goal hits %d of %d",
-	      j, goal_hits, goal_attempts);
+  return err;
+}
 
-  gdp->bg_free_blocks_count--;
-  disk_cache_block_ref_ptr (gdp);
-  record_global_poke (gdp);
+/* Give back COUNT blocks reserved with ext2_reserve_blocks.  */
+void
+ext2_unreserve_blocks (block_t count)
+{
+  pthread_spin_lock (&global_lock);
+  assert_backtrace (reserved_blocks >= count);
+  reserved_blocks -= count;
+  pthread_spin_unlock (&global_lock);
+}
 
-  sblock->s_free_blocks_count--;
-  sblock_dirty = 1;
+/* Return the number of blocks reserved for delayed allocation.  */
+block_t
+ext2_reserved_blocks (void)
+{
+  block_t count;
 
- sync_out:
-  assert_backtrace (bh == NULL);
+  pthread_spin_lock (&global_lock);
+  count = reserved_blocks;
   pthread_spin_unlock (&global_lock);
-  alloc_sync (0);
 
-  return j;
+  return count;
 }
 
 unsigned long
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <stddef.h>
+#include <stdlib.h>
 
 #include <hurd/sigpreempt.h>
 
@@ -35,6 +36,15 @@
    entries that straddle device blocks (but read those that do)...  */
 #define DIRBLKSIZ block_size
 
+/* One level of a path through the index of a hash-indexed directory:
+   the entry array of an index block (inside the directory mapping), and
+   the entry in it that was followed.  */
+struct dx_frame
+{
+  struct ext2_dx_entry *entries;
+  struct ext2_dx_entry *at;
+};
+
 enum slot_status
 {
   /* This means we haven't yet found room for a new entry.  */
@@ -88,6 +98,15 @@ struct dirstat
   /* For stat COMPRESS, this is the number of bytes needed to be copied
      in order to undertake the compression. */
   size_t nbytes;
+
+  /* If the lookup went through the hash index, the number of index
+     levels, else zero.  Changes made without the index drop it.  */
+  int dx_levels;
+
+  /* For type CREATE through the index, the hash of the name and the
+     index path to the leaf block it belongs in.  */
+  __u32 dx_hash;
+  struct dx_frame dx_frames[EXT2_HTREE_LEVEL];
 };
 
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -104,6 +123,44 @@ dirscanblock (vm_address_t blockoff, struct node *dp, int idx,
 	      const char *name, size_t namelen, enum lookup_type type,
 	      struct dirstat *ds, ino_t *inum);
 
+static error_t
+dx_lookup (struct node *dp, vm_address_t buf, const char *name,
+	   size_t namelen, enum lookup_type type, struct dirstat *ds,
+	   ino_t *inum);
+
+static void prefetch_dinodes (struct node *dp, ino_t inum);
+
+/* Return true if DP is a directory whose hash index we should use.  */
+static inline int
+dx_dir (struct node *dp)
+{
+  return (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX)
+	  && (diskfs_node_disknode (dp)->info.i_flags & EXT2_INDEX_FL));
+}
+
+/* Add block IDX of directory DP, mapped at BUF, to the running journal
+   transaction, now that it has been changed.  */
+static void
+journal_dir_block (struct node *dp, vm_address_t buf, int idx)
+{
+  struct disknode *dn = diskfs_node_disknode (dp);
+  block_t block;
+  error_t err;
+
+  if (! journal_active)
+    return;
+
+  pthread_rwlock_rdlock (&dn->alloc_lock);
+  err = ext2_getblk (dp, idx, 0, &block);
+  pthread_rwlock_unlock (&dn->alloc_lock);
+
+  if (err)
+    ext2_warning ("inode=%Ld, directory block %d not journaled: %s",
+		  dp->cache_id, idx, strerror (err));
+  else
+    journal_dirty_block (block, (void *) (buf + idx * DIRBLKSIZ));
+}
+
 
 #if 0				/* XXX unused for now */
 static const unsigned char ext2_file_type[EXT2_FT_MAX] =
@@ -176,6 +233,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
       ds->type = LOOKUP;
       ds->mapbuf = 0;
       ds->mapextent = 0;
+      ds->dx_levels = 0;
     }
   if (buf)
     {
@@ -192,8 +250,10 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
     return errno;
 
   buf = 0;
-  /* We allow extra space in case we have to do an EXTEND. */
-  buflen = round_page (dp->dn_stat.st_size + DIRBLKSIZ);
+  /* We allow extra space in case we have to do an EXTEND.  Splitting a
+     leaf of an indexed directory may need a new index block as well.  */
+  buflen = round_page (dp->dn_stat.st_size
+		       + (dx_dir (dp) ? 2 : 1) * DIRBLKSIZ);
   err = vm_map (mach_task_self (),
 		&buf, buflen, 0, 1, memobj, 0, 0, prot, prot, 0);
   mach_port_deallocate (mach_task_self (), memobj);
@@ -204,6 +264,15 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 
   diskfs_set_node_atime (dp);
 
+  /* An indexed directory only needs the leaf blocks NAME hashes to;
+     fall back to scanning everything if the index is unusable.  */
+  if (dx_dir (dp))
+    {
+      err = dx_lookup (dp, buf, name, namelen, type, ds, &inum);
+      if (err != EINVAL)
+	goto scanned;
+    }
+
   /* Start the lookup at diskfs_node_disknode (DP)->dir_idx.  */
   idx = diskfs_node_disknode (dp)->dir_idx;
   if (idx * DIRBLKSIZ > dp->dn_stat.st_size)
@@ -239,6 +308,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 	}
     }
 
+ scanned:
   diskfs_set_node_atime (dp);
   if (diskfs_synchronous)
     diskfs_node_update (dp, 1);
@@ -247,6 +317,9 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
      think about that as an error yet. */
   err = 0;
 
+  if (inum && diskfs_node_disknode (dp)->prefetch)
+    prefetch_dinodes (dp, inum);
+
   if (inum && npp)
     {
       if (namelen != 2 || name[0] != '.' || name[1] != '.')
@@ -518,6 +591,504 @@ dirscanblock (vm_address_t blockaddr, struct node *dp, int idx,
   return 0;
 }
 
+/* Hash-indexed directories.  The index is a tree of at most
+   EXT2_HTREE_LEVEL levels of sorted (hash, block) arrays whose leaves
+   are ordinary directory blocks, each holding the names whose hashes
+   fall between its entry and the next.  A leaf whose first hash equals
+   the last hash of the previous leaf has the low bit of its index hash
+   set, and names with that hash must be looked for in both.  */
+
+#define dx_countlimit(entries) ((struct ext2_dx_countlimit *) (entries))
+#define dx_block(entry) ((entry)->block & 0x0fffffff)
+
+/* The number of index entries that fit in the root block and in the
+   other index blocks.  */
+#define dx_root_limit()							\
+  ((DIRBLKSIZ - EXT2_DIR_REC_LEN (1) - EXT2_DIR_REC_LEN (2)		\
+    - sizeof (struct ext2_dx_root_info)) / sizeof (struct ext2_dx_entry))
+#define dx_node_limit()							\
+  ((DIRBLKSIZ - EXT2_DIR_REC_LEN (0)) / sizeof (struct ext2_dx_entry))
+
+/* Return the index root of directory DP (mapped at BUF), or zero if we
+   cannot use it.  Set *HASH_VERSION to the hash function it uses.  */
+static struct ext2_dx_root *
+dx_root (struct node *dp, vm_address_t buf, int *hash_version)
+{
+  struct ext2_dx_root *root = (struct ext2_dx_root *) buf;
+  struct ext2_dx_entry *entries = root->entries;
+
+  if (dp->dn_stat.st_size < 2 * DIRBLKSIZ
+      || root->dot.rec_len != EXT2_DIR_REC_LEN (1)
+      || root->dotdot.rec_len != DIRBLKSIZ - EXT2_DIR_REC_LEN (1)
+      || root->info.reserved_zero
+      || root->info.info_length != sizeof root->info
+      || root->info.indirect_levels >= EXT2_HTREE_LEVEL
+      || root->info.unused_flags & 1
+      || root->info.hash_version > EXT2_HASH_TEA
+      || dx_countlimit (entries)->limit != dx_root_limit ())
+    return 0;
+
+  *hash_version = root->info.hash_version;
+  if (sblock->s_flags & EXT2_FLAGS_UNSIGNED_HASH)
+    *hash_version += EXT2_HASH_LEGACY_UNSIGNED;
+  return root;
+}
+
+/* Return the entries of index block IDX of directory DP (mapped at BUF),
+   or zero if it is not a valid index block.  */
+static struct ext2_dx_entry *
+dx_node (struct node *dp, vm_address_t buf, unsigned idx)
+{
+  struct ext2_dx_node *node =
+    (struct ext2_dx_node *) (buf + idx * DIRBLKSIZ);
+
+  if (idx == 0
+      || idx >= dp->dn_stat.st_size / DIRBLKSIZ
+      || node->fake.inode
+      || node->fake.rec_len != DIRBLKSIZ
+      || dx_countlimit (node->entries)->limit != dx_node_limit ())
+    return 0;
+  return node->entries;
+}
+
+/* Descend the index of directory DP (mapped at BUF) from ROOT, filling
+   in FRAMES with the path to the first leaf that may hold names with
+   hash HASH.  Return the number of levels, or zero if the index is
+   corrupt.  */
+static int
+dx_probe (struct node *dp, vm_address_t buf, struct ext2_dx_root *root,
+	  __u32 hash, struct dx_frame *frames)
+{
+  int levels = root->info.indirect_levels + 1;
+  struct ext2_dx_entry *entries = root->entries;
+  int level;
+
+  for (level = 0; ; level++)
+    {
+      unsigned count = dx_countlimit (entries)->count;
+      struct ext2_dx_entry *p, *q, *m;
+
+      if (count == 0 || count > dx_countlimit (entries)->limit)
+	break;
+
+      /* Find the last entry whose hash is not above HASH; the first
+	 entry has no hash and covers everything below the second.  */
+      p = entries + 1;
+      q = entries + count - 1;
+      while (p <= q)
+	{
+	  m = p + (q - p) / 2;
+	  if (m->hash > hash)
+	    q = m - 1;
+	  else
+	    p = m + 1;
+	}
+
+      frames[level].entries = entries;
+      frames[level].at = p - 1;
+
+      if (level == levels - 1)
+	{
+	  unsigned idx = dx_block (p - 1);
+	  if (idx == 0 || idx >= dp->dn_stat.st_size / DIRBLKSIZ)
+	    break;
+	  return levels;
+	}
+
+      entries = dx_node (dp, buf, dx_block (p - 1));
+      if (!entries)
+	break;
+    }
+
+  ext2_warning ("corrupt directory index: inode: %Ld", dp->cache_id);
+  return 0;
+}
+
+/* Advance the index path FRAMES (of LEVELS levels) of directory DP
+   (mapped at BUF) to the next leaf, if that leaf continues the run of
+   names with hash HASH.  Return true if it does.  */
+static int
+dx_next_leaf (struct node *dp, vm_address_t buf, struct dx_frame *frames,
+	      int levels, __u32 hash)
+{
+  int level;
+  unsigned idx;
+
+  for (level = levels - 1; level >= 0; level--)
+    if (frames[level].at + 1
+	< frames[level].entries + dx_countlimit (frames[level].entries)->count)
+      break;
+  if (level < 0)
+    return 0;
+
+  frames[level].at++;
+  if ((frames[level].at->hash & ~1) != hash)
+    return 0;
+
+  while (++level < levels)
+    {
+      struct ext2_dx_entry *entries =
+	dx_node (dp, buf, dx_block (frames[level - 1].at));
+      if (!entries)
+	return 0;
+      frames[level].entries = frames[level].at = entries;
+    }
+
+  idx = dx_block (frames[levels - 1].at);
+  return idx && idx < dp->dn_stat.st_size / DIRBLKSIZ;
+}
+
+/* Look up NAME (of length NAMELEN) in the indexed directory DP, mapped
+   at BUF.  Arguments and return values are as for dirscanblock, except
+   that EINVAL means the index cannot be used and the whole directory
+   must be scanned instead.  */
+static error_t
+dx_lookup (struct node *dp, vm_address_t buf, const char *name,
+	   size_t namelen, enum lookup_type type, struct dirstat *ds,
+	   ino_t *inum)
+{
+  struct dx_frame frames[EXT2_HTREE_LEVEL];
+  struct ext2_dx_root *root;
+  int hash_version;
+  int levels;
+  __u32 hash;
+  error_t err;
+
+  root = dx_root (dp, buf, &hash_version);
+  if (!root)
+    return EINVAL;
+
+  /* "." and ".." are always in the first block, ahead of the root.  */
+  if (name[0] == '.' && (namelen == 1 || (namelen == 2 && name[1] == '.')))
+    {
+      if (ds)
+	ds->dx_levels = root->info.indirect_levels + 1;
+      return dirscanblock (buf, dp, 0, name, namelen, type, ds, inum);
+    }
+
+  err = ext2_dirhash (name, namelen, hash_version, sblock->s_hash_seed,
+		      &hash, 0);
+  if (err)
+    return EINVAL;
+
+  levels = dx_probe (dp, buf, root, hash, frames);
+  if (!levels)
+    return EINVAL;
+
+  if (ds)
+    {
+      ds->dx_levels = levels;
+      ds->dx_hash = hash;
+      memcpy (ds->dx_frames, frames, sizeof frames);
+    }
+
+  do
+    {
+      int idx = dx_block (frames[levels - 1].at);
+
+      err = dirscanblock (buf + idx * DIRBLKSIZ, dp, idx,
+			  name, namelen, type, ds, inum);
+      if (err != ENOENT)
+	return err;
+    }
+  while (dx_next_leaf (dp, buf, frames, levels, hash));
+
+  return ENOENT;
+}
+
+/* Add NBLOCKS empty blocks to the end of directory DP, which is mapped
+   as described by DS.  */
+static error_t
+grow_dir (struct node *dp, struct dirstat *ds, int nblocks,
+	  struct protid *cred)
+{
+  size_t oldsize = dp->dn_stat.st_size;
+  size_t newsize = oldsize + nblocks * DIRBLKSIZ;
+  error_t err;
+  int i;
+
+  if ((off_t) newsize != dp->dn_stat.st_size + nblocks * DIRBLKSIZ
+      || newsize > ds->mapextent)
+    /* We can't possibly map the whole directory in.  */
+    return EOVERFLOW;
+
+  while (newsize > dp->allocsize)
+    {
+      err = diskfs_grow (dp, newsize, cred);
+      if (err)
+	return err;
+    }
+
+  err = hurd_safe_memset ((void *) (ds->mapbuf + oldsize), 0,
+			  nblocks * DIRBLKSIZ);
+  if (err)
+    return err == EKERN_MEMORY_ERROR ? ENOSPC : err;
+
+  for (i = 0; i < nblocks; i++)
+    ((struct ext2_dir_entry_2 *) (ds->mapbuf + oldsize + i * DIRBLKSIZ))
+      ->rec_len = DIRBLKSIZ;
+
+  dp->dn_stat.st_size = newsize;
+  dp->dn_set_ctime = 1;
+  return 0;
+}
+
+/* Insert an index entry for block IDX, holding names hashing to HASH and
+   up, just after the entry FRAME follows.  */
+static void
+dx_insert (struct dx_frame *frame, __u32 hash, unsigned idx)
+{
+  struct ext2_dx_countlimit *cl = dx_countlimit (frame->entries);
+  struct ext2_dx_entry *new = frame->at + 1;
+
+  assert_backtrace (cl->count < cl->limit);
+  memmove (new + 1, new, (frame->entries + cl->count - new) * sizeof *new);
+  new->hash = hash;
+  new->block = idx;
+  cl->count++;
+}
+
+/* A live entry of a leaf being split.  */
+struct dx_map_entry
+{
+  __u32 hash;
+  struct ext2_dir_entry_2 *entry;
+};
+
+static int
+dx_map_compare (const void *a, const void *b)
+{
+  const struct dx_map_entry *x = a, *y = b;
+
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
+
+/* Make room for a new entry named NAME (of length NAMELEN) in the
+   indexed directory DP by splitting the leaf block it hashes to, as
+   described by DS, and adding the new half to the index.  On success,
+   set *NEW to the space for the entry with its rec_len filled in, and
+   DS->idx to its block.  If the leaf cannot be split, set *NEW to zero
+   and leave a valid directory behind.  */
+static error_t
+dx_split (struct node *dp, struct dirstat *ds, const char *name,
+	  size_t namelen, struct protid *cred, struct ext2_dir_entry_2 **new)
+{
+  struct ext2_dx_root *root;
+  struct dx_frame *frames = ds->dx_frames;
+  int levels = ds->dx_levels;
+  struct ext2_dx_entry *entries = frames[levels - 1].entries;
+  struct ext2_dx_countlimit *cl = dx_countlimit (entries);
+  int leafidx = dx_block (frames[levels - 1].at);
+  int newidx = dp->dn_stat.st_size / DIRBLKSIZ;
+  struct ext2_dir_entry_2 *entry, *last, *newlast;
+  struct dx_map_entry *map;
+  vm_address_t leaf, newleaf;
+  char *copy;
+  int hash_version, nblocks, count, split, i;
+  size_t size, oldneeded;
+  __u32 hash2;
+  error_t err;
+
+  /* Rewrite BLOCK to hold the N entries of MAP, and return the last.  */
+  struct ext2_dir_entry_2 *
+  fill (vm_address_t block, struct dx_map_entry *map, int n)
+    {
+      vm_address_t tooff = block;
+      struct ext2_dir_entry_2 *to = 0;
+      int i;
+
+      for (i = 0; i < n; i++)
+	{
+	  size_t len = EXT2_DIR_REC_LEN (map[i].entry->name_len);
+
+	  to = (struct ext2_dir_entry_2 *) tooff;
+	  memcpy (to, map[i].entry, len);
+	  to->rec_len = len;
+	  tooff += len;
+	}
+      to->rec_len += block + DIRBLKSIZ - tooff;
+      return to;
+    }
+
+  *new = 0;
+
+  root = dx_root (dp, ds->mapbuf, &hash_version);
+  if (!root)
+    return 0;
+
+  /* We need a block for the new leaf, and another to grow the index if
+     the leaf's index block is full.  */
+  nblocks = 1;
+  if (cl->count == cl->limit)
+    {
+      if (levels == EXT2_HTREE_LEVEL
+	  && (dx_countlimit (frames[0].entries)->count
+	      == dx_countlimit (frames[0].entries)->limit))
+	/* The index is full.  */
+	return 0;
+      nblocks = 2;
+    }
+
+  /* Work out which names go where before changing anything.  */
+  copy = malloc (DIRBLKSIZ);
+  map = malloc (DIRBLKSIZ / EXT2_DIR_REC_LEN (1) * sizeof *map);
+  if (!copy || !map)
+    {
+      free (copy);
+      free (map);
+      return ENOMEM;
+    }
+
+  leaf = ds->mapbuf + leafidx * DIRBLKSIZ;
+  memcpy (copy, (void *) leaf, DIRBLKSIZ);
+
+  count = 0;
+  for (i = 0; i < DIRBLKSIZ; i += entry->rec_len)
+    {
+      entry = (struct ext2_dir_entry_2 *) (copy + i);
+      if (!entry->rec_len || i + entry->rec_len > DIRBLKSIZ)
+	{
+	  count = 0;
+	  break;
+	}
+      if (entry->inode)
+	{
+	  ext2_dirhash (entry->name, entry->name_len, hash_version,
+			sblock->s_hash_seed, &map[count].hash, 0);
+	  map[count++].entry = entry;
+	}
+    }
+
+  if (count < 2)
+    {
+      free (copy);
+      free (map);
+      return 0;
+    }
+
+  qsort (map, count, sizeof *map, dx_map_compare);
+
+  /* Move the names with the highest hashes, about half the block's worth,
+     into the new leaf.  */
+  size = 0;
+  for (split = count; split > 1; split--)
+    {
+      size_t len = EXT2_DIR_REC_LEN (map[split - 1].entry->name_len);
+      if (size + len / 2 > DIRBLKSIZ / 2)
+	break;
+      size += len;
+    }
+  if (split == count)
+    split--;
+
+  /* If the names on both sides of the split share a hash, the new leaf
+     continues the old one.  */
+  hash2 = map[split].hash;
+  if (map[split - 1].hash == hash2)
+    hash2 |= 1;
+
+  err = grow_dir (dp, ds, nblocks, cred);
+  if (err)
+    {
+      free (copy);
+      free (map);
+      return err;
+    }
+
+  if (nblocks == 2)
+    {
+      int nodeidx = newidx + 1;
+      struct ext2_dx_entry *node =
+	((struct ext2_dx_node *) (ds->mapbuf + nodeidx * DIRBLKSIZ))->entries;
+
+      if (levels == 1)
+	{
+	  /* Move all the root's entries down into the new index block,
+	     and make it the root's only child.  */
+	  memcpy (node, entries, cl->count * sizeof *entries);
+	  dx_countlimit (node)->limit = dx_node_limit ();
+	  frames[1].entries = node;
+	  frames[1].at = node + (frames[0].at - entries);
+
+	  cl->count = 1;
+	  entries[0].block = nodeidx;
+	  frames[0].at = entries;
+	  root->info.indirect_levels = 1;
+	  levels = ds->dx_levels = 2;
+	}
+      else
+	{
+	  /* Move the upper half of the full index block into the new one,
+	     and add that to the root.  */
+	  unsigned keep = cl->count / 2;
+	  unsigned move = cl->count - keep;
+	  __u32 nodehash = entries[keep].hash;
+
+	  memcpy (node, entries + keep, move * sizeof *entries);
+	  dx_countlimit (node)->limit = dx_node_limit ();
+	  dx_countlimit (node)->count = move;
+	  cl->count = keep;
+
+	  dx_insert (&frames[0], nodehash, nodeidx);
+	  if (frames[1].at >= entries + keep)
+	    {
+	      frames[1].at = node + (frames[1].at - (entries + keep));
+	      frames[1].entries = node;
+	      frames[0].at++;
+	    }
+	}
+    }
+
+  newleaf = ds->mapbuf + newidx * DIRBLKSIZ;
+  last = fill (leaf, map, split);
+  newlast = fill (newleaf, map + split, count - split);
+  dx_insert (&frames[levels - 1], hash2, newidx);
+
+  journal_dir_block (dp, ds->mapbuf, 0);
+  journal_dir_block (dp, ds->mapbuf,
+		     ((vm_address_t) entries - ds->mapbuf) / DIRBLKSIZ);
+  if (nblocks == 2)
+    journal_dir_block (dp, ds->mapbuf, newidx + 1);
+  journal_dir_block (dp, ds->mapbuf, leafidx);
+  journal_dir_block (dp, ds->mapbuf, newidx);
+
+  free (copy);
+  free (map);
+
+  /* Neither block's count of entries is known any more.  */
+  if (diskfs_node_disknode (dp)->dirents)
+    {
+      int *dirents = diskfs_node_disknode (dp)->dirents;
+
+      dirents = realloc (dirents, (dp->dn_stat.st_size / DIRBLKSIZ
+				   * sizeof (int)));
+      for (i = newidx; i < dp->dn_stat.st_size / DIRBLKSIZ; i++)
+	dirents[i] = -1;
+      dirents[leafidx] = -1;
+      diskfs_node_disknode (dp)->dirents = dirents;
+    }
+
+  if (ds->dx_hash >= hash2)
+    {
+      last = newlast;
+      ds->idx = newidx;
+    }
+  else
+    ds->idx = leafidx;
+
+  oldneeded = EXT2_DIR_REC_LEN (last->name_len);
+  if (last->rec_len - oldneeded >= EXT2_DIR_REC_LEN (namelen))
+    {
+      *new = (struct ext2_dir_entry_2 *) ((vm_address_t) last + oldneeded);
+      (*new)->rec_len = last->rec_len - oldneeded;
+      last->rec_len = oldneeded;
+    }
+
+  return 0;
+}
+
 /* Following a lookup call for CREATE, this adds a node to a directory.
    DP is the directory to be modified; NAME is the name to be entered;
    NP is the node being linked in; DS is the cached information returned
@@ -601,40 +1172,35 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
       break;
 
     case EXTEND:
-      /* Extend the file. */
       assert_backtrace (needed <= DIRBLKSIZ);
 
-      oldsize = dp->dn_stat.st_size;
-      if ((off_t)(oldsize + DIRBLKSIZ) != (dp->dn_stat.st_size + DIRBLKSIZ))
+      if (ds->dx_levels)
 	{
-	  /* We can't possibly map the whole directory in.  */
-	  munmap ((caddr_t) ds->mapbuf, ds->mapextent);
-	  return EOVERFLOW;
-	}
-      while (oldsize + DIRBLKSIZ > dp->allocsize)
-	{
-	  err = diskfs_grow (dp, oldsize + DIRBLKSIZ, cred);
+	  /* Split the leaf the name belongs in.  */
+	  err = dx_split (dp, ds, name, namelen, cred, &new);
 	  if (err)
 	    {
 	      munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 	      return err;
 	    }
+	  if (new)
+	    break;
+
+	  /* The index can't take another leaf; give it up.  */
+	  ds->dx_levels = 0;
 	}
 
-      new = (struct ext2_dir_entry_2 *) (ds->mapbuf + oldsize);
-      err = hurd_safe_memset (new, 0, DIRBLKSIZ);
+      /* Extend the file. */
+      oldsize = dp->dn_stat.st_size;
+      err = grow_dir (dp, ds, 1, cred);
       if (err)
-       {
-	 if (err == EKERN_MEMORY_ERROR)
-	   err = ENOSPC;
-         munmap ((caddr_t) ds->mapbuf, ds->mapextent);
-         return err;
-       }
-
-      dp->dn_stat.st_size = oldsize + DIRBLKSIZ;
-      dp->dn_set_ctime = 1;
+	{
+	  munmap ((caddr_t) ds->mapbuf, ds->mapextent);
+	  return err;
+	}
 
-      new->rec_len = DIRBLKSIZ;
+      new = (struct ext2_dir_entry_2 *) (ds->mapbuf + oldsize);
+      ds->idx = oldsize / DIRBLKSIZ;
       break;
 
     default:
@@ -662,13 +1228,17 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
   new->name_len = namelen;
   memcpy (new->name, name, namelen);
 
-  /* Mark the directory inode has having been written.  */
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+  journal_dir_block (dp, ds->mapbuf,
+		     ((vm_address_t) new - ds->mapbuf) / DIRBLKSIZ);
+
+  /* An index we did not keep up to date is no longer valid.  */
+  if (!ds->dx_levels)
+    diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_INDEX_FL;
   dp->dn_set_mtime = 1;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
-  if (ds->stat != EXTEND)
+  if (ds->stat != EXTEND || ds->dx_levels)
     {
       /* If we are keeping count of this block, then keep the count up
 	 to date. */
@@ -729,9 +1299,12 @@ diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
 	      == ds->preventry->rec_len);
       ds->preventry->rec_len += ds->entry->rec_len;
     }
+  journal_dir_block (dp, ds->mapbuf,
+		     ((vm_address_t) ds->entry - ds->mapbuf) / DIRBLKSIZ);
 
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+  if (!ds->dx_levels)
+    diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_INDEX_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -762,8 +1335,11 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np, struct dirstat *ds)
   assert_backtrace (!diskfs_readonly);
 
   ds->entry->inode = np->cache_id;
+  journal_dir_block (dp, ds->mapbuf,
+		     ((vm_address_t) ds->entry - ds->mapbuf) / DIRBLKSIZ);
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+  if (!ds->dx_levels)
+    diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_INDEX_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -870,6 +1446,74 @@ count_dirents (struct node *dp, block_t nb, char *buf)
    Must be a power of two.  */
 #define DIRENT_ALIGN 4
 
+/* The most inode table blocks noted for prefetching by one call to
+   diskfs_get_directs.  */
+#define DIR_PREFETCH_BLOCKS 64
+
+static int
+block_compare (const void *a, const void *b)
+{
+  block_t x = *(const block_t *) a, y = *(const block_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Note the COUNT inode table blocks BLOCKS (with possible duplicates) of
+   the entries of directory DP just returned by diskfs_get_directs, to be
+   prefetched if they are looked up next.  */
+static void
+note_prefetch (struct node *dp, block_t *blocks, int count)
+{
+  struct disknode *dn = diskfs_node_disknode (dp);
+  int i, n;
+
+  free (dn->prefetch);
+  dn->prefetch = 0;
+  dn->prefetch_count = 0;
+
+  /* A single block is read on demand just as fast.  */
+  if (count < 2)
+    return;
+
+  qsort (blocks, count, sizeof *blocks, block_compare);
+  for (i = n = 1; i < count; i++)
+    if (blocks[i] != blocks[n - 1])
+      blocks[n++] = blocks[i];
+  if (n < 2)
+    return;
+
+  dn->prefetch = malloc (n * sizeof *blocks);
+  if (dn->prefetch)
+    {
+      memcpy (dn->prefetch, blocks, n * sizeof *blocks);
+      dn->prefetch_count = n;
+    }
+}
+
+/* Inode INUM was just found in directory DP.  If it is one of the
+   entries last read from DP, someone is going through them after
+   reading the directory (like `ls -l'), so read the inode table blocks
+   of all of them at once.  */
+static void
+prefetch_dinodes (struct node *dp, ino_t inum)
+{
+  struct disknode *dn = diskfs_node_disknode (dp);
+  block_t block;
+
+  if (inum > sblock->s_inodes_count)
+    return;
+
+  block = dino_block (inum);
+  if (! bsearch (&block, dn->prefetch, dn->prefetch_count,
+		 sizeof block, block_compare))
+    return;
+
+  disk_cache_prefetch (dn->prefetch, dn->prefetch_count);
+
+  free (dn->prefetch);
+  dn->prefetch = 0;
+  dn->prefetch_count = 0;
+}
+
 /* Implement the diskfs_get_directs callback as described in
    <hurd/diskfs.h>. */
 error_t
@@ -894,6 +1538,8 @@ diskfs_get_directs (struct node *dp,
   int allocsize;
   size_t checklen;
   struct dirent *userp;
+  block_t prefetch[DIR_PREFETCH_BLOCKS];
+  int nprefetch = 0;
 
   nblks = dp->dn_stat.st_size/DIRBLKSIZ;
 
@@ -1062,6 +1708,14 @@ diskfs_get_directs (struct node *dp,
 	  memcpy (userp->d_name, entryp->name, name_len);
 	  userp->d_name[name_len] = '\0';
 
+	  if (nprefetch < DIR_PREFETCH_BLOCKS
+	      && entryp->inode <= sblock->s_inodes_count)
+	    {
+	      block_t block = dino_block (entryp->inode);
+	      if (nprefetch == 0 || prefetch[nprefetch - 1] != block)
+		prefetch[nprefetch++] = block;
+	    }
+
 	  datap += rec_len;
 	  i++;
 	}
@@ -1098,6 +1752,8 @@ diskfs_get_directs (struct node *dp,
 		allocsize - round_page (datap - *data));
     }
 
+  note_prefetch (dp, prefetch, nprefetch);
+
   /* Set variables for return */
   *datacnt = datap - *data;
   *amt = i;
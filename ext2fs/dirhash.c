@@ -0,0 +1,237 @@
+/* Directory name hashing for hash-indexed (dir_index) directories
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* The hash functions must produce exactly the values Linux and e2fsprogs
+   compute, since the index is shared with them.  */
+
+#include "ext2fs.h"
+
+#include <string.h>
+
+/* The largest hash value; it is never returned, so that it can mark the
+   end of a readdir stream in other implementations.  */
+#define HTREE_EOF	0x7fffffffU
+
+#define TEA_DELTA	0x9E3779B9
+
+static void
+tea_transform (__u32 buf[4], const __u32 in[4])
+{
+  __u32 sum = 0;
+  __u32 b0 = buf[0], b1 = buf[1];
+  __u32 a = in[0], b = in[1], c = in[2], d = in[3];
+  int n = 16;
+
+  do
+    {
+      sum += TEA_DELTA;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+  while (--n);
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* The basic MD4 functions: selection, majority and parity.  */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s)					\
+  (a += f (b, c, d) + (x), a = (a << (s)) | (a >> (32 - (s))))
+
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+/* A cut-down MD4 transform, with only three rounds of eight steps.  */
+static void
+half_md4_transform (__u32 buf[4], const __u32 in[8])
+{
+  __u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  ROUND (F, a, b, c, d, in[0] + K1, 3);
+  ROUND (F, d, a, b, c, in[1] + K1, 7);
+  ROUND (F, c, d, a, b, in[2] + K1, 11);
+  ROUND (F, b, c, d, a, in[3] + K1, 19);
+  ROUND (F, a, b, c, d, in[4] + K1, 3);
+  ROUND (F, d, a, b, c, in[5] + K1, 7);
+  ROUND (F, c, d, a, b, in[6] + K1, 11);
+  ROUND (F, b, c, d, a, in[7] + K1, 19);
+
+  ROUND (G, a, b, c, d, in[1] + K2, 3);
+  ROUND (G, d, a, b, c, in[3] + K2, 5);
+  ROUND (G, c, d, a, b, in[5] + K2, 9);
+  ROUND (G, b, c, d, a, in[7] + K2, 13);
+  ROUND (G, a, b, c, d, in[0] + K2, 3);
+  ROUND (G, d, a, b, c, in[2] + K2, 5);
+  ROUND (G, c, d, a, b, in[4] + K2, 9);
+  ROUND (G, b, c, d, a, in[6] + K2, 13);
+
+  ROUND (H, a, b, c, d, in[3] + K3, 3);
+  ROUND (H, d, a, b, c, in[7] + K3, 9);
+  ROUND (H, c, d, a, b, in[2] + K3, 11);
+  ROUND (H, b, c, d, a, in[6] + K3, 15);
+  ROUND (H, a, b, c, d, in[1] + K3, 3);
+  ROUND (H, d, a, b, c, in[5] + K3, 9);
+  ROUND (H, c, d, a, b, in[0] + K3, 11);
+  ROUND (H, b, c, d, a, in[4] + K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+#undef ROUND
+#undef F
+#undef G
+#undef H
+#undef K1
+#undef K2
+#undef K3
+
+/* The original hash used by the first dir_index implementation.  */
+static __u32
+legacy_hash (const char *name, size_t len, int unsigned_chars)
+{
+  __u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      int c = (unsigned_chars
+	       ? (int) (unsigned char) name[i]
+	       : (int) (signed char) name[i]);
+
+      hash = hash1 + (hash0 ^ (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+/* Pack up to NUM words worth of MSG (of length LEN) into BUF, padding
+   the rest with a value derived from LEN.  */
+static void
+str2hashbuf (const char *msg, size_t len, __u32 *buf, int num,
+	     int unsigned_chars)
+{
+  __u32 pad, val;
+  size_t i;
+
+  pad = (__u32) len | ((__u32) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      int c = (unsigned_chars
+	       ? (int) (unsigned char) msg[i]
+	       : (int) (signed char) msg[i]);
+
+      val = c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+/* Compute the hash of the directory entry name NAME (of length LEN)
+   with hash algorithm VERSION (one of EXT2_HASH_*), using the four
+   word SEED (or the default seed if SEED is zero or all zeros).  Return
+   the major hash in *HASH and, if MINOR_HASH is not zero, the minor hash
+   in *MINOR_HASH.  Return EINVAL if VERSION is unknown.  */
+error_t
+ext2_dirhash (const char *name, size_t len, int version, const __u32 *seed,
+	      __u32 *hash, __u32 *minor_hash)
+{
+  __u32 buf[4], in[8];
+  __u32 major = 0, minor = 0;
+  int unsigned_chars = 0;
+  const char *p;
+  ssize_t left;
+
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+  if (seed && (seed[0] || seed[1] || seed[2] || seed[3]))
+    memcpy (buf, seed, sizeof buf);
+
+  switch (version)
+    {
+    case EXT2_HASH_LEGACY_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fall through.  */
+    case EXT2_HASH_LEGACY:
+      major = legacy_hash (name, len, unsigned_chars);
+      break;
+
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fall through.  */
+    case EXT2_HASH_HALF_MD4:
+      for (p = name, left = len; left > 0; p += 32, left -= 32)
+	{
+	  str2hashbuf (p, left, in, 8, unsigned_chars);
+	  half_md4_transform (buf, in);
+	}
+      major = buf[1];
+      minor = buf[2];
+      break;
+
+    case EXT2_HASH_TEA_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fall through.  */
+    case EXT2_HASH_TEA:
+      for (p = name, left = len; left > 0; p += 16, left -= 16)
+	{
+	  str2hashbuf (p, left, in, 4, unsigned_chars);
+	  tea_transform (buf, in);
+	}
+      major = buf[0];
+      minor = buf[1];
+      break;
+
+    default:
+      return EINVAL;
+    }
+
+  major &= ~1;
+  if (major == (HTREE_EOF << 1))
+    major = (HTREE_EOF - 1) << 1;
+
+  *hash = major;
+  if (minor_hash)
+    *minor_hash = minor;
+  return 0;
+}
@@ -61,6 +61,7 @@
 #define EXT2_ACL_DATA_INO	 4	/* ACL inode */
 #define EXT2_BOOT_LOADER_INO	 5	/* Boot loader inode */
 #define EXT2_UNDEL_DIR_INO	 6	/* Undelete directory inode */
+#define EXT3_JOURNAL_INO	 8	/* Journal inode */
 
 /* First non-reserved inode for old ext2 filesystems */
 #define EXT2_GOOD_OLD_FIRST_INO	11
@@ -180,6 +181,43 @@ struct ext2_group_desc
 #define	EXT2_TIND_BLOCK			(EXT2_DIND_BLOCK + 1)
 #define	EXT2_N_BLOCKS			(EXT2_TIND_BLOCK + 1)
 
+/*
+ * Extent trees.  Inodes with EXT4_EXTENTS_FL keep the root of the tree
+ * in i_block instead of block pointers; every node starts with a header
+ * and is followed by an array of index entries (interior nodes) or
+ * extents (leaves), sorted by logical block.
+ */
+#define EXT4_EXT_MAGIC			0xf30a
+#define EXT4_EXT_MAX_DEPTH		5
+
+struct ext4_extent_header {
+	__u16	eh_magic;		/* EXT4_EXT_MAGIC */
+	__u16	eh_entries;		/* Number of valid entries */
+	__u16	eh_max;			/* Capacity of the node in entries */
+	__u16	eh_depth;		/* Levels below this node; 0 for leaves */
+	__u32	eh_generation;
+};
+
+struct ext4_extent {
+	__u32	ee_block;		/* First logical block covered */
+	__u16	ee_len;			/* Number of blocks covered */
+	__u16	ee_start_hi;		/* High 16 bits of physical block */
+	__u32	ee_start_lo;		/* Low 32 bits of physical block */
+};
+
+struct ext4_extent_idx {
+	__u32	ei_block;		/* First logical block of the subtree */
+	__u32	ei_leaf_lo;		/* Block of the node one level down */
+	__u16	ei_leaf_hi;
+	__u16	ei_unused;
+};
+
+/* An ee_len above EXT4_EXT_INIT_MAX_LEN marks an extent whose blocks
+   are allocated but not yet written (and read as zeros); its length is
+   ee_len - EXT4_EXT_INIT_MAX_LEN.  */
+#define EXT4_EXT_INIT_MAX_LEN		(1 << 15)
+#define EXT4_EXT_UNINIT_MAX_LEN		(EXT4_EXT_INIT_MAX_LEN - 1)
+
 /*
  * Inode flags
  */
@@ -198,6 +236,8 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			EXT2_BTREE_FL /* hash-indexed directory */
+#define EXT4_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -418,9 +458,36 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support valid if EXT3_FEATURE_COMPAT_HAS_JOURNAL set.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_jnl_backup_type;
+	__u16	s_desc_size;		/* size of group descriptor */
+	__u32	s_default_mount_opts;
+	__u32	s_first_meta_bg;	/* First metablock block group */
+	__u32	s_mkfs_time;		/* When the filesystem was created */
+	__u32	s_jnl_blocks[17];	/* Backup of the journal inode */
+	__u32	s_blocks_count_hi;	/* Blocks count high 32 bits */
+	__u32	s_r_blocks_count_hi;	/* Reserved blocks count high 32 bits*/
+	__u32	s_free_blocks_hi;	/* Free blocks count high 32 bits */
+	__u16	s_min_extra_isize;	/* All inodes have at least # bytes */
+	__u16	s_want_extra_isize;	/* New inodes should reserve # bytes */
+	__u32	s_flags;		/* Miscellaneous flags */
+	__u32	s_reserved[167];	/* Padding to the end of the block */
 };
 
+/*
+ * Miscellaneous superblock flags (s_flags)
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001 /* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002 /* Unsigned dirhash in use */
+
 #ifdef __KERNEL__
 #define EXT2_SB(sb)	(&((sb)->u.ext2_sb))
 #else
@@ -462,7 +529,9 @@ struct ext2_super_block {
 	( EXT2_SB(sb)->s_feature_incompat & (mask) )
 
 #define EXT2_FEATURE_COMPAT_DIR_PREALLOC	0x0001
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL		0x0004
 #define EXT2_FEATURE_COMPAT_EXT_ATTR		0x0008
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -470,9 +539,16 @@ struct ext2_super_block {
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
-
-#define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
-#define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
+#define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004 /* Needs recovery */
+#define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008 /* Journal device */
+#define EXT4_FEATURE_INCOMPAT_EXTENTS		0x0040
+
+#define EXT2_FEATURE_COMPAT_SUPP	(EXT2_FEATURE_COMPAT_EXT_ATTR| \
+					 EXT3_FEATURE_COMPAT_HAS_JOURNAL| \
+					 EXT2_FEATURE_COMPAT_DIR_INDEX)
+#define EXT2_FEATURE_INCOMPAT_SUPP	(EXT2_FEATURE_INCOMPAT_FILETYPE| \
+					 EXT3_FEATURE_INCOMPAT_RECOVER| \
+					 EXT4_FEATURE_INCOMPAT_EXTENTS)
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT2_FEATURE_RO_COMPAT_BTREE_DIR)
@@ -534,6 +610,63 @@ struct ext2_dir_entry_2 {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * Hashed directory (dir_index) on-disk structures.  The index lives in
+ * directory blocks that look empty to a linear scan: the root is
+ * hidden in the slack of the ".." entry of block 0, and each interior
+ * node is a single unused entry spanning its whole block.  Entries are
+ * sorted by hash; the first entry's hash field holds the limit and
+ * count of the array instead.
+ */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3 /* reserved for userspace lib */
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4 /* reserved for userspace lib */
+#define EXT2_HASH_TEA_UNSIGNED		5 /* reserved for userspace lib */
+
+#define EXT2_HTREE_LEVEL		2 /* Maximum depth of the index */
+
+/* Header of a directory entry, without the name.  */
+struct ext2_dx_fake_dirent {
+	__u32	inode;
+	__u16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct ext2_dx_countlimit {
+	__u16	limit;			/* Number of entries that fit */
+	__u16	count;			/* Number of entries in use */
+};
+
+struct ext2_dx_entry {
+	__u32	hash;			/* Lowest hash value in BLOCK */
+	__u32	block;			/* Logical directory block */
+};
+
+struct ext2_dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;		/* One of EXT2_HASH_* */
+	__u8	info_length;		/* 8 */
+	__u8	indirect_levels;	/* Index levels below the root */
+	__u8	unused_flags;
+};
+
+struct ext2_dx_root {
+	struct ext2_dx_fake_dirent dot;	/* name_len 1, rec_len 12 */
+	char	dot_name[4];
+	struct ext2_dx_fake_dirent dotdot; /* rec_len spans the block */
+	char	dotdot_name[4];
+	struct ext2_dx_root_info info;
+	struct ext2_dx_entry entries[0];
+};
+
+struct ext2_dx_node {
+	struct ext2_dx_fake_dirent fake; /* inode 0, rec_len spans the block */
+	struct ext2_dx_entry entries[0];
+};
+
 #ifdef __KERNEL__
 /*
  * Function prototypes
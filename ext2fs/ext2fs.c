@@ -66,6 +66,8 @@ int ext2_debug_flag;
 /* Use extended attribute-based translator records.  */
 int use_xattr_translator_records;
 #define X_XATTR_TRANSLATOR_RECORDS	-1
+#define OPT_DISK_CACHE_BLOCKS		-2
+#define OPT_READAHEAD			-3
 
 /* Ext2fs-specific options.  */
 static const struct argp_option
@@ -78,6 +80,12 @@ options[] =
   },
   {"x-xattr-translator-records", X_XATTR_TRANSLATOR_RECORDS, 0, 0,
    "Store translator records in extended attributes (experimental)"},
+  {"disk-cache-blocks", OPT_DISK_CACHE_BLOCKS, "BLOCKS", 0,
+   "Cache up to BLOCKS metadata blocks in memory; at run time, this can't"
+   " be raised past the larger of the startup size and the default"},
+  {"readahead", OPT_READAHEAD, "PAGES", 0,
+   "Read up to PAGES pages ahead of sequential file reads (0 disables;"
+   " default 32)"},
 #ifdef ALTERNATE_SBLOCK
   /* XXX This is not implemented.  */
   {"sblock", 'S', "BLOCKNO", 0,
@@ -96,6 +104,8 @@ parse_opt (int key, char *arg, struct argp_state *state)
   {
     int debug_flag;
     int use_xattr_translator_records;
+    int disk_cache_blocks;
+    int readahead_pages;
 #ifdef ALTERNATE_SBLOCK
     unsigned int sb_block;
 #endif
@@ -109,6 +119,24 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case X_XATTR_TRANSLATOR_RECORDS:
       values->use_xattr_translator_records = 1;
       break;
+    case OPT_DISK_CACHE_BLOCKS:
+      values->disk_cache_blocks = strtol (arg, &arg, 0);
+      if (*arg != '\0' || values->disk_cache_blocks <= 0)
+	{
+	  argp_error (state, "invalid number for --disk-cache-blocks");
+	  return EINVAL;
+	}
+      break;
+    case OPT_READAHEAD:
+      values->readahead_pages = strtol (arg, &arg, 0);
+      if (*arg != '\0' || values->readahead_pages < 0
+	  || values->readahead_pages > READAHEAD_MAX_PAGES)
+	{
+	  argp_error (state, "--readahead must be between 0 and %d",
+		      READAHEAD_MAX_PAGES);
+	  return EINVAL;
+	}
+      break;
 #ifdef ALTERNATE_SBLOCK
     case 'S':
       values->sb_block = strtoul (arg, &arg, 0);
@@ -127,6 +155,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
 	return ENOMEM;
       state->hook = values;
       memset (values, 0, sizeof *values);
+      values->readahead_pages = -1;
 #ifdef ALTERNATE_SBLOCK
       values->sb_block = SBLOCK_BLOCK;
 #endif
@@ -144,6 +173,23 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
 	}
 
+      if (values->disk_cache_blocks
+	  && disk_cache_set_limit (values->disk_cache_blocks))
+	{
+	  if (disk_cache)
+	    argp_failure (state, 0, 0,
+			  "--disk-cache-blocks must be between %d and %d",
+			  DISK_CACHE_MIN_BLOCKS, disk_cache_blocks);
+	  else
+	    argp_failure (state, 0, 0,
+			  "--disk-cache-blocks must be at least %d",
+			  DISK_CACHE_MIN_BLOCKS);
+	  return EINVAL;
+	}
+
+      if (values->readahead_pages >= 0)
+	readahead_pages = values->readahead_pages;
+
       use_xattr_translator_records = values->use_xattr_translator_records;
       break;
 
@@ -165,6 +211,20 @@ diskfs_append_args (char **argz, size_t *argz_len)
   if (!err && use_xattr_translator_records)
     err = argz_add (argz, argz_len, "--x-xattr-translator-records");
 
+  if (!err && disk_cache_limit != DISK_CACHE_BLOCKS)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--disk-cache-blocks=%d", disk_cache_limit);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && readahead_pages != READAHEAD_PAGES)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--readahead=%d", readahead_pages);
+      err = argz_add (argz, argz_len, buf);
+    }
+
 #ifdef EXT2FS_DEBUG
   if (!err && ext2_debug_flag)
     err = argz_add (argz, argz_len, "--debug");
@@ -175,6 +235,62 @@ diskfs_append_args (char **argz, size_t *argz_len)
   return err;
 }
 
+/* Override the standard diskfs routine so we can add our own counters.  */
+error_t
+diskfs_append_stats (char **argz, size_t *argz_len)
+{
+  error_t err;
+
+  /* Get the standard things.  */
+  err = diskfs_append_std_stats (argz, argz_len);
+
+  if (!err && disk_cache)
+    {
+      struct disk_cache_stats stats;
+      disk_cache_get_stats (&stats);
+      err = diskfs_append_stat (argz, argz_len, "disk-cache-blocks",
+				stats.blocks);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "disk-cache-hits",
+				  stats.hits);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "disk-cache-misses",
+				  stats.misses);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "disk-cache-evictions",
+				  stats.evictions);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "disk-cache-prefetched",
+				  stats.prefetched);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "disk-cache-prefetch-hits",
+				  stats.prefetch_hits);
+    }
+
+  if (! err)
+    {
+      struct readahead_stats stats;
+      readahead_get_stats (&stats);
+      err = diskfs_append_stat (argz, argz_len, "readahead-windows",
+				stats.windows);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "readahead-hits",
+				  stats.hits);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "readahead-misses",
+				  stats.misses);
+      if (!err)
+	err = diskfs_append_stat (argz, argz_len, "readahead-dropped",
+				  stats.dropped);
+    }
+
+  if (! err)
+    err = diskfs_append_stat (argz, argz_len, "pagemap-bytes",
+			      pagemap_size ());
+
+  return err;
+}
+
 /* Add our startup arguments to the standard diskfs set.  */
 static const struct argp_child startup_children[] =
   {{&diskfs_store_startup_argp}, {0}};
@@ -211,6 +327,14 @@ main (int argc, char **argv)
 
   map_hypermetadata ();
 
+  /* Replay the journal if needed, before anything else is read.  */
+  journal_init ();
+
+  readahead_init ();
+
+  /* Write back dirty nodes as they expire, not all at once.  */
+  diskfs_writeback_hook = writeback_global;
+
   /* Set diskfs_root_node to the root inode. */
   err = diskfs_cached_lookup (EXT2_ROOT_INO, &diskfs_root_node);
   if (err)
@@ -186,6 +186,34 @@ struct disknode
 
   /* Index to start a directory lookup at.  */
   int dir_idx;
+
+  /* True if the journal must write our data before its next commit.  */
+  int journal_data;
+
+  /* The blocks of the file made writable but not allocated yet (delayed
+     allocation), and how many blocks are reserved for them and the
+     metadata they will need.  Protected by alloc_lock.  */
+  struct hurd_ihash delayed;
+  block_t delayed_reserved;
+
+  /* How many blocks ext2_alloc_block should allocate at once, and whether
+     it may use the reserved ones, while delayed blocks are allocated.  */
+  block_t alloc_run;
+  int alloc_reserved;
+
+  /* Sequential read detection, protected by RA_LOCK: where the next
+     read is expected, the current readahead window size, and the range
+     last read ahead.  All in bytes.  */
+  pthread_mutex_t ra_lock;
+  vm_offset_t ra_next;
+  vm_size_t ra_window;
+  vm_offset_t ra_start, ra_end;
+
+  /* For a directory, the inode table blocks of the entries last
+     returned by diskfs_get_directs, to be prefetched once they are
+     looked up.  Protected by the node lock.  */
+  block_t *prefetch;
+  int prefetch_count;
 };
 
 struct user_pager_info
@@ -202,8 +230,19 @@ struct user_pager_info
 /* ---------------------------------------------------------------- */
 /* pager.c */
 
+/* The default number of blocks in the disk cache, which is also the
+   least number it reserves address space for.  */
 #define DISK_CACHE_BLOCKS	65536
 
+/* The disk cache is split into this many shards (a power of two), each
+   with its own lock.  Block B is cached in a slot of shard B %
+   DISK_CACHE_SHARDS, and slot I of the cache belongs to shard I %
+   DISK_CACHE_SHARDS.  */
+#define DISK_CACHE_SHARDS	16
+
+/* The smallest size the disk cache may be set to, in blocks.  */
+#define DISK_CACHE_MIN_BLOCKS	(DISK_CACHE_SHARDS * 64)
+
 #include <hurd/diskfs-pager.h>
 
 /* Set up the disk pager.  */
@@ -225,6 +264,38 @@ void allow_pager_softrefs (struct node *node);
 
 /* Invalidate any pager data associated with NODE.  */
 void flush_node_pager (struct node *node);
+
+/* Write the metadata that diskfs_file_update queued without waiting;
+   this is our diskfs_writeback_hook.  */
+void writeback_global (void);
+
+/* The default largest readahead window, in pages.  */
+#define READAHEAD_PAGES		32
+
+/* The largest readahead window may not be set above this, in pages.  */
+#define READAHEAD_MAX_PAGES	1024
+
+/* The largest readahead window of file pagers, in pages; 0 disables
+   readahead.  */
+extern int readahead_pages;
+
+/* Start the thread reading ahead of sequential file reads.  */
+void readahead_init (void);
+
+struct readahead_stats
+{
+  unsigned long windows;	/* Readahead windows started */
+  unsigned long hits;		/* Reads at the end of a readahead window */
+  unsigned long misses;		/* Reads inside one, before its data came */
+  unsigned long dropped;	/* Windows skipped as the queue was full */
+};
+
+/* Return the readahead counters.  */
+void readahead_get_stats (struct readahead_stats *stats);
+
+/* Return the bytes of memory used by the pagemaps of the disk pager and
+   of all file pagers.  */
+vm_size_t pagemap_size (void);
 
 /* ---------------------------------------------------------------- */
 
@@ -238,10 +309,18 @@ extern void *disk_cache;
 extern store_offset_t disk_cache_size;
 extern int disk_cache_blocks;
 
+/* Only the slots below this are used for new blocks; it can be
+   changed at run time, up to disk_cache_blocks.  Protected by all the
+   shard locks together.  */
+extern int disk_cache_limit;
+
 #define DC_INCORE	0x01	/* Not in core.  */
 #define DC_UNTOUCHED	0x02	/* Not touched by disk_pager_read_paged
 				   or disk_cache_block_ref.  */
 #define DC_FIXED	0x04	/* Must not be re-associated.  */
+#define DC_REFERENCED	0x08	/* Used since the last CLOCK sweep.  */
+#define DC_FREE		0x10	/* On the free list of its shard.  */
+#define DC_PREFETCHED	0x20	/* Prefetched and not used yet.  */
 
 /* Flags that forbid re-association of page.  DC_UNTOUCHED is included
    because this flag is used only when page is already to be
@@ -267,14 +346,38 @@ struct disk_cache_info
 #endif
 };
 
-/* block num --> pointer to in-memory block */
-extern hurd_ihash_t disk_cache_bptr;
+/* One shard of the disk cache.  */
+struct disk_cache_shard
+{
+  /* Lock for the following, and for the disk_cache_info entries of the
+     slots of this shard.  */
+  pthread_mutex_t lock;
+  /* Fired when a re-association is done.  */
+  pthread_cond_t reassociation;
+  /* block num --> pointer to in-memory block */
+  struct hurd_ihash bptr;
+  /* Slots that are neither in core nor referenced.  */
+  struct disk_cache_info *free;
+  /* Where the next CLOCK sweep starts, counted in slots of this shard.  */
+  int hand;
+
+  unsigned long hits;		/* Blocks found in the cache */
+  unsigned long misses;		/* Blocks given a new slot */
+  unsigned long evictions;	/* Blocks pushed out of core by us */
+  unsigned long prefetched;	/* Blocks read by disk_cache_prefetch */
+  unsigned long prefetch_hits;	/* Prefetched blocks used afterwards */
+} __attribute__ ((aligned (64)));
+
+extern struct disk_cache_shard disk_cache_shards[DISK_CACHE_SHARDS];
+
+/* The shard caching BLOCK, and the shard owning the slot INDEX.  */
+#define disk_cache_block_shard(block) \
+  (&disk_cache_shards[(block) % DISK_CACHE_SHARDS])
+#define disk_cache_index_shard(index) \
+  (&disk_cache_shards[(index) % DISK_CACHE_SHARDS])
+
 /* Metadata about cached block. */
 extern struct disk_cache_info *disk_cache_info;
-/* Lock for these mappings */
-extern pthread_mutex_t disk_cache_lock;
-/* Fired when a re-association is done.  */
-extern pthread_cond_t disk_cache_reassociation;
 
 void *disk_cache_block_ref (block_t block);
 void disk_cache_block_ref_ptr (void *ptr);
@@ -283,6 +386,27 @@ void _disk_cache_block_deref (void *ptr);
   do { _disk_cache_block_deref (PTR); PTR = NULL; } while (0)
 int disk_cache_block_is_ref (block_t block);
 
+/* Read those of the COUNT blocks BLOCKS (in increasing order) that
+   aren't in the disk cache into it, batching reads of consecutive
+   blocks.  */
+void disk_cache_prefetch (block_t *blocks, int count);
+
+/* Use only the first BLOCKS slots of the disk cache.  Before the disk
+   pager is created, this sets the size it is created with; afterwards,
+   BLOCKS can't be more than disk_cache_blocks.  Return EINVAL if BLOCKS
+   is out of range.  */
+error_t disk_cache_set_limit (int blocks);
+
+struct disk_cache_stats
+{
+  int blocks;			/* Slots in use */
+  unsigned long hits, misses, evictions;
+  unsigned long prefetched, prefetch_hits;
+};
+
+/* Return the disk cache counters summed over all shards.  */
+void disk_cache_get_stats (struct disk_cache_stats *stats);
+
 /* Our in-core copy of the super-block (pointer into the disk_cache).  */
 struct ext2_super_block *sblock;
 /* True if sblock has been modified.  */
@@ -320,6 +444,49 @@ void get_hypermetadata ();
    diskfs_set_hypermetadata to update the superblock from the cache
    `sblock' points to.  */
 void map_hypermetadata ();
+
+/* Write the superblock to the disk now, bypassing the disk pager.  */
+void write_sblock_direct (void);
+
+/* ---------------------------------------------------------------- */
+/* journal.c */
+
+/* True if changes to metadata are being journaled.  */
+extern int journal_active;
+
+/* Find the journal, and replay it if the filesystem needs recovery.  */
+void journal_init (void);
+
+/* Start journaling; return true if changes are journaled.  */
+int journal_start (void);
+
+/* Checkpoint the journal and stop journaling.  */
+void journal_stop (void);
+
+/* Add the metadata or directory block BLOCK, cached at DATA, to the
+   running transaction; return true if there is a journal.  */
+int journal_dirty_block (block_t block, void *data);
+
+/* Return true if a pager must not write BLOCK in place from DATA yet,
+   keeping DATA to write once BLOCK's transaction has committed.  */
+int journal_hold_block (block_t block, void *data);
+
+/* Copy any contents of BLOCK newer than the disk's over DATA.  */
+void journal_read_block (block_t block, void *data);
+
+/* Keep journaled copies of COUNT blocks from BLOCK from being replayed.  */
+void journal_revoke (block_t block, unsigned long count);
+
+/* Note that NODE has data which must be written before the next commit,
+   and write the data of all such nodes.  */
+void journal_note_data (struct node *node);
+void journal_flush_data (void);
+
+/* Commit the running transaction.  */
+void journal_commit (void);
+
+/* Write committed blocks in place, and empty the journal.  */
+void journal_checkpoint (void);
 
 /* ---------------------------------------------------------------- */
 /* Random stuff calculated from the super block.  */
@@ -372,9 +539,10 @@ EXT2FS_EI char *
 boffs_ptr (off_t offset)
 {
   block_t block = boffs_block (offset);
-  pthread_mutex_lock (&disk_cache_lock);
-  char *ptr = hurd_ihash_find (disk_cache_bptr, block);
-  pthread_mutex_unlock (&disk_cache_lock);
+  struct disk_cache_shard *shard = disk_cache_block_shard (block);
+  pthread_mutex_lock (&shard->lock);
+  char *ptr = hurd_ihash_find (&shard->bptr, block);
+  pthread_mutex_unlock (&shard->lock);
   assert_backtrace (ptr);
   ptr += offset % block_size;
   ext2_debug ("(%lld) = %p", offset, ptr);
@@ -386,14 +554,15 @@ EXT2FS_EI off_t
 bptr_offs (void *ptr)
 {
   vm_offset_t mem_offset = (char *)ptr - (char *)disk_cache;
+  vm_offset_t index = boffs_block (mem_offset);
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
   off_t offset;
   assert_backtrace (mem_offset < disk_cache_size);
-  pthread_mutex_lock (&disk_cache_lock);
-  offset = (off_t) disk_cache_info[boffs_block (mem_offset)].block
-    << log2_block_size;
+  pthread_mutex_lock (&shard->lock);
+  offset = (off_t) disk_cache_info[index].block << log2_block_size;
   assert_backtrace (offset || mem_offset < block_size);
   offset += mem_offset % block_size;
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
   ext2_debug ("(%p) = %lld", ptr, offset);
   return offset;
 }
@@ -417,20 +586,28 @@ struct ext2_group_desc *group_desc_image;
    inlined.  In case inlining is disabled, or inlining is not
    applicable, or a reference is taken to one of these functions, an
    implementation is provided in 'xinl.c'.  */
+extern block_t dino_block (ino_t inum);
 extern struct ext2_inode * dino_ref (ino_t inum);
 extern void _dino_deref (struct ext2_inode *inode);
 
 #if defined(__USE_EXTERN_INLINES) || defined(EXT2FS_DEFINE_EI)
-/* Convert an inode number to the dinode on disk. */
-EXT2FS_EI struct ext2_inode *
-dino_ref (ino_t inum)
+/* Return the inode table block holding the dinode of inode INUM.  */
+EXT2FS_EI block_t
+dino_block (ino_t inum)
 {
   unsigned long inodes_per_group = sblock->s_inodes_per_group;
   unsigned long bg_num = (inum - 1) / inodes_per_group;
   unsigned long group_inum = (inum - 1) % inodes_per_group;
   struct ext2_group_desc *bg = group_desc (bg_num);
-  block_t block = bg->bg_inode_table + (group_inum / inodes_per_block);
-  struct ext2_inode *inode = disk_cache_block_ref (block);
+  return bg->bg_inode_table + (group_inum / inodes_per_block);
+}
+
+/* Convert an inode number to the dinode on disk. */
+EXT2FS_EI struct ext2_inode *
+dino_ref (ino_t inum)
+{
+  unsigned long group_inum = (inum - 1) % sblock->s_inodes_per_group;
+  struct ext2_inode *inode = disk_cache_block_ref (dino_block (inum));
   inode += group_inum % inodes_per_block;
   ext2_debug ("(%llu) = %p", inum, inode);
   return inode;
@@ -507,6 +684,7 @@ record_global_poke (void *ptr)
   ext2_debug ("(%p = %p)", ptr, block_ptr);
   assert_backtrace (disk_cache_block_is_ref (block));
   global_block_modified (block);
+  journal_dirty_block (block, block_ptr);
   pokel_add (&global_pokel, block_ptr, block_size);
 }
 
@@ -518,6 +696,14 @@ sync_global_ptr (void *ptr, int wait)
   void *block_ptr = bptr (block);
   ext2_debug ("(%p -> %u)", ptr, block);
   global_block_modified (block);
+  if (journal_dirty_block (block, block_ptr))
+    /* Committing makes the change safe; it is written in place later.  */
+    {
+      pokel_add (&global_pokel, block_ptr, block_size);
+      if (wait)
+	journal_commit ();
+      return;
+    }
   disk_cache_block_deref (block_ptr);
   pager_sync_some (diskfs_disk_pager,
 		   block_ptr - disk_cache, block_size, wait);
@@ -533,6 +719,7 @@ record_indir_poke (struct node *node, void *ptr)
   ext2_debug ("(%llu, %p)", node->cache_id, ptr);
   assert_backtrace (disk_cache_block_is_ref (block));
   global_block_modified (block);
+  journal_dirty_block (block, block_ptr);
   pokel_add (&diskfs_node_disknode (node)->indir_pokel, block_ptr, block_size);
 }
 
@@ -542,6 +729,7 @@ EXT2FS_EI void
 sync_global (int wait)
 {
   ext2_debug ("%d", wait);
+  journal_commit ();
   pokel_sync (&global_pokel, wait);
 }
 
@@ -566,16 +754,56 @@ alloc_sync (struct node *np)
 
 void ext2_discard_prealloc (struct node *node);
 
+/* Allocate a new block for the file NODE, as close to block GOAL as
+   possible, and return it, or 0 if none could be had.  If ZERO is true,
+   then zero the block.  */
+block_t ext2_alloc_block (struct node *node, block_t goal, int zero);
+
 /* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE.
    If there is no such block yet, but CREATE is true, then it is created,
    otherwise EINVAL is returned.  */
 error_t ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block);
 
+/* Make block BLOCK of the regular file NODE writable: if it isn't
+   allocated yet, reserve space for it, to be allocated by
+   ext2_alloc_delayed when its data is written.  NODE's alloc_lock must
+   be held for writing.  */
+error_t ext2_delay_block (struct node *node, block_t block);
+
+/* Allocate the delayed blocks of NODE among the LENGTH bytes at OFFSET,
+   each run of them in as few pieces as possible.  NODE's alloc_lock must
+   be held for writing.  */
+error_t ext2_alloc_delayed (struct node *node, off_t offset, off_t length);
+
+/* Forget the delayed blocks of NODE from block END on, giving back the
+   space reserved for them.  NODE's alloc_lock must be held for
+   writing.  */
+void ext2_discard_delayed (struct node *node, block_t end);
+
+/* ---------------------------------------------------------------- */
+/* balloc.c */
+
+/* Allocate up to *COUNT contiguous blocks, as close to GOAL as possible,
+   and return the first, or 0 if the disk is full; set *COUNT to how many
+   were allocated.  If RESERVED is true, the blocks may be taken from
+   those reserved with ext2_reserve_blocks.  */
+block_t ext2_new_blocks (block_t goal, block_t *count, int reserved);
+
 block_t ext2_new_block (block_t goal,
 			block_t prealloc_goal,
 			block_t *prealloc_count, block_t *prealloc_block);
 
 void ext2_free_blocks (block_t block, unsigned long count);
+
+/* Reserve COUNT blocks for delayed allocation.  Return ENOSPC if there
+   aren't that many free blocks not already reserved.  */
+error_t ext2_reserve_blocks (block_t count);
+
+/* Give back COUNT blocks reserved with ext2_reserve_blocks.  */
+void ext2_unreserve_blocks (block_t count);
+
+/* Return the number of blocks reserved for delayed allocation.  */
+block_t ext2_reserved_blocks (void);
 
 /* ---------------------------------------------------------------- */
 
@@ -603,6 +831,27 @@ extern void _ext2_panic (const char *, const char *, ...)
 extern void ext2_warning (const char *, ...)
      __attribute__ ((format (printf, 1, 2)));
 
+/* ---------------------------------------------------------------- */
+/* extents.c */
+
+/* Set up the new file NODE to map its blocks with an extent tree.  */
+void ext4_ext_init (struct node *node);
+
+/* Like ext2_getblk, for files with EXT4_EXTENTS_FL set.  */
+error_t ext4_ext_getblk (struct node *node, block_t block, int create,
+			 block_t *disk_block);
+
+/* Free the blocks of NODE, which uses extents, from block END on.  */
+void ext4_ext_truncate (struct node *node, block_t end);
+
+/* ---------------------------------------------------------------- */
+/* dirhash.c */
+
+/* Compute the hash of directory entry name NAME, of length LEN, with
+   hash function VERSION (one of EXT2_HASH_*) and the four word SEED.  */
+error_t ext2_dirhash (const char *name, size_t len, int version,
+		      const __u32 *seed, __u32 *hash, __u32 *minor_hash);
+
 /* ---------------------------------------------------------------- */
 /* xattr.c */
 
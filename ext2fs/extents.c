@@ -0,0 +1,733 @@
+/* Extent tree block mapping
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Files with EXT4_EXTENTS_FL map their blocks with a tree of extents
+   rooted in the inode, instead of with indirect blocks.  The functions
+   here are called with the node's alloc_lock held, like the rest of
+   getblk.c and truncate.c.  */
+
+#include <string.h>
+#include "ext2fs.h"
+
+/* Index entries and extents are the same size, and both start with
+   their key, the first logical block they cover.  */
+#define ENTRY_SIZE	sizeof (struct ext4_extent)
+
+/* The number of entries that fit in the inode and in a tree block.  */
+#define EXT_ROOT_MAX							\
+  ((sizeof (((struct ext2_inode_info *) 0)->i_data)			\
+    - sizeof (struct ext4_extent_header)) / ENTRY_SIZE)
+#define ext_block_max()							\
+  ((block_size - sizeof (struct ext4_extent_header)) / ENTRY_SIZE)
+
+/* One level of a path from the root of an extent tree to a leaf.  */
+struct ext_path
+{
+  struct ext4_extent_header *eh;
+  block_t block;		/* Disk block holding EH, or 0 for the inode.  */
+  int pos;			/* Entry followed or found, or -1.  */
+  int dirty;			/* EH has been changed.  */
+};
+
+static inline struct ext4_extent_header *
+ext_root (struct node *node)
+{
+  return (struct ext4_extent_header *) diskfs_node_disknode (node)->info.i_data;
+}
+
+static inline void *
+ext_entry (struct ext4_extent_header *eh, int i)
+{
+  return (char *) (eh + 1) + i * ENTRY_SIZE;
+}
+
+static inline __u32
+ext_key (struct ext4_extent_header *eh, int i)
+{
+  return *(__u32 *) ext_entry (eh, i);
+}
+
+static inline block_t
+ext_len (struct ext4_extent *ex)
+{
+  return (ex->ee_len <= EXT4_EXT_INIT_MAX_LEN
+	  ? ex->ee_len : ex->ee_len - EXT4_EXT_INIT_MAX_LEN);
+}
+
+static inline int
+ext_uninit (struct ext4_extent *ex)
+{
+  return ex->ee_len > EXT4_EXT_INIT_MAX_LEN;
+}
+
+/* Return true if EH looks like a valid node DEPTH levels above the
+   leaves, holding at most MAX entries.  */
+static int
+ext_header_ok (struct ext4_extent_header *eh, int depth, int max)
+{
+  return (eh->eh_magic == EXT4_EXT_MAGIC
+	  && eh->eh_depth == depth
+	  && eh->eh_max > 0 && eh->eh_max <= max
+	  && eh->eh_entries <= eh->eh_max
+	  && (depth == 0 || eh->eh_entries > 0));
+}
+
+/* Return the position of the last entry of EH whose key is not above
+   BLOCK, or -1 if there is none.  */
+static int
+ext_search (struct ext4_extent_header *eh, block_t block)
+{
+  int lo = 0, hi = eh->eh_entries - 1, pos = -1;
+
+  while (lo <= hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (ext_key (eh, mid) <= block)
+	{
+	  pos = mid;
+	  lo = mid + 1;
+	}
+      else
+	hi = mid - 1;
+    }
+  return pos;
+}
+
+/* Release tree block EH of NODE, recording its modification if DIRTY.  */
+static void
+ext_put (struct node *node, struct ext4_extent_header *eh, int dirty)
+{
+  if (!dirty)
+    disk_cache_block_deref (eh);
+  else if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+    sync_global_ptr (eh, 1);
+  else
+    record_indir_poke (node, eh);
+}
+
+/* Release the LEVELS levels of PATH.  */
+static void
+ext_path_release (struct node *node, struct ext_path *path, int levels)
+{
+  int i;
+
+  for (i = 0; i < levels; i++)
+    if (path[i].block)
+      ext_put (node, path[i].eh, path[i].dirty);
+    else if (path[i].dirty)
+      {
+	node->dn_stat_dirty = 1;
+	if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+	  diskfs_node_update (node, 1);
+      }
+}
+
+/* Account for COUNT blocks starting at BLOCK no longer used by NODE.  */
+static void
+ext_free (struct node *node, block_t block, block_t count)
+{
+  ext2_free_blocks (block, count);
+  node->dn_stat.st_blocks -= count << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+}
+
+/* Allocate a new tree block for NODE, set its header up for a node
+   DEPTH levels above the leaves, and return it (referenced), with its
+   number in *BLOCK.  Return zero if the disk is full.  */
+static struct ext4_extent_header *
+ext_new_node (struct node *node, int depth, block_t *block)
+{
+  struct ext4_extent_header *eh;
+  block_t goal =
+    (diskfs_node_disknode (node)->info.i_block_group
+     * EXT2_BLOCKS_PER_GROUP (sblock))
+    + sblock->s_first_data_block;
+  block_t count = 1;
+
+  /* While delayed blocks are allocated, the tree's blocks come out of
+     their reservation.  */
+  *block = ext2_new_blocks (goal, &count,
+			    diskfs_node_disknode (node)->alloc_reserved);
+  if (!*block)
+    return 0;
+
+  eh = (struct ext4_extent_header *) disk_cache_block_ref (*block);
+  memset (eh, 0, block_size);
+  eh->eh_magic = EXT4_EXT_MAGIC;
+  eh->eh_max = ext_block_max ();
+  eh->eh_depth = depth;
+
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+  return eh;
+}
+
+/* Move the contents of the full root of NODE's tree into a new block,
+   and leave the root with a single index entry pointing at it.  */
+static error_t
+ext_grow_root (struct node *node)
+{
+  struct ext4_extent_header *root = ext_root (node), *eh;
+  struct ext4_extent_idx *idx;
+  block_t block;
+
+  if (root->eh_depth >= EXT4_EXT_MAX_DEPTH)
+    return EFBIG;
+
+  eh = ext_new_node (node, root->eh_depth, &block);
+  if (!eh)
+    return ENOSPC;
+  memcpy (ext_entry (eh, 0), ext_entry (root, 0),
+	  root->eh_entries * ENTRY_SIZE);
+  eh->eh_entries = root->eh_entries;
+
+  idx = ext_entry (root, 0);
+  idx->ei_block = eh->eh_entries ? ext_key (eh, 0) : 0;
+  idx->ei_leaf_lo = block;
+  idx->ei_leaf_hi = 0;
+  idx->ei_unused = 0;
+  root->eh_entries = 1;
+  root->eh_depth++;
+  node->dn_stat_dirty = 1;
+
+  ext_put (node, eh, 1);
+  return 0;
+}
+
+/* The node at LEVEL of PATH is full; move some of its entries into a
+   new sibling and add that to the parent, which must have room.  Leave
+   PATH pointing at whichever of the two should hold BLOCK.  */
+static error_t
+ext_split (struct node *node, struct ext_path *path, int level,
+	   block_t block)
+{
+  struct ext4_extent_header *eh = path[level].eh, *new;
+  struct ext_path *parent = &path[level - 1];
+  struct ext4_extent_idx *idx;
+  block_t newblock;
+  int n = eh->eh_entries, keep;
+
+  /* Files mostly grow at the end, so when adding past the last entry
+     only move that, leaving the old node nearly full.  */
+  keep = ext_key (eh, n - 1) <= block ? n - 1 : n / 2;
+
+  new = ext_new_node (node, eh->eh_depth, &newblock);
+  if (!new)
+    return ENOSPC;
+  memcpy (ext_entry (new, 0), ext_entry (eh, keep), (n - keep) * ENTRY_SIZE);
+  new->eh_entries = n - keep;
+  eh->eh_entries = keep;
+
+  assert_backtrace (parent->eh->eh_entries < parent->eh->eh_max);
+  idx = ext_entry (parent->eh, parent->pos + 1);
+  memmove (idx + 1, idx,
+	   (parent->eh->eh_entries - parent->pos - 1) * ENTRY_SIZE);
+  idx->ei_block = ext_key (new, 0);
+  idx->ei_leaf_lo = newblock;
+  idx->ei_leaf_hi = 0;
+  idx->ei_unused = 0;
+  parent->eh->eh_entries++;
+  parent->dirty = 1;
+
+  if (block >= idx->ei_block)
+    {
+      ext_put (node, eh, 1);
+      parent->pos++;
+      path[level].eh = new;
+      path[level].block = newblock;
+    }
+  else
+    ext_put (node, new, 1);
+  path[level].dirty = 1;
+
+  return 0;
+}
+
+/* Walk NODE's extent tree towards BLOCK, filling in PATH and setting
+   *LEVELS to the number of levels used.  If MAKE_ROOM is set, split
+   full nodes on the way down, so that the leaf has room for another
+   extent.  On error, PATH holds no references.  */
+static error_t
+ext_find (struct node *node, block_t block, int make_room,
+	  struct ext_path *path, int *levels)
+{
+  struct ext4_extent_header *root = ext_root (node);
+  int level, depth;
+  error_t err;
+
+  if (!ext_header_ok (root, root->eh_depth, EXT_ROOT_MAX)
+      || root->eh_depth > EXT4_EXT_MAX_DEPTH)
+    {
+      ext2_warning ("bad extent tree root: inode: %Ld", node->cache_id);
+      return EIO;
+    }
+
+  if (make_room && root->eh_entries == root->eh_max)
+    {
+      err = ext_grow_root (node);
+      if (err)
+	return err;
+    }
+
+  depth = root->eh_depth;
+  path[0].eh = root;
+  path[0].block = 0;
+  path[0].dirty = 0;
+
+  for (level = 0; ; level++)
+    {
+      struct ext4_extent_header *eh = path[level].eh;
+      struct ext4_extent_idx *idx;
+
+      path[level].pos = ext_search (eh, block);
+      if (level == depth)
+	break;
+
+      if (path[level].pos < 0)
+	path[level].pos = 0;
+      idx = ext_entry (eh, path[level].pos);
+      if (idx->ei_leaf_hi || !idx->ei_leaf_lo
+	  || idx->ei_leaf_lo >= sblock->s_blocks_count)
+	{
+	  ext2_warning ("bad extent index: inode: %Ld", node->cache_id);
+	  ext_path_release (node, path, level + 1);
+	  return EIO;
+	}
+
+      path[level + 1].block = idx->ei_leaf_lo;
+      path[level + 1].eh = (struct ext4_extent_header *)
+	disk_cache_block_ref (idx->ei_leaf_lo);
+      path[level + 1].dirty = 0;
+
+      if (!ext_header_ok (path[level + 1].eh, depth - level - 1,
+			  ext_block_max ()))
+	{
+	  ext2_warning ("bad extent tree block %u: inode: %Ld",
+			idx->ei_leaf_lo, node->cache_id);
+	  ext_path_release (node, path, level + 2);
+	  return EIO;
+	}
+
+      if (make_room
+	  && path[level + 1].eh->eh_entries == path[level + 1].eh->eh_max)
+	{
+	  err = ext_split (node, path, level + 1, block);
+	  if (err)
+	    {
+	      ext_path_release (node, path, level + 2);
+	      return err;
+	    }
+	}
+    }
+
+  *levels = depth + 1;
+  return 0;
+}
+
+/* The first key of the node at the bottom of PATH may have changed;
+   update the index entries above it to match.  */
+static void
+ext_fix_keys (struct ext_path *path, int levels)
+{
+  int level;
+
+  for (level = levels - 1; level > 0 && path[level].pos == 0; level--)
+    {
+      struct ext4_extent_idx *idx =
+	ext_entry (path[level - 1].eh, path[level - 1].pos);
+      __u32 key = ext_key (path[level].eh, 0);
+
+      if (idx->ei_block == key)
+	break;
+      idx->ei_block = key;
+      path[level - 1].dirty = 1;
+    }
+}
+
+/* Add extent EX, which must not overlap any other, to NODE's tree.  */
+static error_t
+ext_insert (struct node *node, struct ext4_extent *ex)
+{
+  struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+  struct ext4_extent_header *leaf;
+  int levels, pos;
+  error_t err;
+
+  err = ext_find (node, ex->ee_block, 1, path, &levels);
+  if (err)
+    return err;
+
+  leaf = path[levels - 1].eh;
+  pos = path[levels - 1].pos + 1;
+  memmove (ext_entry (leaf, pos + 1), ext_entry (leaf, pos),
+	   (leaf->eh_entries - pos) * ENTRY_SIZE);
+  memcpy (ext_entry (leaf, pos), ex, ENTRY_SIZE);
+  leaf->eh_entries++;
+  path[levels - 1].pos = pos;
+  path[levels - 1].dirty = 1;
+  ext_fix_keys (path, levels);
+
+  ext_path_release (node, path, levels);
+  return 0;
+}
+
+/* Map BLOCK of NODE to disk block PHYS in the gap just after extent
+   PREV (or at the start, if PREV is -1) of the leaf at the bottom of
+   PATH, growing a neighbouring extent if possible.  Releases PATH.  */
+static error_t
+ext_fill_gap (struct node *node, struct ext_path *path, int levels,
+	      int prev, block_t block, block_t phys)
+{
+  struct ext_path *leafp = &path[levels - 1];
+  struct ext4_extent *ex;
+  struct ext4_extent new;
+
+  if (prev >= 0)
+    {
+      ex = ext_entry (leafp->eh, prev);
+      if (!ext_uninit (ex) && ex->ee_len < EXT4_EXT_INIT_MAX_LEN
+	  && ex->ee_block + ex->ee_len == block
+	  && ex->ee_start_lo + ex->ee_len == phys)
+	{
+	  ex->ee_len++;
+	  leafp->dirty = 1;
+	  ext_path_release (node, path, levels);
+	  return 0;
+	}
+    }
+
+  if (prev + 1 < leafp->eh->eh_entries)
+    {
+      ex = ext_entry (leafp->eh, prev + 1);
+      if (!ext_uninit (ex) && ex->ee_len < EXT4_EXT_INIT_MAX_LEN
+	  && ex->ee_block == block + 1 && ex->ee_start_lo == phys + 1)
+	{
+	  ex->ee_block--;
+	  ex->ee_start_lo--;
+	  ex->ee_len++;
+	  leafp->pos = prev + 1;
+	  leafp->dirty = 1;
+	  ext_fix_keys (path, levels);
+	  ext_path_release (node, path, levels);
+	  return 0;
+	}
+    }
+
+  ext_path_release (node, path, levels);
+
+  new.ee_block = block;
+  new.ee_len = 1;
+  new.ee_start_hi = 0;
+  new.ee_start_lo = phys;
+  return ext_insert (node, &new);
+}
+
+/* Put back EX, as it was before the extent of NODE that now starts at
+   BLOCK was shortened, after mapping part of it on its own failed.  */
+static void
+ext_restore (struct node *node, block_t block, struct ext4_extent *ex)
+{
+  struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+  struct ext_path *leafp;
+  int levels;
+
+  if (ext_find (node, block, 0, path, &levels))
+    return;
+
+  leafp = &path[levels - 1];
+  if (leafp->pos >= 0
+      && ext_entry (leafp->eh, leafp->pos)->ee_block == block)
+    {
+      memcpy (ext_entry (leafp->eh, leafp->pos), ex, ENTRY_SIZE);
+      leafp->dirty = 1;
+      ext_fix_keys (path, levels);
+    }
+  ext_path_release (node, path, levels);
+}
+
+/* Set up NODE, a new file, to map its blocks with an extent tree.  */
+void
+ext4_ext_init (struct node *node)
+{
+  struct ext4_extent_header *eh = ext_root (node);
+
+  memset (diskfs_node_disknode (node)->info.i_data, 0,
+	  sizeof diskfs_node_disknode (node)->info.i_data);
+  eh->eh_magic = EXT4_EXT_MAGIC;
+  eh->eh_max = EXT_ROOT_MAX;
+  diskfs_node_disknode (node)->info.i_flags |= EXT4_EXTENTS_FL;
+  node->dn_stat_dirty = 1;
+}
+
+/* ext2_getblk for files with EXT4_EXTENTS_FL.  */
+error_t
+ext4_ext_getblk (struct node *node, block_t block, int create,
+		 block_t *disk_block)
+{
+  struct ext_path path[EXT4_EXT_MAX_DEPTH + 1];
+  struct ext4_extent_header *leaf;
+  struct ext4_extent *ex = 0, *next = 0;
+  struct ext4_extent tail, orig;
+  block_t goal, offs, len;
+  int levels, pos;
+  error_t err;
+
+  err = ext_find (node, block, 0, path, &levels);
+  if (err)
+    return err;
+
+  leaf = path[levels - 1].eh;
+  pos = path[levels - 1].pos;
+  if (pos >= 0)
+    ex = ext_entry (leaf, pos);
+  if (pos + 1 < leaf->eh_entries)
+    next = ext_entry (leaf, pos + 1);
+
+  if (ex && (ex->ee_start_hi
+	     || ex->ee_start_lo + ext_len (ex) > sblock->s_blocks_count))
+    {
+      ext2_warning ("bad extent: inode: %Ld", node->cache_id);
+      ext_path_release (node, path, levels);
+      return EIO;
+    }
+
+  if (ex && block < ex->ee_block + ext_len (ex))
+    {
+      offs = block - ex->ee_block;
+      *disk_block = ex->ee_start_lo + offs;
+
+      if (!ext_uninit (ex))
+	{
+	  ext_path_release (node, path, levels);
+	  return 0;
+	}
+
+      /* Blocks of an uninitialized extent read as zeros, until they are
+	 written and become an initialized extent of their own.  */
+      if (!create)
+	{
+	  ext_path_release (node, path, levels);
+	  return EINVAL;
+	}
+
+      node->dn_set_ctime = node->dn_set_mtime = 1;
+      len = ext_len (ex);
+      path[levels - 1].dirty = 1;
+
+      if (len == 1)
+	{
+	  ex->ee_len = 1;
+	  ext_path_release (node, path, levels);
+	  return 0;
+	}
+
+      /* Mapping BLOCK on its own may need a new tree block; should
+	 that fail, the uninitialized extent must cover it again, or
+	 its disk block would be lost.  */
+      memcpy (&orig, ex, ENTRY_SIZE);
+
+      if (offs == 0)
+	{
+	  ex->ee_block++;
+	  ex->ee_start_lo++;
+	  ex->ee_len--;
+	  ext_fix_keys (path, levels);
+	  err = ext_fill_gap (node, path, levels, pos - 1,
+			      block, *disk_block);
+	  if (err)
+	    ext_restore (node, block + 1, &orig);
+	  return err;
+	}
+
+      if (offs < len - 1)
+	/* Split the extent in three.  Insert the part after BLOCK
+	   first, while the extent still covers all of it, so that
+	   failing leaves nothing to undo.  ext_insert goes by the
+	   first block only, so the overlap does not confuse it.  */
+	{
+	  ext_path_release (node, path, levels);
+
+	  tail.ee_block = block + 1;
+	  tail.ee_len = EXT4_EXT_INIT_MAX_LEN + len - offs - 1;
+	  tail.ee_start_hi = 0;
+	  tail.ee_start_lo = *disk_block + 1;
+	  err = ext_insert (node, &tail);
+	  if (err)
+	    return err;
+
+	  /* The insertion may have moved the extent.  */
+	  err = ext_find (node, block, 0, path, &levels);
+	  if (err)
+	    return err;
+	  pos = path[levels - 1].pos;
+	  ex = ext_entry (path[levels - 1].eh, pos);
+	  ex->ee_len = EXT4_EXT_INIT_MAX_LEN + offs + 1;
+	  path[levels - 1].dirty = 1;
+	  memcpy (&orig, ex, ENTRY_SIZE);
+	}
+
+      ex->ee_len = EXT4_EXT_INIT_MAX_LEN + offs;
+      err = ext_fill_gap (node, path, levels, pos, block, *disk_block);
+      if (err)
+	ext_restore (node, orig.ee_block, &orig);
+      return err;
+    }
+
+  if (!create)
+    {
+      ext_path_release (node, path, levels);
+      return EINVAL;
+    }
+
+  /* Allocate a block that continues the previous extent, or failing
+     that, one that leads into the next.  */
+  if (ex)
+    goal = ex->ee_start_lo + (block - ex->ee_block);
+  else if (next && next->ee_start_lo > next->ee_block - block)
+    goal = next->ee_start_lo - (next->ee_block - block);
+  else
+    goal = (diskfs_node_disknode (node)->info.i_block_group
+	    * EXT2_BLOCKS_PER_GROUP (sblock))
+      + sblock->s_first_data_block;
+
+  *disk_block = ext2_alloc_block (node, goal, 0);
+  ext2_debug ("goal = %u => %u", goal, *disk_block);
+  if (!*disk_block)
+    {
+      ext_path_release (node, path, levels);
+      return ENOSPC;
+    }
+
+  node->dn_set_ctime = node->dn_set_mtime = 1;
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+
+  err = ext_fill_gap (node, path, levels, pos, block, *disk_block);
+  if (err)
+    ext_free (node, *disk_block, 1);
+  return err;
+}
+
+/* Free the blocks at or after END in the subtree of NODE's extent tree
+   under EH.  Return true if EH was changed.  */
+static int
+ext_truncate_node (struct node *node, struct ext4_extent_header *eh,
+		   block_t end)
+{
+  int n = eh->eh_entries;
+  int changed = 0;
+  int i;
+
+  if (eh->eh_depth == 0)
+    {
+      for (i = n - 1; i >= 0; i--)
+	{
+	  struct ext4_extent *ex = ext_entry (eh, i);
+	  block_t len = ext_len (ex), keep;
+
+	  if (ex->ee_block + len <= end)
+	    break;
+	  if (ex->ee_start_hi)
+	    {
+	      ext2_warning ("bad extent: inode: %Ld", node->cache_id);
+	      break;
+	    }
+
+	  keep = ex->ee_block < end ? end - ex->ee_block : 0;
+	  ext_free (node, ex->ee_start_lo + keep, len - keep);
+	  if (keep)
+	    ex->ee_len = (ext_uninit (ex) ? EXT4_EXT_INIT_MAX_LEN : 0) + keep;
+	  else
+	    eh->eh_entries--;
+	  changed = 1;
+	}
+      return changed;
+    }
+
+  for (i = n - 1; i >= 0; i--)
+    {
+      struct ext4_extent_idx *idx = ext_entry (eh, i);
+      struct ext4_extent_header *child;
+      block_t child_block = idx->ei_leaf_lo;
+
+      /* Subtrees before the one holding END are left alone.  */
+      if (i + 1 < n && ext_key (eh, i + 1) <= end)
+	break;
+
+      if (idx->ei_leaf_hi || !child_block
+	  || child_block >= sblock->s_blocks_count)
+	{
+	  ext2_warning ("bad extent index: inode: %Ld", node->cache_id);
+	  break;
+	}
+
+      child = (struct ext4_extent_header *) disk_cache_block_ref (child_block);
+      if (!ext_header_ok (child, eh->eh_depth - 1, ext_block_max ()))
+	{
+	  ext2_warning ("bad extent tree block %u: inode: %Ld",
+			child_block, node->cache_id);
+	  disk_cache_block_deref (child);
+	  break;
+	}
+
+      if (!ext_truncate_node (node, child, end))
+	{
+	  disk_cache_block_deref (child);
+	  break;
+	}
+      if (child->eh_entries > 0)
+	{
+	  /* END falls inside this subtree, so the ones before it are
+	     untouched.  */
+	  record_indir_poke (node, child);
+	  break;
+	}
+
+      pager_flush_some (diskfs_disk_pager,
+			bptr_index (child) << log2_block_size,
+			block_size, 1);
+      disk_cache_block_deref (child);
+      ext_free (node, child_block, 1);
+      eh->eh_entries--;
+      changed = 1;
+    }
+
+  return changed;
+}
+
+/* Free the blocks of NODE, which uses extents, from block END on.  Each
+   extent is freed as a whole.  */
+void
+ext4_ext_truncate (struct node *node, block_t end)
+{
+  struct ext4_extent_header *root = ext_root (node);
+
+  if (!ext_header_ok (root, root->eh_depth, EXT_ROOT_MAX)
+      || root->eh_depth > EXT4_EXT_MAX_DEPTH)
+    {
+      ext2_warning ("bad extent tree root: inode: %Ld", node->cache_id);
+      return;
+    }
+
+  if (ext_truncate_node (node, root, end))
+    {
+      if (root->eh_entries == 0)
+	root->eh_depth = 0;
+      node->dn_stat_dirty = 1;
+    }
+}
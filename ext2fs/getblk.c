@@ -63,12 +63,13 @@ ext2_discard_prealloc (struct node *node)
 /* Allocate a new block for the file NODE, as close to block GOAL as
    possible, and return it, or 0 if none could be had.  If ZERO is true, then
    zero the block (and add it to NODE's list of modified indirect blocks).  */
-static block_t
+block_t
 ext2_alloc_block (struct node *node, block_t goal, int zero)
 {
 #ifdef EXT2FS_DEBUG
   static unsigned long alloc_hits = 0, alloc_attempts = 0;
 #endif
+  struct disknode *dn = diskfs_node_disknode (node);
   block_t result;
 
 #ifdef EXT2_PREALLOCATE
@@ -81,12 +82,33 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
       ext2_debug ("preallocation hit (%lu/%lu) => %u",
 		  ++alloc_hits, ++alloc_attempts, result);
     }
+  else if (dn->alloc_run && !zero)
+    /* Allocating delayed blocks: get the whole run at once, and let the
+       following calls take the rest from the preallocation.  */
+    {
+      block_t count = dn->alloc_run;
+
+      ext2_discard_prealloc (node);
+      result = ext2_new_blocks (goal, &count, dn->alloc_reserved);
+      if (result && count > 1)
+	{
+	  dn->info.i_prealloc_block = result + 1;
+	  dn->info.i_prealloc_count = count - 1;
+	}
+    }
   else
     {
       ext2_debug ("preallocation miss (%lu/%lu)",
 		  alloc_hits, ++alloc_attempts);
       ext2_discard_prealloc (node);
-      result = ext2_new_block
+      if (dn->alloc_reserved)
+	/* Metadata for delayed blocks.  */
+	{
+	  block_t count = 1;
+	  result = ext2_new_blocks (goal, &count, 1);
+	}
+      else
+	result = ext2_new_block
 	(goal,
 	 S_ISREG (node->dn_stat.st_mode)
 	 ? (sblock->s_prealloc_blocks ?: EXT2_DEFAULT_PREALLOC_BLOCKS)
@@ -108,6 +130,8 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
       memset (bh, 0, block_size);
       record_indir_poke (node, bh);
     }
+  else if (result)
+    journal_note_data (node);
 
   return result;
 }
@@ -247,6 +271,9 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
   block_t indir, b;
   unsigned long addr_per_block = EXT2_ADDR_PER_BLOCK (sblock);
 
+  if (diskfs_node_disknode (node)->info.i_flags & EXT4_EXTENTS_FL)
+    return ext4_ext_getblk (node, block, create, disk_block);
+
   if (block > EXT2_NDIR_BLOCKS + addr_per_block +
       addr_per_block * addr_per_block +
       addr_per_block * addr_per_block * addr_per_block)
@@ -313,3 +340,130 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
 
   return err;
 }
+
+/* Return how many blocks to reserve for COUNT delayed blocks: the blocks
+   themselves, and an estimate of the indirect or extent blocks they will
+   need.  */
+static block_t
+delalloc_space (block_t count)
+{
+  return count ? count + count / EXT2_ADDR_PER_BLOCK (sblock) + 3 : 0;
+}
+
+/* Adjust the reservation of NODE to the number of its delayed blocks.  */
+static void
+delalloc_adjust (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t want = delalloc_space (dn->delayed.nr_items);
+
+  if (want < dn->delayed_reserved)
+    {
+      ext2_unreserve_blocks (dn->delayed_reserved - want);
+      dn->delayed_reserved = want;
+    }
+  else if (want > dn->delayed_reserved
+	   && !ext2_reserve_blocks (want - dn->delayed_reserved))
+    dn->delayed_reserved = want;
+}
+
+/* If block BLOCK of NODE isn't allocated yet, reserve space for it, to
+   be allocated by ext2_alloc_delayed when its data is written.  NODE's
+   alloc_lock must be held for writing.  */
+error_t
+ext2_delay_block (struct node *node, block_t block)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t disk_block, want;
+  error_t err;
+
+  if (hurd_ihash_find (&dn->delayed, block))
+    return 0;
+
+  err = ext2_getblk (node, block, 0, &disk_block);
+  if (err != EINVAL)
+    /* Already allocated, or an error.  */
+    return err;
+
+  want = delalloc_space (dn->delayed.nr_items + 1);
+  if (want > dn->delayed_reserved)
+    {
+      err = ext2_reserve_blocks (want - dn->delayed_reserved);
+      if (err)
+	return err;
+    }
+
+  err = hurd_ihash_add (&dn->delayed, block, (void *) 1);
+  if (err)
+    {
+      if (want > dn->delayed_reserved)
+	ext2_unreserve_blocks (want - dn->delayed_reserved);
+      return err;
+    }
+
+  if (want > dn->delayed_reserved)
+    dn->delayed_reserved = want;
+  return 0;
+}
+
+/* Allocate the delayed blocks of NODE among the LENGTH bytes at OFFSET,
+   taking each run of consecutive ones in a single allocation.  NODE's
+   alloc_lock must be held for writing.  */
+error_t
+ext2_alloc_delayed (struct node *node, off_t offset, off_t length)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t block = offset >> log2_block_size;
+  block_t end = (offset + length + block_size - 1) >> log2_block_size;
+  block_t disk_block;
+  error_t err = 0;
+
+  dn->alloc_reserved = 1;
+
+  while (!err && block < end && dn->delayed.nr_items > 0)
+    {
+      block_t run;
+
+      if (! hurd_ihash_find (&dn->delayed, block))
+	{
+	  block++;
+	  continue;
+	}
+
+      for (run = 1; block + run < end; run++)
+	if (! hurd_ihash_find (&dn->delayed, block + run))
+	  break;
+
+      for (; run > 0 && !err; run--, block++)
+	{
+	  dn->alloc_run = run;
+	  err = ext2_getblk (node, block, 1, &disk_block);
+	  if (!err)
+	    hurd_ihash_remove (&dn->delayed, block);
+	}
+    }
+
+  dn->alloc_run = 0;
+  dn->alloc_reserved = 0;
+
+  delalloc_adjust (node);
+  return err;
+}
+
+/* Forget the delayed blocks of NODE from block END on, giving back the
+   space reserved for them.  NODE's alloc_lock must be held for
+   writing.  */
+void
+ext2_discard_delayed (struct node *node, block_t end)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  if (dn->delayed.nr_items == 0)
+    return;
+
+  HURD_IHASH_ITERATE_ITEMS (&dn->delayed, item)
+    if (item->key >= end)
+      hurd_ihash_locp_remove (&dn->delayed, &item->value);
+
+  delalloc_adjust (node);
+}
@@ -178,16 +178,38 @@ map_hypermetadata (void)
     (struct ext2_group_desc *) bptr (bptr_block (mapped_sblock) + 1);
 }
 
+/* Write the superblock to the disk now, bypassing the disk pager (and so
+   the journal), and wait for it.  */
+void
+write_sblock_direct (void)
+{
+  size_t amount;
+  error_t err;
+
+  memcpy (mapped_sblock, sblock, SBLOCK_SIZE);
+  err = store_write (store, SBLOCK_OFFS >> store->log2_block_size,
+		     sblock, SBLOCK_SIZE, &amount);
+  if (!err && amount != SBLOCK_SIZE)
+    err = EIO;
+  if (err)
+    ext2_warning ("can't write superblock: %s", strerror (err));
+}
+
 error_t
 diskfs_set_hypermetadata (int wait, int clean)
 {
+  /* With a journal, the filesystem is kept consistent on disk while it
+     is written, so it stays marked clean; the superblock says whether
+     the journal needs to be replayed instead.  */
+  int journaled = !clean && journal_start ();
+
   if (clean && ext2fs_clean && !(sblock->s_state & EXT2_VALID_FS))
     /* The filesystem is clean, so we need to set the clean flag.  */
     {
       sblock->s_state |= EXT2_VALID_FS;
       sblock_dirty = 1;
     }
-  else if (!clean && (sblock->s_state & EXT2_VALID_FS))
+  else if (!clean && !journaled && (sblock->s_state & EXT2_VALID_FS))
     /* The filesystem just became dirty, so clear the clean flag.  */
     {
       sblock->s_state &= ~EXT2_VALID_FS;
@@ -205,6 +227,9 @@ diskfs_set_hypermetadata (int wait, int clean)
 
   sync_global (wait);
 
+  if (clean)
+    journal_stop ();
+
   /* Should check writability here and return EROFS if necessary. XXX */
   return 0;
 }
@@ -341,6 +341,12 @@ diskfs_alloc_node (struct node *dir, mode_t mode, struct node **node)
     ext2_mask_flags(mode,
 	       diskfs_node_disknode (dir)->info.i_flags & EXT2_FL_INHERITED);
 
+  /* Regular files and directories map their blocks with extents when the
+     filesystem supports them; symlinks keep room for their target.  */
+  if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT4_FEATURE_INCOMPAT_EXTENTS)
+      && (S_ISREG (mode) || S_ISDIR (mode)))
+    ext4_ext_init (np);
+
   st->st_flags = 0;
 
   /*
@@ -59,6 +59,17 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   dn = diskfs_node_disknode (np);
   dn->dirents = 0;
   dn->dir_idx = 0;
+  dn->journal_data = 0;
+  hurd_ihash_init (&dn->delayed, HURD_IHASH_NO_LOCP);
+  dn->delayed_reserved = 0;
+  dn->alloc_run = 0;
+  dn->alloc_reserved = 0;
+  pthread_mutex_init (&dn->ra_lock, NULL);
+  dn->ra_next = 0;
+  dn->ra_window = 0;
+  dn->ra_start = dn->ra_end = 0;
+  dn->prefetch = 0;
+  dn->prefetch_count = 0;
   dn->pager = 0;
   pthread_rwlock_init (&dn->alloc_lock, NULL);
   pokel_init (&dn->indir_pokel, diskfs_disk_pager, disk_cache);
@@ -74,8 +85,13 @@ diskfs_node_norefs (struct node *np)
 {
   if (diskfs_node_disknode (np)->dirents)
     free (diskfs_node_disknode (np)->dirents);
+  free (diskfs_node_disknode (np)->prefetch);
   assert_backtrace (!diskfs_node_disknode (np)->pager);
 
+  /* Blocks made writable but never written need no space.  */
+  ext2_discard_delayed (np, 0);
+  hurd_ihash_destroy (&diskfs_node_disknode (np)->delayed);
+
   /* Move any pending writes of indirect blocks.  */
   pokel_inherit (&global_pokel, &diskfs_node_disknode (np)->indir_pokel);
   pokel_finalize (&diskfs_node_disknode (np)->indir_pokel);
@@ -490,8 +506,13 @@ write_all_disknodes ()
       struct ext2_inode *di;
 
       /* Sync the indirect blocks here; they'll all be done before any
-	 inodes.  Waiting for them shouldn't be too bad.  */
-      pokel_sync (&diskfs_node_disknode (node)->indir_pokel, 1);
+	 inodes.  Waiting for them shouldn't be too bad.  With a journal,
+	 they are committed with the inodes and written afterwards.  */
+      if (journal_active)
+	pokel_inherit (&global_pokel,
+		       &diskfs_node_disknode (node)->indir_pokel);
+      else
+	pokel_sync (&diskfs_node_disknode (node)->indir_pokel, 1);
 
       diskfs_set_node_times (node);
 
@@ -531,6 +552,11 @@ diskfs_set_statfs (struct statfs *st)
   st->f_bsize = block_size;
   st->f_blocks = sblock->s_blocks_count;
   st->f_bfree = sblock->s_free_blocks_count;
+  /* Space reserved for delayed allocation is as good as used.  */
+  if (st->f_bfree > ext2_reserved_blocks ())
+    st->f_bfree -= ext2_reserved_blocks ();
+  else
+    st->f_bfree = 0;
   st->f_bavail = st->f_bfree - sblock->s_r_blocks_count;
   if (st->f_bfree < sblock->s_r_blocks_count)
     st->f_bavail = 0;
@@ -0,0 +1,1087 @@
+/* Metadata journaling compatible with ext3/ext4 (jbd2)
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Every block changed through the disk pager (see record_global_poke
+   and friends) is metadata, and so is every directory block changed by
+   dir.c; each is copied into the running transaction when it changes.
+   A commit writes the copies to the journal in one sequential write,
+   after the data of files that got new blocks in it (ordered mode).
+
+   Until its commit record is on disk, a block is pinned: the disk pager
+   and directory pagers hand it to journal_hold_block instead of writing
+   it in place, and it is written from the copy kept there once the
+   transaction has committed.  The copies of committed blocks are kept
+   too, until a checkpoint writes them all in place and the journal space
+   can be reused.  Reads of any of these blocks are served from the
+   newest copy (see journal_read_block), so paging never loses a change.
+   Journals left by an unclean shutdown are replayed at startup.  */
+
+#include <string.h>
+#include <endian.h>
+#include <refcount.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <hurd/store.h>
+#include "ext2fs.h"
+#include "journal.h"
+
+/* A copy of the first block of the journal, holding its superblock.  */
+static struct jbd2_superblock *jsb;
+
+/* The disk block holding each block of the journal.  */
+static block_t *journal_map;
+
+/* The log occupies journal blocks JOURNAL_FIRST to JOURNAL_LAST - 1.  */
+static block_t journal_first, journal_last;
+
+/* Bytes taken by a tag in a descriptor block, by a revoked block number
+   in a revoke block, and by the checksum at the end of both.  */
+static size_t tag_bytes, revoke_bytes, tail_bytes;
+
+/* True if changes are being journaled.  */
+int journal_active;
+
+/* A copy of the contents of a journaled block.  The tables below hold
+   a reference each, and so does whoever copies the contents out.  */
+struct block_copy
+{
+  refcount_t refs;
+  char data[];
+};
+
+/* Checkpoint once the copies of committed blocks take this many blocks
+   of memory, even if the log isn't full.  */
+#define CHECKPOINT_BLOCKS	4096
+
+/* Protects the running transaction, the checkpoint list and the held
+   blocks.  */
+static pthread_spinlock_t journal_lock = PTHREAD_SPINLOCK_INITIALIZER;
+
+/* The blocks changed, each with a copy of its contents, and the
+   journaled blocks freed, in the running transaction.  */
+static struct hurd_ihash running_blocks
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+static struct hurd_ihash running_revokes
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+/* Nodes that got new blocks in the running transaction, with a light
+   reference each.  */
+static struct node **data_nodes;
+static size_t data_nodes_count, data_nodes_alloc;
+
+/* The sequence number of the running transaction.  */
+static __u32 running_tid;
+
+/* The blocks of committed transactions that may not be in place yet,
+   each with a copy of its last committed contents.  */
+static struct hurd_ihash checkpoint_blocks
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+/* The blocks of the transaction being written to the log, if any.  */
+static struct hurd_ihash *committing_blocks;
+
+/* Pinned blocks a pager wanted to write in place, each with a copy of
+   the contents it wanted to write.  */
+static struct hurd_ihash held_blocks
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+/* Serializes writing blocks in place from their copies with pagers
+   deciding whether they may write a block in place.  */
+static pthread_mutex_t held_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes commits and checkpoints, and protects the following.  */
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Where the next transaction goes, and how many blocks of the log are
+   used by transactions not yet checkpointed.  */
+static block_t log_head, log_used;
+
+/* Return the journal block following journal block POS.  */
+static inline block_t
+log_next (block_t pos)
+{
+  return pos + 1 == journal_last ? journal_first : pos + 1;
+}
+
+/* Transfer COUNT journal blocks starting at POS between the journal and
+   BUF (to the journal if WRITE is set), wrapping around at the end of
+   the log, with one device operation per physically contiguous run.  */
+static error_t
+journal_io (block_t pos, void *buf, block_t count, int write)
+{
+  error_t err = 0;
+
+  while (count > 0 && !err)
+    {
+      block_t run = 1;
+      size_t len, amount;
+      store_offset_t addr;
+
+      while (run < count && pos + run < journal_last
+	     && journal_map[pos + run] == journal_map[pos] + run)
+	run++;
+
+      len = run << log2_block_size;
+      addr = boffs (journal_map[pos]) >> store->log2_block_size;
+      if (write)
+	{
+	  err = store_write (store, addr, buf, len, &amount);
+	  if (!err && amount != len)
+	    err = EIO;
+	}
+      else
+	{
+	  void *data = buf;
+	  amount = len;
+	  err = store_read (store, addr, len, &data, &amount);
+	  if (!err && amount != len)
+	    err = EIO;
+	  if (data != buf)
+	    {
+	      if (!err)
+		memcpy (buf, data, len);
+	      munmap (data, amount);
+	    }
+	}
+
+      buf += len;
+      count -= run;
+      pos = pos + run == journal_last ? journal_first : pos + run;
+    }
+
+  return err;
+}
+
+/* Write the journal superblock.  */
+static error_t
+write_jsb (void)
+{
+  size_t amount;
+  error_t err = store_write (store,
+			     boffs (journal_map[0]) >> store->log2_block_size,
+			     jsb, block_size, &amount);
+  if (!err && amount != block_size)
+    err = EIO;
+  if (err)
+    ext2_warning ("can't write journal superblock: %s", strerror (err));
+  return err;
+}
+
+/* ---------------------------------------------------------------- */
+/* Recovery */
+
+/* The revoke records found in the log, mapping each revoked block to
+   the index in the log (counting from 1) of the latest transaction
+   revoking it.  */
+static struct hurd_ihash replay_revokes
+  = HURD_IHASH_INITIALIZER (HURD_IHASH_NO_LOCP);
+
+enum replay_pass { PASS_SCAN, PASS_REVOKE, PASS_REPLAY };
+
+/* Return the filesystem block named by the tag at TAG, with its flags
+   in *FLAGS.  Set *HIGH if the block number doesn't fit in 32 bits.  */
+static block_t
+tag_block (void *tag, int *flags, int *high)
+{
+  int wide = !! (jsb->s_feature_incompat
+		 & htobe32 (JBD2_FEATURE_INCOMPAT_64BIT));
+
+  if (jsb->s_feature_incompat & htobe32 (JBD2_FEATURE_INCOMPAT_CSUM_V3))
+    {
+      struct jbd2_block_tag3 *t = tag;
+      *flags = be32toh (t->t_flags);
+      *high = wide && t->t_blocknr_high;
+      return be32toh (t->t_blocknr);
+    }
+  else
+    {
+      struct jbd2_block_tag *t = tag;
+      *flags = be16toh (t->t_flags);
+      *high = wide && t->t_blocknr_high;
+      return be32toh (t->t_blocknr);
+    }
+}
+
+/* Go once through the transactions in the log.  For PASS_SCAN, set
+   *NTRANS to the number of complete transactions; the other passes
+   only look at that many.  */
+static error_t
+replay_pass (enum replay_pass pass, __u32 *ntrans, void *buf, void *data)
+{
+  __u32 seq = be32toh (jsb->s_sequence);
+  block_t pos = be32toh (jsb->s_start);
+  __u32 trans = 0;
+  error_t err;
+
+  while (pass == PASS_SCAN || trans < *ntrans)
+    {
+      struct jbd2_header *h = buf;
+      char *p, *end;
+
+      err = journal_io (pos, buf, 1, 0);
+      if (err)
+	return err;
+      pos = log_next (pos);
+
+      if (h->h_magic != htobe32 (JBD2_MAGIC_NUMBER)
+	  || be32toh (h->h_sequence) != seq)
+	break;
+
+      switch (be32toh (h->h_blocktype))
+	{
+	case JBD2_DESCRIPTOR_BLOCK:
+	  end = buf + block_size - tail_bytes;
+	  for (p = buf + sizeof *h; p + tag_bytes <= end; )
+	    {
+	      int flags, high;
+	      block_t block = tag_block (p, &flags, &high);
+
+	      if (pass == PASS_REPLAY)
+		{
+		  void *revoke = hurd_ihash_find (&replay_revokes, block);
+
+		  err = journal_io (pos, data, 1, 0);
+		  if (err)
+		    return err;
+
+		  if (high || block >= sblock->s_blocks_count)
+		    ext2_warning ("journal block %u of transaction %u is out"
+				  " of range", block, seq);
+		  else if (!revoke || (uintptr_t) revoke <= trans)
+		    {
+		      size_t amount;
+
+		      if (flags & JBD2_FLAG_ESCAPE)
+			*(__u32 *) data = htobe32 (JBD2_MAGIC_NUMBER);
+		      err = store_write (store,
+					 boffs (block) >> store->log2_block_size,
+					 data, block_size, &amount);
+		      if (!err && amount != block_size)
+			err = EIO;
+		      if (err)
+			return err;
+		    }
+		}
+	      pos = log_next (pos);
+
+	      p += tag_bytes;
+	      if (!(flags & JBD2_FLAG_SAME_UUID))
+		p += 16;
+	      if (flags & JBD2_FLAG_LAST_TAG)
+		break;
+	    }
+	  break;
+
+	case JBD2_REVOKE_BLOCK:
+	  if (pass == PASS_REVOKE)
+	    {
+	      struct jbd2_revoke_header *r = buf;
+	      size_t count = be32toh (r->r_count);
+
+	      if (count > block_size - tail_bytes)
+		count = block_size - tail_bytes;
+	      for (p = buf + sizeof *r; p + revoke_bytes <= (char *) buf + count;
+		   p += revoke_bytes)
+		{
+		  block_t block;
+
+		  if (revoke_bytes == 8)
+		    {
+		      if (*(__u32 *) p)
+			continue;
+		      block = be32toh (*(__u32 *) (p + 4));
+		    }
+		  else
+		    block = be32toh (*(__u32 *) p);
+
+		  /* Transactions count from 1 here, so that the values
+		     are valid hash table values.  */
+		  if (hurd_ihash_add (&replay_revokes, block,
+				      (void *) (uintptr_t) (trans + 1)))
+		    return ENOMEM;
+		}
+	    }
+	  break;
+
+	case JBD2_COMMIT_BLOCK:
+	  trans++;
+	  seq++;
+	  break;
+
+	default:
+	  goto done;
+	}
+    }
+
+ done:
+  if (pass == PASS_SCAN)
+    *ntrans = trans;
+  return 0;
+}
+
+/* Replay the transactions left in the journal.  */
+static error_t
+journal_recover (void)
+{
+  void *buf, *data;
+  __u32 ntrans;
+  error_t err;
+
+  buf = mmap (0, 2 * block_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    return ENOMEM;
+  data = buf + block_size;
+
+  err = replay_pass (PASS_SCAN, &ntrans, buf, data);
+  if (!err)
+    err = replay_pass (PASS_REVOKE, &ntrans, buf, data);
+  if (!err)
+    err = replay_pass (PASS_REPLAY, &ntrans, buf, data);
+  hurd_ihash_destroy (&replay_revokes);
+  munmap (buf, 2 * block_size);
+  if (err)
+    return err;
+
+  ext2_warning ("replayed %u journal transactions", ntrans);
+
+  /* Skip a sequence number, so that a transaction left half-written
+     after the last one replayed can never pass for a new one.  */
+  jsb->s_sequence = htobe32 (be32toh (jsb->s_sequence) + ntrans + 1);
+  jsb->s_start = 0;
+  return write_jsb ();
+}
+
+/* ---------------------------------------------------------------- */
+/* Setup */
+
+/* Find and check the journal.  If it needs recovery, replay it and
+   reread the hypermetadata.  */
+void
+journal_init (void)
+{
+  struct node *jnode;
+  block_t i, maxlen;
+  __u32 incompat;
+  error_t err;
+
+  if (!EXT2_HAS_COMPAT_FEATURE (sblock, EXT3_FEATURE_COMPAT_HAS_JOURNAL))
+    {
+      if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT3_FEATURE_INCOMPAT_RECOVER))
+	ext2_panic ("filesystem needs recovery but has no journal");
+      return;
+    }
+
+  if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT3_FEATURE_INCOMPAT_JOURNAL_DEV)
+      || sblock->s_journal_inum == 0)
+    ext2_panic ("external journals are not supported");
+
+  err = diskfs_cached_lookup (sblock->s_journal_inum, &jnode);
+  if (err)
+    ext2_panic ("can't get journal inode: %s", strerror (err));
+
+  maxlen = boffs_block (jnode->dn_stat.st_size);
+  journal_map = malloc (maxlen * sizeof *journal_map);
+  if (! journal_map)
+    ext2_panic ("can't allocate journal map");
+
+  pthread_rwlock_rdlock (&diskfs_node_disknode (jnode)->alloc_lock);
+  for (i = 0; i < maxlen; i++)
+    {
+      err = ext2_getblk (jnode, i, 0, &journal_map[i]);
+      if (err)
+	ext2_panic ("journal block %u is not mapped: %s", i, strerror (err));
+    }
+  pthread_rwlock_unlock (&diskfs_node_disknode (jnode)->alloc_lock);
+  diskfs_nput (jnode);
+
+  jsb = mmap (0, block_size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (jsb == MAP_FAILED)
+    ext2_panic ("can't allocate journal superblock");
+  err = journal_io (0, jsb, 1, 0);
+  if (err)
+    ext2_panic ("can't read journal superblock: %s", strerror (err));
+
+  if (jsb->s_header.h_magic != htobe32 (JBD2_MAGIC_NUMBER)
+      || (jsb->s_header.h_blocktype != htobe32 (JBD2_SUPERBLOCK_V1)
+	  && jsb->s_header.h_blocktype != htobe32 (JBD2_SUPERBLOCK_V2))
+      || be32toh (jsb->s_blocksize) != block_size
+      || be32toh (jsb->s_maxlen) > maxlen
+      || be32toh (jsb->s_first) == 0
+      || be32toh (jsb->s_first) >= be32toh (jsb->s_maxlen))
+    ext2_panic ("bad journal superblock");
+
+  if (jsb->s_header.h_blocktype == htobe32 (JBD2_SUPERBLOCK_V1))
+    {
+      jsb->s_feature_compat = 0;
+      jsb->s_feature_incompat = 0;
+      jsb->s_feature_ro_compat = 0;
+    }
+  incompat = be32toh (jsb->s_feature_incompat);
+
+  journal_first = be32toh (jsb->s_first);
+  journal_last = be32toh (jsb->s_maxlen);
+
+  /* As in jbd2, version 2 checksums make tags two bytes longer than
+     the structure.  */
+  if (incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3)
+    tag_bytes = sizeof (struct jbd2_block_tag3);
+  else
+    {
+      tag_bytes = sizeof (struct jbd2_block_tag);
+      if (incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2)
+	tag_bytes += sizeof (__u16);
+      if (!(incompat & JBD2_FEATURE_INCOMPAT_64BIT))
+	tag_bytes -= sizeof (__u32);
+    }
+  revoke_bytes = incompat & JBD2_FEATURE_INCOMPAT_64BIT ? 8 : 4;
+  tail_bytes = (incompat & (JBD2_FEATURE_INCOMPAT_CSUM_V2
+			    | JBD2_FEATURE_INCOMPAT_CSUM_V3)
+		? sizeof (struct jbd2_block_tail) : 0);
+
+  if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT3_FEATURE_INCOMPAT_RECOVER))
+    {
+      if (incompat & ~JBD2_FEATURE_INCOMPAT_RECOVER_SUPP)
+	ext2_panic ("can't recover journal with unsupported features"
+		    " (0x%x)", incompat & ~JBD2_FEATURE_INCOMPAT_RECOVER_SUPP);
+
+      if (store->flags & STORE_READONLY)
+	{
+	  ext2_warning ("filesystem needs recovery, but the device is"
+			" read-only; not replaying the journal");
+	  diskfs_readonly = 1;
+	  journal_last = 0;
+	  return;
+	}
+
+      if (jsb->s_start)
+	{
+	  err = journal_recover ();
+	  if (err)
+	    ext2_panic ("journal recovery failed: %s", strerror (err));
+	}
+
+      /* Reread everything that may have been replayed.  */
+      pager_flush (diskfs_disk_pager, 1);
+      get_hypermetadata ();
+      map_hypermetadata ();
+
+      sblock->s_feature_incompat &= ~EXT3_FEATURE_INCOMPAT_RECOVER;
+      write_sblock_direct ();
+    }
+
+  if (incompat & ~JBD2_FEATURE_INCOMPAT_WRITE_SUPP)
+    {
+      ext2_warning ("mounted readonly because of unsupported journal"
+		    " features (0x%x)",
+		    incompat & ~JBD2_FEATURE_INCOMPAT_WRITE_SUPP);
+      diskfs_readonly = 1;
+      journal_last = 0;
+      return;
+    }
+
+  running_tid = be32toh (jsb->s_sequence);
+  log_head = journal_first;
+}
+
+/* Start journaling changes, as the filesystem is about to be written.
+   Until journal_stop, the superblock says the journal may need to be
+   replayed.  Return true if changes are journaled.  */
+int
+journal_start (void)
+{
+  if (journal_active || !journal_last || diskfs_readonly)
+    return journal_active;
+
+  jsb->s_feature_incompat |= htobe32 (JBD2_FEATURE_INCOMPAT_REVOKE);
+  write_jsb ();
+
+  sblock->s_feature_incompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+  write_sblock_direct ();
+
+  journal_active = 1;
+  return 1;
+}
+
+/* Stop journaling, after checkpointing everything, and mark the
+   filesystem as not needing recovery.  */
+void
+journal_stop (void)
+{
+  if (! journal_active)
+    return;
+
+  journal_flush_data ();
+  journal_commit ();
+  journal_checkpoint ();
+
+  pthread_spin_lock (&journal_lock);
+  journal_active = 0;
+  pthread_spin_unlock (&journal_lock);
+
+  sblock->s_feature_incompat &= ~EXT3_FEATURE_INCOMPAT_RECOVER;
+  write_sblock_direct ();
+}
+
+/* ---------------------------------------------------------------- */
+/* Transactions */
+
+/* Return a new copy of the block at DATA, with one reference.  */
+static struct block_copy *
+copy_block (const void *data)
+{
+  struct block_copy *copy = malloc (sizeof *copy + block_size);
+
+  if (! copy)
+    ext2_panic ("can't copy block for the journal");
+  refcount_init (&copy->refs, 1);
+  memcpy (copy->data, data, block_size);
+  return copy;
+}
+
+/* Drop a reference to COPY.  */
+static void
+copy_deref (struct block_copy *copy)
+{
+  if (copy && refcount_deref (&copy->refs) == 0)
+    free (copy);
+}
+
+/* Remove BLOCK from TABLE, and return its copy (with the reference the
+   table held), or NULL.  JOURNAL_LOCK must be held.  */
+static struct block_copy *
+take_copy (struct hurd_ihash *table, block_t block)
+{
+  struct block_copy *copy = hurd_ihash_find (table, block);
+
+  if (copy)
+    hurd_ihash_remove (table, block);
+  return copy;
+}
+
+/* Return true if BLOCK may not be written in place yet.  JOURNAL_LOCK
+   must be held.  */
+static inline int
+block_pinned (block_t block)
+{
+  return (hurd_ihash_find (&running_blocks, block)
+	  || (committing_blocks && hurd_ihash_find (committing_blocks, block)));
+}
+
+/* Add BLOCK, a block which has been changed and is cached at DATA, to
+   the running transaction.  Return true if it was, false if there is no
+   journal.  The caller must still hold the lock under which it changed
+   the block.  */
+int
+journal_dirty_block (block_t block, void *data)
+{
+  struct block_copy *copy, *old;
+
+  if (! journal_active)
+    return 0;
+
+  /* Copy the block now, while the change is complete; the commit writes
+     the last copy taken.  Reading DATA may fault, so this is done before
+     taking JOURNAL_LOCK.  */
+  copy = copy_block (data);
+
+  pthread_spin_lock (&journal_lock);
+  old = take_copy (&running_blocks, block);
+  if (hurd_ihash_add (&running_blocks, block, copy))
+    ext2_panic ("can't add block to journal transaction");
+  /* A block freed and reused as metadata must be replayed again.  */
+  hurd_ihash_remove (&running_revokes, block);
+  pthread_spin_unlock (&journal_lock);
+
+  copy_deref (old);
+  return 1;
+}
+
+/* COUNT blocks starting at BLOCK have been freed, and may be reused as
+   file data: make sure older copies in the journal are not replayed
+   over them, and forget the copies kept in memory.  */
+void
+journal_revoke (block_t block, unsigned long count)
+{
+  if (! journal_active)
+    return;
+
+  pthread_spin_lock (&journal_lock);
+  for (; count > 0; count--, block++)
+    {
+      struct block_copy *checkpointed;
+
+      copy_deref (take_copy (&running_blocks, block));
+      copy_deref (take_copy (&held_blocks, block));
+      checkpointed = take_copy (&checkpoint_blocks, block);
+      if ((checkpointed
+	   || (committing_blocks
+	       && hurd_ihash_find (committing_blocks, block)))
+	  && ! hurd_ihash_find (&running_revokes, block)
+	  && hurd_ihash_add (&running_revokes, block, (void *) 1))
+	ext2_panic ("can't add revoke record to journal transaction");
+      copy_deref (checkpointed);
+    }
+  pthread_spin_unlock (&journal_lock);
+}
+
+/* A pager is about to write BLOCK in place from DATA.  Return true if it
+   must not, as BLOCK is part of a transaction that hasn't committed yet;
+   DATA is then kept, and written in place once that has committed.  */
+int
+journal_hold_block (block_t block, void *data)
+{
+  struct block_copy *copy = NULL, *old;
+  int pinned;
+
+  if (! journal_active)
+    return 0;
+
+  pthread_mutex_lock (&held_lock);
+
+  pthread_spin_lock (&journal_lock);
+  pinned = block_pinned (block);
+  pthread_spin_unlock (&journal_lock);
+
+  if (pinned)
+    copy = copy_block (data);
+
+  pthread_spin_lock (&journal_lock);
+  /* Whatever was held is older than DATA.  */
+  old = take_copy (&held_blocks, block);
+  if (copy && hurd_ihash_add (&held_blocks, block, copy))
+    ext2_panic ("can't hold journaled block");
+  pthread_spin_unlock (&journal_lock);
+
+  pthread_mutex_unlock (&held_lock);
+
+  copy_deref (old);
+  return pinned;
+}
+
+/* BLOCK has just been read from the disk into DATA by a pager.  If the
+   journal has newer contents for it, copy them over DATA.  */
+void
+journal_read_block (block_t block, void *data)
+{
+  struct block_copy *copy;
+
+  if (! journal_active)
+    return;
+
+  pthread_spin_lock (&journal_lock);
+  copy = hurd_ihash_find (&held_blocks, block);
+  if (! copy)
+    copy = hurd_ihash_find (&running_blocks, block);
+  if (! copy && committing_blocks)
+    copy = hurd_ihash_find (committing_blocks, block);
+  if (! copy)
+    copy = hurd_ihash_find (&checkpoint_blocks, block);
+  if (copy)
+    refcount_ref (&copy->refs);
+  pthread_spin_unlock (&journal_lock);
+
+  if (copy)
+    {
+      memcpy (data, copy->data, block_size);
+      copy_deref (copy);
+    }
+}
+
+/* NODE has been given new blocks; its data must be written before the
+   running transaction commits.  */
+void
+journal_note_data (struct node *node)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+
+  if (! journal_active)
+    return;
+
+  pthread_spin_lock (&journal_lock);
+  if (! dn->journal_data)
+    {
+      if (data_nodes_count == data_nodes_alloc)
+	{
+	  size_t alloc = data_nodes_alloc ? 2 * data_nodes_alloc : 64;
+	  struct node **nodes = realloc (data_nodes, alloc * sizeof *nodes);
+	  if (! nodes)
+	    ext2_panic ("can't add node to journal transaction");
+	  data_nodes = nodes;
+	  data_nodes_alloc = alloc;
+	}
+      data_nodes[data_nodes_count++] = node;
+      diskfs_nref_light (node);
+      dn->journal_data = 1;
+    }
+  pthread_spin_unlock (&journal_lock);
+}
+
+/* Write the data of the nodes noted with journal_note_data.  */
+void
+journal_flush_data (void)
+{
+  struct node **nodes;
+  size_t count, i;
+
+  if (! journal_active)
+    return;
+
+  pthread_spin_lock (&journal_lock);
+  nodes = data_nodes;
+  count = data_nodes_count;
+  data_nodes = NULL;
+  data_nodes_count = data_nodes_alloc = 0;
+  for (i = 0; i < count; i++)
+    diskfs_node_disknode (nodes[i])->journal_data = 0;
+  pthread_spin_unlock (&journal_lock);
+
+  for (i = 0; i < count; i++)
+    {
+      struct pager *pager;
+
+      pthread_spin_lock (&node_to_page_lock);
+      pager = diskfs_node_disknode (nodes[i])->pager;
+      if (pager)
+	ports_port_ref (pager);
+      pthread_spin_unlock (&node_to_page_lock);
+
+      if (pager)
+	{
+	  pager_sync (pager, 1);
+	  ports_port_deref (pager);
+	}
+      diskfs_nrele_light (nodes[i]);
+    }
+
+  free (nodes);
+}
+
+/* Write BLOCK in place from DATA, bypassing the pagers.  */
+static void
+write_block (block_t block, void *data)
+{
+  size_t amount;
+  error_t err = store_write (store, boffs (block) >> store->log2_block_size,
+			     data, block_size, &amount);
+  if (!err && amount != block_size)
+    err = EIO;
+  if (err)
+    ext2_warning ("can't write journaled block %u: %s",
+		  block, strerror (err));
+}
+
+/* Write the blocks in TABLE in place from their copies, and remove them
+   from it; if UNPINNED, only those no longer pinned.  The copies stay
+   in TABLE while they are written, so that pagers reading the blocks
+   meanwhile find them.  HELD_LOCK must be held.  */
+static void
+write_copies (struct hurd_ihash *table, int unpinned)
+{
+  struct { block_t block; struct block_copy *copy; } *items;
+  size_t count = 0, i;
+
+  /* Nothing can be added to TABLE meanwhile, only removed.  */
+  items = malloc (table->nr_items * sizeof *items);
+  if (table->nr_items && ! items)
+    ext2_panic ("can't write journaled blocks");
+
+  pthread_spin_lock (&journal_lock);
+  HURD_IHASH_ITERATE_ITEMS (table, item)
+    if (! unpinned || ! block_pinned (item->key))
+      {
+	struct block_copy *copy = item->value;
+	refcount_ref (&copy->refs);
+	items[count].block = item->key;
+	items[count++].copy = copy;
+      }
+  pthread_spin_unlock (&journal_lock);
+
+  for (i = 0; i < count; i++)
+    write_block (items[i].block, items[i].copy->data);
+
+  pthread_spin_lock (&journal_lock);
+  for (i = 0; i < count; i++)
+    /* Unless it was freed or replaced meanwhile.  */
+    if (hurd_ihash_find (table, items[i].block) == items[i].copy)
+      {
+	hurd_ihash_remove (table, items[i].block);
+	refcount_deref (&items[i].copy->refs);
+      }
+  pthread_spin_unlock (&journal_lock);
+
+  for (i = 0; i < count; i++)
+    copy_deref (items[i].copy);
+  free (items);
+}
+
+/* Write all the blocks of committed transactions in place, so that the
+   log can be reused from the start.  COMMIT_LOCK must be held.  */
+static void
+checkpoint (void)
+{
+  pthread_mutex_lock (&held_lock);
+  write_copies (&checkpoint_blocks, 0);
+  pthread_mutex_unlock (&held_lock);
+
+  if (log_used)
+    {
+      log_used = 0;
+      jsb->s_start = 0;
+      jsb->s_sequence = htobe32 (running_tid);
+      write_jsb ();
+    }
+}
+
+/* Write the blocks of committed transactions in place, and mark the
+   journal empty.  */
+void
+journal_checkpoint (void)
+{
+  if (! journal_active)
+    return;
+
+  pthread_mutex_lock (&commit_lock);
+  checkpoint ();
+  pthread_mutex_unlock (&commit_lock);
+}
+
+/* Fill in the header H of a journal block.  */
+static inline void
+set_header (struct jbd2_header *h, int type, __u32 tid)
+{
+  h->h_magic = htobe32 (JBD2_MAGIC_NUMBER);
+  h->h_blocktype = htobe32 (type);
+  h->h_sequence = htobe32 (tid);
+}
+
+/* Write transaction TID, made of BLOCKS and REVOKES, to the log.  Return
+   EFBIG if it doesn't fit in the log at all.  COMMIT_LOCK must be
+   held.  */
+static error_t
+write_transaction (__u32 tid, struct hurd_ihash *blocks,
+		   struct hurd_ihash *revokes)
+{
+  size_t per_desc = (block_size - sizeof (struct jbd2_header) - tail_bytes
+		     - 16) / tag_bytes;
+  size_t per_revoke = (block_size - sizeof (struct jbd2_revoke_header)
+		       - tail_bytes) / revoke_bytes;
+  size_t nblocks = blocks->nr_items, nrevokes = revokes->nr_items;
+  block_t need = ((nblocks + per_desc - 1) / per_desc + nblocks
+		  + (nrevokes + per_revoke - 1) / per_revoke + 1);
+  struct jbd2_commit_block *commit;
+  struct jbd2_revoke_header *revoke = NULL;
+  struct jbd2_block_tag *last_tag = NULL;
+  char *buf, *p, *tag = NULL, *desc_end = NULL;
+  struct timeval now;
+  error_t err;
+
+  if (need >= journal_last - journal_first)
+    return EFBIG;
+
+  if (need > journal_last - journal_first - log_used)
+    checkpoint ();
+
+  buf = mmap (0, need << log2_block_size, PROT_READ|PROT_WRITE,
+	      MAP_ANON, 0, 0);
+  if (buf == MAP_FAILED)
+    return ENOMEM;
+  p = buf;
+
+  /* Descriptor blocks, each followed by the blocks it describes.  */
+  HURD_IHASH_ITERATE_ITEMS (blocks, item)
+    {
+      block_t block = item->key;
+      struct jbd2_block_tag *t;
+      int flags = JBD2_FLAG_SAME_UUID;
+
+      if (! tag || tag + tag_bytes > desc_end)
+	{
+	  if (last_tag)
+	    last_tag->t_flags |= htobe16 (JBD2_FLAG_LAST_TAG);
+	  set_header ((struct jbd2_header *) p, JBD2_DESCRIPTOR_BLOCK, tid);
+	  tag = p + sizeof (struct jbd2_header);
+	  desc_end = p + block_size - tail_bytes;
+	  flags = 0;
+	  p += block_size;
+	}
+
+      memcpy (p, ((struct block_copy *) item->value)->data, block_size);
+      if (*(__u32 *) p == htobe32 (JBD2_MAGIC_NUMBER))
+	{
+	  *(__u32 *) p = 0;
+	  flags |= JBD2_FLAG_ESCAPE;
+	}
+      p += block_size;
+
+      t = (struct jbd2_block_tag *) tag;
+      t->t_blocknr = htobe32 (block);
+      t->t_flags = htobe16 (flags);
+      tag += tag_bytes;
+      if (! (flags & JBD2_FLAG_SAME_UUID))
+	{
+	  memcpy (tag, jsb->s_uuid, 16);
+	  tag += 16;
+	}
+      last_tag = t;
+    }
+  if (last_tag)
+    last_tag->t_flags |= htobe16 (JBD2_FLAG_LAST_TAG);
+
+  /* Revoke blocks.  */
+  tag = NULL;
+  HURD_IHASH_ITERATE_ITEMS (revokes, item)
+    {
+      if (! tag || tag + revoke_bytes > desc_end)
+	{
+	  revoke = (struct jbd2_revoke_header *) p;
+	  set_header (&revoke->r_header, JBD2_REVOKE_BLOCK, tid);
+	  tag = p + sizeof *revoke;
+	  desc_end = p + block_size - tail_bytes;
+	  p += block_size;
+	}
+
+      if (revoke_bytes == 8)
+	{
+	  *(__u32 *) tag = 0;
+	  tag += 4;
+	}
+      *(__u32 *) tag = htobe32 (item->key);
+      tag += 4;
+      revoke->r_count = htobe32 (tag - (char *) revoke);
+    }
+
+  commit = (struct jbd2_commit_block *) p;
+  set_header (&commit->h, JBD2_COMMIT_BLOCK, tid);
+  gettimeofday (&now, NULL);
+  commit->h_commit_sec = htobe64 (now.tv_sec);
+  commit->h_commit_nsec = htobe32 (now.tv_usec * 1000);
+
+  if (log_used == 0)
+    {
+      /* The log was empty; it now starts with this transaction.  */
+      jsb->s_start = htobe32 (log_head);
+      jsb->s_sequence = htobe32 (tid);
+      err = write_jsb ();
+      if (err)
+	goto out;
+    }
+
+  /* Everything but the commit block, then the commit block, so that
+     the transaction is never complete on disk before all its blocks.  */
+  err = journal_io (log_head, buf, need - 1, 1);
+  if (!err)
+    {
+      block_t pos = log_head + need - 1;
+      if (pos >= journal_last)
+	pos -= journal_last - journal_first;
+      err = journal_io (pos, commit, 1, 1);
+    }
+  if (err)
+    {
+      ext2_warning ("can't write journal transaction %u: %s",
+		    tid, strerror (err));
+      goto out;
+    }
+
+  log_head += need;
+  if (log_head >= journal_last)
+    log_head -= journal_last - journal_first;
+  log_used += need;
+
+ out:
+  munmap (buf, need << log2_block_size);
+  return err;
+}
+
+/* Commit the running transaction, and return once it is in the journal.
+   Callers arriving while a commit is being written wait for it, and
+   then commit whatever they changed meanwhile together.  */
+void
+journal_commit (void)
+{
+  struct hurd_ihash blocks, revokes;
+  __u32 tid;
+  error_t err;
+
+  if (! journal_active)
+    return;
+
+  pthread_spin_lock (&journal_lock);
+  tid = running_tid;
+  pthread_spin_unlock (&journal_lock);
+
+  pthread_mutex_lock (&commit_lock);
+
+  pthread_spin_lock (&journal_lock);
+  if (running_tid != tid
+      || (running_blocks.nr_items == 0 && running_revokes.nr_items == 0))
+    {
+      /* Someone else committed our changes, or there are none.  */
+      pthread_spin_unlock (&journal_lock);
+      pthread_mutex_unlock (&commit_lock);
+      return;
+    }
+  blocks = running_blocks;
+  revokes = running_revokes;
+  hurd_ihash_init (&running_blocks, HURD_IHASH_NO_LOCP);
+  hurd_ihash_init (&running_revokes, HURD_IHASH_NO_LOCP);
+  running_tid++;
+  /* Blocks freed from now on must be revoked in the next transaction,
+     even before these are on the checkpoint list.  */
+  committing_blocks = &blocks;
+  pthread_spin_unlock (&journal_lock);
+
+  err = write_transaction (tid, &blocks, &revokes);
+  if (err)
+    {
+      /* Write the blocks in place instead.  Nothing in the log may be
+	 replayed over them afterwards.  */
+      if (err == EFBIG)
+	ext2_debug ("transaction %u too big for the journal", tid);
+      checkpoint ();
+      pthread_mutex_lock (&held_lock);
+      write_copies (&blocks, 0);
+      pthread_mutex_unlock (&held_lock);
+    }
+
+  pthread_spin_lock (&journal_lock);
+  /* The copies now hold the last committed contents of their blocks,
+     until these are written in place.  */
+  HURD_IHASH_ITERATE_ITEMS (&blocks, item)
+    {
+      struct block_copy *old = take_copy (&checkpoint_blocks, item->key);
+      if (hurd_ihash_add (&checkpoint_blocks, item->key, item->value))
+	ext2_panic ("can't add block to journal checkpoint list");
+      copy_deref (old);
+    }
+  hurd_ihash_destroy (&blocks);
+  committing_blocks = NULL;
+  pthread_spin_unlock (&journal_lock);
+
+  hurd_ihash_destroy (&revokes);
+
+  /* What pagers wanted to write of these blocks can go in place now.  */
+  pthread_mutex_lock (&held_lock);
+  write_copies (&held_blocks, 1);
+  pthread_mutex_unlock (&held_lock);
+
+  if (checkpoint_blocks.nr_items > CHECKPOINT_BLOCKS)
+    checkpoint ();
+
+  pthread_mutex_unlock (&commit_lock);
+}
@@ -0,0 +1,148 @@
+/* On-disk format of the ext3/ext4 (jbd2) journal
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#ifndef EXT2_JOURNAL_H
+#define EXT2_JOURNAL_H
+
+/* Unlike the rest of the filesystem, all journal fields are big-endian.  */
+
+#define JBD2_MAGIC_NUMBER	0xc03b3998U
+
+/* Block types.  */
+#define JBD2_DESCRIPTOR_BLOCK	1
+#define JBD2_COMMIT_BLOCK	2
+#define JBD2_SUPERBLOCK_V1	3
+#define JBD2_SUPERBLOCK_V2	4
+#define JBD2_REVOKE_BLOCK	5
+
+/* Header at the start of every metadata block of the journal.  */
+struct jbd2_header
+{
+  __u32 h_magic;
+  __u32 h_blocktype;
+  __u32 h_sequence;		/* Transaction the block belongs to */
+};
+
+/* A descriptor block is a header followed by tags, one for each of the
+   following blocks of the journal, giving the filesystem block it is a
+   copy of.  The first tag is followed by the 16 byte journal UUID, the
+   others repeat it unless they have JBD2_FLAG_SAME_UUID.  */
+struct jbd2_block_tag
+{
+  __u32 t_blocknr;
+  __u16 t_checksum;		/* Only with JBD2_FEATURE_INCOMPAT_CSUM_V2 */
+  __u16 t_flags;
+  __u32 t_blocknr_high;		/* Only with JBD2_FEATURE_INCOMPAT_64BIT */
+};
+
+/* The tag format with JBD2_FEATURE_INCOMPAT_CSUM_V3.  */
+struct jbd2_block_tag3
+{
+  __u32 t_blocknr;
+  __u32 t_flags;
+  __u32 t_blocknr_high;
+  __u32 t_checksum;
+};
+
+#define JBD2_FLAG_ESCAPE	1 /* Block started with the magic number */
+#define JBD2_FLAG_SAME_UUID	2 /* No UUID follows this tag */
+#define JBD2_FLAG_DELETED	4 /* Block deleted by this transaction */
+#define JBD2_FLAG_LAST_TAG	8 /* Last tag in this descriptor block */
+
+/* Trailing checksum of descriptor and revoke blocks in journals with
+   checksums.  */
+struct jbd2_block_tail
+{
+  __u32 t_checksum;
+};
+
+/* A revoke block lists filesystem blocks whose copies in this and
+   earlier transactions must not be replayed.  */
+struct jbd2_revoke_header
+{
+  struct jbd2_header r_header;
+  __u32 r_count;		/* Bytes used in the block, with this header */
+};
+
+struct jbd2_commit_block
+{
+  struct jbd2_header h;
+  __u8 h_chksum_type;
+  __u8 h_chksum_size;
+  __u8 h_padding[2];
+  __u32 h_chksum[8];
+  __u64 h_commit_sec;
+  __u32 h_commit_nsec;
+};
+
+/* The journal superblock, in the first block of the journal.  */
+struct jbd2_superblock
+{
+  struct jbd2_header s_header;
+
+  /* Static information describing the journal.  */
+  __u32 s_blocksize;		/* Journal device block size */
+  __u32 s_maxlen;		/* Total blocks in journal file */
+  __u32 s_first;		/* First block of log information */
+
+  /* Dynamic information describing the current state of the log.  */
+  __u32 s_sequence;		/* First commit ID expected in log */
+  __u32 s_start;		/* Block of start of log, or 0 if empty */
+  __u32 s_errno;
+
+  /* Remaining fields are only valid in a version 2 superblock.  */
+  __u32 s_feature_compat;
+  __u32 s_feature_incompat;
+  __u32 s_feature_ro_compat;
+  __u8 s_uuid[16];		/* 128-bit uuid for journal */
+  __u32 s_nr_users;		/* Nr of filesystems sharing log */
+  __u32 s_dynsuper;
+  __u32 s_max_transaction;
+  __u32 s_max_trans_data;
+  __u8 s_checksum_type;
+  __u8 s_padding2[3];
+  __u32 s_num_fc_blks;		/* Number of fast commit blocks */
+  __u32 s_padding[41];
+  __u32 s_checksum;
+  __u8 s_users[16 * 48];	/* Ids of all filesystems sharing the log */
+};
+
+#define JBD2_FEATURE_COMPAT_CHECKSUM		0x00000001
+
+#define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
+#define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
+#define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
+#define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
+
+/* Features we can recover a journal with (checksums are not verified).  */
+#define JBD2_FEATURE_INCOMPAT_RECOVER_SUPP	\
+  (JBD2_FEATURE_INCOMPAT_REVOKE		\
+   | JBD2_FEATURE_INCOMPAT_64BIT		\
+   | JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	\
+   | JBD2_FEATURE_INCOMPAT_CSUM_V2	\
+   | JBD2_FEATURE_INCOMPAT_CSUM_V3)
+
+/* Features we can write new transactions with.  */
+#define JBD2_FEATURE_INCOMPAT_WRITE_SUPP	\
+  (JBD2_FEATURE_INCOMPAT_REVOKE		\
+   | JBD2_FEATURE_INCOMPAT_64BIT		\
+   | JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+
+#endif
@@ -61,8 +61,10 @@ struct ext2fs_pager_stats
   unsigned long file_pagein_reads; /* Device reads done by file pagein */
   unsigned long file_pagein_freed_bufs;	/* Discarded pages */
   unsigned long file_pagein_alloced_bufs; /* Allocated pages */
+  unsigned long file_pagein_runs; /* Multi-page pageins */
 
   unsigned long file_pageouts;
+  unsigned long file_pageout_runs; /* Multi-page pageouts */
 
   unsigned long file_page_unlocks;
   unsigned long file_grows;
@@ -81,7 +83,8 @@ do { pthread_spin_lock (&ext2s_pager_stats.lock);			      \
 #endif /* STATS */
 
 static void
-disk_cache_info_free_push (struct disk_cache_info *p);
+disk_cache_info_free_push (struct disk_cache_shard *shard,
+			   struct disk_cache_info *p);
 
 #define FREE_PAGE_BUFS 24
 
@@ -124,11 +127,12 @@ get_page_buf ()
   return buf;
 }
 
-/* Frees a block returned by get_page_buf.  */
+/* Frees a block of LENGTH bytes returned by get_page_buf, get_pages_buf,
+   or store_read.  */
 static inline void
-free_page_buf (void *buf)
+free_pages_buf (void *buf, vm_size_t length)
 {
-  munmap (buf, vm_page_size);
+  munmap (buf, round_page (length));
 }
 
 /* Find the location on disk of page OFFSET in NODE.  Return the disk block
@@ -162,23 +166,39 @@ find_block (struct node *node, vm_offset_t offset,
   return err;
 }
 
-/* Read one page for the pager backing NODE at offset PAGE, into BUF.  This
-   may need to read several filesystem blocks to satisfy one page, and tries
-   to consolidate the i/o if possible.  */
+/* Returns a page-aligned buffer of LENGTH bytes, which must be a multiple
+   of the page size.  */
+static void *
+get_pages_buf (vm_size_t length)
+{
+  void *buf;
+
+  if (length == vm_page_size)
+    return get_page_buf ();
+
+  buf = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  return buf == MAP_FAILED ? 0 : buf;
+}
+
+/* Read LENGTH bytes (a multiple of the page size) for the pager backing
+   NODE at offset PAGE, into BUF.  This may need to read several filesystem
+   blocks, and tries to consolidate the i/o if possible.  */
 static error_t
-file_pager_read_page (struct node *node, vm_offset_t page,
-		      void **buf, int *writelock)
+file_pager_read_pages (struct node *node, vm_offset_t page, vm_size_t length,
+		       void **buf, int *writelock)
 {
   error_t err;
-  int offs = 0;
+  vm_size_t offs = 0;
+  int have_buf = 0;		/* Whether *BUF has been set up.  */
   int partial = 0;		/* A page truncated by the EOF.  */
   pthread_rwlock_t *lock = NULL;
-  int left = vm_page_size;
+  vm_offset_t start = page;
+  vm_size_t left = length;
   block_t pending_blocks = 0;
   int num_pending_blocks = 0;
 
-  ext2_debug ("reading inode %llu page %lu[%u]",
-	      node->cache_id, page, vm_page_size);
+  ext2_debug ("reading inode %llu page %lu[%lu]",
+	      node->cache_id, page, length);
 
   /* Read the NUM_PENDING_BLOCKS blocks in PENDING_BLOCKS, into the buffer
      pointed to by BUF (allocating it if necessary) at offset OFFS.  OFFS in
@@ -191,12 +211,26 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	  store_offset_t dev_block = (store_offset_t) pending_blocks
 	    << log2_dev_blocks_per_fs_block;
 	  size_t amount = num_pending_blocks << log2_block_size;
+	  void *new_buf;
+	  size_t new_len;
+
+	  if (! have_buf && round_page (amount) < length)
+	    /* A buffer allocated by this read would be too small to hold
+	       the following ones, so get one big enough for everything.  */
+	    {
+	      *buf = get_pages_buf (length);
+	      if (! *buf)
+		return ENOMEM;
+	      have_buf = 1;
+	      STAT_INC (file_pagein_alloced_bufs);
+	    }
+
 	  /* The buffer we try to read into; on the first read, we pass in a
 	     size of zero, so that the read is guaranteed to allocate a new
 	     buffer, otherwise, we try to read directly into the tail of the
 	     buffer we've already got.  */
-	  void *new_buf = *buf + offs;
-	  size_t new_len = offs == 0 ? 0 : vm_page_size - offs;
+	  new_buf = *buf + offs;
+	  new_len = have_buf ? length - offs : 0;
 
 	  STAT_INC (file_pagein_reads);
 
@@ -210,14 +244,17 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	    {
 	      /* The read went into a different buffer than the one we
                  passed. */
-	      if (offs == 0)
+	      if (! have_buf)
 		/* First read, make the returned page be our buffer.  */
-		*buf = new_buf;
+		{
+		  *buf = new_buf;
+		  have_buf = 1;
+		}
 	      else
 		/* We've already got some buffer, so copy into it.  */
 		{
 		  memcpy (*buf + offs, new_buf, new_len);
-		  free_page_buf (new_buf); /* Return NEW_BUF to our pool.  */
+		  free_pages_buf (new_buf, new_len);
 		  STAT_INC (file_pagein_freed_bufs);
 		}
 	    }
@@ -264,12 +301,13 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	/* Reading unallocated block, just make a zero-filled one.  */
 	{
 	  *writelock = 1;
-	  if (offs == 0)
+	  if (! have_buf)
 	    /* No page allocated to read into yet.  */
 	    {
-	      *buf = get_page_buf ();
+	      *buf = get_pages_buf (length);
 	      if (! *buf)
 		break;
+	      have_buf = 1;
 	      STAT_INC (file_pagein_alloced_bufs);
 	    }
 	  memset (*buf + offs, 0, block_size);
@@ -285,15 +323,28 @@ file_pager_read_page (struct node *node, vm_offset_t page,
   if (!err && num_pending_blocks > 0)
     err = do_pending_reads();
 
+  if (!err && S_ISDIR (node->dn_stat.st_mode))
+    /* Directory blocks are journaled, and the journal may have newer
+       contents for them than the disk.  */
+    for (vm_size_t done = 0; done < offs; done += block_size)
+      {
+	block_t block;
+	if (! find_block (node, start + done, &block, &lock) && block)
+	  journal_read_block (block, *buf + done);
+      }
+
   if (!err && partial && !*writelock)
     diskfs_node_disknode (node)->last_page_partially_writable = 1;
 
   if (lock)
     pthread_rwlock_unlock (lock);
 
+  if (err && have_buf)
+    free_pages_buf (*buf, length);
+
   return err;
 }
-
+
 struct pending_blocks
 {
   /* The block number of the first of the blocks.  */
@@ -319,16 +370,20 @@ pending_blocks_write (struct pending_blocks *pb)
 
       ext2_debug ("writing block %u[%ld]", pb->block, pb->num);
 
-      if (pb->offs > 0)
+      if (pb->offs % vm_page_size)
 	/* Put what we're going to write into a page-aligned buffer.  */
 	{
-	  void *page_buf = get_page_buf ();
+	  vm_size_t buf_len = round_page (length);
+	  void *page_buf = get_pages_buf (buf_len);
+	  if (! page_buf)
+	    return ENOMEM;
 	  memcpy ((void *)page_buf, pb->buf + pb->offs, length);
 	  err = store_write (store, dev_block, page_buf, length, &amount);
-	  free_page_buf (page_buf);
+	  free_pages_buf (page_buf, buf_len);
 	}
       else
-	err = store_write (store, dev_block, pb->buf, length, &amount);
+	err = store_write (store, dev_block, pb->buf + pb->offs, length,
+			   &amount);
       if (err)
 	return err;
       else if (amount != length)
@@ -376,20 +431,39 @@ pending_blocks_add (struct pending_blocks *pb, block_t block)
   return 0;
 }
 
-/* Write one page for the pager backing NODE, at OFFSET, into BUF.  This
-   may need to write several filesystem blocks to satisfy one page, and tries
-   to consolidate the i/o if possible.  */
+/* Write LENGTH bytes (a multiple of the page size) for the pager backing
+   NODE, at OFFSET, from BUF.  This may need to write several filesystem
+   blocks, and tries to consolidate the i/o if possible.  */
 static error_t
-file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
+file_pager_write_pages (struct node *node, vm_offset_t offset,
+			vm_size_t length, void *buf)
 {
   error_t err = 0;
   struct pending_blocks pb;
   pthread_rwlock_t *lock = &diskfs_node_disknode (node)->alloc_lock;
   block_t block;
-  int left = vm_page_size;
+  vm_offset_t start = offset;
+  vm_size_t left = length;
 
   pending_blocks_init (&pb, buf);
 
+  if (diskfs_node_disknode (node)->delayed.nr_items > 0)
+    /* Give the blocks that were only reserved by pager_unlock_page their
+       place on disk, now that we know how many we write at once.  */
+    {
+      pthread_rwlock_wrlock (lock);
+      err = ext2_alloc_delayed (node, offset, length);
+      pthread_rwlock_unlock (lock);
+      if (err)
+	{
+	  ext2_warning ("inode=%Ld, page=0x%lx: %s",
+			node->cache_id, offset, strerror (err));
+	  return err;
+	}
+      /* The inode now points to the new blocks.  */
+      diskfs_node_dirty (node, 0);
+    }
+
   /* Holding diskfs_node_disknode (node)->alloc_lock effectively locks NODE->allocsize,
      at least for the cases we care about: pager_unlock_page,
      diskfs_grow and diskfs_truncate.  */
@@ -402,6 +476,9 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
 
   ext2_debug ("writing inode %d page %d[%d]", node->cache_id, offset, left);
 
+  if (length > vm_page_size)
+    STAT_INC (file_pageout_runs);
+
   STAT_INC (file_pageouts);
 
   while (left > 0)
@@ -410,13 +487,21 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
       if (err)
 	break;
       assert_backtrace (block);
-      pending_blocks_add (&pb, block);
+      if (S_ISDIR (node->dn_stat.st_mode)
+	  && journal_hold_block (block, buf + (offset - start)))
+	/* A journaled directory block, which goes in place once its
+	   transaction has committed.  */
+	err = pending_blocks_skip (&pb);
+      else
+	err = pending_blocks_add (&pb, block);
+      if (err)
+	break;
       offset += block_size;
       left -= block_size;
     }
 
   if (!err)
-    pending_blocks_write (&pb);
+    err = pending_blocks_write (&pb);
 
   pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
 
@@ -430,8 +515,9 @@ disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
   size_t length = vm_page_size, read = 0;
   store_offset_t offset = page, dev_end = store->size;
   int index = offset >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   offset = ((store_offset_t) disk_cache_info[index].block << log2_block_size)
     + offset % block_size;
   disk_cache_info[index].flags |= DC_INCORE;
@@ -441,7 +527,7 @@ disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
   disk_cache_info[index].last_read_xor
     = disk_cache_info[index].block ^ DISK_CACHE_LAST_READ_XOR;
 #endif
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   ext2_debug ("(%lld)", offset >> log2_block_size);
 
@@ -454,6 +540,8 @@ disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
     return EIO;
   if (!err && length != vm_page_size)
     memset ((void *)(*buf + length), 0, vm_page_size - length);
+  if (!err)
+    journal_read_block (boffs_block (offset), *buf);
 
   *writelock = 0;
 
@@ -467,8 +555,9 @@ disk_pager_write_page (vm_offset_t page, void *buf)
   size_t length = vm_page_size, amount;
   store_offset_t offset = page, dev_end = store->size;
   int index = offset >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   assert_backtrace (disk_cache_info[index].block != DC_NO_BLOCK);
   offset = ((store_offset_t) disk_cache_info[index].block << log2_block_size)
     + offset % block_size;
@@ -478,7 +567,7 @@ disk_pager_write_page (vm_offset_t page, void *buf)
   assert_backtrace (disk_cache_info[index].last_read
 	  == disk_cache_info[index].block);
 #endif
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   if (offset + vm_page_size > dev_end)
     length = dev_end - offset;
@@ -487,6 +576,10 @@ disk_pager_write_page (vm_offset_t page, void *buf)
 
   STAT_INC (disk_pageouts);
 
+  if (journal_hold_block (boffs_block (offset), buf))
+    /* It goes in place once its transaction has committed.  */
+    return 0;
+
   if (modified_global_blocks)
     /* Be picky about which blocks in a page that we write.  */
     {
@@ -536,17 +629,195 @@ static void
 disk_pager_notify_evict (vm_offset_t page)
 {
   unsigned long index = page >> log2_block_size;
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
 
   ext2_debug ("(block %lu)", index);
 
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   disk_cache_info[index].flags &= ~DC_INCORE;
   if (disk_cache_info[index].ref_count == 0 &&
       !(disk_cache_info[index].flags & DC_DONT_REUSE))
-    disk_cache_info_free_push (&disk_cache_info[index]);
-  pthread_mutex_unlock (&disk_cache_lock);
+    disk_cache_info_free_push (shard, &disk_cache_info[index]);
+  pthread_mutex_unlock (&shard->lock);
 }
 
+/* Readahead.  File pages are read ahead of readers that go through a
+   file sequentially, by a thread of our own, so that the reader finds
+   them in core instead of faulting on every page.  */
+
+int readahead_pages = READAHEAD_PAGES;
+
+/* The window first read ahead of a sequential reader, in pages; it
+   doubles as long as the reader keeps up, until readahead_pages.  */
+#define READAHEAD_FIRST_PAGES	4
+
+/* How many windows may wait to be read.  */
+#define READAHEAD_QUEUE		16
+
+struct readahead_request
+{
+  struct pager *pager;		/* Referenced */
+  vm_offset_t offset;
+  vm_size_t length;
+};
+
+/* Lock for the queue, and for the statistics but HITS and MISSES, which
+   are counted atomically.  Each node's readahead state has a lock of its
+   own.  */
+static pthread_mutex_t readahead_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readahead_wakeup = PTHREAD_COND_INITIALIZER;
+static struct readahead_request readahead_queue[READAHEAD_QUEUE];
+static int readahead_head, readahead_count;
+static struct readahead_stats readahead_stats;
+
+/* True in the readahead thread, whose reads are not the file's
+   reader's.  */
+static __thread int reading_ahead;
+
+/* Note that LENGTH bytes at PAGE of NODE are being read on demand, and
+   if the reads of NODE look sequential, queue the next window to be
+   read ahead.  */
+static void
+file_pager_note_read (struct node *node, vm_offset_t page, vm_size_t length)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  vm_size_t max = (vm_size_t) readahead_pages * vm_page_size;
+  vm_offset_t start, end;
+  struct readahead_request *req;
+  struct pager *pager;
+
+  if (reading_ahead || max == 0)
+    return;
+
+  pthread_mutex_lock (&dn->ra_lock);
+
+  if (dn->ra_end > dn->ra_start && page == dn->ra_end)
+    /* The reader used up the last window without waiting for it.  */
+    {
+      __atomic_add_fetch (&readahead_stats.hits, 1, __ATOMIC_RELAXED);
+      dn->ra_window *= 2;
+    }
+  else if (page >= dn->ra_start && page < dn->ra_end)
+    /* The reader got there before the data did.  */
+    __atomic_add_fetch (&readahead_stats.misses, 1, __ATOMIC_RELAXED);
+  else if (page == dn->ra_next)
+    dn->ra_window = dn->ra_window * 2 ?: READAHEAD_FIRST_PAGES * vm_page_size;
+  else
+    /* A random access; start over.  */
+    {
+      dn->ra_window = 0;
+      dn->ra_start = dn->ra_end = 0;
+      dn->ra_next = page + length;
+      pthread_mutex_unlock (&dn->ra_lock);
+      return;
+    }
+
+  if (dn->ra_window > max)
+    dn->ra_window = max;
+  dn->ra_next = page + length;
+
+  start = page + length;
+  if (start < dn->ra_end)
+    start = dn->ra_end;
+  end = page + length + dn->ra_window;
+  if (end > round_page (node->allocsize))
+    end = round_page (node->allocsize);
+
+  if (start >= end)
+    {
+      pthread_mutex_unlock (&dn->ra_lock);
+      return;
+    }
+
+  pthread_mutex_lock (&readahead_lock);
+
+  if (readahead_count == READAHEAD_QUEUE)
+    {
+      readahead_stats.dropped++;
+      pthread_mutex_unlock (&readahead_lock);
+      pthread_mutex_unlock (&dn->ra_lock);
+      return;
+    }
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = dn->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+
+  if (pager)
+    {
+      req = &readahead_queue[(readahead_head + readahead_count)
+			     % READAHEAD_QUEUE];
+      req->pager = pager;
+      req->offset = start;
+      req->length = end - start;
+      readahead_count++;
+      readahead_stats.windows++;
+
+      dn->ra_start = start;
+      dn->ra_end = end;
+
+      pthread_cond_signal (&readahead_wakeup);
+    }
+
+  pthread_mutex_unlock (&readahead_lock);
+  pthread_mutex_unlock (&dn->ra_lock);
+}
+
+static void *
+readahead_thread (void *arg)
+{
+  reading_ahead = 1;
+
+  for (;;)
+    {
+      struct readahead_request req;
+
+      pthread_mutex_lock (&readahead_lock);
+      while (readahead_count == 0)
+	pthread_cond_wait (&readahead_wakeup, &readahead_lock);
+      req = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE;
+      readahead_count--;
+      pthread_mutex_unlock (&readahead_lock);
+
+      pager_read_ahead (req.pager, req.offset, req.length);
+      ports_port_deref (req.pager);
+    }
+
+  return NULL;
+}
+
+/* Start the thread reading ahead of sequential file reads.  */
+void
+readahead_init (void)
+{
+  pthread_t thread;
+  error_t err;
+
+  err = pthread_create (&thread, NULL, readahead_thread, NULL);
+  if (err)
+    {
+      ext2_warning ("can't start the readahead thread: %s", strerror (err));
+      readahead_pages = 0;
+    }
+  else
+    pthread_detach (thread);
+}
+
+/* Return the readahead counters.  */
+void
+readahead_get_stats (struct readahead_stats *stats)
+{
+  pthread_mutex_lock (&readahead_lock);
+  *stats = readahead_stats;
+  pthread_mutex_unlock (&readahead_lock);
+  stats->hits = __atomic_load_n (&readahead_stats.hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n (&readahead_stats.misses,
+				   __ATOMIC_RELAXED);
+}
+
 /* Satisfy a pager read request for either the disk pager or file pager
    PAGER, to the page at offset PAGE into BUF.  WRITELOCK should be set if
    the pager should make the page writeable.  */
@@ -557,7 +828,32 @@ pager_read_page (struct user_pager_info *pager, vm_offset_t page,
   if (pager->type == DISK)
     return disk_pager_read_page (page, (void **)buf, writelock);
   else
-    return file_pager_read_page (pager->node, page, (void **)buf, writelock);
+    {
+      file_pager_note_read (pager->node, page, vm_page_size);
+      return file_pager_read_pages (pager->node, page, vm_page_size,
+				    (void **)buf, writelock);
+    }
+}
+
+/* Satisfy a multi-page pager read request for the file pager PAGER, of
+   LENGTH bytes at offset PAGE into BUF.  The disk pager maps scattered
+   blocks, so let libpager read its pages one by one.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t page,
+		  vm_size_t length, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == DISK)
+    return EOPNOTSUPP;
+  else if (page + length > round_page (pager->node->allocsize))
+    /* Let the pages past the end be refused individually.  */
+    return EOPNOTSUPP;
+  else
+    {
+      STAT_INC (file_pagein_runs);
+      file_pager_note_read (pager->node, page, length);
+      return file_pager_read_pages (pager->node, page, length,
+				    (void **)buf, writelock);
+    }
 }
 
 /* Satisfy a pager write request for either the disk pager or file pager
@@ -569,7 +865,21 @@ pager_write_page (struct user_pager_info *pager, vm_offset_t page,
   if (pager->type == DISK)
     return disk_pager_write_page (page, (void *)buf);
   else
-    return file_pager_write_page (pager->node, page, (void *)buf);
+    return file_pager_write_pages (pager->node, page, vm_page_size,
+				   (void *)buf);
+}
+
+/* Satisfy a multi-page pager write request for the file pager PAGER, of
+   LENGTH bytes at offset PAGE from BUF.  The disk pager only writes
+   modified blocks, so let libpager write its pages one by one.  */
+error_t
+pager_write_pages (struct user_pager_info *pager, vm_offset_t page,
+		   vm_size_t length, vm_address_t buf)
+{
+  if (pager->type == DISK)
+    return EOPNOTSUPP;
+  else
+    return file_pager_write_pages (pager->node, page, length, (void *)buf);
 }
 
 void
@@ -608,7 +918,12 @@ pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 	  while (left > 0)
 	    {
 	      block_t disk_block;
-	      err = ext2_getblk (node, block++, 1, &disk_block);
+	      if (S_ISREG (node->dn_stat.st_mode))
+		/* Only reserve the space; the block is allocated when
+		   the page is written.  */
+		err = ext2_delay_block (node, block++);
+	      else
+		err = ext2_getblk (node, block++, 1, &disk_block);
 	      if (err)
 		break;
 	      left -= block_size;
@@ -710,7 +1025,10 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
 	      while (!err && end_block < writable_end)
 		{
 		  block_t disk_block;
-		  err = ext2_getblk (node, end_block++, 1, &disk_block);
+		  if (S_ISREG (node->dn_stat.st_mode))
+		    err = ext2_delay_block (node, end_block++);
+		  else
+		    err = ext2_getblk (node, end_block++, 1, &disk_block);
 		}
 	      diskfs_end_catch_exception ();
 
@@ -758,10 +1076,30 @@ diskfs_file_update (struct node *node, int wait)
 
   if (pager)
     {
+      /* Pages changed through a writable mapping are only written by
+	 syncing the pager, so keep the node on the dirty list for as
+	 long as it may be mapped that way.  */
+      if (pager_get_upi (pager)->max_prot & VM_PROT_WRITE)
+	diskfs_node_dirty (node, 0);
       pager_sync (pager, wait);
       ports_port_deref (pager);
     }
 
+  if (journal_active)
+    /* Commit the metadata changes in one journal write, after the data
+       they refer to; the metadata blocks are written in place later.  */
+    {
+      pokel_inherit (&global_pokel,
+		     &diskfs_node_disknode (node)->indir_pokel);
+      diskfs_node_update (node, 0);
+      if (wait)
+	{
+	  journal_flush_data ();
+	  journal_commit ();
+	}
+      return;
+    }
+
   pokel_sync (&diskfs_node_disknode (node)->indir_pokel, wait);
 
   diskfs_node_update (node, wait);
@@ -852,52 +1190,59 @@ void *disk_cache;
 store_offset_t disk_cache_size;
 int disk_cache_blocks;
 
-/* block num --> pointer to in-memory block */
-hurd_ihash_t disk_cache_bptr;
+/* Number of slots in use.  */
+int disk_cache_limit;
+
+/* The shards, each with its block num --> pointer mapping, list of
+   reusable slots and lock.  */
+struct disk_cache_shard disk_cache_shards[DISK_CACHE_SHARDS];
+
 /* Cached blocks' info.  */
 struct disk_cache_info *disk_cache_info;
-/* Lock for these structures.  */
-pthread_mutex_t disk_cache_lock;
-/* Fired when a re-association is done.  */
-pthread_cond_t disk_cache_reassociation;
 
-/* Linked list of potentially unused blocks. */
-static struct disk_cache_info *disk_cache_info_free;
-static pthread_mutex_t disk_cache_info_free_lock;
+/* Number of slots of each shard in use.  */
+#define shard_slots() (disk_cache_limit / DISK_CACHE_SHARDS)
+
+/* The slot with index I in the shard with index S.  */
+#define shard_slot(s, i) ((s) + (i) * DISK_CACHE_SHARDS)
+
+/* How many blocks a CLOCK sweep pushes out of core at most.  */
+#define DISK_CACHE_RETURN_BATCH	64
 
-/* Get a reusable entry.  Must be called with disk_cache_lock
+/* Get a reusable entry of SHARD.  Must be called with SHARD's lock
    held.  */
 static struct disk_cache_info *
-disk_cache_info_free_pop (void)
+disk_cache_info_free_pop (struct disk_cache_shard *shard)
 {
   struct disk_cache_info *p;
 
   do
     {
-      pthread_mutex_lock (&disk_cache_info_free_lock);
-      p = disk_cache_info_free;
+      p = shard->free;
       if (p)
 	{
-	  disk_cache_info_free = p->next;
+	  shard->free = p->next;
 	  p->next = NULL;
+	  p->flags &= ~DC_FREE;
 	}
-      pthread_mutex_unlock (&disk_cache_info_free_lock);
     }
-  while (p && (p->flags & DC_DONT_REUSE || p->ref_count > 0));
+  while (p && (p->flags & DC_DONT_REUSE || p->ref_count > 0
+	       || p - disk_cache_info >= disk_cache_limit));
   return p;
 }
 
-/* Add P to the list of potentially re-usable entries.  */
+/* Add P to the list of potentially re-usable entries of SHARD.  Must be
+   called with SHARD's lock held.  */
 static void
-disk_cache_info_free_push (struct disk_cache_info *p)
+disk_cache_info_free_push (struct disk_cache_shard *shard,
+			   struct disk_cache_info *p)
 {
-  pthread_mutex_lock (&disk_cache_info_free_lock);
-  if (! p->next)
+  if (! (p->flags & DC_FREE))
     {
-      p->next = disk_cache_info_free;
-      disk_cache_info_free = p;
+      p->next = shard->free;
+      p->flags |= DC_FREE;
+      shard->free = p;
     }
-  pthread_mutex_unlock (&disk_cache_info_free_lock);
 }
 
 /* Finish mapping initialization. */
@@ -908,13 +1253,17 @@ disk_cache_init (void)
     ext2_panic ("Block size %u != vm_page_size %u",
 		block_size, vm_page_size);
 
-  pthread_mutex_init (&disk_cache_lock, NULL);
-  pthread_cond_init (&disk_cache_reassociation, NULL);
-  pthread_mutex_init (&disk_cache_info_free_lock, NULL);
-
-  /* Allocate space for block num -> in-memory pointer mapping.  */
-  if (hurd_ihash_create (&disk_cache_bptr, HURD_IHASH_NO_LOCP))
-    ext2_panic ("Can't allocate memory for disk_pager_bptr");
+  for (int s = 0; s < DISK_CACHE_SHARDS; s++)
+    {
+      struct disk_cache_shard *shard = &disk_cache_shards[s];
+
+      pthread_mutex_init (&shard->lock, NULL);
+      pthread_cond_init (&shard->reassociation, NULL);
+      hurd_ihash_init (&shard->bptr, HURD_IHASH_NO_LOCP);
+      hurd_ihash_set_flags (&shard->bptr, HURD_IHASH_CONTROL_BYTES);
+      shard->free = NULL;
+      shard->hand = 0;
+    }
 
   /* Allocate space for disk cache blocks' info.  */
   disk_cache_info = malloc ((sizeof *disk_cache_info) * disk_cache_blocks);
@@ -922,7 +1271,7 @@ disk_cache_init (void)
     ext2_panic ("Cannot allocate space for disk cache info");
 
   /* Initialize disk_cache_info.  Start with the last entry so that
-     the first ends up at the front of the free list.  This keeps the
+     the first ends up at the front of the free lists.  This keeps the
      assertions at the end of this function happy.  */
   for (int i = disk_cache_blocks - 1; i >= 0; i--)
     {
@@ -930,7 +1279,9 @@ disk_cache_init (void)
       disk_cache_info[i].flags = 0;
       disk_cache_info[i].ref_count = 0;
       disk_cache_info[i].next = NULL;
-      disk_cache_info_free_push (&disk_cache_info[i]);
+      if (i < disk_cache_limit)
+	disk_cache_info_free_push (disk_cache_index_shard (i),
+				   &disk_cache_info[i]);
 #ifdef DEBUG_DISK_CACHE
       disk_cache_info[i].last_read = DC_NO_BLOCK;
       disk_cache_info[i].last_read_xor
@@ -938,13 +1289,17 @@ disk_cache_init (void)
 #endif
     }
 
-  /* Map the superblock and the block group descriptors.  */
+  /* Map the superblock and the block group descriptors.  They must be
+     contiguous in the cache, which they are, since block I goes to the
+     first free slot of shard I % DISK_CACHE_SHARDS, and the first one
+     is block 0 (as the block size is the page size).  */
   block_t fixed_first = boffs_block (SBLOCK_OFFS);
   block_t fixed_last = fixed_first
     + (round_block ((sizeof *group_desc_image) * groups_count)
        >> log2_block_size);
   ext2_debug ("%u-%u\n", fixed_first, fixed_last);
-  assert_backtrace (fixed_last - fixed_first + 1 <= (block_t)disk_cache_blocks + 3);
+  assert_backtrace (fixed_first % DISK_CACHE_SHARDS == 0);
+  assert_backtrace (fixed_last - fixed_first + 1 <= (block_t)disk_cache_limit + 3);
   for (block_t i = fixed_first; i <= fixed_last; i++)
     {
       disk_cache_block_ref (i);
@@ -953,56 +1308,61 @@ disk_cache_init (void)
     }
 }
 
+/* Push some unreferenced blocks of SHARD out of core, so that their
+   slots can be reused.  A CLOCK sweep picks them, passing over (once)
+   those used since the previous sweep.  */
 static void
-disk_cache_return_unused (void)
+disk_cache_return_unused (struct disk_cache_shard *shard)
 {
-  int index;
+  int s = shard - disk_cache_shards;
+  int batch[DISK_CACHE_RETURN_BATCH];
+  int count = 0;
+  int slots, n;
 
   /* XXX: Touch all pages.  It seems that sometimes GNU Mach "forgets"
      to notify us about evicted pages.  Disk cache must be
      unlocked.  */
-  for (vm_offset_t i = 0; i < disk_cache_size; i += vm_page_size)
-    *(volatile char *)(disk_cache + i);
+  slots = shard_slots ();
+  for (int i = 0; i < slots; i++)
+    *(volatile char *)(disk_cache
+		       + ((vm_offset_t) shard_slot (s, i) << log2_block_size));
 
   /* Release some references to cached blocks.  */
   pokel_sync (&global_pokel, 1);
 
-  /* Return unused pages that are in core.  */
-  int pending_begin = -1, pending_end = -1;
-  pthread_mutex_lock (&disk_cache_lock);
-  for (index = 0; index < disk_cache_blocks; index++)
-    if (! (disk_cache_info[index].flags & (DC_DONT_REUSE & ~DC_INCORE))
-	&& ! disk_cache_info[index].ref_count)
-      {
-	ext2_debug ("return %u -> %d",
-		    disk_cache_info[index].block, index);
-	if (index != pending_end)
-	  {
-	    /* Return previous region, if there is such, ... */
-	    if (pending_end >= 0)
-	      {
-		pthread_mutex_unlock (&disk_cache_lock);
-		pager_return_some (diskfs_disk_pager,
-				   pending_begin * vm_page_size,
-				   (pending_end - pending_begin)
-				   * vm_page_size, 1);
-		pthread_mutex_lock (&disk_cache_lock);
-	      }
-	    /* ... and start new region.  */
-	    pending_begin = index;
-	  }
-	pending_end = index + 1;
-      }
+  pthread_mutex_lock (&shard->lock);
+  slots = shard_slots ();
+  for (n = 0; n < 2 * slots && count < DISK_CACHE_RETURN_BATCH; n++)
+    {
+      int index;
 
-  pthread_mutex_unlock (&disk_cache_lock);
+      if (shard->hand >= slots)
+	shard->hand = 0;
+      index = shard_slot (s, shard->hand++);
 
-  /* Return last region, if there is such.   */
-  if (pending_end >= 0)
+      if ((disk_cache_info[index].flags & (DC_DONT_REUSE & ~DC_INCORE))
+	  || disk_cache_info[index].ref_count)
+	continue;
+
+      if (disk_cache_info[index].flags & DC_REFERENCED)
+	/* Give it a second chance.  */
+	{
+	  disk_cache_info[index].flags &= ~DC_REFERENCED;
+	  continue;
+	}
+
+      ext2_debug ("return %u -> %d", disk_cache_info[index].block, index);
+      batch[count++] = index;
+    }
+  shard->evictions += count;
+  pthread_mutex_unlock (&shard->lock);
+
+  for (n = 0; n < count; n++)
     pager_return_some (diskfs_disk_pager,
-		       pending_begin * vm_page_size,
-		       (pending_end - pending_begin) * vm_page_size,
-		       1);
-  else
+		       (vm_offset_t) batch[n] << log2_block_size,
+		       vm_page_size, 1);
+
+  if (count == 0)
     {
       ext2_debug ("ext2fs: disk cache is starving\n");
 
@@ -1015,6 +1375,7 @@ disk_cache_return_unused (void)
 void *
 disk_cache_block_ref (block_t block)
 {
+  struct disk_cache_shard *shard = disk_cache_block_shard (block);
   struct disk_cache_info *info;
   int index;
   void *bptr;
@@ -1025,9 +1386,9 @@ disk_cache_block_ref (block_t block)
   ext2_debug ("(%u)", block);
 
 retry_ref:
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  bptr = hurd_ihash_locp_find (disk_cache_bptr, block, &slot);
+  bptr = hurd_ihash_locp_find (&shard->bptr, block, &slot);
   if (bptr)
     /* Already mapped.  */
     {
@@ -1037,8 +1398,8 @@ retry_ref:
       if (disk_cache_info[index].flags & DC_UNTOUCHED)
 	{
 	  /* Wait re-association to finish.  */
-	  pthread_cond_wait (&disk_cache_reassociation, &disk_cache_lock);
-	  pthread_mutex_unlock (&disk_cache_lock);
+	  pthread_cond_wait (&shard->reassociation, &shard->lock);
+	  pthread_mutex_unlock (&shard->lock);
 
 #if 0
 	  printf ("Re-association -- wait finished.\n");
@@ -1051,36 +1412,44 @@ retry_ref:
       assert_backtrace (disk_cache_info[index].ref_count + 1
 	      > disk_cache_info[index].ref_count);
       disk_cache_info[index].ref_count++;
+      disk_cache_info[index].flags |= DC_REFERENCED;
+      shard->hits++;
+      if (disk_cache_info[index].flags & DC_PREFETCHED)
+	{
+	  disk_cache_info[index].flags &= ~DC_PREFETCHED;
+	  shard->prefetch_hits++;
+	}
 
       ext2_debug ("cached %u -> %d (ref_count = %hu, flags = %#hx, ptr = %p)",
 		  disk_cache_info[index].block, index,
 		  disk_cache_info[index].ref_count,
 		  disk_cache_info[index].flags, bptr);
 
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       return bptr;
     }
 
   /* Search for a block that is not in core and is not referenced.  */
-  info = disk_cache_info_free_pop ();
+  info = disk_cache_info_free_pop (shard);
 
   /* Is suitable place found?  */
   if (info == NULL)
     /* No place is found.  Try to release some blocks and try
        again.  */
     {
-      ext2_debug ("flush %u -> %d", disk_cache_info[index].block, index);
+      ext2_debug ("flush for %u", block);
 
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
-      disk_cache_return_unused ();
+      disk_cache_return_unused (shard);
 
       goto retry_ref;
     }
 
   /* Suitable place is found.  */
   index = info - disk_cache_info;
+  assert_backtrace (disk_cache_index_shard (index) == shard);
 
   /* Calculate pointer to data.  */
   bptr = (char *)disk_cache + (index << log2_block_size);
@@ -1088,22 +1457,22 @@ retry_ref:
 
   /* This pager_return_some is used only to set PM_FORCEREAD for the
      page.  DC_UNTOUCHED is set so that we catch if someone has
-     referenced the block while we didn't hold disk_cache_lock.  */
+     referenced the block while we didn't hold the shard lock.  */
   disk_cache_info[index].flags |= DC_UNTOUCHED;
 
 #if 0 /* XXX: Let's see if this is needed at all.  */
 
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
   pager_return_some (diskfs_disk_pager, bptr - disk_cache, vm_page_size, 1);
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
   /* Has someone used our bptr?  Has someone mapped requested block
-     while we have unlocked disk_cache_lock?  If so, environment has
+     while we have unlocked the shard lock?  If so, environment has
      changed and we have to restart operation.  */
   if ((! (disk_cache_info[index].flags & DC_UNTOUCHED))
-      || hurd_ihash_find (disk_cache_bptr, block))
+      || hurd_ihash_find (&shard->bptr, block))
     {
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
       goto retry_ref;
     }
 
@@ -1114,12 +1483,12 @@ retry_ref:
   pthread_mutex_lock (&diskfs_disk_pager->interlock);
   int page = (bptr - disk_cache) / vm_page_size;
   assert_backtrace (page >= 0);
-  int is_incore = (page < diskfs_disk_pager->pagemapsize
-		   && (diskfs_disk_pager->pagemap[page] & PM_INCORE));
+  int is_incore = (_pager_pagemap_get (diskfs_disk_pager,
+				       page * vm_page_size) & PM_INCORE);
   pthread_mutex_unlock (&diskfs_disk_pager->interlock);
   if (is_incore)
     {
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
       printf ("INCORE\n");
       goto retry_ref;
     }
@@ -1129,33 +1498,36 @@ retry_ref:
   /* Re-associate.  */
 
   /* New association.  */
-  if (hurd_ihash_locp_add (disk_cache_bptr, slot, block, bptr))
+  if (hurd_ihash_locp_add (&shard->bptr, slot, block, bptr))
     ext2_panic ("Couldn't hurd_ihash_locp_add new disk block");
   if (disk_cache_info[index].block != DC_NO_BLOCK)
     /* Remove old association.  */
-    hurd_ihash_remove (disk_cache_bptr, disk_cache_info[index].block);
+    hurd_ihash_remove (&shard->bptr, disk_cache_info[index].block);
   assert_backtrace (! (disk_cache_info[index].flags & DC_DONT_REUSE & ~DC_UNTOUCHED));
   disk_cache_info[index].block = block;
   assert_backtrace (! disk_cache_info[index].ref_count);
   disk_cache_info[index].ref_count = 1;
+  disk_cache_info[index].flags |= DC_REFERENCED;
+  disk_cache_info[index].flags &= ~DC_PREFETCHED;
+  shard->misses++;
 
   /* All data structures are set up.  */
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   /* Try to read page.  */
   *(volatile char *) bptr;
 
   /* Check if it's actually read.  */
-  pthread_mutex_lock (&disk_cache_lock);
+  pthread_mutex_lock (&shard->lock);
   if (disk_cache_info[index].flags & DC_UNTOUCHED)
     /* It's not read.  */
     {
       /* Remove newly created association.  */
-      hurd_ihash_remove (disk_cache_bptr, block);
+      hurd_ihash_remove (&shard->bptr, block);
       disk_cache_info[index].block = DC_NO_BLOCK;
       disk_cache_info[index].flags &=~ DC_UNTOUCHED;
       disk_cache_info[index].ref_count = 0;
-      pthread_mutex_unlock (&disk_cache_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       /* Prepare next time association of this page to succeed.  */
       pager_flush_some (diskfs_disk_pager, bptr - disk_cache,
@@ -1169,9 +1541,9 @@ retry_ref:
     }
 
   /* Re-association was successful.  */
-  pthread_cond_broadcast (&disk_cache_reassociation);
+  pthread_cond_broadcast (&shard->reassociation);
 
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   ext2_debug ("(%u) = %p", block, bptr);
   return bptr;
@@ -1180,10 +1552,10 @@ retry_ref:
 void
 disk_cache_block_ref_ptr (void *ptr)
 {
-  int index;
+  int index = bptr_index (ptr);
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
 
-  pthread_mutex_lock (&disk_cache_lock);
-  index = bptr_index (ptr);
+  pthread_mutex_lock (&shard->lock);
   assert_backtrace (disk_cache_info[index].ref_count >= 1);
   assert_backtrace (disk_cache_info[index].ref_count + 1
 	  > disk_cache_info[index].ref_count);
@@ -1193,18 +1565,20 @@ disk_cache_block_ref_ptr (void *ptr)
 	      ptr,
 	      disk_cache_info[index].ref_count,
 	      disk_cache_info[index].flags);
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 }
 
 void
 _disk_cache_block_deref (void *ptr)
 {
   int index;
+  struct disk_cache_shard *shard;
 
   assert_backtrace (disk_cache <= ptr && ptr <= disk_cache + disk_cache_size);
 
-  pthread_mutex_lock (&disk_cache_lock);
   index = bptr_index (ptr);
+  shard = disk_cache_index_shard (index);
+  pthread_mutex_lock (&shard->lock);
   ext2_debug ("(%p) (ref_count = %hu, flags = %#hx)",
 	      ptr,
 	      disk_cache_info[index].ref_count - 1,
@@ -1214,28 +1588,234 @@ _disk_cache_block_deref (void *ptr)
   disk_cache_info[index].ref_count--;
   if (disk_cache_info[index].ref_count == 0 &&
       !(disk_cache_info[index].flags & DC_DONT_REUSE))
-    disk_cache_info_free_push (&disk_cache_info[index]);
-  pthread_mutex_unlock (&disk_cache_lock);
+    disk_cache_info_free_push (shard, &disk_cache_info[index]);
+  pthread_mutex_unlock (&shard->lock);
 }
 
 /* Not used.  */
 int
 disk_cache_block_is_ref (block_t block)
 {
+  struct disk_cache_shard *shard = disk_cache_block_shard (block);
   int ref;
   void *ptr;
 
-  pthread_mutex_lock (&disk_cache_lock);
-  ptr = hurd_ihash_find (disk_cache_bptr, block);
+  pthread_mutex_lock (&shard->lock);
+  ptr = hurd_ihash_find (&shard->bptr, block);
   if (ptr == NULL)
     ref = 0;
   else				/* XXX: Should check for DC_UNTOUCHED too.  */
     ref = disk_cache_info[bptr_index (ptr)].ref_count;
-  pthread_mutex_unlock (&disk_cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return ref;
 }
-
+
+/* Give BLOCK a slot in the disk cache without reading it, for
+   disk_cache_prefetch.  Return the slot, or -1 if BLOCK is cached
+   already or there is no free slot.  Whoever references BLOCK meanwhile
+   waits for disk_cache_prefetch_done.  */
+static int
+disk_cache_prefetch_claim (block_t block)
+{
+  struct disk_cache_shard *shard = disk_cache_block_shard (block);
+  struct disk_cache_info *info;
+  hurd_ihash_locp_t slot;
+  int index;
+
+  pthread_mutex_lock (&shard->lock);
+
+  if (hurd_ihash_locp_find (&shard->bptr, block, &slot))
+    {
+      pthread_mutex_unlock (&shard->lock);
+      return -1;
+    }
+
+  /* Unlike disk_cache_block_ref, don't push anything out for this.  */
+  info = disk_cache_info_free_pop (shard);
+  if (! info)
+    {
+      pthread_mutex_unlock (&shard->lock);
+      return -1;
+    }
+
+  index = info - disk_cache_info;
+  if (hurd_ihash_locp_add (&shard->bptr, slot, block,
+			   (char *) disk_cache + (index << log2_block_size)))
+    {
+      disk_cache_info_free_push (shard, info);
+      pthread_mutex_unlock (&shard->lock);
+      return -1;
+    }
+  if (info->block != DC_NO_BLOCK)
+    hurd_ihash_remove (&shard->bptr, info->block);
+  info->block = block;
+  info->flags |= DC_UNTOUCHED;
+  info->flags &= ~DC_PREFETCHED;
+
+  pthread_mutex_unlock (&shard->lock);
+  return index;
+}
+
+/* Finish the prefetch of the block in slot INDEX: if DATA is not null,
+   hand it to the kernel as the slot's contents, otherwise the read
+   failed and the slot is given back.  */
+static void
+disk_cache_prefetch_done (int index, void *data)
+{
+  struct disk_cache_info *info = &disk_cache_info[index];
+  struct disk_cache_shard *shard = disk_cache_index_shard (index);
+
+  if (data)
+    pager_offer_page (diskfs_disk_pager, 1, 0,
+		      (vm_offset_t) index << log2_block_size,
+		      (vm_address_t) data);
+
+  pthread_mutex_lock (&shard->lock);
+  if (data)
+    {
+      info->flags |= DC_INCORE | DC_PREFETCHED;
+      shard->prefetched++;
+    }
+  else
+    {
+      hurd_ihash_remove (&shard->bptr, info->block);
+      info->block = DC_NO_BLOCK;
+      disk_cache_info_free_push (shard, info);
+    }
+  info->flags &= ~DC_UNTOUCHED;
+  pthread_cond_broadcast (&shard->reassociation);
+  pthread_mutex_unlock (&shard->lock);
+}
+
+/* Read those of the COUNT blocks BLOCKS (in increasing order) that
+   aren't in the disk cache into it, with one store read for each run
+   of consecutive blocks.  This only works if blocks are pages, as the
+   disk pager supplies whole pages.  */
+void
+disk_cache_prefetch (block_t *blocks, int count)
+{
+  int index[count];
+  int i, j;
+
+  if (block_size != vm_page_size || count == 0)
+    return;
+
+  for (i = 0; i < count; i++)
+    index[i] = disk_cache_prefetch_claim (blocks[i]);
+
+  for (i = 0; i < count; i = j)
+    {
+      store_offset_t dev_block;
+      void *buf = 0;
+      size_t amount, read = 0;
+      error_t err;
+
+      j = i + 1;
+      if (index[i] < 0)
+	continue;
+      while (j < count && index[j] >= 0 && blocks[j] == blocks[j - 1] + 1)
+	j++;
+
+      dev_block = (store_offset_t) blocks[i] << log2_dev_blocks_per_fs_block;
+      amount = (j - i) << log2_block_size;
+      err = store_read (store, dev_block, amount, &buf, &read);
+      if (!err && read != amount)
+	{
+	  free_pages_buf (buf, read);
+	  err = EIO;
+	}
+
+      for (int k = i; k < j; k++)
+	disk_cache_prefetch_done (index[k],
+				  err ? NULL
+				  : buf + ((k - i) << log2_block_size));
+
+      if (! err)
+	free_pages_buf (buf, read);
+    }
+}
+
+error_t
+disk_cache_set_limit (int blocks)
+{
+  int old, s, i;
+
+  /* Keep the same number of slots in every shard.  */
+  blocks -= blocks % DISK_CACHE_SHARDS;
+  if (blocks < DISK_CACHE_MIN_BLOCKS)
+    return EINVAL;
+
+  if (! disk_cache)
+    /* Not set up yet; create_disk_pager will reserve room for it.  */
+    {
+      disk_cache_limit = blocks;
+      return 0;
+    }
+
+  /* The cache can't be moved, as pointers into it are held.  */
+  if (blocks > disk_cache_blocks)
+    return EINVAL;
+
+  for (s = 0; s < DISK_CACHE_SHARDS; s++)
+    pthread_mutex_lock (&disk_cache_shards[s].lock);
+  old = disk_cache_limit;
+  disk_cache_limit = blocks;
+  for (i = old; i < blocks; i++)
+    /* The new slots have never been used.  */
+    disk_cache_info_free_push (disk_cache_index_shard (i),
+			       &disk_cache_info[i]);
+  for (s = DISK_CACHE_SHARDS - 1; s >= 0; s--)
+    pthread_mutex_unlock (&disk_cache_shards[s].lock);
+
+  if (blocks >= old)
+    return 0;
+
+  /* Write back and drop the blocks in slots no longer used.  */
+  pokel_sync (&global_pokel, 1);
+  pager_return_some (diskfs_disk_pager, (vm_offset_t) blocks << log2_block_size,
+		     (vm_size_t) (old - blocks) << log2_block_size, 1);
+
+  /* Forget those which are not referenced; the others stay usable until
+     they are released, and are then left alone.  */
+  for (i = blocks; i < old; i++)
+    {
+      struct disk_cache_shard *shard = disk_cache_index_shard (i);
+
+      pthread_mutex_lock (&shard->lock);
+      if (disk_cache_info[i].block != DC_NO_BLOCK
+	  && ! disk_cache_info[i].ref_count
+	  && ! (disk_cache_info[i].flags & DC_DONT_REUSE))
+	{
+	  hurd_ihash_remove (&shard->bptr, disk_cache_info[i].block);
+	  disk_cache_info[i].block = DC_NO_BLOCK;
+	  disk_cache_info[i].flags &= ~DC_REFERENCED;
+	}
+      pthread_mutex_unlock (&shard->lock);
+    }
+
+  return 0;
+}
+
+void
+disk_cache_get_stats (struct disk_cache_stats *stats)
+{
+  memset (stats, 0, sizeof *stats);
+  for (int s = 0; s < DISK_CACHE_SHARDS; s++)
+    {
+      struct disk_cache_shard *shard = &disk_cache_shards[s];
+
+      pthread_mutex_lock (&shard->lock);
+      stats->hits += shard->hits;
+      stats->misses += shard->misses;
+      stats->evictions += shard->evictions;
+      stats->prefetched += shard->prefetched;
+      stats->prefetch_hits += shard->prefetch_hits;
+      pthread_mutex_unlock (&shard->lock);
+    }
+  stats->blocks = disk_cache_limit;
+}
+
 /* Create the disk pager, and the file pager.  */
 void
 create_disk_pager (void)
@@ -1249,7 +1829,12 @@ create_disk_pager (void)
   upi->type = DISK;
   disk_pager_bucket = ports_create_bucket ();
   get_hypermetadata ();
-  disk_cache_blocks = DISK_CACHE_BLOCKS;
+  /* Reserve room for the default size even if a smaller one was asked
+     for, so that the cache can be grown back at run time.  */
+  if (! disk_cache_limit)
+    disk_cache_limit = DISK_CACHE_BLOCKS;
+  disk_cache_blocks = (disk_cache_limit > DISK_CACHE_BLOCKS
+		       ? disk_cache_limit : DISK_CACHE_BLOCKS);
   disk_cache_size = disk_cache_blocks << log2_block_size;
   diskfs_start_disk_pager (upi, disk_pager_bucket, MAY_CACHE, 1,
 			   disk_cache_size, &disk_cache);
@@ -1315,8 +1900,10 @@ diskfs_get_filemap (struct node *node, vm_prot_t prot)
       else
 	{
 	  struct user_pager_info *upi;
+	  /* Being told of evicted pages keeps PM_INCORE accurate, so that
+	     readahead covers pages read once and dropped since.  */
 	  pager = pager_create_alloc (sizeof *upi, file_pager_bucket,
-				      MAY_CACHE, MEMORY_OBJECT_COPY_DELAY, 0);
+				      MAY_CACHE, MEMORY_OBJECT_COPY_DELAY, 1);
 	  if (pager == NULL)
 	    {
 	      pthread_spin_unlock (&node_to_page_lock);
@@ -1343,6 +1930,10 @@ diskfs_get_filemap (struct node *node, vm_prot_t prot)
   mach_port_insert_right (mach_task_self (), right, right,
 			  MACH_MSG_TYPE_MAKE_SEND);
 
+  /* Writes through the mapping don't reach us; see diskfs_file_update.  */
+  if (prot & VM_PROT_WRITE)
+    diskfs_node_dirty (node, 0);
+
   return right;
 }
 
@@ -1412,6 +2003,7 @@ diskfs_shutdown_pager ()
 
   write_all_disknodes ();
 
+  journal_flush_data ();
   ports_bucket_iterate (file_pager_bucket, shutdown_one);
 
   /* Sync everything on the the disk pager.  */
@@ -1421,6 +2013,15 @@ diskfs_shutdown_pager ()
      pager, just make sure it's synced. */
 }
 
+/* Write the metadata that diskfs_file_update queued without waiting;
+   this is our diskfs_writeback_hook.  */
+void
+writeback_global (void)
+{
+  journal_flush_data ();
+  sync_global (0);
+}
+
 /* Sync all the pagers. */
 void
 diskfs_sync_everything (int wait)
@@ -1435,6 +2036,10 @@ diskfs_sync_everything (int wait)
   write_all_disknodes ();
   ports_bucket_iterate (file_pager_bucket, sync_one);
 
+  /* Data written to new blocks must be on disk before they are
+     committed.  */
+  journal_flush_data ();
+
   /* Do things on the the disk pager.  */
   sync_global (wait);
 }
@@ -1551,3 +2156,25 @@ diskfs_max_user_pager_prot ()
 
   return max_prot;
 }
+
+/* Return the bytes of memory used by the pagemaps of the disk pager and
+   of all file pagers.  */
+vm_size_t
+pagemap_size (void)
+{
+  struct pager_stats stats;
+  vm_size_t size = 0;
+
+  error_t add_pagemap_size (void *v_p)
+    {
+      pager_get_stats (v_p, &stats);
+      size += stats.pagemap_size;
+      return 0;
+    }
+
+  if (diskfs_disk_pager)
+    add_pagemap_size (diskfs_disk_pager);
+  ports_bucket_iterate (file_pager_bucket, add_pagemap_size);
+
+  return size;
+}
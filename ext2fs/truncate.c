@@ -338,18 +338,28 @@ diskfs_truncate (struct node *node, off_t length)
       block_t *bptrs = diskfs_node_disknode (node)->info.i_data;
       struct free_block_run fbr;
 
-      free_block_run_init (&fbr, node);
+      ext2_discard_delayed (node, end);
 
-      trunc_direct (node, end, &fbr);
+      if (diskfs_node_disknode (node)->info.i_flags & EXT4_EXTENTS_FL)
+	ext4_ext_truncate (node, end);
+      else
+	{
+	  free_block_run_init (&fbr, node);
 
-      offs = EXT2_NDIR_BLOCKS;
-      trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs, &fbr);
-      offs += addr_per_block;
-      trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs, &fbr);
-      offs += addr_per_block * addr_per_block;
-      trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs, &fbr);
+	  trunc_direct (node, end, &fbr);
 
-      free_block_run_finish (&fbr);
+	  offs = EXT2_NDIR_BLOCKS;
+	  trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block;
+	  trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block * addr_per_block;
+	  trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs,
+				 &fbr);
+
+	  free_block_run_finish (&fbr);
+	}
 
       node->allocsize = round_block (length);
 
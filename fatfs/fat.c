@@ -58,11 +58,23 @@ pthread_spinlock_t allocate_free_cluster_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
 /* Where to look for the next free cluster. This is meant to avoid
    searching through a nearly full file system from the beginning at
-   every request.  It would be better to use the field of the same
-   name in the fs_info block. 2 is the first data cluster in any
-   FAT.  */
+   every request.  Taken from the fs_info block of FAT32 file systems
+   at first. 2 is the first data cluster in any FAT.  */
 cluster_t next_free_cluster = 2;
 
+/* Bit N of the free map is set if cluster N + 2 is free.  The bits
+   follow fat_write_next_cluster, with atomic operations so that
+   clusters can be freed without ALLOCATE_FREE_CLUSTER_LOCK; searching
+   for free clusters and taking them needs that lock.  */
+static unsigned long *free_map;
+static cluster_t nr_of_free_clusters;
+
+#define MAP_BITS	(sizeof (unsigned long) * CHAR_BIT)
+
+/* How far fat_allocate_clusters looks for a run of the size asked for,
+   before it settles for a shorter one.  */
+#define RUN_SEARCH_LIMIT	65536
+
 
 /* Read the superblock.  */
 void
@@ -204,6 +216,129 @@ fat_read_sblock (void)
 }
 
 
+/* Note in the free map whether CLUSTER is FREE.  */
+static void
+mark_cluster (cluster_t cluster, int free)
+{
+  unsigned long *word, bit;
+
+  if (! free_map)
+    return;
+
+  word = &free_map[(cluster - 2) / MAP_BITS];
+  bit = 1UL << ((cluster - 2) % MAP_BITS);
+
+  if (free)
+    {
+      if (! (__atomic_fetch_or (word, bit, __ATOMIC_RELAXED) & bit))
+	__atomic_add_fetch (&nr_of_free_clusters, 1, __ATOMIC_RELAXED);
+    }
+  else
+    {
+      if (__atomic_fetch_and (word, ~bit, __ATOMIC_RELAXED) & bit)
+	__atomic_sub_fetch (&nr_of_free_clusters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Build the free map from the FAT.  */
+void
+fat_init_free_map (void)
+{
+  size_t words = (nr_of_clusters + MAP_BITS - 1) / MAP_BITS;
+  cluster_t cluster, next_cluster, hint;
+  struct fat_fs_info *info = NULL;
+  size_t read = 0;
+  error_t err;
+
+  free_map = calloc (words, sizeof *free_map);
+  if (! free_map)
+    error (1, errno, "Could not allocate the free cluster map");
+
+  err = diskfs_catch_exception ();
+  if (err)
+    error (1, err, "Could not read the FAT");
+  for (cluster = 2; cluster < nr_of_clusters + 2; cluster++)
+    {
+      fat_get_next_cluster (cluster, &next_cluster);
+      if (next_cluster == FAT_FREE_CLUSTER)
+	{
+	  free_map[(cluster - 2) / MAP_BITS] |= 1UL << ((cluster - 2) % MAP_BITS);
+	  nr_of_free_clusters++;
+	}
+    }
+  diskfs_end_catch_exception ();
+
+  /* Start allocating where the last user of the file system stopped.  */
+  if (fat_type != FAT32 || read_word (sblock->compat.fat32.fs_info_sector) == 0)
+    return;
+  err = store_read (store,
+		    (read_word (sblock->compat.fat32.fs_info_sector)
+		     << log2_bytes_per_sector) >> store->log2_block_size,
+		    sizeof *info, (void **) &info, &read);
+  if (err || read < sizeof *info)
+    return;
+  if (read_dword (info->lead_signature) == FAT_FS_INFO_LEAD_SIGNATURE
+      && read_dword (info->struct_signature) == FAT_FS_INFO_STRUCT_SIGNATURE)
+    {
+      hint = read_dword (info->next_free_cluster);
+      if (hint >= 2 && hint < nr_of_clusters + 2)
+	next_free_cluster = hint;
+    }
+  munmap (info, read);
+}
+
+/* Return the first free cluster from START on, not looking at or past
+   END, or FAT_FREE_CLUSTER if there is none.  */
+static cluster_t
+find_free (cluster_t start, cluster_t end)
+{
+  cluster_t n = start - 2;
+  unsigned long word;
+
+  /* Look at whole words, skipping those without a free cluster.  */
+  while (n < end - 2)
+    {
+      word = __atomic_load_n (&free_map[n / MAP_BITS], __ATOMIC_RELAXED)
+	     >> (n % MAP_BITS);
+      if (word)
+	{
+	  n += __builtin_ctzl (word);
+	  return n < end - 2 ? n + 2 : FAT_FREE_CLUSTER;
+	}
+      n = (n / MAP_BITS + 1) * MAP_BITS;
+    }
+  return FAT_FREE_CLUSTER;
+}
+
+/* Return the number of free clusters from START on, up to MAX.  */
+static cluster_t
+run_length (cluster_t start, cluster_t max)
+{
+  cluster_t n = start - 2, len = 0;
+  unsigned long word;
+  unsigned int shift, ones;
+
+  while (len < max && n < nr_of_clusters)
+    {
+      shift = n % MAP_BITS;
+      word = ~(__atomic_load_n (&free_map[n / MAP_BITS], __ATOMIC_RELAXED)
+	       >> shift);
+      ones = word ? __builtin_ctzl (word) : MAP_BITS;
+      if (ones > MAP_BITS - shift)
+	ones = MAP_BITS - shift;
+      len += ones;
+      n += ones;
+      if (ones < MAP_BITS - shift)
+	break;			/* Found a used cluster in this word.  */
+    }
+
+  if (len > max)
+    len = max;
+  if (len > nr_of_clusters - (start - 2))
+    len = nr_of_clusters - (start - 2);
+  return len;
+}
+
 /* Write NEXT_CLUSTER in the FAT at position CLUSTER.
    You must call this from inside diskfs_catch_exception.
    Returns 0 (always succeeds).  */
@@ -255,6 +390,7 @@ fat_write_next_cluster(cluster_t cluster, cluster_t next_cluster)
       write_dword (fat_image + fat_entry_offset, next_cluster & 0x0fffffff);
     }
 
+  mark_cluster (cluster, next_cluster == FAT_FREE_CLUSTER);
   return 0;
 }
 
@@ -308,6 +444,18 @@ fat_get_next_cluster(cluster_t cluster, cluster_t *next_cluster)
   return 0;
 }
 
+/* Return the first free cluster from next_free_cluster on, wrapping
+   around at the end of the FAT, or FAT_FREE_CLUSTER if there is none.
+   ALLOCATE_FREE_CLUSTER_LOCK must be held.  */
+static cluster_t
+find_next_free (void)
+{
+  cluster_t cluster = find_free (next_free_cluster, nr_of_clusters + 2);
+  if (cluster == FAT_FREE_CLUSTER)
+    cluster = find_free (2, next_free_cluster);
+  return cluster;
+}
+
 /* Allocate a new cluster, write CONTENT into the FAT at this new
    clusters position.  At success, 0 is returned and CLUSTER contains
    the cluster number allocated.  Otherwise, ENOSPC is returned if the
@@ -316,48 +464,138 @@ fat_get_next_cluster(cluster_t cluster, cluster_t *next_cluster)
 error_t
 fat_allocate_cluster (cluster_t content, cluster_t *cluster)
 {
-  error_t err = 0;
-  cluster_t old_next_free_cluster;
-  int wrapped = 0;
-  cluster_t found_cluster = FAT_FREE_CLUSTER;
+  cluster_t found_cluster;
 
   assert_backtrace (content != FAT_FREE_CLUSTER);
 
   pthread_spin_lock (&allocate_free_cluster_lock);
-  old_next_free_cluster = next_free_cluster;
+  found_cluster = find_next_free ();
+  if (found_cluster == FAT_FREE_CLUSTER)
+    {
+      pthread_spin_unlock (&allocate_free_cluster_lock);
+      return ENOSPC;
+    }
+
+  *cluster = found_cluster;
+  fat_write_next_cluster (found_cluster, content);
+  next_free_cluster = found_cluster + 1;
+  if (next_free_cluster == nr_of_clusters + 2)
+    next_free_cluster = 2;
+
+  pthread_spin_unlock (&allocate_free_cluster_lock);
+  return 0;
+}
+
+/* Allocate up to WANT clusters in a row, chained to each other in the
+   FAT, the last one marked as the end of a chain.  Prefer a run of
+   WANT clusters, but settle for a shorter one if none is close by.
+   At success, 0 is returned, FIRST contains the first cluster and
+   COUNT their number.  Otherwise, ENOSPC is returned if the filesystem
+   is full.
+   You must call this from inside diskfs_catch_exception.  */
+error_t
+fat_allocate_clusters (cluster_t want, cluster_t *first, cluster_t *count)
+{
+  cluster_t start, len, cluster, limit, i;
+
+  assert_backtrace (want > 0);
+
+  pthread_spin_lock (&allocate_free_cluster_lock);
+  start = find_next_free ();
+  if (start == FAT_FREE_CLUSTER)
+    {
+      pthread_spin_unlock (&allocate_free_cluster_lock);
+      return ENOSPC;
+    }
 
-  /* Loop over all clusters, starting from next_free_cluster and
-     wrapping if reaching the end of the FAT, until we either find an
-     unallocated cluster, or we have to give up because all clusters
-     are allocated.  */
-  do
+  len = run_length (start, want);
+  if (len < want)
     {
-      cluster_t next_free_content;
+      limit = start + RUN_SEARCH_LIMIT < nr_of_clusters + 2
+	      ? start + RUN_SEARCH_LIMIT : nr_of_clusters + 2;
+      for (cluster = find_free (start + len, limit);
+	   cluster != FAT_FREE_CLUSTER;
+	   cluster = find_free (cluster + i, limit))
+	{
+	  i = run_length (cluster, want);
+	  if (i == want)
+	    {
+	      start = cluster;
+	      len = i;
+	      break;
+	    }
+	}
+    }
+
+  for (i = 0; i < len; i++)
+    fat_write_next_cluster (start + i, i + 1 < len ? start + i + 1 : FAT_EOC);
 
-      fat_get_next_cluster (next_free_cluster, &next_free_content);
+  *first = start;
+  *count = len;
+  next_free_cluster = start + len;
+  if (next_free_cluster == nr_of_clusters + 2)
+    next_free_cluster = 2;
 
-      if (next_free_content == FAT_FREE_CLUSTER)
-	found_cluster = next_free_cluster;
+  pthread_spin_unlock (&allocate_free_cluster_lock);
+  return 0;
+}
+
+/* Add the COUNT clusters from CLUSTER on to the end of the chain of DN
+   as read so far, merging them into its last extent if they follow it
+   on disk.  DN->chain_extension_lock must be held, or DN->alloc_lock
+   for writing.  */
+static error_t
+append_extent (struct disknode *dn, cluster_t cluster, cluster_t count)
+{
+  struct cluster_extent *e;
+  size_t n;
 
-      if (++next_free_cluster == nr_of_clusters + 2)
+  if (dn->nr_extents > 0)
+    {
+      e = &dn->extents[dn->nr_extents - 1];
+      if (e->disk_cluster + e->length == cluster)
 	{
-	  next_free_cluster = 2;
-	  wrapped = 1;
+	  e->length += count;
+	  dn->length_of_chain += count;
+	  return 0;
 	}
     }
-  while (found_cluster == FAT_FREE_CLUSTER
-	 && !(wrapped && next_free_cluster == old_next_free_cluster));
 
-  if (found_cluster != FAT_FREE_CLUSTER)
+  if (dn->nr_extents == dn->alloc_extents)
     {
-      *cluster = found_cluster;
-      fat_write_next_cluster(found_cluster, content);
+      n = dn->alloc_extents ? 2 * dn->alloc_extents : 4;
+      e = realloc (dn->extents, n * sizeof *e);
+      if (! e)
+	return ENOMEM;
+      dn->extents = e;
+      dn->alloc_extents = n;
     }
-  else 
-    err = ENOSPC;
 
-  pthread_spin_unlock (&allocate_free_cluster_lock);
-  return err;
+  e = &dn->extents[dn->nr_extents++];
+  e->file_cluster = dn->length_of_chain;
+  e->disk_cluster = cluster;
+  e->length = count;
+  dn->length_of_chain += count;
+  return 0;
+}
+
+/* Return the extent of DN holding cluster CLUSTER of the file, which
+   must be less than DN->length_of_chain.  */
+static struct cluster_extent *
+lookup_extent (struct disknode *dn, cluster_t cluster)
+{
+  size_t lo = 0, hi = dn->nr_extents, mid;
+
+  assert_backtrace (cluster < dn->length_of_chain);
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) / 2;
+      if (dn->extents[mid].file_cluster <= cluster)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return &dn->extents[lo];
 }
 
 /* Extend the cluster chain to maximum size or new_last_cluster,
@@ -370,26 +608,8 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 {
   error_t err = 0;
   struct disknode *dn = node->dn;
-  struct cluster_chain *table;
-  int offs;
-  cluster_t left, prev_cluster, cluster;
-
-  error_t allocate_new_table(struct cluster_chain **table)
-    {
-      struct cluster_chain *t;
+  cluster_t left, prev_cluster, cluster, count;
 
-      t = *table;
-      *table = malloc (sizeof (struct cluster_chain));
-      if (!*table)
-	return ENOMEM;
-      (*table)->next = 0;
-      if (t)
-	dn->last = t->next = *table;
-      else
-	dn->last = dn->first = *table;
-      return 0;
-    }
-  
   pthread_spin_lock (&dn->chain_extension_lock);
 
   /* If we already have what we need, or we have all clusters that are
@@ -403,30 +623,34 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 
   left = new_last_cluster + 1 - dn->length_of_chain;
 
-  table = dn->last;
-  if (table)
-    {
-      offs = (dn->length_of_chain - 1) & (CLUSTERS_PER_TABLE - 1);
-      prev_cluster = table->cluster[offs];
-    }
+  if (dn->nr_extents > 0)
+    prev_cluster = dn->extents[dn->nr_extents - 1].disk_cluster
+		   + dn->extents[dn->nr_extents - 1].length - 1;
   else
-    {
-      offs = CLUSTERS_PER_TABLE - 1;
-      prev_cluster = FAT_FREE_CLUSTER;
-    }
+    prev_cluster = FAT_FREE_CLUSTER;
 
    while (left)
      {
        if (dn->chain_complete)
 	 {
-	   err = fat_allocate_cluster(FAT_EOC, &cluster);
+	   /* Allocate what is left in one go, as far as possible.  */
+	   err = fat_allocate_clusters (left, &cluster, &count);
 	   if (err)
 	     break;
+	   err = append_extent (dn, cluster, count);
+	   if (err)
+	     {
+	       while (count--)
+		 fat_write_next_cluster (cluster + count, FAT_FREE_CLUSTER);
+	       break;
+	     }
 	   if (prev_cluster)
 	     fat_write_next_cluster(prev_cluster, cluster);
 	   else
 	     /* XXX: Also write this to dirent structure!  */
 	     dn->start_cluster = cluster;
+	   prev_cluster = cluster + count - 1;
+	   left -= count;
 	 }
        else
 	 {
@@ -442,19 +666,12 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 	       else
 		 break;
 	     }
-	 }
-       prev_cluster = cluster;
-       offs++;
-       if (offs == CLUSTERS_PER_TABLE)
-	 {
-	   offs = 0;
-	   err = allocate_new_table(&table);
+	   err = append_extent (dn, cluster, 1);
 	   if (err)
 	     break;
+	   prev_cluster = cluster;
+	   left--;
 	 }
-       table->cluster[offs] = cluster;
-       dn->length_of_chain++;
-       left--;
      }
 
    if (dn->length_of_chain << log2_bytes_per_cluster > node->allocsize)
@@ -465,46 +682,59 @@ fat_extend_chain (struct node *node, cluster_t new_last_cluster, int create)
 }
    
 /* Returns in DISK_CLUSTER the disk cluster corresponding to cluster
-   CLUSTER in NODE.  If there is no such cluster yet, but CREATE is
-   true, then it is created, otherwise EINVAL is returned.  */
+   CLUSTER in NODE, and in COUNT the number of clusters from there on
+   which follow each other on disk, as far as the chain is known.  If
+   there is no such cluster yet, but CREATE is true, then it is
+   created, otherwise EINVAL is returned.  */
 error_t
-fat_getcluster (struct node *node, cluster_t cluster, int create,
-		cluster_t *disk_cluster)
+fat_getextent (struct node *node, cluster_t cluster, int create,
+	       cluster_t *disk_cluster, cluster_t *count)
 {
   error_t err = 0;
-  cluster_t chains_to_go = cluster >> LOG2_CLUSTERS_PER_TABLE;
-  cluster_t offs = cluster & (CLUSTERS_PER_TABLE - 1);
-  struct cluster_chain *chain;
+  struct disknode *dn = node->dn;
+  struct cluster_extent *e;
 
-  if (cluster >= node->dn->length_of_chain)
+  if (cluster >= dn->length_of_chain)
     {
       err = fat_extend_chain (node, cluster, create);
       if (err)
 	return err;
-      if (cluster >= node->dn->length_of_chain)
+      if (cluster >= dn->length_of_chain)
 	{
 	  assert_backtrace (!create);
 	  return EINVAL;
 	}
     }
-  chain = node->dn->first;
-  while (chains_to_go--)
-    {
-      assert_backtrace (chain);
-      chain = chain->next;
-    }
-  assert_backtrace (chain);
-  *disk_cluster = chain->cluster[offs];
+
+  /* Another reader may be extending the chain, and moving the
+     extents.  */
+  pthread_spin_lock (&dn->chain_extension_lock);
+  e = lookup_extent (dn, cluster);
+  *disk_cluster = e->disk_cluster + (cluster - e->file_cluster);
+  *count = e->length - (cluster - e->file_cluster);
+  pthread_spin_unlock (&dn->chain_extension_lock);
   return 0;
 }
 
+/* Returns in DISK_CLUSTER the disk cluster corresponding to cluster
+   CLUSTER in NODE.  If there is no such cluster yet, but CREATE is
+   true, then it is created, otherwise EINVAL is returned.  */
+error_t
+fat_getcluster (struct node *node, cluster_t cluster, int create,
+		cluster_t *disk_cluster)
+{
+  cluster_t count;
+
+  return fat_getextent (node, cluster, create, disk_cluster, &count);
+}
+
 void
 fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 {
-  struct cluster_chain *next;
-  cluster_t count;
-  cluster_t offs;
-  cluster_t pos;
+  struct disknode *dn = node->dn;
+  struct cluster_extent *e;
+  cluster_t c;
+  size_t i, keep;
 
   /* The root dir of a FAT12/16 fs is of fixed size, while the root
      dir of a FAT32 fs must never decease to exist.  */
@@ -513,104 +743,60 @@ fat_truncate_node (struct node *node, cluster_t clusters_to_keep)
 
   /* Expand the cluster chain, because we have to know the complete tail.  */
   fat_extend_chain (node, FAT_EOC, 0);
-  if (clusters_to_keep == node->dn->length_of_chain)
+  if (clusters_to_keep == dn->length_of_chain)
     return;
-  assert_backtrace (clusters_to_keep < node->dn->length_of_chain);
+  assert_backtrace (clusters_to_keep < dn->length_of_chain);
 
   /* Truncation happens here.  */
-  next = node->dn->first;
   if (clusters_to_keep == 0)
     {
       /* Deallocate the complete file.  */
-      node->dn->start_cluster = 0;
-      pos = count = offs = 0;
-      node->dn->last = 0;
+      dn->start_cluster = 0;
+      keep = 0;
     }
   else
     {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-
-	  /* This cluster is now the last cluster in the chain.  */
-	  if (count == 0)
-	    node->dn->last = next;
-
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      fat_write_next_cluster (next->cluster[offs++], FAT_EOC);
-      pos = clusters_to_keep;
+      /* This cluster is now the last cluster in the chain.  */
+      e = lookup_extent (dn, clusters_to_keep - 1);
+      fat_write_next_cluster (e->disk_cluster
+			      + (clusters_to_keep - 1 - e->file_cluster),
+			      FAT_EOC);
+      keep = e - dn->extents + 1;
     }
 
   /* Purge dangling clusters. If we die here, scandisk will have to
      clean up the remains.  */
-  while (pos < node->dn->length_of_chain)
+  for (i = keep ? keep - 1 : 0; i < dn->nr_extents; i++)
     {
-      if (offs == CLUSTERS_PER_TABLE)
-	{
-	  offs = 0;
-	  next = next->next;
-	  assert_backtrace (next);
-	}
-      fat_write_next_cluster(next->cluster[offs++], 0);
-      pos++;
+      e = &dn->extents[i];
+      c = clusters_to_keep > e->file_cluster
+	  ? clusters_to_keep - e->file_cluster : 0;
+      for (; c < e->length; c++)
+	fat_write_next_cluster (e->disk_cluster + c, FAT_FREE_CLUSTER);
     }
- 
-  /* Free now unused tables.  (Could be done in one run with the above.)  */
-  next = node->dn->first;
-  if (clusters_to_keep != 0)
+
+  /* Drop the extents past the end.  */
+  if (keep)
     {
-      count = (clusters_to_keep - 1) >> LOG2_CLUSTERS_PER_TABLE;
-      offs = (clusters_to_keep - 1) & (CLUSTERS_PER_TABLE - 1);
-      while (count-- > 0)
-	{
-	  assert_backtrace (next);
-	  next = next->next;
-	}
-      assert_backtrace (next);
-      next = next->next;
+      e = &dn->extents[keep - 1];
+      e->length = clusters_to_keep - e->file_cluster;
+      dn->nr_extents = keep;
     }
-  while (next)
+  else
     {
-      struct cluster_chain *next_next = next->next;
-      free (next);
-      next = next_next;
+      free (dn->extents);
+      dn->extents = NULL;
+      dn->nr_extents = dn->alloc_extents = 0;
     }
 
-  if (clusters_to_keep == 0)
-    node->dn->first = 0;
-  
-  node->dn->length_of_chain = clusters_to_keep; 
+  dn->length_of_chain = clusters_to_keep; 
 }
 
-
-/* Count the number of free clusters in the FAT.  */
+/* Return the number of free clusters in the FAT.  */
 int
 fat_get_freespace (void)
 {
-  int free_clusters = 0;
-  cluster_t curr_cluster;
-  cluster_t next_cluster;
-  error_t err;
-
-  err = diskfs_catch_exception ();
-  if (!err)
-    {
-      /* First cluster is the 3rd entry in the FAT table.  */
-      for (curr_cluster = 2; curr_cluster < nr_of_clusters + 2;
-	   curr_cluster++)
-	{
-	  fat_get_next_cluster (curr_cluster, &next_cluster);
-	  if (next_cluster == FAT_FREE_CLUSTER)
-	    free_clusters++;
-	}
-    }
-  diskfs_end_catch_exception ();
-
-  return free_clusters;
+  return __atomic_load_n (&nr_of_free_clusters, __ATOMIC_RELAXED);
 }
 
 
@@ -307,13 +307,13 @@ extern size_t bytes_per_cluster;
 /* A cluster number.  */
 typedef unsigned long cluster_t;
 
-#define LOG2_CLUSTERS_PER_TABLE 10
-#define CLUSTERS_PER_TABLE (1 << LOG2_CLUSTERS_PER_TABLE)
-
-struct cluster_chain
+/* LENGTH clusters of a file, from FILE_CLUSTER on, which follow each
+   other on disk from DISK_CLUSTER on.  */
+struct cluster_extent
 {
-  struct cluster_chain *next;
-  cluster_t cluster[CLUSTERS_PER_TABLE];
+  cluster_t file_cluster;
+  cluster_t disk_cluster;
+  cluster_t length;
 };
 
 /* Prototyping.  */
@@ -321,8 +321,13 @@ void fat_read_sblock (void);
 void fat_to_epoch (unsigned char *, unsigned char *, struct timespec *);
 void fat_from_epoch (unsigned char *, unsigned char *, time_t *);
 error_t fat_getcluster (struct node *, cluster_t, int, cluster_t *);
+error_t fat_getextent (struct node *, cluster_t, int, cluster_t *,
+		       cluster_t *);
 void fat_truncate_node (struct node *, cluster_t);
 error_t fat_extend_chain (struct node *, cluster_t, int);
+void fat_init_free_map (void);
+error_t fat_allocate_cluster (cluster_t, cluster_t *);
+error_t fat_allocate_clusters (cluster_t, cluster_t *, cluster_t *);
 int fat_get_freespace (void);
 
 /* Unprocessed superblock.  */
@@ -56,8 +56,10 @@ struct disknode
      Hold only if you hold readers alloc_lock, then you don't need to
      hold it if you hold writers alloc_lock already.  */
   pthread_spinlock_t chain_extension_lock;
-  struct cluster_chain *first;
-  struct cluster_chain *last;
+  /* The clusters of the chain read so far, sorted by file cluster.  */
+  struct cluster_extent *extents;
+  size_t nr_extents;
+  size_t alloc_extents;
   cluster_t length_of_chain;
   int chain_complete;
 
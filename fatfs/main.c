@@ -233,6 +233,8 @@ main (int argc, char **argv)
 
   create_fat_pager ();
 
+  fat_init_free_map ();
+
   zerocluster = (vm_address_t) mmap (0, bytes_per_cluster, PROT_READ|PROT_WRITE,
 				     MAP_ANON, 0, 0);
 
@@ -98,16 +98,15 @@ free_page_buf (void *buf)
 }
 
 /* Find the location on disk of page OFFSET in NODE.  Return the disk
-   cluster in CLUSTER. If *LOCK is 0, then it a reader
+   cluster in CLUSTER, and in COUNT the number of clusters from there on
+   which are contiguous on disk. If *LOCK is 0, then it a reader
    lock is acquired on NODE's ALLOC_LOCK before doing anything, and left
    locked after return -- even if an error is returned.  0 on success or an
    error code otherwise is returned.  */
 static error_t
-find_cluster (struct node *node, vm_offset_t offset,
-	      cluster_t *cluster, pthread_rwlock_t **lock)
+find_extent (struct node *node, vm_offset_t offset,
+	     cluster_t *cluster, cluster_t *count, pthread_rwlock_t **lock)
 {
-  error_t err;
-
   if (!*lock)
     {
       *lock = &node->dn->alloc_lock;
@@ -117,9 +116,18 @@ find_cluster (struct node *node, vm_offset_t offset,
   if (round_cluster (offset) > node->allocsize)
     return EIO;
 
-  err = fat_getcluster (node, offset >> log2_bytes_per_cluster, 0, cluster);
+  return fat_getextent (node, offset >> log2_bytes_per_cluster, 0,
+			cluster, count);
+}
 
-  return err;
+/* Like find_extent, but only return the disk cluster.  */
+static error_t
+find_cluster (struct node *node, vm_offset_t offset,
+	      cluster_t *cluster, pthread_rwlock_t **lock)
+{
+  cluster_t count;
+
+  return find_extent (node, offset, cluster, &count, lock);
 }
 
 /* Read one page for the root dir pager at offset PAGE, into BUF.  This
@@ -594,6 +602,249 @@ pager_write_page (struct user_pager_info *pager, vm_offset_t page,
     }
 }
 
+/* Read LENGTH bytes (a multiple of the page size) for the pager backing
+   NODE at offset PAGE, into BUF.  Runs of clusters which are contiguous on
+   disk are read with a single store_read.  Anything past the allocated
+   size of NODE reads as zeros.  */
+static error_t
+file_pager_read_pages (struct node *node, vm_offset_t page, vm_size_t length,
+		       void **buf, int *writelock)
+{
+  error_t err = 0;
+  pthread_rwlock_t *lock = NULL;
+  vm_size_t offs = 0, left;
+  store_offset_t pending_addr = 0;
+  vm_size_t pending_offs = 0;
+  size_t pending_len = 0;
+
+  /* Read the PENDING_LEN bytes at device address PENDING_ADDR into BUF at
+     offset PENDING_OFFS.  */
+  error_t do_pending_read ()
+    {
+      if (pending_len > 0)
+	{
+	  void *new_buf = *buf + pending_offs;
+	  size_t new_len = pending_len;
+	  error_t err;
+
+	  STAT_INC (file_pagein_reads);
+
+	  err = store_read (store, pending_addr, pending_len,
+			    &new_buf, &new_len);
+	  if (err)
+	    return err;
+	  else if (new_len != pending_len)
+	    return EIO;
+
+	  if (new_buf != *buf + pending_offs)
+	    {
+	      memcpy (*buf + pending_offs, new_buf, new_len);
+	      munmap (new_buf, new_len);
+	    }
+
+	  pending_len = 0;
+	}
+      return 0;
+    }
+
+  *writelock = 0;
+
+  if (page >= node->allocsize)
+    return EIO;
+
+  left = length;
+  if (page + left > node->allocsize)
+    left = node->allocsize - page;
+
+  *buf = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (*buf == MAP_FAILED)
+    return ENOMEM;
+
+  while (offs < left)
+    {
+      cluster_t cluster, count;
+      vm_offset_t pos = page + offs;
+      vm_size_t chunk;
+      store_offset_t addr;
+
+      /* Take the rest of the extent of POS at once.  */
+      err = find_extent (node, pos, &cluster, &count, &lock);
+      if (err)
+	break;
+
+      if (count > ((left - offs) >> log2_bytes_per_cluster) + 1)
+	count = ((left - offs) >> log2_bytes_per_cluster) + 1;
+      chunk = ((vm_size_t) count << log2_bytes_per_cluster)
+	      - (pos & (bytes_per_cluster - 1));
+      if (chunk > left - offs)
+	chunk = left - offs;
+
+      addr = FAT_FIRST_CLUSTER_BLOCK (cluster)
+	+ ((pos & (bytes_per_cluster - 1)) >> store->log2_block_size);
+
+      if (pending_len == 0
+	  || addr != pending_addr + (pending_len >> store->log2_block_size))
+	{
+	  err = do_pending_read ();
+	  if (err)
+	    break;
+	  pending_addr = addr;
+	  pending_offs = offs;
+	}
+      pending_len += chunk;
+      offs += chunk;
+    }
+
+  if (!err)
+    err = do_pending_read ();
+
+  if (lock)
+    pthread_rwlock_unlock (lock);
+
+  if (err)
+    munmap (*buf, length);
+
+  return err;
+}
+
+/* Satisfy a multi-page pager read request for the file pager PAGER, of
+   LENGTH bytes at offset PAGE into BUF.  The FAT and the FAT12/16 root
+   directory are small and are left to pager_read_page.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t page,
+		  vm_size_t length, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == FAT
+      || (pager->node == diskfs_root_node
+	  && (fat_type == FAT12 || fat_type == FAT16)))
+    return EOPNOTSUPP;
+  else if (page + length > round_page (pager->node->allocsize))
+    /* Let the pages past the end be refused individually.  */
+    return EOPNOTSUPP;
+  else
+    return file_pager_read_pages (pager->node, page, length,
+				  (void **)buf, writelock);
+}
+
+/* Write LENGTH bytes (a multiple of the page size) for the pager backing
+   NODE, at offset OFFSET, from BUF.  Runs of clusters which are contiguous
+   on disk are written with a single store_write.  */
+static error_t
+file_pager_write_pages (struct node *node, vm_offset_t offset,
+			vm_size_t length, void *buf)
+{
+  error_t err = 0;
+  pthread_rwlock_t *lock = &node->dn->alloc_lock;
+  vm_size_t offs = 0, left;
+  store_offset_t pending_addr = 0;
+  vm_size_t pending_offs = 0;
+  size_t pending_len = 0;
+
+  /* Write the PENDING_LEN bytes of BUF at offset PENDING_OFFS to device
+     address PENDING_ADDR.  */
+  error_t do_pending_write ()
+    {
+      if (pending_len > 0)
+	{
+	  error_t err;
+	  size_t amount;
+
+	  if (pending_offs % vm_page_size)
+	    /* Put what we're going to write into a page-aligned buffer.  */
+	    {
+	      void *page_buf = mmap (0, pending_len, PROT_READ|PROT_WRITE,
+				     MAP_ANON, 0, 0);
+	      if (page_buf == MAP_FAILED)
+		return ENOMEM;
+	      memcpy (page_buf, buf + pending_offs, pending_len);
+	      err = store_write (store, pending_addr, page_buf, pending_len,
+				 &amount);
+	      munmap (page_buf, pending_len);
+	    }
+	  else
+	    err = store_write (store, pending_addr, buf + pending_offs,
+			       pending_len, &amount);
+	  if (err)
+	    return err;
+	  else if (amount != pending_len)
+	    return EIO;
+
+	  pending_len = 0;
+	}
+      return 0;
+    }
+
+  /* Holding NODE->dn->alloc_lock effectively locks NODE->allocsize,
+     at least for the cases we care about: pager_unlock_page,
+     diskfs_grow and diskfs_truncate.  */
+  pthread_rwlock_rdlock (&node->dn->alloc_lock);
+
+  left = length;
+  if (offset >= node->allocsize)
+    left = 0;
+  else if (offset + left > node->allocsize)
+    left = node->allocsize - offset;
+
+  STAT_INC (file_pageouts);
+
+  while (offs < left)
+    {
+      cluster_t cluster, count;
+      vm_offset_t pos = offset + offs;
+      vm_size_t chunk;
+      store_offset_t addr;
+
+      /* Take the rest of the extent of POS at once.  */
+      err = find_extent (node, pos, &cluster, &count, &lock);
+      if (err)
+	break;
+
+      if (count > ((left - offs) >> log2_bytes_per_cluster) + 1)
+	count = ((left - offs) >> log2_bytes_per_cluster) + 1;
+      chunk = ((vm_size_t) count << log2_bytes_per_cluster)
+	      - (pos & (bytes_per_cluster - 1));
+      if (chunk > left - offs)
+	chunk = left - offs;
+
+      addr = FAT_FIRST_CLUSTER_BLOCK (cluster)
+	+ ((pos & (bytes_per_cluster - 1)) >> store->log2_block_size);
+
+      if (pending_len == 0
+	  || addr != pending_addr + (pending_len >> store->log2_block_size))
+	{
+	  err = do_pending_write ();
+	  if (err)
+	    break;
+	  pending_addr = addr;
+	  pending_offs = offs;
+	}
+      pending_len += chunk;
+      offs += chunk;
+    }
+
+  if (!err)
+    err = do_pending_write ();
+
+  pthread_rwlock_unlock (&node->dn->alloc_lock);
+
+  return err;
+}
+
+/* Satisfy a multi-page pager write request for the file pager PAGER, of
+   LENGTH bytes at offset PAGE from BUF.  The FAT and the FAT12/16 root
+   directory are left to pager_write_page.  */
+error_t
+pager_write_pages (struct user_pager_info *pager, vm_offset_t page,
+		   vm_size_t length, vm_address_t buf)
+{
+  if (pager->type == FAT
+      || (pager->node == diskfs_root_node
+	  && (fat_type == FAT12 || fat_type == FAT16)))
+    return EOPNOTSUPP;
+  else
+    return file_pager_write_pages (pager->node, page, length, (void *)buf);
+}
+
 /* Make page PAGE writable, at least up to ALLOCSIZE.  */
 error_t
 pager_unlock_page (struct user_pager_info *pager,
@@ -628,8 +879,7 @@ diskfs_grow (struct node *node, loff_t size, struct protid *cred)
       error_t err = 0;
       loff_t old_size;
       volatile loff_t new_size;
-      volatile cluster_t end_cluster;
-      cluster_t new_end_cluster;
+      cluster_t end_cluster, new_end_cluster;
       struct disknode *dn = node->dn;
 
       pthread_rwlock_wrlock (&dn->alloc_lock);
@@ -645,17 +895,16 @@ diskfs_grow (struct node *node, loff_t size, struct protid *cred)
 
       if (new_end_cluster > end_cluster)
         {
+	  /* Allocate all new clusters at once, so that they can be
+	     contiguous on disk.  */
 	  err = diskfs_catch_exception ();
-	  while (!err && end_cluster < new_end_cluster)
-	    {
-	      cluster_t disk_cluster;
-	      err = fat_getcluster (node, end_cluster++, 1, &disk_cluster);
-	    }
+	  if (!err)
+	    err = fat_extend_chain (node, new_end_cluster - 1, 1);
 	  diskfs_end_catch_exception ();
 
 	  if (err)
 	    /* Reflect how much we allocated successfully.  */
-	    new_size = (end_cluster - 1) >> log2_bytes_per_cluster;
+	    new_size = (loff_t) dn->length_of_chain << log2_bytes_per_cluster;
 	}
       
       STAT_INC (file_grows);
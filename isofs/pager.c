@@ -81,6 +81,85 @@ pager_read_page (struct user_pager_info *upi,
   return 0;
 }
 
+/* Implement the pager_read_pages callback from the pager library.  Both
+   file data and the disk image are contiguous on the medium, so the whole
+   range can be read at once.  */
+error_t
+pager_read_pages (struct user_pager_info *upi,
+		  vm_offset_t page,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *writelock)
+{
+  error_t err;
+  daddr_t addr;
+  struct node *np = upi->np;
+  size_t read = 0;
+  size_t want = length;
+
+  /* This is a read-only medium */
+  *writelock = 1;
+
+  if (upi->type == FILE_DATA)
+    {
+      if (page >= np->dn_stat.st_size)
+	/* Let libpager hand out the zero pages.  */
+	return EOPNOTSUPP;
+
+      addr = np->dn->file_start + (page >> store->log2_block_size);
+      if (page + want > np->dn_stat.st_size)
+	want = round_page (np->dn_stat.st_size - page);
+    }
+  else
+    {
+      assert_backtrace (upi->type == DISK);
+      addr = page >> store->log2_block_size;
+    }
+
+  if (want == length)
+    {
+      err = store_read (store, addr, want, (void **) buf, &read);
+      if (!err && read != want)
+	err = EIO;
+      if (err)
+	return err;
+    }
+  else
+    {
+      /* The range runs past the end of the file; read what there is into
+	 a buffer covering the whole range.  */
+      void *whole = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      void *data = whole;
+
+      if (whole == MAP_FAILED)
+	return ENOMEM;
+
+      read = length;
+      err = store_read (store, addr, want, &data, &read);
+      if (!err && read != want)
+	err = EIO;
+      if (data != whole)
+	{
+	  if (!err)
+	    memcpy (whole, data, want);
+	  munmap (data, read);
+	}
+      if (err)
+	{
+	  munmap (whole, length);
+	  return err;
+	}
+
+      *buf = (vm_address_t) whole;
+    }
+
+  if (upi->type == FILE_DATA && page + want > np->dn_stat.st_size)
+    memset ((void *) *buf + (np->dn_stat.st_size - page), 0,
+	    page + want - np->dn_stat.st_size);
+
+  return 0;
+}
+
 /* This function should never be called.  */
 error_t
 pager_write_page (struct user_pager_info *pager,
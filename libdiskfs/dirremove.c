@@ -35,7 +35,7 @@ diskfs_dirremove (struct node *dp,
 {
   error_t err;
 
-  diskfs_purge_lookup_cache (dp, np);
+  _diskfs_purge_lookup_cache_name (dp, np, name);
 
   err = diskfs_dirremove_hard (dp, ds);
 
@@ -105,6 +105,10 @@ struct node
 
   pthread_mutex_t lock;
 
+  /* Held shared by io_read while it copies file contents without LOCK,
+     and exclusively, with LOCK held, by anything changing them.  */
+  pthread_rwlock_t rdwr_lock;
+
   refcounts_t refcounts;
 
   mach_port_t sockaddr;		/* address for S_IFSOCK shortcut */
@@ -126,6 +130,13 @@ struct node
   loff_t allocsize;
 
   ino64_t cache_id;
+
+  /* While DIRTY_PREVP is set, the node is on the list of nodes with
+     changes not written yet, which it joined at DIRTY_SINCE; DIRTY_BYTES
+     of the changes are to its contents.  See diskfs_node_dirty.  */
+  struct node *dirty_next, **dirty_prevp;
+  time_t dirty_since;
+  size_t dirty_bytes;
 };
 
 struct diskfs_control
@@ -531,6 +542,23 @@ error_t diskfs_node_iterate (error_t (*fun)(struct node *));
    then return only after the physicial media has been completely updated. */
 void diskfs_sync_everything (int wait);
 
+/* The user may set this to a function that writes to disk whatever
+   diskfs_file_update with WAIT clear only queued, such as the blocks
+   holding the nodes.  If it is set, the periodic sync thread writes back
+   each node once it has been dirty for the --dirty-expire time, at most
+   at the --writeback-rate, and calls this after each batch, instead of
+   calling diskfs_sync_everything every sync interval.  */
+extern void (*diskfs_writeback_hook) (void);
+
+/* The user may set this to a function that reads (DIR clear) or writes
+   (DIR set) *AMT bytes of the locked file NP at OFFSET from or to DATA
+   without the memory object of the file, for instance when the data is
+   kept in the node itself.  The size of the file already permits the
+   access.  If it returns EINVAL, the memory object is used instead; any
+   other error is returned to the user.  */
+extern error_t (*diskfs_rdwr_hook) (struct node *np, char *data,
+				    off_t offset, size_t *amt, int dir);
+
 /* Shutdown all pagers; this is done when the filesystem is exiting and is
    irreversable.  */
 void diskfs_shutdown_pager ();
@@ -673,6 +701,30 @@ void diskfs_nput (struct node *np);
    to be dropped.  */
 void diskfs_nrele (struct node *np);
 
+/* Note that NP has changes not written to disk yet, BYTES of them to
+   its contents.  This puts NP on the list of dirty nodes, if it isn't
+   there yet, for the periodic sync thread to write back once it
+   expires; see diskfs_writeback_hook.  */
+void diskfs_node_dirty (struct node *np, size_t bytes);
+
+/* Call diskfs_node_dirty on NP if it has stat changes pending.  The
+   library does this whenever an RPC on NP ends and whenever a hard
+   reference to NP is released.  */
+void diskfs_check_dirty (struct node *np);
+
+struct diskfs_writeback_stats
+{
+  int dirty_nodes;		/* Nodes waiting to be written */
+  unsigned long long dirty_bytes; /* Bytes written to them meanwhile */
+  unsigned long written_nodes;	/* Nodes written back so far */
+  unsigned long long written_bytes; /* Bytes they accounted for */
+  unsigned long long total_latency; /* Microseconds spent writing them */
+  unsigned long max_latency;	/* Longest time spent on one, in us */
+};
+
+/* Return in *STATS the statistics of dirty node writeback.  */
+void diskfs_get_writeback_stats (struct diskfs_writeback_stats *stats);
+
 /* Add a light reference to a node. */
 void diskfs_nref_light (struct node *np);
 
@@ -958,7 +1010,10 @@ DISKFS_EXTERN_INLINE void
 diskfs_end_using_protid_port (struct protid *cred)
 {
   if (cred)
-    ports_port_deref (cred);
+    {
+      diskfs_check_dirty (cred->po->np);
+      ports_port_deref (cred);
+    }
 }
 
 /* And for the fsys interface. */
@@ -1011,6 +1066,24 @@ void diskfs_purge_lookup_cache (struct node *dp, struct node *np);
    a newly allocated reference. */
 struct node *diskfs_check_lookup_cache (struct node *dir, const char *name);
 
+/* Return the number of entries the lookup cache has room for.  */
+int diskfs_name_cache_size (void);
+
+/* Make the lookup cache hold about ENTRIES entries, dropping what it
+   holds now.  */
+error_t diskfs_set_name_cache_size (int entries);
+
+struct diskfs_name_cache_stats
+{
+  int size;			/* Entries the cache has room for */
+  unsigned long hits;		/* Names found */
+  unsigned long negative_hits;	/* Names found to be absent */
+  unsigned long misses;		/* Names the cache knew nothing about */
+};
+
+/* Return the lookup cache counters.  */
+void diskfs_get_name_cache_stats (struct diskfs_name_cache_stats *stats);
+
 /* Rename directory node FNP (whose parent is FDP, and which has name
    FROMNAME in that directory) to have name TONAME inside directory
    TDP.  None of these nodes are locked, and none should be locked
@@ -1091,6 +1164,25 @@ error_t diskfs_set_options (const char *argz, size_t argz_len);
    routine simply calls diskfs_append_std_options.  */
 error_t diskfs_append_args (char **argz, size_t *argz_len);
 
+/* When the --stats run-time option is in effect, the options returned by
+   fsys_get_options (and so shown by fsysopts) are followed by the
+   translator's statistics counters, each as a "--stat=NAME=VALUE" entry;
+   these entries are ignored if passed back as options.  This routine
+   appends those entries to the malloced string *ARGZ of length *ARGZ_LEN.
+   The default definition simply calls diskfs_append_std_stats; a
+   filesystem overriding it should call that too, and add its own
+   counters with diskfs_append_stat.  */
+error_t diskfs_append_stats (char **argz, size_t *argz_len);
+
+/* Append to the malloced string *ARGZ of length *ARGZ_LEN the statistics
+   counters kept by the diskfs library.  */
+error_t diskfs_append_std_stats (char **argz, size_t *argz_len);
+
+/* Append to the malloced string *ARGZ of length *ARGZ_LEN the statistics
+   counter NAME with value VALUE.  */
+error_t diskfs_append_stat (char **argz, size_t *argz_len,
+			    const char *name, unsigned long long value);
+
 /* If this is defined or set to an argp structure, it will be used by the
    default diskfs_set_options to handle runtime option parsing.  The default
    definition is initialized to a pointer to DISKFS_STD_RUNTIME_ARGP.  */
@@ -42,6 +42,8 @@ diskfs_S_file_get_fs_options (struct protid *cred,
 
   pthread_rwlock_rdlock (&diskfs_fsys_lock);
   err = diskfs_append_args (&argz, &argz_len);
+  if (!err && _diskfs_report_stats)
+    err = diskfs_append_stats (&argz, &argz_len);
   pthread_rwlock_unlock (&diskfs_fsys_lock);
 
   if (! err)
@@ -30,7 +30,9 @@ diskfs_S_file_set_size (struct protid *cred,
 			 err = EINVAL;
 		       else if (size < np->dn_stat.st_size)
 			 {
+			   pthread_rwlock_wrlock (&np->rdwr_lock);
 			   err = diskfs_truncate (np, size);
+			   pthread_rwlock_unlock (&np->rdwr_lock);
 			   if (!err && np->filemod_reqs)
 			     diskfs_notice_filechange (np, 
 						       FILE_CHANGED_TRUNCATE, 
@@ -98,6 +98,8 @@ diskfs_S_fsys_get_options (struct diskfs_control *port,
 
   pthread_rwlock_rdlock (&diskfs_fsys_lock);
   err = diskfs_append_args (&argz, &argz_len);
+  if (!err && _diskfs_report_stats)
+    err = diskfs_append_stats (&argz, &argz_len);
   pthread_rwlock_unlock (&diskfs_fsys_lock);
 
   if (! err)
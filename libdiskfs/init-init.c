@@ -38,6 +38,7 @@ mach_port_t diskfs_fsys_identity;
 
 int _diskfs_nosuid, _diskfs_noexec;
 int _diskfs_noatime;
+int _diskfs_zero_copy_threshold = DEFAULT_ZERO_COPY_THRESHOLD;
 
 struct hurd_port _diskfs_exec_portcell;
 
@@ -18,6 +18,106 @@
 #include "priv.h"
 #include "io_S.h"
 #include <fcntl.h>
+#include <hurd/pager.h>
+#include <hurd/sigpreempt.h>
+
+/* Replace *DATA, which is memory of our own holding room for AMT bytes,
+   with a copy-on-write mapping of AMT bytes of MEMOBJ at OFFSET, which
+   must be page-aligned.  Every page is faulted in here, so that an I/O
+   error is returned to us, for the caller to copy instead, rather than
+   showing up as a fault in the receiver of the reply.  */
+static error_t
+map_reply (memory_object_t memobj, off_t offset, char **data, size_t amt)
+{
+  vm_address_t addr = 0;
+  vm_size_t size = round_page (amt);
+  error_t err;
+
+  error_t fault_in (struct hurd_signal_preemptor *preemptor)
+    {
+      vm_address_t page;
+
+      for (page = addr; page < addr + size; page += vm_page_size)
+	(void) *(volatile char *) page;
+      return 0;
+    }
+
+  err = vm_map (mach_task_self (), &addr, size, 0, 1, memobj, offset, 1,
+		VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+		VM_INHERIT_NONE);
+  if (err)
+    return err;
+
+  err = hurd_catch_signal (sigmask (SIGSEGV) | sigmask (SIGBUS),
+			   addr, addr + size, &fault_in, SIG_ERR);
+  if (err)
+    {
+      vm_deallocate (mach_task_self (), addr, size);
+      return err;
+    }
+
+  /* Don't hand out what lies past the end of the file in the last
+     page.  This copies only that page.  */
+  if (size > amt)
+    memset ((char *) addr + amt, 0, size - amt);
+
+  munmap (*data, amt);
+  *data = (char *) addr;
+  return 0;
+}
+
+/* Read *AMT bytes of NP at OFFSET into *DATA, like _diskfs_rdwr_internal,
+   but release NP's lock while copying, so that readers of the same file
+   don't wait on each other.  Writers still wait for the copy to finish
+   through NP->rdwr_lock.  NP must be locked; it is locked again on
+   return.  If NOTIME is set, then don't update the atime.  If MAP is
+   set, *DATA is an mmapped buffer that may be replaced by a mapping of
+   the file, see map_reply; should that fail, the data is copied.  */
+static error_t
+read_shared (struct node *np, char **data, off_t offset, size_t *amt,
+	     int notime, int map)
+{
+  memory_object_t memobj;
+  struct pager *pager;
+  error_t err;
+
+  /* pager_memcpy inherently uses vm_offset_t, which may be smaller than off_t.  */
+  if (sizeof(off_t) > sizeof(vm_offset_t) &&
+      offset + *amt > ((off_t) 1) << (sizeof(vm_offset_t) * 8))
+    return EFBIG;
+
+  if (!diskfs_check_readonly () && !notime && !_diskfs_noatime)
+    np->dn_set_atime = 1;
+
+  if (diskfs_rdwr_hook)
+    {
+      err = (*diskfs_rdwr_hook) (np, *data, offset, amt, 0);
+      if (err != EINVAL)
+	return err;
+    }
+
+  memobj = diskfs_get_filemap (np, VM_PROT_READ);
+  if (memobj == MACH_PORT_NULL)
+    return errno;
+  pager = diskfs_get_filemap_pager_struct (np);
+
+  /* Writers take RDWR_LOCK while holding NP's lock, so we must get it
+     before letting go of NP's lock, and let go of it before locking NP
+     again.  */
+  pthread_rwlock_rdlock (&np->rdwr_lock);
+  pthread_mutex_unlock (&np->lock);
+
+  if (! map || map_reply (memobj, offset, data, *amt))
+    err = pager_memcpy (pager, memobj, offset, *data, amt, VM_PROT_READ);
+  else
+    err = 0;
+
+  pthread_rwlock_unlock (&np->rdwr_lock);
+  pthread_mutex_lock (&np->lock);
+
+  mach_port_deallocate (mach_task_self (), memobj);
+  return err;
+}
 
 /* Implement io_read as described in <hurd/io.defs>. */
 kern_return_t
@@ -92,15 +192,30 @@ diskfs_S_io_read (struct protid *cred,
     err = EINVAL;		/* Use read below.  */
 
   if (err == EINVAL)
-    err = _diskfs_rdwr_internal (np, buf, off, datalen, 0,
-				 cred->po->openstat & O_NOATIME);
+    {
+      /* Other readers sharing the file pointer may run while we copy,
+	 so move it past our data first, and back again should we read
+	 less than that.  */
+      if (offset == -1)
+	cred->po->filepointer += maxread;
+
+      err = read_shared (np, &buf, off, datalen,
+			 cred->po->openstat & O_NOATIME,
+			 ourbuf && _diskfs_zero_copy_threshold > 0
+			 && maxread >= _diskfs_zero_copy_threshold
+			 && off % vm_page_size == 0);
+      *data = buf;
+
+      if (offset == -1 && (err || *datalen < maxread)
+	  && cred->po->filepointer == off + maxread)
+	cred->po->filepointer = off + (err ? 0 : *datalen);
+    }
+  else if (offset == -1 && !err)
+    cred->po->filepointer += *datalen;
 
   if (diskfs_synchronous)
     diskfs_node_update (np, 1);	/* atime! */
 
-  if (offset == -1 && !err)
-    cred->po->filepointer += *datalen;
-
   if (err && ourbuf)
     munmap (buf, maxread);
 
@@ -81,6 +81,9 @@ diskfs_S_io_write (struct protid *cred,
   if (!err && offset == -1)
     cred->po->filepointer += *amt;
 
+  if (!err)
+    diskfs_node_dirty (np, *amt);
+
   if (!err
       && ((cred->po->openstat & O_FSYNC) || diskfs_synchronous))
     diskfs_file_update (np, 1);
@@ -22,132 +22,300 @@
 #include "priv.h"
 #include <assert-backtrace.h>
 #include <hurd/ihash.h>
+#include <sched.h>
 #include <string.h>
-
+#include <sys/mman.h>
+
 /* The name cache is implemented using a hash table.
 
    We use buckets of a fixed size.  We approximate the
    least-frequently used cache algorithm by counting the number of
-   lookups using saturating arithmetic in the two lowest bits of the
-   pointer to the name.  Using this strategy we achieve a constant
-   worst-case lookup and insertion time.  */
-
-/* Number of buckets.  Must be a power of two. */
-#define CACHE_SIZE	256
+   lookups using saturating arithmetic.  Using this strategy we
+   achieve a constant worst-case lookup and insertion time.
+
+   Lookups take no lock.  Each bucket has a sequence number, which is
+   odd while the bucket is being written: readers retry if it was odd
+   or changed while they looked, and writers make it odd to lock the
+   bucket against each other.  Short names are kept in the entries;
+   names longer than CACHE_NAME_MAX are allocated separately.
+
+   Every user of the table registers in one of the reader slots for the
+   current epoch.  The table itself can be replaced to change its size:
+   the resizer publishes the new table, moves on to the next epoch, and
+   frees the old table once no one is registered for the previous epoch
+   any more.  Long names that are replaced or purged are freed the same
+   way, in batches, as readers may still be comparing them.  */
 
 /* Entries per bucket.  */
 #define BUCKET_SIZE	4
 
-/* A mask for fast binary modulo.  */
-#define CACHE_MASK	(CACHE_SIZE - 1)
+/* Number of buckets by default.  Must be a power of two. */
+#define CACHE_SIZE	(DEFAULT_NAME_CACHE_SIZE / BUCKET_SIZE)
 
-/* Cache bucket with BUCKET_SIZE entries.
+/* The largest and smallest number of buckets.  */
+#define CACHE_MAX_SIZE	(1 << 20)
+#define CACHE_MIN_SIZE	16
 
-   The layout of the bucket is chosen so that it will be straight
-   forward to use vector operations in the future.  */
-struct cache_bucket
+/* Longest name kept in an entry.  This makes an entry 64 bytes long
+   on 64-bit machines.  */
+#define CACHE_NAME_MAX	29
+
+/* The length recorded in an entry whose name is in LONG_NAME.  */
+#define LONG_NAME	(CACHE_NAME_MAX + 1)
+
+/* Number of replaced long names to collect before freeing them.  */
+#define RETIRED_NAMES_MAX	64
+
+/* Number of reader slots.  Must be a power of two. */
+#define READER_SLOTS	16
+
+/* A name longer than CACHE_NAME_MAX.  */
+struct cache_name
 {
-  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  If
-     NULL, the entry is unused.  */
-  unsigned long name[BUCKET_SIZE];
+  /* The next name waiting to be freed, once retired.  */
+  struct cache_name *next;
+
+  size_t len;
+  char name[];
+};
 
+struct cache_entry
+{
   /* The key.  */
-  unsigned long key[BUCKET_SIZE];
+  unsigned long key;
 
   /* Used to indentify nodes to the fs dependent code.  */
-  ino64_t dir_cache_id[BUCKET_SIZE];
+  ino64_t dir_cache_id;
 
   /* 0 for NODE_CACHE_ID means a `negative' entry -- recording that
      there's definitely no node with this name.  */
-  ino64_t node_cache_id[BUCKET_SIZE];
+  ino64_t node_cache_id;
+
+  /* The name, if it is longer than CACHE_NAME_MAX, or null.  */
+  struct cache_name *long_name;
+
+  /* Length of NAME, LONG_NAME if the name is in LONG_NAME, or 0 if the
+     entry is unused.  */
+  unsigned char namelen;
+
+  /* Approximation of use frequency, from 0 to 3.  */
+  unsigned char frequ;
+
+  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  */
+  char name[CACHE_NAME_MAX + 1];
 };
 
+/* Cache bucket with BUCKET_SIZE entries.  */
+struct cache_bucket
+{
+  /* Odd while a writer has the bucket.  */
+  unsigned int seq;
+
+  /* If there is no best candidate to replace, pick any.  We
+     approximate any by picking the slot depicted by REPLACE, and
+     increment REPLACE then.  */
+  unsigned int replace;
+
+  struct cache_entry entry[BUCKET_SIZE];
+} __attribute__ ((aligned (64)));
+
+struct cache_table
+{
+  unsigned long mask;		/* Number of buckets minus one */
+  struct cache_bucket *bucket;
+};
+
+/* The table the cache starts with.  */
+static struct cache_bucket initial_buckets[CACHE_SIZE];
+static struct cache_table initial_table =
+  { CACHE_SIZE - 1, initial_buckets };
+
 /* The cache.  */
-static struct cache_bucket name_cache[CACHE_SIZE];
-
-/* Protected by this lock.  */
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/* Given VALUE, return the char pointer.  */
-static inline char *
-charp (unsigned long value)
+static struct cache_table *cache_table = &initial_table;
+
+/* Readers of the table, and statistics, spread over several cache
+   lines by key.  */
+struct reader_slot
 {
-  return (char *) (value & ~3L);
-}
+  /* Threads using the table, in each of the two last epochs.  */
+  unsigned int readers[2];
 
-/* Given VALUE, return the approximation of use frequency.  */
-static inline unsigned long
-frequ (unsigned long value)
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long negative_hits;
+} __attribute__ ((aligned (64)));
+
+static struct reader_slot reader_slots[READER_SLOTS];
+
+/* Incremented each time the table is replaced.  */
+static unsigned int cache_epoch;
+
+/* Serializes moving on to the next epoch.  */
+static pthread_mutex_t resize_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Long names no longer in the table, but maybe still looked at.  */
+static struct cache_name *retired_names;
+static unsigned int retired_count;
+
+/* Register as a user of the cache, for an operation on KEY.  Return the
+   table, and in *READERS what to pass to table_exit.  */
+static inline struct cache_table *
+table_enter (unsigned long key, unsigned int **readers)
 {
-  return value & 3;
+  struct reader_slot *slot = &reader_slots[key & (READER_SLOTS - 1)];
+  unsigned int epoch;
+
+  for (;;)
+    {
+      epoch = __atomic_load_n (&cache_epoch, __ATOMIC_SEQ_CST);
+      *readers = &slot->readers[epoch & 1];
+      __atomic_add_fetch (*readers, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n (&cache_epoch, __ATOMIC_SEQ_CST) == epoch)
+	break;
+      /* The table was replaced meanwhile, and the resizer may not have
+	 seen us.  */
+      __atomic_sub_fetch (*readers, 1, __ATOMIC_RELEASE);
+    }
+
+  return __atomic_load_n (&cache_table, __ATOMIC_ACQUIRE);
 }
-
-/* Add an entry in the Ith slot of the given bucket.  If there is a
-   value there, remove it first.  */
+
 static inline void
-add_entry (struct cache_bucket *b, int i,
-	   const char *name, unsigned long key,
-	   ino64_t dir_cache_id, ino64_t node_cache_id)
+table_exit (unsigned int *readers)
+{
+  __atomic_sub_fetch (readers, 1, __ATOMIC_RELEASE);
+}
+
+/* Move on to the next epoch, and wait until no one uses the cache as
+   of the previous one any more.  RESIZE_LOCK must be held.  */
+static void
+next_epoch (void)
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
+  unsigned int epoch;
+  int i;
+
+  epoch = __atomic_add_fetch (&cache_epoch, 1, __ATOMIC_SEQ_CST) - 1;
+  for (i = 0; i < READER_SLOTS; i++)
+    while (__atomic_load_n (&reader_slots[i].readers[epoch & 1],
+			    __ATOMIC_ACQUIRE))
+      sched_yield ();
+}
 
-  b->name[i] = (unsigned long) strdup (name);
-  assert_backtrace ((b->name[i] & 3) == 0);
-  if (b->name[i] == 0)
+/* NAME was taken out of the table; free it once no one can be looking
+   at it any more, see reclaim_names.  */
+static void
+retire_name (struct cache_name *name)
+{
+  name->next = __atomic_load_n (&retired_names, __ATOMIC_RELAXED);
+  while (! __atomic_compare_exchange_n (&retired_names, &name->next, name,
+					1, __ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+    ;
+  __atomic_add_fetch (&retired_count, 1, __ATOMIC_RELAXED);
+}
+
+/* Free the retired names, if there are enough of them.  The caller
+   must not be using the table.  */
+static void
+reclaim_names (void)
+{
+  struct cache_name *name, *next;
+
+  if (__atomic_load_n (&retired_count, __ATOMIC_RELAXED) < RETIRED_NAMES_MAX
+      || pthread_mutex_trylock (&resize_lock))
     return;
 
-  b->key[i] = key;
-  b->dir_cache_id[i] = dir_cache_id;
-  b->node_cache_id[i] = node_cache_id;
+  __atomic_store_n (&retired_count, 0, __ATOMIC_RELAXED);
+  name = __atomic_exchange_n (&retired_names, NULL, __ATOMIC_ACQUIRE);
+  next_epoch ();
+  pthread_mutex_unlock (&resize_lock);
+
+  for (; name; name = next)
+    {
+      next = name->next;
+      free (name);
+    }
+}
+
+/* Empty entry E of a locked bucket, retiring its long name.  */
+static inline void
+entry_clear (struct cache_entry *e)
+{
+  e->namelen = 0;
+  if (e->long_name)
+    {
+      retire_name (e->long_name);
+      __atomic_store_n (&e->long_name, NULL, __ATOMIC_RELAXED);
+    }
+}
+
+/* Lock bucket B against other writers, and make readers retry.  */
+static inline void
+bucket_lock (struct cache_bucket *b)
+{
+  unsigned int seq;
+
+  for (;;)
+    {
+      seq = __atomic_load_n (&b->seq, __ATOMIC_RELAXED);
+      if (! (seq & 1)
+	  && __atomic_compare_exchange_n (&b->seq, &seq, seq + 1, 0,
+					  __ATOMIC_ACQUIRE,
+					  __ATOMIC_RELAXED))
+	break;
+    }
+
+  /* Make the odd number visible before any change to the entries.  */
+  __atomic_thread_fence (__ATOMIC_RELEASE);
 }
 
-/* Remove the entry in the Ith slot of the given bucket.  */
 static inline void
-remove_entry (struct cache_bucket *b, int i)
+bucket_unlock (struct cache_bucket *b)
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
-  b->name[i] = 0;
+  __atomic_store_n (&b->seq, b->seq + 1, __ATOMIC_RELEASE);
 }
 
-/* Check if the entry in the Ith slot of the given bucket is
-   valid.  */
+/* Return whether entry E is for NAME (of length NAMELEN, and hashing
+   to KEY) in directory DIR_CACHE_ID.  */
 static inline int
-valid_entry (struct cache_bucket *b, int i)
+entry_matches (struct cache_entry *e, ino64_t dir_cache_id,
+	       const char *name, size_t namelen, unsigned long key)
 {
-  return b->name[i] != 0;
+  struct cache_name *long_name;
+
+  if (e->key != key || e->dir_cache_id != dir_cache_id)
+    return 0;
+
+  if (namelen <= CACHE_NAME_MAX)
+    return e->namelen == namelen && memcmp (e->name, name, namelen) == 0;
+
+  /* Readers may see the entry change under them, but the name it
+     points to stays whole until they are done.  */
+  long_name = __atomic_load_n (&e->long_name, __ATOMIC_ACQUIRE);
+  return (e->namelen == LONG_NAME
+	  && long_name
+	  && long_name->len == namelen
+	  && memcmp (long_name->name, name, namelen) == 0);
 }
-
-/* If there is no best candidate to replace, pick any.  We approximate
-   any by picking the slot depicted by REPLACE, and increment REPLACE
-   then.  */
-static int replace;
-
-/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache.  If it is found,
-   return 1 and set BUCKET and INDEX to the item.  Otherwise, return 0
-   and set BUCKET and INDEX to the slot where the item should be
-   inserted.  */
+
+/* Lookup (DIR_CACHE_ID, NAME, KEY) in bucket B, which is locked.  If it
+   is found, return 1 and set INDEX to the item.  Otherwise, return 0
+   and set INDEX to the slot where the item should be inserted.  */
 static inline int
-lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
-	struct cache_bucket **bucket, int *index)
+lookup_locked (struct cache_bucket *b, ino64_t dir_cache_id,
+	       const char *name, size_t namelen, unsigned long key,
+	       int *index)
 {
-  struct cache_bucket *b = *bucket = &name_cache[key & CACHE_MASK];
-  unsigned long best = 3;
+  unsigned int best = 3;
   int i;
 
   for (i = 0; i < BUCKET_SIZE; i++)
     {
-      unsigned long f = frequ (b->name[i]);
+      struct cache_entry *e = &b->entry[i];
+      unsigned int f = e->namelen ? e->frequ : 0;
 
-      if (valid_entry (b, i)
-	  && b->key[i] == key
-	  && b->dir_cache_id[i] == dir_cache_id
-	  && strcmp (charp (b->name[i]), name) == 0)
+      if (entry_matches (e, dir_cache_id, name, namelen, key))
 	{
-	  if (f < 3)
-	    b->name[i] += 1;
-
 	  *index = i;
 	  return 1;
 	}
@@ -164,64 +332,215 @@ lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
      any entry.  */
   if (best == 3)
     {
-      *index = replace;
-      replace = (replace + 1) & (BUCKET_SIZE - 1);
+      *index = b->replace;
+      b->replace = (b->replace + 1) & (BUCKET_SIZE - 1);
     }
 
   return 0;
 }
 
+/* Lookup (DIR_CACHE_ID, NAME, KEY) in bucket B without locking it.  If
+   it is found, return 1 and set *NODE_CACHE_ID; otherwise, return 0.  */
+static inline int
+lookup (struct cache_bucket *b, ino64_t dir_cache_id,
+	const char *name, size_t namelen, unsigned long key,
+	ino64_t *node_cache_id)
+{
+  unsigned int seq;
+  int i, found;
+
+  do
+    {
+      seq = __atomic_load_n (&b->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+	continue;
+
+      found = 0;
+      for (i = 0; i < BUCKET_SIZE; i++)
+	{
+	  struct cache_entry *e = &b->entry[i];
+
+	  if (entry_matches (e, dir_cache_id, name, namelen, key))
+	    {
+	      unsigned char f = e->frequ;
+
+	      *node_cache_id = e->node_cache_id;
+	      found = 1;
+
+	      /* Racing with a writer here only makes the count
+		 inexact.  */
+	      if (f < 3)
+		__atomic_store_n (&e->frequ, f + 1, __ATOMIC_RELAXED);
+	      break;
+	    }
+	}
+
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    }
+  while ((seq & 1) || __atomic_load_n (&b->seq, __ATOMIC_RELAXED) != seq);
+
+  return found;
+}
+
 /* Hash the directory cache_id and the name.  */
 static inline unsigned long
-hash (ino64_t dir_cache_id, const char *name)
+hash (ino64_t dir_cache_id, const char *name, size_t namelen)
 {
   unsigned long h;
   h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
-  h = hurd_ihash_hash32 (name, strlen (name), h);
+  h = hurd_ihash_hash32 (name, namelen, h);
   return h;
 }
-
+
 /* Node NP has just been found in DIR with NAME.  If NP is null, that
    means that this name has been confirmed as absent in the directory. */
 void
 diskfs_enter_lookup_cache (struct node *dir, struct node *np, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t namelen = strlen (name);
+  unsigned long key = hash (dir->cache_id, name, namelen);
   ino64_t value = np ? np->cache_id : 0;
-  struct cache_bucket *bucket;
-  int i = 0, found;
+  struct cache_table *table;
+  struct cache_bucket *b;
+  struct cache_name *long_name = NULL;
+  unsigned int *readers;
+  int i = 0;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (! found)
-    add_entry (bucket, i, name, key, dir->cache_id, value);
+  if (namelen > CACHE_NAME_MAX)
+    {
+      long_name = malloc (sizeof *long_name + namelen);
+      if (! long_name)
+	return;
+      long_name->len = namelen;
+      memcpy (long_name->name, name, namelen);
+    }
+
+  table = table_enter (key, &readers);
+  b = &table->bucket[key & table->mask];
+
+  bucket_lock (b);
+  if (lookup_locked (b, dir->cache_id, name, namelen, key, &i))
+    b->entry[i].node_cache_id = value;
   else
-    if (bucket->node_cache_id[i] != value)
-      bucket->node_cache_id[i] = value;
+    {
+      struct cache_entry *e = &b->entry[i];
+
+      entry_clear (e);
+      e->key = key;
+      e->dir_cache_id = dir->cache_id;
+      e->node_cache_id = value;
+      e->frequ = 0;
+      if (long_name)
+	{
+	  __atomic_store_n (&e->long_name, long_name, __ATOMIC_RELEASE);
+	  e->namelen = LONG_NAME;
+	  long_name = NULL;
+	}
+      else
+	{
+	  memcpy (e->name, name, namelen);
+	  e->name[namelen] = '\0';
+	  e->namelen = namelen;
+	}
+    }
+  bucket_unlock (b);
+
+  table_exit (readers);
+
+  /* The name was cached already.  */
+  free (long_name);
 
-  pthread_mutex_unlock (&cache_lock);
+  reclaim_names ();
 }
-
+
 /* Purge all references in the cache to NP as a node inside
    directory DP. */
 void
 diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 {
-  int i;
+  struct cache_table *table;
   struct cache_bucket *b;
+  unsigned int *readers;
+  int i;
 
-  pthread_mutex_lock (&cache_lock);
+  table = table_enter (0, &readers);
 
-  for (b = &name_cache[0]; b < &name_cache[CACHE_SIZE]; b++)
+  for (b = &table->bucket[0]; b <= &table->bucket[table->mask]; b++)
     for (i = 0; i < BUCKET_SIZE; i++)
-      if (valid_entry (b, i)
-	  && b->dir_cache_id[i] == dp->cache_id
-	  && b->node_cache_id[i] == np->cache_id)
-	remove_entry (b, i);
+      /* Only lock the buckets that seem to need it.  */
+      if (b->entry[i].namelen
+	  && b->entry[i].dir_cache_id == dp->cache_id
+	  && b->entry[i].node_cache_id == np->cache_id)
+	{
+	  bucket_lock (b);
+	  for (i = 0; i < BUCKET_SIZE; i++)
+	    if (b->entry[i].namelen
+		&& b->entry[i].dir_cache_id == dp->cache_id
+		&& b->entry[i].node_cache_id == np->cache_id)
+	      entry_clear (&b->entry[i]);
+	  bucket_unlock (b);
+	  break;
+	}
+
+  table_exit (readers);
+
+  reclaim_names ();
+}
+
+/* Purge the entry in the cache for NAME in directory DP, if it refers
+   to NP.  */
+void
+_diskfs_purge_lookup_cache_name (struct node *dp, struct node *np,
+				 const char *name)
+{
+  size_t namelen = strlen (name);
+  unsigned long key = hash (dp->cache_id, name, namelen);
+  struct cache_table *table;
+  struct cache_bucket *b;
+  unsigned int *readers;
+  int i;
+
+  table = table_enter (key, &readers);
+  b = &table->bucket[key & table->mask];
+
+  bucket_lock (b);
+  if (lookup_locked (b, dp->cache_id, name, namelen, key, &i)
+      && b->entry[i].node_cache_id == np->cache_id)
+    entry_clear (&b->entry[i]);
+  bucket_unlock (b);
+
+  table_exit (readers);
+
+  reclaim_names ();
+}
+
+/* Look NAME up in DIR, and set *ID to what it is cached as.  Return 0
+   if it isn't cached.  Count the outcome.  */
+static int
+check (struct node *dir, const char *name, ino64_t *id)
+{
+  size_t namelen = strlen (name);
+  unsigned long key = hash (dir->cache_id, name, namelen);
+  struct reader_slot *slot = &reader_slots[key & (READER_SLOTS - 1)];
+  struct cache_table *table;
+  unsigned int *readers;
+  int found;
+
+  table = table_enter (key, &readers);
+  found = lookup (&table->bucket[key & table->mask], dir->cache_id,
+		  name, namelen, key, id);
+  table_exit (readers);
+
+  if (! found)
+    __atomic_add_fetch (&slot->misses, 1, __ATOMIC_RELAXED);
+  else if (*id == 0)
+    __atomic_add_fetch (&slot->negative_hits, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch (&slot->hits, 1, __ATOMIC_RELAXED);
 
-  pthread_mutex_unlock (&cache_lock);
+  return found;
 }
-
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
@@ -229,22 +548,15 @@ diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 struct node *
 diskfs_check_lookup_cache (struct node *dir, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
   int lookup_parent = name[0] == '.' && name[1] == '.' && name[2] == '\0';
-  struct cache_bucket *bucket;
-  int i, found;
+  ino64_t id;
 
   if (lookup_parent && dir == diskfs_root_node)
     /* This is outside our file system, return cache miss.  */
     return NULL;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (found)
+  if (check (dir, name, &id))
     {
-      ino64_t id = bucket->node_cache_id[i];
-      pthread_mutex_unlock (&cache_lock);
-
       if (id == 0)
 	/* A negative cache entry.  */
 	return (struct node *) -1;
@@ -262,25 +574,32 @@ diskfs_check_lookup_cache (struct node *dir, const char *name)
 
 	  if (lookup_parent)
 	    {
+	      size_t namelen = strlen (name);
+	      unsigned long key = hash (dir->cache_id, name, namelen);
+	      struct cache_table *table;
+	      unsigned int *readers;
+	      ino64_t again;
+	      int found;
+
 	      pthread_mutex_unlock (&dir->lock);
 	      err = diskfs_cached_lookup (id, &np);
 	      pthread_mutex_lock (&dir->lock);
+	      if (err)
+		return 0;
 
 	      /* In the window where DP was unlocked, we might
 		 have lost.  So check the cache again, and see
 		 if it's still there; if so, then we win. */
-	      pthread_mutex_lock (&cache_lock);
-	      found = lookup (dir->cache_id, name, key, &bucket, &i);
-	      if (! found
-		  || bucket->node_cache_id[i] != id)
+	      table = table_enter (key, &readers);
+	      found = lookup (&table->bucket[key & table->mask],
+			      dir->cache_id, name, namelen, key, &again);
+	      table_exit (readers);
+	      if (! found || again != id)
 		{
-		  pthread_mutex_unlock (&cache_lock);
-
 		  /* Lose */
 		  diskfs_nput (np);
 		  return 0;
 		}
-	      pthread_mutex_unlock (&cache_lock);
 	    }
 	  else
 	    err = diskfs_cached_lookup (id, &np);
@@ -288,6 +607,95 @@ diskfs_check_lookup_cache (struct node *dir, const char *name)
 	}
     }
 
-  pthread_mutex_unlock (&cache_lock);
   return 0;
 }
+
+/* Return the number of entries the name cache has room for.  */
+int
+diskfs_name_cache_size (void)
+{
+  return (__atomic_load_n (&cache_table, __ATOMIC_ACQUIRE)->mask + 1)
+	 * BUCKET_SIZE;
+}
+
+/* Make the name cache hold about ENTRIES entries, dropping its current
+   contents.  */
+error_t
+diskfs_set_name_cache_size (int entries)
+{
+  struct cache_table *new, *old;
+  unsigned long size;
+  struct cache_bucket *b;
+  int i;
+
+  if (entries <= 0)
+    return EINVAL;
+
+  for (size = CACHE_MIN_SIZE;
+       size < CACHE_MAX_SIZE && size * BUCKET_SIZE < entries;
+       size *= 2)
+    ;
+
+  pthread_mutex_lock (&resize_lock);
+
+  old = cache_table;
+  if (old->mask + 1 == size)
+    {
+      pthread_mutex_unlock (&resize_lock);
+      return 0;
+    }
+
+  new = malloc (sizeof *new);
+  if (! new)
+    {
+      pthread_mutex_unlock (&resize_lock);
+      return ENOMEM;
+    }
+  new->mask = size - 1;
+  new->bucket = mmap (0, size * sizeof *new->bucket,
+		      PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (new->bucket == MAP_FAILED)
+    {
+      free (new);
+      pthread_mutex_unlock (&resize_lock);
+      return ENOMEM;
+    }
+
+  __atomic_store_n (&cache_table, new, __ATOMIC_SEQ_CST);
+
+  /* Wait for whoever may still be using the old table.  */
+  next_epoch ();
+
+  for (b = &old->bucket[0]; b <= &old->bucket[old->mask]; b++)
+    for (i = 0; i < BUCKET_SIZE; i++)
+      free (b->entry[i].long_name);
+
+  if (old != &initial_table)
+    {
+      munmap (old->bucket, (old->mask + 1) * sizeof *old->bucket);
+      free (old);
+    }
+
+  pthread_mutex_unlock (&resize_lock);
+  return 0;
+}
+
+/* Return the name cache counters.  */
+void
+diskfs_get_name_cache_stats (struct diskfs_name_cache_stats *stats)
+{
+  int i;
+
+  memset (stats, 0, sizeof *stats);
+  for (i = 0; i < READER_SLOTS; i++)
+    {
+      stats->hits += __atomic_load_n (&reader_slots[i].hits,
+				      __ATOMIC_RELAXED);
+      stats->misses += __atomic_load_n (&reader_slots[i].misses,
+					__ATOMIC_RELAXED);
+      stats->negative_hits
+	+= __atomic_load_n (&reader_slots[i].negative_hits,
+			    __ATOMIC_RELAXED);
+    }
+  stats->size = diskfs_name_cache_size ();
+}
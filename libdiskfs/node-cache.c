@@ -21,8 +21,10 @@
 
 #include "priv.h"
 
-/* The node cache is implemented using a hash table.  Access to the
-   cache is protected by nodecache_lock.
+/* The node cache is implemented using hash tables, split into
+   NODECACHE_SHARDS shards by the hash of the inode number, each
+   protected by its own lock, so that lookups of different nodes don't
+   contend on a single lock.
 
    Every node in the cache carries a light reference.  When we are
    asked to give up that light reference, we reacquire our lock
@@ -55,10 +57,40 @@ compare (const void *a, const void *b)
   return *(ino_t *) a == *(ino_t *) b;
 }
 
-static struct hurd_ihash nodecache =
-  HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, slot), NULL, NULL,
-                              hash, compare);
-static pthread_rwlock_t nodecache_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Number of shards.  */
+#define NODECACHE_SHARD_BITS	6
+#define NODECACHE_SHARDS	(1 << NODECACHE_SHARD_BITS)
+
+struct nodecache_shard
+{
+  pthread_rwlock_t lock;
+  struct hurd_ihash nodes;
+} __attribute__ ((aligned (64)));
+
+#define SHARD_INITIALIZER						\
+  { PTHREAD_RWLOCK_INITIALIZER,						\
+    HURD_IHASH_INITIALIZER_GKI_FLAGS (offsetof (struct node, slot),	\
+				      NULL, NULL, hash, compare,	\
+				      HURD_IHASH_CONTROL_BYTES		\
+				      | HURD_IHASH_INCREMENTAL) }
+#define SHARD_INITIALIZER_4						\
+  SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER
+#define SHARD_INITIALIZER_16						\
+  SHARD_INITIALIZER_4, SHARD_INITIALIZER_4,				\
+  SHARD_INITIALIZER_4, SHARD_INITIALIZER_4
+
+static struct nodecache_shard nodecache[NODECACHE_SHARDS] =
+  { SHARD_INITIALIZER_16, SHARD_INITIALIZER_16,
+    SHARD_INITIALIZER_16, SHARD_INITIALIZER_16 };
+
+/* Return the shard caching inode INUM.  The hash tables index their
+   slots with the low bits of the hash, so use the high ones here.  */
+static inline struct nodecache_shard *
+shard_of (ino_t inum)
+{
+  uint32_t h = hash (&inum);
+  return &nodecache[h >> (32 - NODECACHE_SHARD_BITS)];
+}
 
 /* Fetch inode INUM, set *NPP to the node structure;
    gain one user reference and lock the node.  */
@@ -77,12 +109,13 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
   error_t err;
   struct node *np, *tmp;
   hurd_ihash_locp_t slot;
+  struct nodecache_shard *shard = shard_of (inum);
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &inum, &slot);
+  pthread_rwlock_rdlock (&shard->lock);
+  np = hurd_ihash_locp_find (&shard->nodes, (hurd_ihash_key_t) &inum, &slot);
   if (np)
     goto gotit;
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&shard->lock);
 
   err = diskfs_user_make_node (&np, ctx);
   if (err)
@@ -92,8 +125,8 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
   pthread_mutex_lock (&np->lock);
 
   /* Put NP in NODEHASH.  */
-  pthread_rwlock_wrlock (&nodecache_lock);
-  tmp = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &np->cache_id,
+  pthread_rwlock_wrlock (&shard->lock);
+  tmp = hurd_ihash_locp_find (&shard->nodes, (hurd_ihash_key_t) &np->cache_id,
 			      &slot);
   if (tmp)
     {
@@ -103,11 +136,11 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
       goto gotit;
     }
 
-  err = hurd_ihash_locp_add (&nodecache, slot,
+  err = hurd_ihash_locp_add (&shard->nodes, slot,
 			     (hurd_ihash_key_t) &np->cache_id, np);
   assert_perror_backtrace (err);
   diskfs_nref_light (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&shard->lock);
 
   /* Get the contents of NP off disk.  */
   err = diskfs_user_read_node (np, ctx);
@@ -121,7 +154,7 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
 
  gotit:
   diskfs_nref (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&shard->lock);
   pthread_mutex_lock (&np->lock);
   *npp = np;
   return 0;
@@ -133,10 +166,11 @@ struct node *
 diskfs_cached_ifind (ino_t inum)
 {
   struct node *np;
+  struct nodecache_shard *shard = shard_of (inum);
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_find (&nodecache, (hurd_ihash_key_t) &inum);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_rdlock (&shard->lock);
+  np = hurd_ihash_find (&shard->nodes, (hurd_ihash_key_t) &inum);
+  pthread_rwlock_unlock (&shard->lock);
 
   assert_backtrace (np);
   return np;
@@ -145,7 +179,9 @@ diskfs_cached_ifind (ino_t inum)
 void __attribute__ ((weak))
 diskfs_try_dropping_softrefs (struct node *np)
 {
-  pthread_rwlock_wrlock (&nodecache_lock);
+  struct nodecache_shard *shard = shard_of (np->cache_id);
+
+  pthread_rwlock_wrlock (&shard->lock);
   if (np->slot != NULL)
     {
       /* Check if someone reacquired a reference through the
@@ -157,15 +193,15 @@ diskfs_try_dropping_softrefs (struct node *np)
 	{
 	  /* A reference was reacquired through a hash table lookup.
 	     It's fine, we didn't touch anything yet. */
-	  pthread_rwlock_unlock (&nodecache_lock);
+	  pthread_rwlock_unlock (&shard->lock);
 	  return;
 	}
 
-      hurd_ihash_locp_remove (&nodecache, np->slot);
+      hurd_ihash_locp_remove (&shard->nodes, np->slot);
       np->slot = NULL;
       diskfs_nrele_light (np);
     }
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&shard->lock);
 
   diskfs_user_try_dropping_softrefs (np);
 }
@@ -177,51 +213,60 @@ error_t __attribute__ ((weak))
 diskfs_node_iterate (error_t (*fun)(struct node *))
 {
   error_t err = 0;
-  size_t num_nodes;
-  struct node *node, **node_list, **p;
-
-  pthread_rwlock_rdlock (&nodecache_lock);
-
-  /* We must copy everything from the hash table into another data structure
-     to avoid running into any problems with the hash-table being modified
-     during processing (normally we delegate access to hash-table with
-     nodecache_lock, but we can't hold this while locking the
-     individual node locks).  */
-  /* XXX: Can we?  */
-  num_nodes = nodecache.nr_items;
-
-  /* TODO This method doesn't scale beyond a few dozen nodes and should be
-     replaced.  */
-  node_list = malloc (num_nodes * sizeof (struct node *));
-  if (node_list == NULL)
+  size_t num_nodes, size = 0;
+  struct node *node, **node_list = NULL, **p;
+  struct nodecache_shard *shard;
+
+  /* We must copy the nodes of a shard into another data structure to
+     avoid running into any problems with its hash table being modified
+     during processing (we can't hold the shard lock while locking the
+     individual node locks).  Doing one shard at a time keeps that copy
+     small.  Nodes added to a shard already visited are missed, as they
+     would have been had they been added after the walk.  */
+  for (shard = &nodecache[0];
+       !err && shard < &nodecache[NODECACHE_SHARDS];
+       shard++)
     {
-      pthread_rwlock_unlock (&nodecache_lock);
-      return ENOMEM;
-    }
+    retry:
+      pthread_rwlock_rdlock (&shard->lock);
 
-  p = node_list;
-  HURD_IHASH_ITERATE (&nodecache, i)
-    {
-      *p++ = node = i;
+      num_nodes = shard->nodes.nr_items;
+      if (num_nodes > size)
+	{
+	  pthread_rwlock_unlock (&shard->lock);
+	  free (node_list);
+	  /* Leave room for some growth while we were unlocked.  */
+	  size = num_nodes + num_nodes / 4 + 16;
+	  node_list = malloc (size * sizeof (struct node *));
+	  if (node_list == NULL)
+	    return ENOMEM;
+	  goto retry;
+	}
 
-      /* We acquire a hard reference for node, but without using
-	 diskfs_nref.  We do this so that diskfs_new_hardrefs will not
-	 get called.  */
-      refcounts_ref (&node->refcounts, NULL);
-    }
-  pthread_rwlock_unlock (&nodecache_lock);
+      p = node_list;
+      HURD_IHASH_ITERATE (&shard->nodes, i)
+	{
+	  *p++ = node = i;
 
-  p = node_list;
-  while (num_nodes-- > 0)
-    {
-      node = *p++;
-      if (!err)
+	  /* We acquire a hard reference for node, but without using
+	     diskfs_nref.  We do this so that diskfs_new_hardrefs will not
+	     get called.  */
+	  refcounts_ref (&node->refcounts, NULL);
+	}
+      pthread_rwlock_unlock (&shard->lock);
+
+      p = node_list;
+      while (num_nodes-- > 0)
 	{
-	  pthread_mutex_lock (&node->lock);
-	  err = (*fun)(node);
-	  pthread_mutex_unlock (&node->lock);
+	  node = *p++;
+	  if (!err)
+	    {
+	      pthread_mutex_lock (&node->lock);
+	      err = (*fun)(node);
+	      pthread_mutex_unlock (&node->lock);
+	    }
+	  diskfs_nrele (node);
 	}
-      diskfs_nrele (node);
     }
 
   free (node_list);
@@ -38,6 +38,8 @@ _diskfs_lastref (struct node *np)
 	  np->sockaddr = MACH_PORT_NULL;
 	}
 
+      _diskfs_forget_dirty (np);
+
       /* There are no links.  If there are soft references that
 	 can be dropped, we can't let them postpone deallocation.
 	 So attempt to drop them.  But that's a user-supplied
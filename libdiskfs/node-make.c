@@ -30,6 +30,7 @@ init_node (struct node *np, struct disknode *dn)
   np->author_tracks_uid = 0;
 
   pthread_mutex_init (&np->lock, NULL);
+  pthread_rwlock_init (&np->rdwr_lock, NULL);
   refcounts_init (&np->refcounts, 1, 0);
   np->owner = 0;
   np->sockaddr = MACH_PORT_NULL;
@@ -39,6 +40,11 @@ init_node (struct node *np, struct disknode *dn)
   np->filemod_reqs = 0;
   np->filemod_tick = 0;
 
+  np->dirty_next = NULL;
+  np->dirty_prevp = NULL;
+  np->dirty_since = 0;
+  np->dirty_bytes = 0;
+
   fshelp_transbox_init (&np->transbox, &np->lock, np);
   iohelp_initialize_conch (&np->conch, &np->lock);
   fshelp_lock_init (&np->userlock);
@@ -28,6 +28,8 @@ diskfs_nput (struct node *np)
 {
   struct references result;
 
+  diskfs_check_dirty (np);
+
   /* While we call the diskfs_try_dropping_softrefs, we need to hold
      one reference.  We use a weak reference for this purpose, which
      we acquire by demoting our hard reference to a weak one.  */
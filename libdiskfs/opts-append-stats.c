@@ -0,0 +1,79 @@
+/* Report statistics counters along with the run-time options
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <stdio.h>
+#include <argz.h>
+
+#include "priv.h"
+
+/* Set by --stats, cleared by --no-stats.  */
+int _diskfs_report_stats;
+
+error_t
+diskfs_append_stat (char **argz, size_t *argz_len,
+		    const char *name, unsigned long long value)
+{
+  char buf[80];
+  snprintf (buf, sizeof buf, "--stat=%s=%llu", name, value);
+  return argz_add (argz, argz_len, buf);
+}
+
+error_t
+diskfs_append_std_stats (char **argz, size_t *argz_len)
+{
+  error_t err;
+  struct diskfs_name_cache_stats stats;
+  struct diskfs_writeback_stats wb;
+
+  diskfs_get_name_cache_stats (&stats);
+  err = diskfs_append_stat (argz, argz_len, "name-cache-size", stats.size);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "name-cache-hits", stats.hits);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "name-cache-negative-hits",
+			      stats.negative_hits);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "name-cache-misses",
+			      stats.misses);
+
+  diskfs_get_writeback_stats (&wb);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-dirty-nodes",
+			      wb.dirty_nodes);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-dirty-bytes",
+			      wb.dirty_bytes);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-written-nodes",
+			      wb.written_nodes);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-written-bytes",
+			      wb.written_bytes);
+  /* Flush latencies, in microseconds.  */
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-average-latency",
+			      wb.written_nodes
+			      ? wb.total_latency / wb.written_nodes : 0);
+  if (!err)
+    err = diskfs_append_stat (argz, argz_len, "writeback-max-latency",
+			      wb.max_latency);
+
+  return err;
+}
@@ -45,6 +45,37 @@ diskfs_append_std_options (char **argz, size_t *argz_len)
   if (!err && _diskfs_no_inherit_dir_group)
     err = argz_add (argz, argz_len, "--no-inherit-dir-group");
 
+  if (!err && diskfs_name_cache_size () != DEFAULT_NAME_CACHE_SIZE)
+    {
+      char buf[80];
+      sprintf (buf, "--name-cache-size=%d", diskfs_name_cache_size ());
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && _diskfs_zero_copy_threshold != DEFAULT_ZERO_COPY_THRESHOLD)
+    {
+      char buf[80];
+      sprintf (buf, "--zero-copy-threshold=%d", _diskfs_zero_copy_threshold);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && _diskfs_dirty_expire != DEFAULT_DIRTY_EXPIRE)
+    {
+      char buf[80];
+      sprintf (buf, "--dirty-expire=%d", _diskfs_dirty_expire);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && _diskfs_writeback_rate)
+    {
+      char buf[80];
+      sprintf (buf, "--writeback-rate=%d", _diskfs_writeback_rate);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && _diskfs_report_stats)
+    err = argz_add (argz, argz_len, "--stats");
+
   if (! err)
     {
       if (diskfs_synchronous)
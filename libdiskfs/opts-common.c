@@ -55,5 +55,16 @@ const struct argp_option diskfs_common_options[] =
    "Create new nodes with gid of parent dir (default)"},
   {"grpid",    0,   0, OPTION_ALIAS | OPTION_HIDDEN},
   {"bsdgroups", 0,   0, OPTION_ALIAS | OPTION_HIDDEN},
+  {"name-cache-size", OPT_NAME_CACHE_SIZE, "ENTRIES", 0,
+   "Cache about ENTRIES directory lookups (the default is 1024)"},
+  {"zero-copy-threshold", OPT_ZERO_COPY_THRESHOLD, "BYTES", 0,
+   "Answer page-aligned reads of at least BYTES bytes by mapping the file"
+   " instead of copying it (0 disables; the default is 65536)"},
+  {"dirty-expire", OPT_DIRTY_EXPIRE, "SECONDS", 0,
+   "Write back changed nodes once they have been dirty for SECONDS"
+   " seconds (the default is 30), if the format supports it"},
+  {"writeback-rate", OPT_WRITEBACK_RATE, "KB", 0,
+   "Write back expired nodes at about KB kilobytes per second at most"
+   " (the default, 0, means as fast as possible)"},
   {0, 0}
 };
@@ -26,3 +26,9 @@ diskfs_append_args (char **argz, size_t *argz_len)
 {
   return diskfs_append_std_options (argz, argz_len);
 }
+
+error_t
+diskfs_append_stats (char **argz, size_t *argz_len)
+{
+  return diskfs_append_std_stats (argz, argz_len);
+}
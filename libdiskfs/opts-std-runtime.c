@@ -27,13 +27,18 @@ std_runtime_options[] =
 {
   {"update", 'u',  0, 0, "Flush any meta-data cached in core"},
   {"remount", 0, 0, OPTION_HIDDEN | OPTION_ALIAS}, /* deprecated */
+  {"stats", OPT_STATS, 0, 0,
+   "Report statistics counters along with the options shown by fsysopts"},
+  {"no-stats", OPT_NO_STATS, 0, 0, "Stop reporting statistics counters"},
+  {"stat", OPT_STAT, "NAME=VALUE", OPTION_HIDDEN}, /* reported; ignored */
   {0, 0}
 };
 
 struct parse_hook
 {
   int readonly, sync, sync_interval, remount, nosuid, noexec, noatime,
-    noinheritdirgroup;
+    noinheritdirgroup, name_cache_size, zero_copy_threshold, dirty_expire,
+    writeback_rate, stats;
 };
 
 /* Implement the options in H, and free H.  */
@@ -83,6 +88,19 @@ set_opts (struct parse_hook *h)
   if (h->noinheritdirgroup != -1)
     _diskfs_no_inherit_dir_group = h->noinheritdirgroup;
 
+  if (h->zero_copy_threshold >= 0)
+    _diskfs_zero_copy_threshold = h->zero_copy_threshold;
+  if (h->dirty_expire >= 0)
+    _diskfs_dirty_expire = h->dirty_expire;
+  if (h->writeback_rate >= 0)
+    _diskfs_writeback_rate = h->writeback_rate;
+
+  if (h->stats != -1)
+    _diskfs_report_stats = h->stats;
+
+  if (!err && h->name_cache_size > 0)
+    err = diskfs_set_name_cache_size (h->name_cache_size);
+
   free (h);
 
   return err;
@@ -107,6 +125,41 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     case OPT_NO_INHERIT_DIR_GROUP: h->noinheritdirgroup = 1; break;
     case OPT_INHERIT_DIR_GROUP: h->noinheritdirgroup = 0; break;
     case 'n': h->sync_interval = 0; h->sync = 0; break;
+    case OPT_NAME_CACHE_SIZE:
+      h->name_cache_size = atoi (arg);
+      if (h->name_cache_size <= 0)
+	{
+	  argp_error (state, "invalid number for --name-cache-size");
+	  return EINVAL;
+	}
+      break;
+    case OPT_ZERO_COPY_THRESHOLD:
+      h->zero_copy_threshold = atoi (arg);
+      if (h->zero_copy_threshold < 0)
+	{
+	  argp_error (state, "invalid number for --zero-copy-threshold");
+	  return EINVAL;
+	}
+      break;
+    case OPT_DIRTY_EXPIRE:
+      h->dirty_expire = atoi (arg);
+      if (h->dirty_expire < 0)
+	{
+	  argp_error (state, "invalid number for --dirty-expire");
+	  return EINVAL;
+	}
+      break;
+    case OPT_WRITEBACK_RATE:
+      h->writeback_rate = atoi (arg);
+      if (h->writeback_rate < 0)
+	{
+	  argp_error (state, "invalid number for --writeback-rate");
+	  return EINVAL;
+	}
+      break;
+    case OPT_STATS: h->stats = 1; break;
+    case OPT_NO_STATS: h->stats = 0; break;
+    case OPT_STAT: break;
     case 's':
       if (arg)
 	{
@@ -130,6 +183,10 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	  h->sync_interval = -1;
 	  h->remount = 0;
 	  h->nosuid = h->noexec = h->noatime = h->noinheritdirgroup = -1;
+	  h->name_cache_size = 0;
+	  h->zero_copy_threshold = -1;
+	  h->dirty_expire = h->writeback_rate = -1;
+	  h->stats = -1;
 
 	  /* We know that we have one child, with which we share our hook.  */
 	  state->child_inputs[0] = h;
@@ -101,6 +101,25 @@ parse_startup_opt (int opt, char *arg, struct argp_state *state)
       diskfs_synchronous = 0;
       diskfs_default_sync_interval = 0;
       break;
+    case OPT_NAME_CACHE_SIZE:
+      if (diskfs_set_name_cache_size (atoi (arg)))
+	argp_error (state, "invalid number for --name-cache-size");
+      break;
+    case OPT_ZERO_COPY_THRESHOLD:
+      _diskfs_zero_copy_threshold = atoi (arg);
+      if (_diskfs_zero_copy_threshold < 0)
+	argp_error (state, "invalid number for --zero-copy-threshold");
+      break;
+    case OPT_DIRTY_EXPIRE:
+      _diskfs_dirty_expire = atoi (arg);
+      if (_diskfs_dirty_expire < 0)
+	argp_error (state, "invalid number for --dirty-expire");
+      break;
+    case OPT_WRITEBACK_RATE:
+      _diskfs_writeback_rate = atoi (arg);
+      if (_diskfs_writeback_rate < 0)
+	argp_error (state, "invalid number for --writeback-rate");
+      break;
 
       /* Boot options */
     case OPT_DEVICE_MASTER_PORT:
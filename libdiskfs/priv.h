@@ -38,6 +38,27 @@ extern int _diskfs_nosuid, _diskfs_noexec;
 /* This relaxes the requirement to set `st_atim'.  */
 extern int _diskfs_noatime;
 
+/* Reads of at least this many bytes at page-aligned offsets are
+   answered with a copy-on-write mapping of the file instead of a copy.
+   Zero disables this.  */
+extern int _diskfs_zero_copy_threshold;
+
+/* Nodes are written back once they have been dirty this many seconds,
+   at most at this many kilobytes per second (0 means no limit).  */
+extern int _diskfs_dirty_expire, _diskfs_writeback_rate;
+
+/* Write back the nodes that have been dirty for _DISKFS_DIRTY_EXPIRE
+   seconds, oldest first, until about BUDGET bytes are written.  Return
+   the number of nodes written.  */
+int _diskfs_writeback (size_t budget);
+
+/* Empty the dirty list without writing anything.  */
+void _diskfs_clear_dirty (void);
+
+/* Take locked node NP, which is about to lose its last link and hard
+   reference, off the dirty list.  */
+void _diskfs_forget_dirty (struct node *np);
+
 /* This enables SysV style group behaviour.  New nodes inherit the GID
    of the user creating them unless the SGID bit is set of the parent
    directory.  */
@@ -61,6 +82,26 @@ extern const struct argp_option diskfs_common_options[];
 #define OPT_ATIME	602	/* --atime */
 #define OPT_NO_INHERIT_DIR_GROUP	603	/* --no-inherit-dir-group */
 #define OPT_INHERIT_DIR_GROUP		604	/* --inherit-dir-group */
+#define OPT_STATS			605	/* --stats */
+#define OPT_NO_STATS			606	/* --no-stats */
+#define OPT_STAT			607	/* --stat */
+#define OPT_NAME_CACHE_SIZE		608	/* --name-cache-size */
+#define OPT_ZERO_COPY_THRESHOLD		609	/* --zero-copy-threshold */
+#define OPT_DIRTY_EXPIRE		610	/* --dirty-expire */
+#define OPT_WRITEBACK_RATE		611	/* --writeback-rate */
+
+/* Set by --stats: report statistics counters along with the options
+   returned by fsys_get_options and file_get_fs_options.  */
+extern int _diskfs_report_stats;
+
+/* The default size of the lookup cache, in entries.  */
+#define DEFAULT_NAME_CACHE_SIZE		1024
+
+/* The default for --zero-copy-threshold, in bytes.  */
+#define DEFAULT_ZERO_COPY_THRESHOLD	(64 * 1024)
+
+/* The default for --dirty-expire, in seconds.  */
+#define DEFAULT_DIRTY_EXPIRE		30
 
 /* Common value for diskfs_common_options and diskfs_default_sync_interval. */
 #define DEFAULT_SYNC_INTERVAL 30
@@ -100,6 +141,11 @@ void _diskfs_control_clean (void *);
    links, then request soft references to be dropped.  */
 void _diskfs_lastref (struct node *np);
 
+/* Purge the lookup cache entry for NAME in directory DP, if it refers
+   to NP.  */
+void _diskfs_purge_lookup_cache_name (struct node *dp, struct node *np,
+				      const char *name);
+
 /* Number of outstanding PT_CTL ports. */
 extern int _diskfs_ncontrol_ports;
 
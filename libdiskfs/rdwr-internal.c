@@ -20,12 +20,16 @@
 #include <fcntl.h>
 #include <hurd/pager.h>
 
+error_t (*diskfs_rdwr_hook) (struct node *np, char *data, off_t offset,
+			     size_t *amt, int dir);
+
 /* Actually read or write a file.  The file size must already permit
    the requested access.  NP is the file to read/write.  DATA is a buffer
    to write from or fill on read.  OFFSET is the absolute address (-1
    not permitted here); AMT is the size of the read/write to perform;
    DIR is set for writing and clear for reading.  The inode must
-   be locked.  If NOTIME is set, then don't update the mtime or atime. */
+   be locked.  If NOTIME is set, then don't update the mtime or atime.
+   Writes exclude readers copying without the inode lock.  */
 error_t
 _diskfs_rdwr_internal (struct node *np,
 		       char *data,
@@ -53,6 +57,14 @@ _diskfs_rdwr_internal (struct node *np,
 	np->dn_set_atime = 1;
     }
 
+  if (diskfs_rdwr_hook)
+    {
+      err = (*diskfs_rdwr_hook) (np, data, offset, amt, dir);
+      if (err != EINVAL)
+	return err;
+      err = 0;
+    }
+
   memobj = diskfs_get_filemap (np, prot);
 
   if (memobj == MACH_PORT_NULL)
@@ -63,8 +75,14 @@ _diskfs_rdwr_internal (struct node *np,
       offset + *amt > ((off_t) 1) << (sizeof(vm_offset_t) * 8))
     err = EFBIG;
   else
-    err = pager_memcpy (diskfs_get_filemap_pager_struct (np), memobj,
-		      offset, data, amt, prot);
+    {
+      if (dir)
+	pthread_rwlock_wrlock (&np->rdwr_lock);
+      err = pager_memcpy (diskfs_get_filemap_pager_struct (np), memobj,
+			  offset, data, amt, prot);
+      if (dir)
+	pthread_rwlock_unlock (&np->rdwr_lock);
+    }
 
   if (!diskfs_check_readonly () && !notime)
     {
@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #include <hurd/fsys.h>
@@ -38,6 +39,10 @@ static struct port_info *pi;
 
 static void * periodic_sync (void *);
 
+/* When the format does incremental writeback, the sync thread looks for
+   expired dirty nodes this often, in seconds.  */
+#define WRITEBACK_PERIOD 5
+
 /* Establish a thread to sync the filesystem every INTERVAL seconds, or
    never, if INTERVAL is zero.  If an error occurs creating the thread, it is
    returned, otherwise 0.  Subsequent calls will create a new thread and
@@ -78,7 +83,11 @@ diskfs_set_sync_interval (int interval)
     }
 
   if (!err)
-    diskfs_sync_interval = interval;
+    {
+      diskfs_sync_interval = interval;
+      if (interval == 0)
+	_diskfs_clear_dirty ();
+    }
 
   ports_resume_port_rpcs (pi);
 
@@ -89,11 +98,17 @@ diskfs_set_sync_interval (int interval)
 
 /* Sync the filesystem (pointed to by the variable CONTROL_PORT above) every
    INTERVAL seconds, as long as it's in the thread pointed to by the global
-   variable PERIODIC_SYNC_THREAD.   */
+   variable PERIODIC_SYNC_THREAD.  If diskfs_writeback_hook is set, write
+   back the expired dirty nodes every WRITEBACK_PERIOD seconds instead, and
+   only update the hypermetadata every INTERVAL seconds.  */
 static void *
 periodic_sync (void * arg)
 {
   int interval = (int) arg;
+  int period = interval;
+  int since_hypermetadata = 0;
+  size_t budget;
+
   for (;;)
     {
       error_t err;
@@ -118,7 +133,23 @@ periodic_sync (void * arg)
 	      /* Only sync if we need to, to avoid clearing the clean flag
 		 when it's just been set.  Any other thread doing a sync
 		 will have held the lock while it did its work.  */
-	      if (_diskfs_diskdirty)
+	      if (diskfs_writeback_hook)
+		{
+		  period = interval < WRITEBACK_PERIOD
+			   ? interval : WRITEBACK_PERIOD;
+		  budget = _diskfs_writeback_rate
+			   ? (size_t) _diskfs_writeback_rate * 1024 * period
+			   : SIZE_MAX;
+		  _diskfs_writeback (budget);
+
+		  since_hypermetadata += period;
+		  if (since_hypermetadata >= interval && _diskfs_diskdirty)
+		    {
+		      diskfs_set_hypermetadata (0, 0);
+		      since_hypermetadata = 0;
+		    }
+		}
+	      else if (_diskfs_diskdirty)
 		{
 		  diskfs_sync_everything (0);
 		  diskfs_set_hypermetadata (0, 0);
@@ -129,7 +160,7 @@ periodic_sync (void * arg)
 	}
 
       /* Wait until next time.  */
-      sleep (interval);
+      sleep (period);
     }
 
   return NULL;
@@ -0,0 +1,207 @@
+/* Writing back dirty nodes as they expire
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include <time.h>
+
+#include "priv.h"
+
+/* Nodes with changes not written yet, in the order they were first
+   changed.  Each holds a light reference for the list.  Protected by
+   DIRTY_LOCK, as are the dirty_* fields of every node.  */
+static struct node *dirty_head, **dirty_tail = &dirty_head;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct diskfs_writeback_stats stats;
+
+void (*diskfs_writeback_hook) (void);
+
+int _diskfs_dirty_expire = DEFAULT_DIRTY_EXPIRE;
+int _diskfs_writeback_rate;
+
+static time_t
+now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static unsigned long
+now_usecs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* Take NP off the dirty list, returning the bytes it accounted for.
+   DIRTY_LOCK must be held.  */
+static size_t
+unlink_dirty (struct node *np)
+{
+  size_t bytes = np->dirty_bytes;
+
+  *np->dirty_prevp = np->dirty_next;
+  if (np->dirty_next)
+    np->dirty_next->dirty_prevp = np->dirty_prevp;
+  else
+    dirty_tail = np->dirty_prevp;
+  np->dirty_next = NULL;
+  np->dirty_prevp = NULL;
+  np->dirty_since = 0;
+  np->dirty_bytes = 0;
+
+  stats.dirty_nodes--;
+  stats.dirty_bytes -= bytes;
+  return bytes;
+}
+
+/* Note that NP has changes not written to disk yet, BYTES of them to
+   its contents.  */
+void
+diskfs_node_dirty (struct node *np, size_t bytes)
+{
+  extern int diskfs_sync_interval;
+
+  /* Nobody would take NP off the list again.  */
+  if (! diskfs_writeback_hook || diskfs_sync_interval == 0)
+    return;
+
+  pthread_mutex_lock (&dirty_lock);
+  if (! np->dirty_prevp)
+    {
+      diskfs_nref_light (np);
+      np->dirty_since = now_seconds ();
+      np->dirty_next = NULL;
+      np->dirty_prevp = dirty_tail;
+      *dirty_tail = np;
+      dirty_tail = &np->dirty_next;
+      stats.dirty_nodes++;
+    }
+  np->dirty_bytes += bytes;
+  stats.dirty_bytes += bytes;
+  pthread_mutex_unlock (&dirty_lock);
+}
+
+/* Call diskfs_node_dirty on NP if it has stat changes pending.  */
+void
+diskfs_check_dirty (struct node *np)
+{
+  /* This is only a hint, so don't bother locking NP.  */
+  if (! np->dirty_prevp
+      && (np->dn_set_ctime || np->dn_set_atime || np->dn_set_mtime
+	  || np->dn_stat_dirty))
+    diskfs_node_dirty (np, 0);
+}
+
+/* NP, which is locked, is about to lose its last link and hard
+   reference; don't let the dirty list keep it around until it
+   expires.  Dropping NP writes it anyway.  The caller must hold a
+   reference of its own.  */
+void
+_diskfs_forget_dirty (struct node *np)
+{
+  int listed;
+
+  pthread_mutex_lock (&dirty_lock);
+  listed = np->dirty_prevp != NULL;
+  if (listed)
+    unlink_dirty (np);
+  pthread_mutex_unlock (&dirty_lock);
+
+  if (listed)
+    refcounts_deref_weak (&np->refcounts, NULL);
+}
+
+/* Empty the dirty list without writing anything, as periodic syncs
+   were turned off.  */
+void
+_diskfs_clear_dirty (void)
+{
+  struct node *np;
+
+  pthread_mutex_lock (&dirty_lock);
+  while ((np = dirty_head) != NULL)
+    {
+      unlink_dirty (np);
+      pthread_mutex_unlock (&dirty_lock);
+      diskfs_nrele_light (np);
+      pthread_mutex_lock (&dirty_lock);
+    }
+  pthread_mutex_unlock (&dirty_lock);
+}
+
+/* Write back the nodes that have been dirty for _DISKFS_DIRTY_EXPIRE
+   seconds, oldest first, until about BUDGET bytes are written.  Return
+   the number of nodes written.  */
+int
+_diskfs_writeback (size_t budget)
+{
+  struct node *np;
+  time_t now = now_seconds ();
+  size_t bytes, spent = 0;
+  unsigned long start, latency;
+  int written = 0;
+
+  pthread_mutex_lock (&dirty_lock);
+  while ((np = dirty_head) != NULL
+	 && now - np->dirty_since >= _diskfs_dirty_expire
+	 && spent < budget)
+    {
+      bytes = unlink_dirty (np);
+      pthread_mutex_unlock (&dirty_lock);
+
+      /* Trade the light reference of the list for a hard one.  This
+	 may lock NP, so not while holding DIRTY_LOCK.  */
+      diskfs_nref (np);
+      diskfs_nrele_light (np);
+
+      start = now_usecs ();
+      pthread_mutex_lock (&np->lock);
+      diskfs_file_update (np, 0);
+      pthread_mutex_unlock (&np->lock);
+      latency = now_usecs () - start;
+
+      diskfs_nrele (np);
+
+      /* Writing the node itself costs about a page.  */
+      spent += bytes + vm_page_size;
+      written++;
+
+      pthread_mutex_lock (&dirty_lock);
+      stats.written_nodes++;
+      stats.written_bytes += bytes;
+      stats.total_latency += latency;
+      if (latency > stats.max_latency)
+	stats.max_latency = latency;
+    }
+  pthread_mutex_unlock (&dirty_lock);
+
+  if (written)
+    (*diskfs_writeback_hook) ();
+
+  return written;
+}
+
+/* Return in *ST the statistics of dirty node writeback.  */
+void
+diskfs_get_writeback_stats (struct diskfs_writeback_stats *st)
+{
+  pthread_mutex_lock (&dirty_lock);
+  *st = stats;
+  pthread_mutex_unlock (&dirty_lock);
+}
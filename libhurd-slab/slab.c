@@ -67,6 +67,36 @@ struct hurd_slab
   union hurd_bufctl *free_list;
 };
 
+
+/* A magazine is a stack of free objects.  Thread caches take objects
+   from and put them into magazines without locking, and exchange
+   whole magazines with the depot of the slab space when theirs run
+   empty or full (see Bonwick & Adams, "Magazines and Vmem", 2001).  */
+struct hurd_slab_magazine
+{
+  struct hurd_slab_magazine *next;
+  int rounds;
+  void *objs[HURD_SLAB_MAGAZINE_SIZE];
+};
+
+/* The cache of a thread for one slab space.  LOADED is the magazine
+   the thread uses; PREVIOUS is either full or empty, and is swapped
+   with LOADED before going to the depot.  Either may be NULL.  */
+struct hurd_slab_cache
+{
+  struct hurd_slab_cache *next;
+  struct hurd_slab_cache **prevp;
+  struct hurd_slab_space *space;
+
+  struct hurd_slab_magazine *loaded;
+  struct hurd_slab_magazine *previous;
+
+  /* Only updated by the thread owning the cache.  */
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long magazine_hits;
+};
+
 /* Allocate a buffer in *PTR of size SIZE which must be a power of 2
    and self aligned (i.e. aligned on a SIZE byte boundary) for slab
    space SPACE.  Return 0 on success, an error code on failure.  */
@@ -145,6 +175,106 @@ remove_slab (struct hurd_slab_space *space, struct hurd_slab *slab)
 }
 
 
+static inline void
+put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
+{
+  bufctl->next = slab->free_list;
+  slab->free_list = bufctl;
+  slab->refcount--;
+  assert_backtrace (slab->refcount >= 0);
+}
+
+
+/* Return BUFFER to its slab in SPACE.  SPACE must be locked.  */
+static void
+dealloc_locked (struct hurd_slab_space *space, void *buffer)
+{
+  struct hurd_slab *slab;
+  union hurd_bufctl *bufctl;
+
+  bufctl = (buffer + (space->size - sizeof *bufctl));
+  put_on_slab_list (slab = bufctl->slab, bufctl);
+
+  /* Try to have first_free always pointing at the slab that has the
+     most number of free objects.  So after this deallocation, update
+     the first_free pointer if reference counter drops below the
+     current reference counter of first_free.  */
+  if (!space->first_free 
+      || slab->refcount < space->first_free->refcount)
+    space->first_free = slab;
+}
+
+
+/* Return the objects in MAGAZINE to their slabs in SPACE, and free
+   MAGAZINE.  SPACE must be locked.  */
+static void
+flush_magazine (struct hurd_slab_space *space,
+		struct hurd_slab_magazine *magazine)
+{
+  if (! magazine)
+    return;
+
+  while (magazine->rounds > 0)
+    dealloc_locked (space, magazine->objs[--magazine->rounds]);
+  free (magazine);
+}
+
+
+/* Empty the depot of SPACE.  SPACE must be locked.  */
+static void
+flush_depot (struct hurd_slab_space *space)
+{
+  struct hurd_slab_magazine *magazine;
+
+  while ((magazine = space->full_magazines))
+    {
+      space->full_magazines = magazine->next;
+      flush_magazine (space, magazine);
+    }
+  space->nr_full_magazines = 0;
+
+  while ((magazine = space->empty_magazines))
+    {
+      space->empty_magazines = magazine->next;
+      free (magazine);
+    }
+}
+
+
+/* Unlink CACHE from its slab space, keep its counters and return its
+   objects.  The slab space must be locked.  */
+static void
+flush_cache (struct hurd_slab_cache *cache)
+{
+  struct hurd_slab_space *space = cache->space;
+
+  *cache->prevp = cache->next;
+  if (cache->next)
+    cache->next->prevp = cache->prevp;
+
+  space->allocs += cache->allocs;
+  space->frees += cache->frees;
+  space->magazine_hits += cache->magazine_hits;
+
+  flush_magazine (space, cache->loaded);
+  flush_magazine (space, cache->previous);
+  free (cache);
+}
+
+
+/* Called when a thread that used a slab space exits.  */
+static void
+release_cache (void *arg)
+{
+  struct hurd_slab_cache *cache = arg;
+  struct hurd_slab_space *space = cache->space;
+
+  pthread_mutex_lock (&space->lock);
+  flush_cache (cache);
+  pthread_mutex_unlock (&space->lock);
+}
+
+
 /* Iterate through slabs in SPACE and release memory for slabs that
    are complete (no allocated buffers).  */
 static error_t
@@ -153,6 +283,8 @@ reap (struct hurd_slab_space *space)
   struct hurd_slab *s, *next, *new_first;
   error_t err = 0;
 
+  flush_depot (space);
+
   for (s = space->slab_first; s; s = next)
     {
       next = s->next;
@@ -186,6 +318,8 @@ reap (struct hurd_slab_space *space)
 	  if (err)
 	    break;
 	  __hurd_slab_nr_pages--;
+	  space->nr_slabs--;
+	  space->slabs_reaped++;
 	}
     }
 
@@ -211,6 +345,10 @@ init_space (hurd_slab_space_t space)
   size_t size = space->requested_size + sizeof (union hurd_bufctl);
   size_t alignment = space->requested_align;
 
+  /* Spaces set up by HURD_SLAB_SPACE_INITIALIZER get the default.  */
+  if (!space->slab_size)
+    space->slab_size = getpagesize () * SLAB_PAGES;
+
   /* If SIZE is so big that one object can not fit into a page
      something gotta be really wrong.  */ 
   size = (size + alignment - 1) & ~(alignment - 1);
@@ -228,7 +366,62 @@ init_space (hurd_slab_space_t space)
   /* FIXME: Notify pager's reap functionality about this slab
      space.  */
 
-  space->initialized = true;
+  /* Without a key, all threads share the slabs.  */
+  space->have_cache_key
+    = pthread_key_create (&space->cache_key, release_cache) == 0;
+
+  __atomic_store_n (&space->initialized, true, __ATOMIC_RELEASE);
+}
+
+
+/* Make sure SPACE is initialized.  */
+static inline void
+ensure_initialized (struct hurd_slab_space *space)
+{
+  if (__atomic_load_n (&space->initialized, __ATOMIC_ACQUIRE))
+    return;
+
+  pthread_mutex_lock (&space->lock);
+  if (!space->initialized)
+    init_space (space);
+  pthread_mutex_unlock (&space->lock);
+}
+
+
+/* Return the cache of the calling thread for SPACE, or NULL if it
+   has none and can't get one.  */
+static inline struct hurd_slab_cache *
+get_cache (struct hurd_slab_space *space)
+{
+  struct hurd_slab_cache *cache;
+
+  if (!space->have_cache_key)
+    return NULL;
+
+  cache = pthread_getspecific (space->cache_key);
+  if (cache)
+    return cache;
+
+  cache = calloc (1, sizeof *cache);
+  if (!cache)
+    return NULL;
+  cache->space = space;
+
+  if (pthread_setspecific (space->cache_key, cache))
+    {
+      free (cache);
+      return NULL;
+    }
+
+  pthread_mutex_lock (&space->lock);
+  cache->next = space->caches;
+  if (cache->next)
+    cache->next->prevp = &cache->next;
+  cache->prevp = &space->caches;
+  space->caches = cache;
+  pthread_mutex_unlock (&space->lock);
+
+  return cache;
 }
 
 
@@ -243,11 +436,7 @@ grow (struct hurd_slab_space *space)
   int nr_objs, i;
   void *p;
 
-  /* If the space has not yet been initialized this is the place to do
-     so.  It is okay to test some fields such as first_free prior to
-     initialization since they will be a null pointer in any case.  */
-  if (!space->initialized)
-    init_space (space);
+  assert_backtrace (space->initialized);
 
   err = allocate_buffer (space, space->slab_size, &p);
   if (err)
@@ -302,6 +491,7 @@ grow (struct hurd_slab_space *space)
      buffers, so it is safe to repoint first_free.  */  
   insert_slab (space, new_slab);
   space->first_free = new_slab;
+  space->nr_slabs++;
   return 0;
 }
 
@@ -392,8 +582,17 @@ hurd_slab_destroy (hurd_slab_space_t space)
   error_t err;
 
   /* The caller wants to destroy the slab.  It can not be destroyed if
-     there are any outstanding memory allocations.  */
+     there are any outstanding memory allocations.  Take back the
+     objects the threads keep first; nobody may use SPACE anymore.  */
   pthread_mutex_lock (&space->lock);
+  if (space->have_cache_key)
+    {
+      space->have_cache_key = false;
+      pthread_key_delete (space->cache_key);
+    }
+  while (space->caches)
+    flush_cache (space->caches);
+
   err = reap (space);
   if (err)
     {
@@ -408,6 +607,7 @@ hurd_slab_destroy (hurd_slab_space_t space)
       pthread_mutex_unlock (&space->lock);
       return EBUSY;
     }
+  pthread_mutex_unlock (&space->lock);
 
   /* FIXME: Remove slab space from pager's reap functionality.  */
 
@@ -429,26 +629,21 @@ hurd_slab_free (hurd_slab_space_t space)
 }
 
 
-/* Allocate a new object from the slab space SPACE.  */
-error_t
-hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+/* Take a buffer from the slabs of SPACE, which must be locked, and
+   return it in *BUFFER.  */
+static error_t
+alloc_locked (struct hurd_slab_space *space, void **buffer)
 {
   error_t err;
   union hurd_bufctl *bufctl;
 
-  pthread_mutex_lock (&space->lock);
-
   /* If there is no slabs with free buffer, the cache has to be
-     expanded with another slab.  If the slab space has not yet been
-     initialized this is always true.  */
+     expanded with another slab.  */
   if (!space->first_free)
     {
       err = grow (space);
       if (err)
-	{
-	  pthread_mutex_unlock (&space->lock);
-	  return err;
-	}
+	return err;
     }
 
   /* Remove buffer from the free list and update the reference
@@ -477,18 +672,73 @@ hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
       space->first_free = new_first;
     }
   *buffer = ((void *) bufctl) - (space->size - sizeof *bufctl);
-  pthread_mutex_unlock (&space->lock);
   return 0;
 }
 
 
-static inline void
-put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
+/* Allocate a new object from the slab space SPACE.  */
+error_t
+hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
 {
-  bufctl->next = slab->free_list;
-  slab->free_list = bufctl;
-  slab->refcount--;
-  assert_backtrace (slab->refcount >= 0);
+  error_t err;
+  struct hurd_slab_cache *cache;
+  struct hurd_slab_magazine *magazine;
+
+  ensure_initialized (space);
+
+  cache = get_cache (space);
+  if (cache)
+    {
+      cache->allocs++;
+
+      if (cache->loaded && cache->loaded->rounds > 0)
+	{
+	  cache->magazine_hits++;
+	  *buffer = cache->loaded->objs[--cache->loaded->rounds];
+	  return 0;
+	}
+
+      if (cache->previous && cache->previous->rounds > 0)
+	{
+	  /* PREVIOUS is full.  */
+	  magazine = cache->previous;
+	  cache->previous = cache->loaded;
+	  cache->loaded = magazine;
+	  cache->magazine_hits++;
+	  *buffer = magazine->objs[--magazine->rounds];
+	  return 0;
+	}
+    }
+
+  pthread_mutex_lock (&space->lock);
+
+  if (cache && space->full_magazines)
+    {
+      /* Both magazines of the thread are empty; trade one for a full
+	 one from the depot.  */
+      magazine = space->full_magazines;
+      space->full_magazines = magazine->next;
+      space->nr_full_magazines--;
+
+      if (cache->previous)
+	{
+	  cache->previous->next = space->empty_magazines;
+	  space->empty_magazines = cache->previous;
+	}
+      cache->previous = cache->loaded;
+      cache->loaded = magazine;
+      cache->magazine_hits++;
+      pthread_mutex_unlock (&space->lock);
+
+      *buffer = magazine->objs[--magazine->rounds];
+      return 0;
+    }
+
+  if (!cache)
+    space->allocs++;
+  err = alloc_locked (space, buffer);
+  pthread_mutex_unlock (&space->lock);
+  return err;
 }
 
 
@@ -496,23 +746,131 @@ put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
 void
 hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
 {
-  struct hurd_slab *slab;
-  union hurd_bufctl *bufctl;
+  struct hurd_slab_cache *cache;
+  struct hurd_slab_magazine *magazine;
 
   assert_backtrace (space->initialized);
 
+  cache = get_cache (space);
+  if (cache)
+    {
+      cache->frees++;
+
+      if (cache->loaded && cache->loaded->rounds < HURD_SLAB_MAGAZINE_SIZE)
+	{
+	  cache->magazine_hits++;
+	  cache->loaded->objs[cache->loaded->rounds++] = buffer;
+	  return;
+	}
+
+      if (cache->previous && cache->previous->rounds == 0)
+	{
+	  /* PREVIOUS is empty.  */
+	  magazine = cache->previous;
+	  cache->previous = cache->loaded;
+	  cache->loaded = magazine;
+	  cache->magazine_hits++;
+	  magazine->objs[magazine->rounds++] = buffer;
+	  return;
+	}
+    }
+
   pthread_mutex_lock (&space->lock);
 
-  bufctl = (buffer + (space->size - sizeof *bufctl));
-  put_on_slab_list (slab = bufctl->slab, bufctl);
+  if (cache)
+    {
+      /* The magazines of the thread are full, if it has any; trade one
+	 for an empty one from the depot, or a new one.  */
+      magazine = space->empty_magazines;
+      if (magazine)
+	space->empty_magazines = magazine->next;
+      else
+	{
+	  magazine = malloc (sizeof *magazine);
+	  if (magazine)
+	    magazine->rounds = 0;
+	}
 
-  /* Try to have first_free always pointing at the slab that has the
-     most number of free objects.  So after this deallocation, update
-     the first_free pointer if reference counter drops below the
-     current reference counter of first_free.  */
-  if (!space->first_free 
-      || slab->refcount < space->first_free->refcount)
-    space->first_free = slab;
+      if (magazine)
+	{
+	  if (cache->previous)
+	    {
+	      cache->previous->next = space->full_magazines;
+	      space->full_magazines = cache->previous;
+	      space->nr_full_magazines++;
+	    }
+	  cache->previous = cache->loaded;
+	  cache->loaded = magazine;
+	  cache->magazine_hits++;
+	  pthread_mutex_unlock (&space->lock);
 
+	  magazine->objs[magazine->rounds++] = buffer;
+	  return;
+	}
+    }
+  else
+    space->frees++;
+
+  dealloc_locked (space, buffer);
   pthread_mutex_unlock (&space->lock);
 }
+
+
+/* Give SPACE the name NAME in its statistics.  */
+void
+hurd_slab_set_name (hurd_slab_space_t space, const char *name)
+{
+  space->name = name;
+}
+
+
+/* Return the free objects kept in the depot of SPACE to their slabs,
+   and release the memory of the slabs that are completely free.  */
+error_t
+hurd_slab_reap (hurd_slab_space_t space)
+{
+  error_t err;
+
+  if (!__atomic_load_n (&space->initialized, __ATOMIC_ACQUIRE))
+    return 0;
+
+  pthread_mutex_lock (&space->lock);
+  err = reap (space);
+  pthread_mutex_unlock (&space->lock);
+  return err;
+}
+
+
+/* Fill in *STATS with the statistics of SPACE.  */
+void
+hurd_slab_get_stats (hurd_slab_space_t space, struct hurd_slab_stats *stats)
+{
+  struct hurd_slab_cache *cache;
+
+  pthread_mutex_lock (&space->lock);
+  stats->name = space->name;
+  stats->obj_size = space->size;
+  stats->slab_size = space->slab_size;
+  stats->bufs_per_slab = space->full_refcount;
+  stats->nr_slabs = space->nr_slabs;
+  stats->nr_magazined = space->nr_full_magazines * HURD_SLAB_MAGAZINE_SIZE;
+  stats->allocs = space->allocs;
+  stats->frees = space->frees;
+  stats->magazine_hits = space->magazine_hits;
+  stats->slabs_reaped = space->slabs_reaped;
+
+  /* The threads update their counters without locking, so these are
+     only approximate.  */
+  for (cache = space->caches; cache; cache = cache->next)
+    {
+      stats->allocs += cache->allocs;
+      stats->frees += cache->frees;
+      stats->magazine_hits += cache->magazine_hits;
+      if (cache->loaded)
+	stats->nr_magazined += cache->loaded->rounds;
+      if (cache->previous)
+	stats->nr_magazined += cache->previous->rounds;
+    }
+  pthread_mutex_unlock (&space->lock);
+}
+
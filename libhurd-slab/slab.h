@@ -48,6 +48,24 @@ typedef error_t (*hurd_slab_constructor_t) (void *hook, void *object);
 typedef void (*hurd_slab_destructor_t) (void *hook, void *object);
 
 
+/* The number of objects a magazine holds.  */
+#define HURD_SLAB_MAGAZINE_SIZE	15
+
+/* Statistics of a slab space, as returned by hurd_slab_get_stats.  */
+struct hurd_slab_stats
+{
+  const char *name;		/* As given to hurd_slab_set_name, or NULL */
+  size_t obj_size;		/* Size of an object, bufctl included */
+  size_t slab_size;
+  unsigned long bufs_per_slab;
+  unsigned long nr_slabs;	/* Slabs now allocated */
+  unsigned long nr_magazined;	/* Free objects kept in magazines */
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long magazine_hits;	/* Allocs and frees served by magazines */
+  unsigned long slabs_reaped;
+};
+
 /* The type of a slab space.  
 
    The structure is divided into two parts: the first is only used
@@ -111,6 +129,31 @@ struct hurd_slab_space
   /* The size of one object.  Should include possible alignment as
      well as the size of the bufctl structure.  */
   size_t size;
+
+  /* Every thread allocating from the space gets a cache of its own,
+     holding up to two magazines of free objects, which it can use
+     without taking LOCK.  Objects in magazines are constructed, like
+     those in the slabs.  CACHE_KEY is only valid if HAVE_CACHE_KEY.  */
+  pthread_key_t cache_key;
+  bool have_cache_key;
+  struct hurd_slab_cache *caches;
+
+  /* The depot: magazines the thread caches do not use, either full or
+     empty.  */
+  struct hurd_slab_magazine *full_magazines;
+  struct hurd_slab_magazine *empty_magazines;
+  unsigned long nr_full_magazines;
+
+  /* Counters for hurd_slab_get_stats, not including those of the
+     thread caches.  */
+  unsigned long nr_slabs;
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long magazine_hits;
+  unsigned long slabs_reaped;
+
+  /* Shown in the statistics.  */
+  const char *name;
 };
 
 
@@ -128,6 +171,7 @@ struct hurd_slab_space
     PTHREAD_MUTEX_INITIALIZER, 					\
     sizeof (TYPE),						\
     __alignof__ (TYPE),						\
+    0,								\
     ALLOC,							\
     DEALLOC,							\
     CTOR,							\
@@ -178,6 +222,18 @@ error_t hurd_slab_alloc (hurd_slab_space_t space, void **buffer);
 /* Deallocate the object BUFFER from the slab space SPACE.  */
 void hurd_slab_dealloc (hurd_slab_space_t space, void *buffer);
 
+/* Give SPACE the name NAME, which must stay valid as long as SPACE,
+   in its statistics.  */
+void hurd_slab_set_name (hurd_slab_space_t space, const char *name);
+
+/* Return the free objects kept in the depot of SPACE to their slabs,
+   and release the memory of the slabs that are completely free.  */
+error_t hurd_slab_reap (hurd_slab_space_t space);
+
+/* Fill in *STATS with the statistics of SPACE.  */
+void hurd_slab_get_stats (hurd_slab_space_t space,
+			  struct hurd_slab_stats *stats);
+
 /* Create a more strongly typed slab interface a la a C++ template.
 
    NAME is the name of the new slab class.  NAME is used to synthesize
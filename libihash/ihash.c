@@ -28,7 +28,11 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ihash.h"
 
@@ -67,6 +71,115 @@ index_valid (hurd_ihash_t ht, unsigned int idx, hurd_ihash_key_t key)
 }
 
 
+/* The control byte of a slot in use holds seven bits of the hash of
+   its key, see control_tag.  Free slots have one of these.  */
+#define CONTROL_EMPTY	0x80
+#define CONTROL_DELETED	0xfe
+
+/* Return the control byte for a key with the hash H.  The index is
+   taken from the low bits of H, and the identity hash leaves the high
+   ones mostly clear, so mix them first.  */
+static inline unsigned char
+control_tag (hurd_ihash_key_t h)
+{
+  return ((uint32_t) h * 2654435761U) >> 25;
+}
+
+/* Set the control byte of the slot with the index IDX in an array of
+   SIZE items to C, in CONTROL.  */
+static inline void
+set_control (unsigned char *control, size_t size, unsigned int idx,
+	     unsigned char c)
+{
+  control[idx] = c;
+  if (idx < HURD_IHASH_GROUP - 1)
+    control[size + idx] = c;
+}
+
+/* Return a mask with bit I set if the control byte at P + I is C, for
+   the HURD_IHASH_GROUP bytes at P.  */
+static inline unsigned int
+match_group (const unsigned char *p, unsigned char c)
+{
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128 ((const __m128i *) p);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (group, _mm_set1_epi8 (c)));
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  unsigned int i, mask = 0;
+  uint32_t word, x, zero;
+
+  /* Four bytes at a time: find the bytes of X that are zero, which
+     leaves their top bits set in ZERO, and gather those bits.  */
+  for (i = 0; i < HURD_IHASH_GROUP; i += 4)
+    {
+      memcpy (&word, p + i, sizeof word);
+      x = word ^ (c * 0x01010101U);
+      zero = ~(((x & 0x7f7f7f7fU) + 0x7f7f7f7fU) | x | 0x7f7f7f7fU);
+      mask |= (((zero >> 7) * 0x01020408U) >> 24) << i;
+    }
+  return mask;
+#else
+  unsigned int i, mask = 0;
+
+  for (i = 0; i < HURD_IHASH_GROUP; i++)
+    mask |= (unsigned int) (p[i] == c) << i;
+  return mask;
+#endif
+}
+
+/* Like find_index below, for tables with control bytes.  The probe
+   sequence is the same, but a group of slots is looked at in one go,
+   and only keys whose control byte matches are compared.  */
+static inline int
+find_index_control (hurd_ihash_t ht, hurd_ihash_key_t key)
+{
+  hurd_ihash_key_t h = hash (ht, key);
+  unsigned int mask = ht->size - 1;
+  unsigned int pos = h & mask;
+  unsigned char tag = control_tag (h);
+  unsigned int first_deleted = 0;
+  int first_deleted_set = 0;
+  size_t probed;
+
+  for (probed = 0; probed < ht->size; probed += HURD_IHASH_GROUP)
+    {
+      const unsigned char *group = &ht->control[pos];
+      unsigned int match = match_group (group, tag);
+      unsigned int empty = match_group (group, CONTROL_EMPTY);
+      unsigned int deleted = match_group (group, CONTROL_DELETED);
+
+      /* A search one slot at a time would stop at the first empty
+	 slot.  */
+      if (empty)
+	{
+	  match &= (empty & -empty) - 1;
+	  deleted &= (empty & -empty) - 1;
+	}
+
+      for (; match; match &= match - 1)
+	{
+	  unsigned int idx = (pos + __builtin_ctz (match)) & mask;
+	  if (compare (ht, ht->items[idx].key, key))
+	    return idx;
+	}
+
+      if (deleted && ! first_deleted_set)
+	{
+	  first_deleted = (pos + __builtin_ctz (deleted)) & mask;
+	  first_deleted_set = 1;
+	}
+
+      if (empty)
+	return (first_deleted_set ? first_deleted
+		: (pos + __builtin_ctz (empty)) & mask);
+
+      pos = (pos + HURD_IHASH_GROUP) & mask;
+    }
+
+  return first_deleted;
+}
+
+
 /* Given a hash table HT, and a key KEY, find the index in the table
    of that key.  You must subsequently check with index_valid() if the
    returned index is valid.  */
@@ -79,6 +192,9 @@ find_index (hurd_ihash_t ht, hurd_ihash_key_t key)
   int first_deleted_set = 0;
   unsigned int mask = ht->size - 1;
 
+  if (ht->control)
+    return find_index_control (ht, key);
+
   idx = hash (ht, key) & mask;
 
   up_idx = idx;
@@ -114,9 +230,53 @@ locp_remove (hurd_ihash_t ht, hurd_ihash_locp_t locp)
     (*ht->cleanup) (item->value, ht->cleanup_data);
   item->value = _HURD_IHASH_DELETED;
   item->key = 0;
+  if (ht->control)
+    set_control (ht->control, ht->size, item - ht->items, CONTROL_DELETED);
   ht->nr_items--;
 }
 
+
+/* Make OLD look like a hash table holding the items of HT not migrated
+   yet.  */
+static inline void
+old_view (hurd_ihash_t ht, hurd_ihash_t old)
+{
+  *old = *ht;
+  old->items = ht->old_items;
+  old->size = ht->old_size;
+  old->control = ht->old_control;
+  old->old_items = NULL;
+}
+
+
+/* Return 1 if LOCP points into the items of HT not migrated yet.  */
+static inline int
+locp_old (hurd_ihash_t ht, hurd_ihash_locp_t locp)
+{
+  struct _hurd_ihash_item *item = (struct _hurd_ihash_item *) locp;
+  return (ht->old_items
+	  && item >= ht->old_items && item < ht->old_items + ht->old_size);
+}
+
+
+/* Remove the item with the key KEY from those of HT not migrated yet.
+   If such an item was found and removed, 1 is returned, otherwise 0.  */
+static int
+remove_old (hurd_ihash_t ht, hurd_ihash_key_t key)
+{
+  struct hurd_ihash old;
+  int idx;
+
+  old_view (ht, &old);
+  idx = find_index (&old, key);
+  if (! index_valid (&old, idx, key))
+    return 0;
+
+  locp_remove (&old, &old.items[idx].value);
+  ht->nr_items--;
+  return 1;
+}
+
 
 /* Construction and destruction of hash tables.  */
 
@@ -132,6 +292,12 @@ hurd_ihash_init (hurd_ihash_t ht, intptr_t locp_offs)
   ht->fct_hash = NULL;
   ht->fct_cmp = NULL;
   ht->nr_free = 0;
+  ht->flags = 0;
+  ht->control = NULL;
+  ht->old_items = NULL;
+  ht->old_size = 0;
+  ht->old_control = NULL;
+  ht->migrated = 0;
 }
 
 
@@ -151,7 +317,12 @@ hurd_ihash_destroy (hurd_ihash_t ht)
     }
 
   if (ht->size > 0)
-    free (ht->items);
+    {
+      free (ht->items);
+      free (ht->control);
+      free (ht->old_items);
+      free (ht->old_control);
+    }
 }
 
 
@@ -207,6 +378,16 @@ hurd_ihash_set_gki (hurd_ihash_t ht,
 }
 
 
+/* Set the FLAGS for the hash table HT.  Must be called before any
+   item is inserted into the table.  */
+void
+hurd_ihash_set_flags (hurd_ihash_t ht, unsigned int flags)
+{
+  assert (ht->size == 0 || !"called after insertion");
+  ht->flags = flags;
+}
+
+
 /* Set the maximum load factor in binary percent to MAX_LOAD, which
    should be between 64 and 128.  The default is
    HURD_IHASH_MAX_LOAD_DEFAULT.  New elements are only added to the
@@ -254,6 +435,9 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
         }
       ht->items[idx].value = value;
       ht->items[idx].key = key;
+      if (ht->control)
+	set_control (ht->control, ht->size, idx,
+		     control_tag (hash (ht, key)));
 
       if (ht->locp_offset != HURD_IHASH_NO_LOCP)
 	*((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
@@ -266,6 +450,50 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
 }
 
 
+/* Move the items in up to COUNT slots of the array HT is migrating
+   away from to the current one.  */
+static void
+migrate (hurd_ihash_t ht, size_t count)
+{
+  struct _hurd_ihash_item *item;
+  hurd_ihash_key_t key;
+  hurd_ihash_value_t value;
+  int was_added;
+
+  for (; ht->old_items && count > 0; count--)
+    {
+      item = &ht->old_items[ht->migrated];
+      if (hurd_ihash_value_valid (item->value))
+	{
+	  key = item->key;
+	  value = item->value;
+
+	  /* Leave a tombstone, so that searches for the items left
+	     behind still get past this slot.  */
+	  item->value = _HURD_IHASH_DELETED;
+	  item->key = 0;
+	  if (ht->old_control)
+	    set_control (ht->old_control, ht->old_size, ht->migrated,
+			 CONTROL_DELETED);
+	  ht->nr_items--;
+
+	  was_added = add_one (ht, key, value);
+	  assert (was_added);
+	}
+
+      if (++ht->migrated == ht->old_size)
+	{
+	  free (ht->old_items);
+	  free (ht->old_control);
+	  ht->old_items = NULL;
+	  ht->old_size = 0;
+	  ht->old_control = NULL;
+	  ht->migrated = 0;
+	}
+    }
+}
+
+
 /* Add VALUE to the hash table HT under the key KEY at LOCP.  If there
    already is an item under this key, call the cleanup function (if
    any) for it before overriding the value.  This function is faster
@@ -289,12 +517,16 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
       || item == NULL
       || (hurd_ihash_value_valid (item->value)
           && ! compare (ht, item->key, key))
-      || hurd_ihash_get_effective_load (ht) > ht->max_load)
+      || hurd_ihash_get_effective_load (ht) > ht->max_load
+      || locp_old (ht, locp))
     return hurd_ihash_add (ht, key, value);
 
   if (! hurd_ihash_value_valid (item->value))
     {
       item->key = key;
+      if (ht->control)
+	set_control (ht->control, ht->size, item - ht->items,
+		     control_tag (hash (ht, key)));
       ht->nr_items += 1;
       if (item->value == _HURD_IHASH_EMPTY)
         {
@@ -315,6 +547,7 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
     *((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
       = locp;
 
+  migrate (ht, HURD_IHASH_MIGRATE_STEP);
   return 0;
 }
 
@@ -326,24 +559,37 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
 error_t
 hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
 {
-  struct hurd_ihash old_ht = *ht;
+  struct hurd_ihash old_ht;
   int was_added;
   int fatal = 0;	/* bail out on allocation errors */
   unsigned int i;
 
+  /* An item under KEY not migrated yet is replaced as well.  */
+  if (ht->old_items)
+    remove_old (ht, key);
+
   if (ht->size)
     {
       /* Only fill the hash table up to its maximum load factor.  */
       if (hurd_ihash_get_effective_load (ht) <= ht->max_load)
       add_one:
 	if (add_one (ht, key, item))
-	  return 0;
+	  {
+	    migrate (ht, HURD_IHASH_MIGRATE_STEP);
+	    return 0;
+	  }
     }
 
+  /* Only one array can be left behind at a time.  */
+  if (ht->old_items)
+    migrate (ht, ht->old_size);
+
   /* If the load exceeds the configured maximal load, then the hash
      table is too small, and we have to increase it.  Otherwise we
      merely rehash the table to get rid of the tombstones.  */
-  ht->nr_items = 0;
+  old_ht = *ht;
+  if (! (ht->flags & HURD_IHASH_INCREMENTAL))
+    ht->nr_items = 0;
   if (ht->size == 0)
       ht->size = HURD_IHASH_MIN_SIZE;
   else if (hurd_ihash_get_load (&old_ht) > ht->max_load)
@@ -353,6 +599,18 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
   /* calloc() will initialize all values to _HURD_IHASH_EMPTY implicitly.  */
   ht->items = calloc (ht->size, sizeof (struct _hurd_ihash_item));
 
+  if (ht->items && (ht->flags & HURD_IHASH_CONTROL_BYTES))
+    {
+      ht->control = malloc (ht->size + HURD_IHASH_GROUP - 1);
+      if (ht->control)
+	memset (ht->control, CONTROL_EMPTY, ht->size + HURD_IHASH_GROUP - 1);
+      else
+	{
+	  free (ht->items);
+	  ht->items = NULL;
+	}
+    }
+
   if (ht->items == NULL)
     {
       *ht = old_ht;
@@ -367,6 +625,23 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
       goto add_one;
     }
 
+  if ((ht->flags & HURD_IHASH_INCREMENTAL) && old_ht.size > 0)
+    {
+      /* Leave the old entries where they are for now.  */
+      ht->old_items = old_ht.items;
+      ht->old_size = old_ht.size;
+      ht->old_control = old_ht.control;
+      ht->migrated = 0;
+
+      /* We may be replacing an item that was just left behind.  */
+      remove_old (ht, key);
+      was_added = add_one (ht, key, item);
+      assert (was_added);
+
+      migrate (ht, HURD_IHASH_MIGRATE_STEP);
+      return 0;
+    }
+
   /* We have to rehash the old entries.  */
   for (i = 0; i < old_ht.size; i++)
     if (!index_empty (&old_ht, i))
@@ -380,7 +655,10 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
   assert (was_added);
 
   if (old_ht.size > 0)
-    free (old_ht.items);
+    {
+      free (old_ht.items);
+      free (old_ht.control);
+    }
 
   return 0;
 }
@@ -396,7 +674,20 @@ hurd_ihash_find (hurd_ihash_t ht, hurd_ihash_key_t key)
   else
     {
       int idx = find_index (ht, key);
-      return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
+      if (index_valid (ht, idx, key))
+	return ht->items[idx].value;
+
+      if (ht->old_items)
+	{
+	  struct hurd_ihash old;
+
+	  old_view (ht, &old);
+	  idx = find_index (&old, key);
+	  if (index_valid (&old, idx, key))
+	    return old.items[idx].value;
+	}
+
+      return NULL;
     }
 }
 
@@ -428,7 +719,23 @@ hurd_ihash_locp_find (hurd_ihash_t ht,
 
   idx = find_index (ht, key);
   *slot = &ht->items[idx].value;
-  return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
+  if (index_valid (ht, idx, key))
+    return ht->items[idx].value;
+
+  if (ht->old_items)
+    {
+      struct hurd_ihash old;
+
+      old_view (ht, &old);
+      idx = find_index (&old, key);
+      if (index_valid (&old, idx, key))
+	{
+	  *slot = &old.items[idx].value;
+	  return old.items[idx].value;
+	}
+    }
+
+  return NULL;
 }
 
 
@@ -446,6 +753,9 @@ hurd_ihash_remove (hurd_ihash_t ht, hurd_ihash_key_t key)
 	  locp_remove (ht, &ht->items[idx].value);
 	  return 1;
 	}
+
+      if (ht->old_items)
+	return remove_old (ht, key);
     }
 
   return 0;
@@ -459,5 +769,14 @@ hurd_ihash_remove (hurd_ihash_t ht, hurd_ihash_key_t key)
 void
 hurd_ihash_locp_remove (hurd_ihash_t ht, hurd_ihash_locp_t locp)
 {
-  locp_remove (ht, locp);
+  if (locp_old (ht, locp))
+    {
+      struct hurd_ihash old;
+
+      old_view (ht, &old);
+      locp_remove (&old, locp);
+      ht->nr_items--;
+    }
+  else
+    locp_remove (ht, locp);
 }
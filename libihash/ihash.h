@@ -116,6 +116,22 @@ struct hurd_ihash
 
   /* Number of free slots.  */
   size_t nr_free;
+
+  /* HURD_IHASH_CONTROL_BYTES and HURD_IHASH_INCREMENTAL, see below.  */
+  unsigned int flags;
+
+  /* With HURD_IHASH_CONTROL_BYTES, a byte for each item, and a copy of
+     the first HURD_IHASH_GROUP - 1 of them after those, so that any
+     HURD_IHASH_GROUP consecutive bytes can be loaded at once.  */
+  unsigned char *control;
+
+  /* With HURD_IHASH_INCREMENTAL, the array ITEMS replaced, and its
+     control bytes, while its items are moved to ITEMS.  Those before
+     MIGRATED are moved already.  NR_ITEMS counts the items in both.  */
+  _hurd_ihash_item_t old_items;
+  size_t old_size;
+  unsigned char *old_control;
+  size_t migrated;
 };
 typedef struct hurd_ihash *hurd_ihash_t;
 
@@ -149,6 +165,25 @@ typedef struct hurd_ihash *hurd_ihash_t;
     .fct_hash = (f_hash),						\
     .fct_cmp = (f_compare)}						\
 
+/* The same, for tables with FLAGS, see hurd_ihash_set_flags.  */
+#define HURD_IHASH_INITIALIZER_FLAGS(locp_offs, f_flags)		\
+  { .nr_items = 0, .size = 0, .cleanup = (hurd_ihash_cleanup_t) 0,	\
+    .max_load = HURD_IHASH_MAX_LOAD_DEFAULT,				\
+    .locp_offset = (locp_offs),						\
+    .flags = (f_flags)}
+
+#define HURD_IHASH_INITIALIZER_GKI_FLAGS(locp_offs, f_clean,		\
+					 f_clean_data, f_hash,		\
+					 f_compare, f_flags)		\
+  { .nr_items = 0, .size = 0,						\
+    .cleanup = (f_clean),						\
+    .cleanup_data = (f_clean_data),					\
+    .max_load = HURD_IHASH_MAX_LOAD_DEFAULT,				\
+    .locp_offset = (locp_offs),						\
+    .fct_hash = (f_hash),						\
+    .fct_cmp = (f_compare),						\
+    .flags = (f_flags)}
+
 /* Initialize the hash table at address HT.  If LOCP_OFFSET is not
    HURD_IHASH_NO_LOCP, then this is an offset (in bytes) from the
    address of a hash value where a location pointer can be found.  The
@@ -189,6 +224,31 @@ void hurd_ihash_set_gki (hurd_ihash_t ht,
 			 hurd_ihash_fct_hash_t fct_hash,
 			 hurd_ihash_fct_cmp_t fct_cmp);
 
+/* The number of control bytes looked at in one go.  */
+#define HURD_IHASH_GROUP	16
+
+/* Keep a byte with a few bits of the hash of each item next to the
+   table, and look for keys by comparing HURD_IHASH_GROUP of those at
+   once, with SSE2 if available.  Full keys are only compared when
+   these bits match, so lookups touch much less memory, at the cost of
+   about one byte per item.  The items themselves, the location
+   pointers and the iterators are the same as without.  */
+#define HURD_IHASH_CONTROL_BYTES	0x1
+
+/* When the table is reorganized, don't move all items at once, but
+   keep the old array around and move HURD_IHASH_MIGRATE_STEP of its
+   slots each time an item is added.  Until all are moved, lookups
+   that miss in the new array look in the old one too.  Adding an item
+   may thus move other items and update their location pointers, while
+   removing items never does.  */
+#define HURD_IHASH_INCREMENTAL		0x2
+
+#define HURD_IHASH_MIGRATE_STEP	16
+
+/* Set the FLAGS above for the hash table HT.  Must be called before
+   any item is inserted into the table.  */
+void hurd_ihash_set_flags (hurd_ihash_t ht, unsigned int flags);
+
 /* Set the maximum load factor in binary percent to MAX_LOAD, which
    should be between 64 and 128.  The default is
    HURD_IHASH_MAX_LOAD_DEFAULT.  New elements are only added to the
@@ -302,6 +362,27 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    value of the current element is available in the variable VALUE
    (which is declared for you and local to the block).  */
 
+/* Return the first item of HT, or NULL.  */
+static inline _hurd_ihash_item_t
+_hurd_ihash_iter_first (hurd_ihash_t ht)
+{
+  return ht->size ? &ht->items[0] : (_hurd_ihash_item_t) 0;
+}
+
+/* Return the item of HT after ITEM, or NULL.  The items not migrated
+   yet come after the others.  */
+static inline _hurd_ihash_item_t
+_hurd_ihash_iter_next (hurd_ihash_t ht, _hurd_ihash_item_t item)
+{
+  item++;
+  if (item == &ht->items[ht->size])
+    return ht->old_items ? &ht->old_items[ht->migrated]
+			 : (_hurd_ihash_item_t) 0;
+  if (ht->old_items && item == &ht->old_items[ht->old_size])
+    return (_hurd_ihash_item_t) 0;
+  return item;
+}
+
 /* The implementation of this macro is peculiar.  We want the macro to
    execute a block following its invocation, so we can only prepend
    code.  This excludes creating an outer block.  However, we must
@@ -324,14 +405,13 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    subexpression is always true).  */
 #define HURD_IHASH_ITERATE(ht, val)					\
   for (hurd_ihash_value_t val,						\
-         *_hurd_ihash_valuep = (ht)->size ? &(ht)->items[0].value : 0;	\
-       (ht)->size							\
-	 && (size_t) ((_hurd_ihash_item_t) _hurd_ihash_valuep		\
-		      - &(ht)->items[0])				\
-            < (ht)->size						\
+         *_hurd_ihash_valuep =						\
+	   (hurd_ihash_value_t *) _hurd_ihash_iter_first (ht);		\
+       _hurd_ihash_valuep						\
          && (val = *_hurd_ihash_valuep, 1);				\
        _hurd_ihash_valuep = (hurd_ihash_value_t *)			\
-	 (((_hurd_ihash_item_t) _hurd_ihash_valuep) + 1))		\
+	 _hurd_ihash_iter_next ((ht),					\
+				(_hurd_ihash_item_t) _hurd_ihash_valuep)) \
     if (val != _HURD_IHASH_EMPTY && val != _HURD_IHASH_DELETED)
 
 /* Iterate over all elements in the hash table making both the key and
@@ -345,9 +425,9 @@ hurd_ihash_value_t hurd_ihash_locp_find (hurd_ihash_t ht,
    key and value of the current element is available as ITEM->key and
    ITEM->value.  */
 #define HURD_IHASH_ITERATE_ITEMS(ht, item)                              \
-  for (_hurd_ihash_item_t item = (ht)->size? &(ht)->items[0]: 0;	\
-       (ht)->size && item - &(ht)->items[0] < (ht)->size;               \
-       item++)                                                          \
+  for (_hurd_ihash_item_t item = _hurd_ihash_iter_first (ht);		\
+       item;								\
+       item = _hurd_ihash_iter_next ((ht), item))			\
     if (item->value != _HURD_IHASH_EMPTY &&                             \
         item->value != _HURD_IHASH_DELETED)
 
@@ -20,6 +20,90 @@
 #include <stdio.h>
 #include <string.h>
 
+/* What to do with each page of a data request once the pagemap has
+   been consulted.  */
+enum
+  {
+    PAGE_SKIP,			/* someone else will supply it */
+    PAGE_READ,			/* read it from the backing store */
+    PAGE_FAIL,			/* the data is known to be bad */
+  };
+
+/* Default for the optional pager_read_pages callback: decline, so that
+   the pages are read one at a time with pager_read_page.  */
+error_t __attribute__ ((weak))
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t offset,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *write_lock)
+{
+  return EOPNOTSUPP;
+}
+
+/* Read LENGTH bytes at OFFSET one page at a time and hand each page
+   (or the error) to the kernel.  */
+static void
+read_single_pages (struct pager *p, vm_offset_t offset, vm_size_t length)
+{
+  vm_offset_t end = offset + length;
+
+  for (; offset < end; offset += __vm_page_size)
+    {
+      error_t err;
+      vm_address_t page;
+      int write_lock;
+
+      err = pager_read_page (p->upi, offset, &page, &write_lock);
+      if (err)
+	memory_object_data_error (p->memobjcntl, offset, __vm_page_size, EIO);
+      else
+	memory_object_data_supply (p->memobjcntl, offset, page,
+				   __vm_page_size, 1,
+				   write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
+				   p->notify_on_evict ? 1 : 0,
+				   MACH_PORT_NULL);
+
+      pthread_mutex_lock (&p->interlock);
+      _pager_mark_object_error (p, offset, __vm_page_size, err ? EIO : 0);
+      pthread_mutex_unlock (&p->interlock);
+    }
+}
+
+/* Read the run of LENGTH bytes at OFFSET, all of which need to be
+   fetched from the backing store, and supply it to the kernel.  Try
+   to do it with a single call to pager_read_pages; if the user
+   declines or fails, fall back to reading each page separately so
+   that errors are attributed to the right pages.  */
+static void
+read_run (struct pager *p, vm_offset_t offset, vm_size_t length)
+{
+  error_t err;
+  vm_address_t buf;
+  int write_lock;
+
+  if (length == __vm_page_size)
+    {
+      read_single_pages (p, offset, length);
+      return;
+    }
+
+  err = pager_read_pages (p->upi, offset, length, &buf, &write_lock);
+  if (err)
+    {
+      read_single_pages (p, offset, length);
+      return;
+    }
+
+  memory_object_data_supply (p->memobjcntl, offset, buf, length, 1,
+			     write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
+			     p->notify_on_evict ? 1 : 0,
+			     MACH_PORT_NULL);
+  pthread_mutex_lock (&p->interlock);
+  _pager_mark_object_error (p, offset, length, 0);
+  pthread_mutex_unlock (&p->interlock);
+}
+
 /* Implement pagein callback as described in <mach/memory_object.defs>. */
 kern_return_t
 _pager_S_memory_object_data_request (struct pager *p,
@@ -28,11 +112,9 @@ _pager_S_memory_object_data_request (struct pager *p,
 					  vm_size_t length,
 					  vm_prot_t access)
 {
-  short *pm_entry;
-  int doread, doerror;
+  char *action;
+  int npages, i, j;
   error_t err;
-  vm_address_t page;
-  int write_lock;
 
   if (!p
       || p->port.class != _pager_class)
@@ -41,13 +123,13 @@ _pager_S_memory_object_data_request (struct pager *p,
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
 
-  /* sanity checks -- we don't do multi-page requests yet.  */
+  /* sanity checks */
   if (control != p->memobjcntl)
     {
       printf ("incg data request: wrong control port\n");
       goto release_out;
     }
-  if (length != __vm_page_size)
+  if (length == 0 || length % __vm_page_size)
     {
       printf ("incg data request: bad length size %zd\n", length);
       goto release_out;
@@ -67,67 +149,82 @@ _pager_S_memory_object_data_request (struct pager *p,
       goto allow_release_out;
     }
 
-  err = _pager_pagemap_resize (p, offset + length);
+  err = _pager_pagemap_reserve (p, offset, length);
   if (err)
     goto allow_release_out;	/* Can't do much about the actual error.  */
 
-  /* If someone is paging this out right now, the disk contents are
-     unreliable, so we have to wait.  It is too expensive (right now) to
-     find the data and return it, and then interrupt the write, so we just
-     mark the page and have the writing thread do m_o_data_supply when it
-     gets around to it.  */
-  pm_entry = &p->pagemap[offset / __vm_page_size];
-  if (*pm_entry & PM_PAGINGOUT)
-    {
-      doread = 0;
-      *pm_entry |= PM_PAGEINWAIT;
-    }
-  else
-    doread = 1;
-
-  if (*pm_entry & PM_INVALID)
-    doerror = 1;
-  else
-    doerror = 0;
+  npages = length / __vm_page_size;
+  action = alloca (npages * sizeof *action);
 
-  *pm_entry |= PM_INCORE;
-
-  if (PM_NEXTERROR (*pm_entry) != PAGE_NOERR && (access & VM_PROT_WRITE))
+  for (i = 0; i < npages; i++)
     {
-      memory_object_data_error (control, offset, length,
-				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
-      _pager_mark_object_error (p, offset, length,
-				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
-      *pm_entry = SET_PM_NEXTERROR (*pm_entry, PAGE_NOERR);
-      doread = 0;
+      vm_offset_t page = offset + i * __vm_page_size;
+      short pm_entry = _pager_pagemap_get (p, page);
+
+      /* Take the page over from pager_read_ahead, which then leaves it
+	 out.  */
+      pm_entry &= ~PM_READAHEAD;
+
+      /* If someone is paging this out right now, the disk contents are
+	 unreliable, so we have to wait.  It is too expensive (right now)
+	 to find the data and return it, and then interrupt the write, so
+	 we just mark the page and have the writing thread do
+	 m_o_data_supply when it gets around to it.  */
+      if (pm_entry & PM_PAGINGOUT)
+	{
+	  action[i] = PAGE_SKIP;
+	  pm_entry |= PM_PAGEINWAIT;
+	}
+      else if (pm_entry & PM_INVALID)
+	action[i] = PAGE_FAIL;
+      else
+	action[i] = PAGE_READ;
+
+      pm_entry |= PM_INCORE;
+
+      if (PM_NEXTERROR (pm_entry) != PAGE_NOERR
+	  && (access & VM_PROT_WRITE))
+	{
+	  error_t page_err = _pager_page_errors[PM_NEXTERROR (pm_entry)];
+
+	  memory_object_data_error (control, page, __vm_page_size, page_err);
+	  pm_entry = SET_PM_NEXTERROR (pm_entry, PAGE_NOERR);
+	  _pager_pagemap_set (p, page, pm_entry);
+	  _pager_mark_object_error (p, page, __vm_page_size, page_err);
+	  action[i] = PAGE_SKIP;
+	}
+      else
+	_pager_pagemap_set (p, page, pm_entry);
     }
 
   /* Let someone else in.  */
   pthread_mutex_unlock (&p->interlock);
 
-  if (!doread)
-    goto allow_term_out;
-  if (doerror)
-    goto error_read;
+  /* Hand the pages to the backing store in runs that can be read
+     together.  */
+  for (i = 0; i < npages; i = j)
+    {
+      vm_offset_t page = offset + i * __vm_page_size;
 
-  err = pager_read_page (p->upi, offset, &page, &write_lock);
-  if (err)
-    goto error_read;
+      j = i + 1;
+      if (action[i] == PAGE_SKIP)
+	continue;
 
-  memory_object_data_supply (p->memobjcntl, offset, page, length, 1,
-			     write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
-			     p->notify_on_evict ? 1 : 0,
-			     MACH_PORT_NULL);
-  pthread_mutex_lock (&p->interlock);
-  _pager_mark_object_error (p, offset, length, 0);
-  _pager_allow_termination (p);
-  pthread_mutex_unlock (&p->interlock);
-  return 0;
+      if (action[i] == PAGE_FAIL)
+	{
+	  memory_object_data_error (p->memobjcntl, page, __vm_page_size, EIO);
+	  pthread_mutex_lock (&p->interlock);
+	  _pager_mark_object_error (p, page, __vm_page_size, EIO);
+	  pthread_mutex_unlock (&p->interlock);
+	  continue;
+	}
+
+      while (j < npages && action[j] == PAGE_READ)
+	j++;
+
+      read_run (p, page, (j - i) * __vm_page_size);
+    }
 
- error_read:
-  memory_object_data_error (p->memobjcntl, offset, length, EIO);
-  _pager_mark_object_error (p, offset, length, EIO);
- allow_term_out:
   pthread_mutex_lock (&p->interlock);
   _pager_allow_termination (p);
   pthread_mutex_unlock (&p->interlock);
@@ -21,6 +21,41 @@
 #include <string.h>
 #include <assert-backtrace.h>
 
+/* Default for the optional pager_write_pages callback: decline, so that
+   the pages are written one at a time with pager_write_page.  */
+error_t __attribute__ ((weak))
+pager_write_pages (struct user_pager_info *pager,
+		   vm_offset_t offset,
+		   vm_size_t length,
+		   vm_address_t buf)
+{
+  return EOPNOTSUPP;
+}
+
+/* Write the NPAGES contiguous pages at OFFSET, whose data is at DATA, to
+   the backing store, and set PAGERRS[I] to the result for the I-th page.
+   Try to do it with a single call to pager_write_pages; if the user
+   declines or fails, fall back to writing each page separately so that
+   errors are attributed to the right pages.  */
+static void
+write_run (struct pager *p, vm_offset_t offset, pointer_t data,
+	   int npages, error_t *pagerrs)
+{
+  int i;
+
+  if (npages > 1
+      && ! pager_write_pages (p->upi, offset, npages * vm_page_size, data))
+    {
+      memset (pagerrs, 0, npages * sizeof *pagerrs);
+      return;
+    }
+
+  for (i = 0; i < npages; i++)
+    pagerrs[i] = pager_write_page (p->upi,
+				   offset + (vm_page_size * i),
+				   data + (vm_page_size * i));
+}
+
 /* Worker function used by _pager_S_memory_object_data_return
    and _pager_S_memory_object_data_initialize.  All args are
    as for _pager_S_memory_object_data_return; the additional
@@ -35,8 +70,8 @@ _pager_do_write_request (struct pager *p,
 			 int kcopy,
 			 int initializing)
 {
-  short *pm_entries;
-  int npages, i;
+  short pm_entry;
+  int npages, i, j;
   char *notified;
   error_t *pagerrs;
   struct lock_request *lr;
@@ -86,18 +121,24 @@ _pager_do_write_request (struct pager *p,
   _pager_block_termination (p);	/* until we are done with the pagemap
 				   when the write completes. */
 
-  _pager_pagemap_resize (p, offset + length);
-
-  pm_entries = &p->pagemap[offset / __vm_page_size];
+  _pager_pagemap_reserve (p, offset, length);
 
   if (! dirty)
     {
       munmap ((void *) data, length);
       if (!kcopy) {
-        /* Prepare notified array.  */
+        /* Prepare notified array.  The kernel no longer has these
+	   pages.  */
         for (i = 0; i < npages; i++)
-          notified[i] = (p->notify_on_evict
-                         && ! (pm_entries[i] & PM_PAGEINWAIT));
+	  {
+	    vm_offset_t page = offset + (vm_page_size * i);
+
+	    pm_entry = _pager_pagemap_get (p, page);
+	    notified[i] = (p->notify_on_evict
+			   && ! (pm_entry & PM_PAGEINWAIT));
+	    if (! (pm_entry & PM_PAGEINWAIT))
+	      _pager_pagemap_set (p, page, pm_entry & ~PM_INCORE);
+	  }
 
         goto notify;
       }
@@ -115,12 +156,17 @@ _pager_do_write_request (struct pager *p,
   /* XXX: Is this still needed?  */
  retry:
   for (i = 0; i < npages; i++)
-    if (pm_entries[i] & PM_PAGINGOUT)
-      {
-	pm_entries[i] |= PM_WRITEWAIT;
-	pthread_cond_wait (&p->wakeup, &p->interlock);
-	goto retry;
-      }
+    {
+      vm_offset_t page = offset + (vm_page_size * i);
+
+      pm_entry = _pager_pagemap_get (p, page);
+      if (pm_entry & PM_PAGINGOUT)
+	{
+	  _pager_pagemap_set (p, page, pm_entry | PM_WRITEWAIT);
+	  pthread_cond_wait (&p->wakeup, &p->interlock);
+	  goto retry;
+	}
+    }
 
   /* Mark these pages as being paged out.  */
   if (initializing)
@@ -128,15 +174,28 @@ _pager_do_write_request (struct pager *p,
       assert_backtrace (npages <= 32);
       for (i = 0; i < npages; i++)
 	{
-	  if (pm_entries[i] & PM_INIT)
-	    omitdata |= 1 << i;
+	  vm_offset_t page = offset + (vm_page_size * i);
+
+	  /* Any readahead of the page is stale now.  */
+	  pm_entry = _pager_pagemap_get (p, page) & ~PM_READAHEAD;
+	  if (pm_entry & PM_INIT)
+	    {
+	      omitdata |= 1 << i;
+	      _pager_pagemap_set (p, page, pm_entry);
+	    }
 	  else
-	    pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
+	    _pager_pagemap_set (p, page, pm_entry | PM_PAGINGOUT | PM_INIT);
 	}
     }
   else
     for (i = 0; i < npages; i++)
-      pm_entries[i] |= PM_PAGINGOUT | PM_INIT;
+      {
+	vm_offset_t page = offset + (vm_page_size * i);
+
+	_pager_pagemap_set (p, page, ((_pager_pagemap_get (p, page)
+				       & ~PM_READAHEAD)
+				      | PM_PAGINGOUT | PM_INIT));
+      }
 
   /* If this write occurs while a lock is pending, record
      it.  We have to keep this list because a lock request
@@ -158,33 +217,43 @@ _pager_do_write_request (struct pager *p,
   /* Let someone else in. */
   pthread_mutex_unlock (&p->interlock);
 
-  /* This is inefficient; we should send all the pages to the device at once
-     but until the pager library interface is changed, this will have to do. */
+  /* Send each run of pages we have data for to the backing store in one
+     go.  */
+  for (i = 0; i < npages; i = j)
+    {
+      if (omitdata & (1 << i))
+	{
+	  j = i + 1;
+	  continue;
+	}
 
-  for (i = 0; i < npages; i++)
-    if (!(omitdata & (1 << i)))
-      pagerrs[i] = pager_write_page (p->upi,
-				     offset + (vm_page_size * i),
-				     data + (vm_page_size * i));
+      for (j = i + 1; j < npages && !(omitdata & (1 << j)); j++)
+	;
+
+      write_run (p, offset + (vm_page_size * i), data + (vm_page_size * i),
+		 j - i, &pagerrs[i]);
+    }
 
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
-  _pager_pagemap_resize (p, offset + length);
-  pm_entries = &p->pagemap[offset / __vm_page_size];
 
   wakeup = 0;
   for (i = 0; i < npages; i++)
     {
+      vm_offset_t page = offset + (vm_page_size * i);
+
       if (omitdata & (1 << i))
 	{
 	  notified[i] = 0;
 	  continue;
 	}
 
-      if (pm_entries[i] & PM_WRITEWAIT)
+      pm_entry = _pager_pagemap_get (p, page);
+
+      if (pm_entry & PM_WRITEWAIT)
 	wakeup = 1;
 
-      if (pagerrs[i] && ! (pm_entries[i] & PM_PAGEINWAIT))
+      if (pagerrs[i] && ! (pm_entry & PM_PAGEINWAIT))
 	/* The only thing we can do here is mark the page, and give
 	   errors from now on when it is to be read.  This is
 	   imperfect, because if all users go away, the pagemap will
@@ -192,9 +261,9 @@ _pager_do_write_request (struct pager *p,
 	   better than Un*x.  Of course, if we are about to hand this
 	   data to the kernel, the error isn't a problem, hence the
 	   check for pageinwait.  */
-	pm_entries[i] |= PM_INVALID;
+	pm_entry |= PM_INVALID;
 
-      if (pm_entries[i] & PM_PAGEINWAIT)
+      if (pm_entry & PM_PAGEINWAIT)
 	{
 	  memory_object_data_supply (p->memobjcntl,
 				     offset + (vm_page_size * i),
@@ -209,10 +278,11 @@ _pager_do_write_request (struct pager *p,
 		  vm_page_size);
 	  notified[i] = (! kcopy && p->notify_on_evict);
 	  if (! kcopy)
-	    pm_entries[i] &= ~PM_INCORE;
+	    pm_entry &= ~PM_INCORE;
 	}
 
-      pm_entries[i] &= ~(PM_PAGINGOUT | PM_PAGEINWAIT | PM_WRITEWAIT);
+      pm_entry &= ~(PM_PAGINGOUT | PM_PAGEINWAIT | PM_WRITEWAIT);
+      _pager_pagemap_set (p, page, pm_entry);
     }
 
   for (ll = lock_list; ll; ll = ll->next)
@@ -231,16 +301,18 @@ _pager_do_write_request (struct pager *p,
       assert_backtrace (notified[i] == 0 || notified[i] == 1);
       if (notified[i])
 	{
-	  short *pm_entry = &pm_entries[i];
+	  vm_offset_t page = offset + (i * vm_page_size);
 
 	  /* Do notify user.  */
-	  pager_notify_evict (p->upi, offset + (i * vm_page_size));
+	  pager_notify_evict (p->upi, page);
 
 	  /* Clear any error that is left.  Notification on eviction
 	     is used only to change association of page, so any
 	     error may no longer be valid.  */
 	  pthread_mutex_lock (&p->interlock);
-	  *pm_entry = SET_PM_ERROR (SET_PM_NEXTERROR (*pm_entry, 0), 0);
+	  pm_entry = _pager_pagemap_get (p, page);
+	  _pager_pagemap_set (p, page,
+			      SET_PM_ERROR (SET_PM_NEXTERROR (pm_entry, 0), 0));
 	  pthread_mutex_unlock (&p->interlock);
 	}
     }
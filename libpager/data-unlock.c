@@ -74,7 +74,9 @@ _pager_S_memory_object_data_unlock (struct pager *p,
 	 to issue an error.  */
       _pager_lock_object (p, offset, length, MEMORY_OBJECT_RETURN_NONE, 1,
 			  VM_PROT_WRITE, 0);
+      pthread_mutex_lock (&p->interlock);
       _pager_mark_next_request_error (p, offset, length, err);
+      pthread_mutex_unlock (&p->interlock);
     }
  out:
   return 0;
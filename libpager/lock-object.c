@@ -30,7 +30,6 @@ _pager_lock_object (struct pager *p,
 		    vm_prot_t lock_value,
 		    int sync)
 {
-  int i;
   struct lock_request *lr = 0;
 
   pthread_mutex_lock (&p->interlock);
@@ -86,20 +85,9 @@ _pager_lock_object (struct pager *p,
 
       if (should_flush)
 	{
-	  vm_offset_t pm_offs = offset / __vm_page_size;
-
-	  _pager_pagemap_resize (p, offset + size);
-	  if (p->pagemapsize > pm_offs)
-	    {
-	      short *pm_entries = &p->pagemap[pm_offs];
-	      vm_offset_t bound = size / vm_page_size;
-
-	      if (bound > p->pagemapsize)
-		bound = p->pagemapsize;
-
-	      for (i = 0; i < bound; i++)
-		pm_entries[i] &= ~PM_INCORE;
-	    }
+	  /* A readahead in progress may have read what is gone now.  */
+	  _pager_pagemap_clear_bits (p, offset, size,
+				     PM_INCORE | PM_READAHEAD);
 	}
     }
 
@@ -32,10 +32,7 @@ _pager_mark_next_request_error(struct pager *pager,
 			       error_t error)
 {
   int page_error;
-  short *p;
-
-  offset /= __vm_page_size;
-  length /= __vm_page_size;
+  vm_address_t end = offset + length;
   
   switch (error)
     {
@@ -54,8 +51,10 @@ _pager_mark_next_request_error(struct pager *pager,
       break;
     }
   
-  for (p = pager->pagemap + offset; p < pager->pagemap + offset + length; p++)
-    *p = SET_PM_NEXTERROR (*p, page_error);
+  for (; offset < end; offset += __vm_page_size)
+    _pager_pagemap_set (pager, offset,
+			SET_PM_NEXTERROR (_pager_pagemap_get (pager, offset),
+					  page_error));
 }
 
 /* We are returning a pager error to the kernel.  Write down
@@ -70,10 +69,7 @@ _pager_mark_object_error(struct pager *pager,
 			 error_t error)
 {
   int page_error = 0;
-  short *p;
-
-  offset /= __vm_page_size;
-  length /= __vm_page_size;
+  vm_address_t end = offset + length;
   
   switch (error)
     {
@@ -92,8 +88,10 @@ _pager_mark_object_error(struct pager *pager,
       break;
     }
   
-  for (p = pager->pagemap + offset; p < pager->pagemap + offset + length; p++)
-    *p = SET_PM_ERROR (*p, page_error);
+  for (; offset < end; offset += __vm_page_size)
+    _pager_pagemap_set (pager, offset,
+			SET_PM_ERROR (_pager_pagemap_get (pager, offset),
+				      page_error));
 }
 
 /* Tell us what the error (set with mark_object_error) for 
@@ -105,16 +103,9 @@ pager_get_error (struct pager *p, vm_address_t addr)
   
   pthread_mutex_lock (&p->interlock);
 
-  addr /= vm_page_size;
-
-  /* If there really is no error for ADDR, we should be able to exted the
-     pagemap table; otherwise, if some previous operation failed because it
-     couldn't extend the table, this attempt will *probably* (heh) fail for
-     the same reason.  */
-  err = _pager_pagemap_resize (p, addr);
-
-  if (! err)
-    err = _pager_page_errors[PM_ERROR(p->pagemap[addr])];
+  /* Pages never touched have no pagemap entry, which reads as zero, that
+     is no error.  */
+  err = _pager_page_errors[PM_ERROR (_pager_pagemap_get (p, addr))];
 
   pthread_mutex_unlock (&p->interlock);
 
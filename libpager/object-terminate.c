@@ -116,12 +116,7 @@ _pager_free_structure (struct pager *p)
     }
 
   /* Free the pagemap */
-  if (p->pagemapsize)
-    {
-      munmap (p->pagemap, p->pagemapsize * sizeof (* p->pagemap));
-      p->pagemapsize = 0;
-      p->pagemap = 0;
-    }
+  _pager_pagemap_free (p);
   
   p->pager_state = NOTINIT;
 }
@@ -30,17 +30,16 @@ pager_offer_page (struct pager *p,
 {
   pthread_mutex_lock (&p->interlock);
 
-  if (_pager_pagemap_resize (p, offset + vm_page_size))
+  if (! _pager_pagemap_reserve (p, offset, vm_page_size))
     {
-      short *pm_entry = &p->pagemap[offset / vm_page_size];
-
-      while (*pm_entry & PM_INCORE)
+      while (_pager_pagemap_get (p, offset) & PM_INCORE)
 	{
 	  pthread_mutex_unlock (&p->interlock);
 	  pager_flush_some (p, offset, vm_page_size, 1);
 	  pthread_mutex_lock (&p->interlock);
 	}
-      *pm_entry |= PM_INCORE;
+      _pager_pagemap_set (p, offset,
+			  _pager_pagemap_get (p, offset) | PM_INCORE);
 
       memory_object_data_supply (p->memobjcntl, offset, buf, vm_page_size, 0,
 				 writelock ? VM_PROT_WRITE : VM_PROT_NONE, 
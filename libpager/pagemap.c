@@ -16,32 +16,331 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include "priv.h"
-#include <string.h>
-  
-/* Grow the pagemap of pager P as necessary to deal with address OFF */
+#include <stdlib.h>
+#include <assert-backtrace.h>
+
+/* The pagemap is a radix tree indexed by page number.  Interior nodes
+   and leaves both have PAGEMAP_FANOUT slots; the leaves hold the
+   pagemap entries themselves.  A tree of height H has H levels of
+   interior nodes above the leaves.  Subtrees are only allocated once a
+   non-zero entry is stored in them, and are freed again when all their
+   entries have returned to zero, so a sparse object costs memory in
+   proportion to the pages actually touched.  */
+
+struct pagemap_leaf
+{
+  int count;			/* number of non-zero entries */
+  short entries[PAGEMAP_FANOUT];
+};
+
+struct pagemap_node
+{
+  int count;			/* number of non-null slots */
+  void *slots[PAGEMAP_FANOUT];
+};
+
+/* Return the height of the smallest tree that can hold PAGE.  */
+static int
+height_for (vm_offset_t page)
+{
+  int height = 0;
+
+  while (height < PAGEMAP_MAX_HEIGHT
+	 && (page >> (PAGEMAP_SHIFT * (height + 1))) != 0)
+    height++;
+
+  return height;
+}
+
+/* Return the index of PAGE in a node at level LEVEL of the tree (the
+   leaves being at level 0).  */
+static inline int
+slot_index (vm_offset_t page, int level)
+{
+  return (page >> (PAGEMAP_SHIFT * level)) & (PAGEMAP_FANOUT - 1);
+}
+
+/* Make the pagemap of P tall enough to hold PAGE.  */
+static error_t
+pagemap_grow (struct pager *p, vm_offset_t page)
+{
+  int height = height_for (page);
+
+  if (! p->pagemap)
+    {
+      p->pagemapheight = height;
+      return 0;
+    }
+
+  while (p->pagemapheight < height)
+    {
+      struct pagemap_node *root = calloc (1, sizeof *root);
+      if (! root)
+	return ENOMEM;
+
+      root->slots[0] = p->pagemap;
+      root->count = 1;
+      p->pagemap = root;
+      p->pagemapheight++;
+      p->pagemapbytes += sizeof *root;
+    }
+
+  return 0;
+}
+
+/* Free the node PATH[LEVEL] of the pagemap of P, which holds PAGE and
+   has nothing left in it, and any node above it left empty.  */
+static void
+pagemap_prune (struct pager *p, vm_offset_t page, void **path, int level)
+{
+  free (path[level]);
+  p->pagemapbytes -= (level > 0
+		      ? sizeof (struct pagemap_node)
+		      : sizeof (struct pagemap_leaf));
+
+  for (level++; level <= p->pagemapheight; level++)
+    {
+      struct pagemap_node *node = path[level];
+
+      node->slots[slot_index (page, level)] = NULL;
+      if (--node->count > 0)
+	return;
+
+      free (node);
+      p->pagemapbytes -= sizeof *node;
+    }
+
+  p->pagemap = NULL;
+  p->pagemapheight = 0;
+}
+
+/* Find the leaf of the pagemap of P holding PAGE.  If CREATE is set,
+   allocate any missing part of the tree, otherwise return NULL if the
+   leaf does not exist.  If PATH is not NULL, fill in the nodes visited,
+   PATH[LEVEL] being the node at level LEVEL.  */
+static struct pagemap_leaf *
+pagemap_find_leaf (struct pager *p, vm_offset_t page, int create,
+		   void **path)
+{
+  void *nodes[PAGEMAP_MAX_HEIGHT + 1];
+  void **slot = &p->pagemap;
+  struct pagemap_node *parent = NULL;
+  int level;
+
+  if (! path)
+    path = nodes;
+
+  if (create)
+    {
+      if (pagemap_grow (p, page))
+	return NULL;
+    }
+  else if (! p->pagemap || height_for (page) > p->pagemapheight)
+    return NULL;
+
+  for (level = p->pagemapheight; level >= 0; level--)
+    {
+      void *child = *slot;
+
+      if (! child)
+	{
+	  size_t size;
+
+	  if (! create)
+	    return NULL;
+
+	  size = (level > 0
+		  ? sizeof (struct pagemap_node)
+		  : sizeof (struct pagemap_leaf));
+	  child = calloc (1, size);
+	  if (! child)
+	    {
+	      /* Don't leave the nodes made on the way here behind
+		 empty.  */
+	      if (parent && parent->count == 0)
+		pagemap_prune (p, page, path, level + 1);
+	      return NULL;
+	    }
+
+	  *slot = child;
+	  p->pagemapbytes += size;
+	  if (parent)
+	    parent->count++;
+	}
+
+      path[level] = child;
+
+      if (level > 0)
+	{
+	  parent = child;
+	  slot = &parent->slots[slot_index (page, level)];
+	}
+    }
+
+  return *slot;
+}
+
+/* Make sure the pagemap of P has room for the entries of the LENGTH bytes
+   starting at OFFSET, so that setting them cannot fail.  */
+error_t
+_pager_pagemap_reserve (struct pager *p, vm_offset_t offset,
+			vm_size_t length)
+{
+  vm_offset_t page = offset / __vm_page_size;
+  vm_offset_t end = (offset + length + __vm_page_size - 1) / __vm_page_size;
+
+  while (page < end)
+    {
+      if (! pagemap_find_leaf (p, page, 1, NULL))
+	return ENOMEM;
+
+      /* Skip to the first page of the next leaf.  */
+      page = (page | (PAGEMAP_FANOUT - 1)) + 1;
+    }
+
+  return 0;
+}
+
+/* Return the pagemap entry of P for the page at OFFSET.  */
+short
+_pager_pagemap_get (struct pager *p, vm_offset_t offset)
+{
+  vm_offset_t page = offset / __vm_page_size;
+  struct pagemap_leaf *leaf = pagemap_find_leaf (p, page, 0, NULL);
+
+  return leaf ? leaf->entries[page & (PAGEMAP_FANOUT - 1)] : 0;
+}
+
+/* Set the pagemap entry of P for the page at OFFSET to VALUE.  */
 error_t
-_pager_pagemap_resize (struct pager *p, vm_address_t off)
+_pager_pagemap_set (struct pager *p, vm_offset_t offset, short value)
+{
+  vm_offset_t page = offset / __vm_page_size;
+  void *path[PAGEMAP_MAX_HEIGHT + 1];
+  struct pagemap_leaf *leaf;
+  short *entry;
+
+  leaf = pagemap_find_leaf (p, page, value != 0, path);
+  if (! leaf)
+    return value ? ENOMEM : 0;
+
+  entry = &leaf->entries[page & (PAGEMAP_FANOUT - 1)];
+  if (*entry == 0 && value != 0)
+    leaf->count++;
+  else if (*entry != 0 && value == 0)
+    {
+      assert_backtrace (leaf->count > 0);
+      leaf->count--;
+    }
+  *entry = value;
+
+  if (leaf->count == 0)
+    pagemap_prune (p, page, path, 0);
+
+  return 0;
+}
+
+/* Clear BITS in the entries for the pages in [START, END) of the subtree
+   NODE of the pagemap of P, which is at level LEVEL and whose first page
+   is BASE.  Free any part of the subtree left without non-zero entries,
+   and return non-zero if that includes NODE itself.  */
+static int
+clear_bits (struct pager *p, void *node, int level, vm_offset_t base,
+	    vm_offset_t start, vm_offset_t end, short bits)
 {
-  error_t err = 0;
-  
-  off /= __vm_page_size;
+  int i;
 
-  if (p->pagemapsize < off)
+  if (level == 0)
     {
-      void *newaddr;
-      int newsize = round_page (off);
+      struct pagemap_leaf *leaf = node;
+      int first = start > base ? start - base : 0;
+      int last = end - base < PAGEMAP_FANOUT ? end - base : PAGEMAP_FANOUT;
 
-      newaddr = mmap (0, newsize * sizeof (*p->pagemap), 
-		      PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-      err = (newaddr == (void *) -1) ? errno : 0;
-      if (! err)
+      for (i = first; i < last; i++)
+	if ((leaf->entries[i] & bits) && ! (leaf->entries[i] &= ~bits))
+	  leaf->count--;
+
+      if (leaf->count > 0)
+	return 0;
+
+      free (leaf);
+      p->pagemapbytes -= sizeof *leaf;
+      return 1;
+    }
+  else
+    {
+      struct pagemap_node *n = node;
+      vm_offset_t span = (vm_offset_t) 1 << (PAGEMAP_SHIFT * level);
+
+      for (i = 0; i < PAGEMAP_FANOUT; i++)
 	{
-	  memcpy (newaddr, p->pagemap, p->pagemapsize * sizeof (*p->pagemap));
-	  munmap (p->pagemap, p->pagemapsize * sizeof (*p->pagemap));
-	  p->pagemap = newaddr;
-	  p->pagemapsize = newsize;
+	  vm_offset_t child_base = base + i * span;
+
+	  if (child_base >= end)
+	    break;
+	  if (child_base + span <= start || ! n->slots[i])
+	    continue;
+
+	  if (clear_bits (p, n->slots[i], level - 1, child_base,
+			  start, end, bits))
+	    {
+	      n->slots[i] = NULL;
+	      n->count--;
+	    }
 	}
+
+      if (n->count > 0)
+	return 0;
+
+      free (n);
+      p->pagemapbytes -= sizeof *n;
+      return 1;
     }
+}
+
+/* Clear BITS in the pagemap entries of P for the LENGTH bytes starting at
+   OFFSET.  Only the parts of the pagemap that exist are visited.  */
+void
+_pager_pagemap_clear_bits (struct pager *p, vm_offset_t offset,
+			   vm_size_t length, short bits)
+{
+  vm_offset_t page = offset / __vm_page_size;
+  vm_offset_t end = (page + length / __vm_page_size
+		     + (length % __vm_page_size != 0));
+
+  if (p->pagemap
+      && clear_bits (p, p->pagemap, p->pagemapheight, 0, page, end, bits))
+    {
+      p->pagemap = NULL;
+      p->pagemapheight = 0;
+    }
+}
+
+/* Free the subtree NODE of height LEVEL.  */
+static void
+pagemap_free_node (void *node, int level)
+{
+  if (level > 0)
+    {
+      struct pagemap_node *n = node;
+      int i;
+
+      for (i = 0; i < PAGEMAP_FANOUT; i++)
+	if (n->slots[i])
+	  pagemap_free_node (n->slots[i], level - 1);
+    }
+
+  free (node);
+}
+
+/* Free the whole pagemap of P.  */
+void
+_pager_pagemap_free (struct pager *p)
+{
+  if (p->pagemap)
+    pagemap_free_node (p->pagemap, p->pagemapheight);
 
-  return err;
+  p->pagemap = NULL;
+  p->pagemapheight = 0;
+  p->pagemapbytes = 0;
 }
@@ -42,8 +42,10 @@ _pager_create (size_t size,
   p->memobjname = MACH_PORT_NULL;
   p->noterm = 0;
   p->termwaiting = 0;
+  p->readingahead = 0;
   p->pagemap = 0;
-  p->pagemapsize = 0;
+  p->pagemapheight = 0;
+  p->pagemapbytes = 0;
 
   return p;
 }
@@ -0,0 +1,27 @@
+/* Pager statistics
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "priv.h"
+
+/* Fill in *STATS with the current statistics of pager P.  */
+void
+pager_get_stats (struct pager *p, struct pager_stats *stats)
+{
+  pthread_mutex_lock (&p->interlock);
+  stats->pagemap_size = p->pagemapbytes;
+  pthread_mutex_unlock (&p->interlock);
+}
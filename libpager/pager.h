@@ -139,6 +139,18 @@ pager_offer_page (struct pager *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);  
 
+/* Read the pages among the LENGTH bytes at OFFSET of pager PAGER that
+   the kernel does not have yet, with pager_read_pages, and supply them
+   as though it had asked for them.  Pages the kernel has, or which are
+   being written, are left alone.  Nothing is read if pager_read_pages
+   is not provided, or if another readahead of PAGER is in progress.
+   This is meant to be called from a thread of the user's own, to read
+   ahead of sequential accesses.  */
+void
+pager_read_ahead (struct pager *pager,
+		  vm_offset_t offset,
+		  vm_size_t length);
+
 /* Change the attributes of the memory object underlying pager PAGER.
    Arguments MAY_CACHE and COPY_STRATEGY are as for
    memory_object_change_attributes.  Wait for the kernel to report
@@ -163,6 +175,17 @@ pager_get_port (struct pager *pager);
 void
 pager_shutdown (struct pager *pager);
 
+/* Statistics about a pager, see pager_get_stats.  */
+struct pager_stats
+{
+  vm_size_t pagemap_size;	/* bytes of memory used by the pagemap */
+};
+
+/* Fill in *STATS with the current statistics of pager P.  */
+void
+pager_get_stats (struct pager *p,
+		 struct pager_stats *stats);
+
 /* Return the error code of the last page error for pager P at address ADDR;
    this will be deleted when the kernel interface is fixed.  */
 error_t
@@ -190,6 +213,21 @@ pager_read_page (struct user_pager_info *pager,
 		 vm_address_t *buf,
 		 int *write_lock);
 
+/* The user may define this function.  For pager PAGER, read LENGTH
+   bytes (a multiple of the page size greater than one page) starting
+   at offset OFFSET.  Set *BUF to be the address of a single buffer
+   holding all the pages, and set *WRITE_LOCK if the pages must be
+   provided read-only.  If an error is returned, including EOPNOTSUPP
+   for ranges the user does not wish to handle, the pages are instead
+   read individually with pager_read_page.  The default implementation
+   always returns EOPNOTSUPP.  */
+error_t
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t offset,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *write_lock);
+
 /* The user must define this function.  For pager PAGER, synchronously
    write one page from BUF to offset PAGE.  In addition, mfree
    (or equivalent) BUF.  The only permissible error returns are EIO,
@@ -199,6 +237,19 @@ pager_write_page (struct user_pager_info *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);
 
+/* The user may define this function.  For pager PAGER, synchronously
+   write LENGTH bytes (a multiple of the page size greater than one page)
+   from BUF to offset OFFSET.  BUF must not be freed.  If an error is
+   returned, including EOPNOTSUPP for ranges the user does not wish to
+   handle, the pages are instead written individually with
+   pager_write_page.  The default implementation always returns
+   EOPNOTSUPP.  */
+error_t
+pager_write_pages (struct user_pager_info *pager,
+		   vm_offset_t offset,
+		   vm_size_t length,
+		   vm_address_t buf);
+
 /* The user must define this function.  A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *pager,
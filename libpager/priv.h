@@ -58,6 +58,7 @@ struct pager
   int noterm;			/* number of threads blocking termination */
 
   int termwaiting:1;
+  int readingahead:1;		/* a pager_read_ahead is in progress */
 
 #ifdef KERNEL_INIT_RACE
   /* Out of sequence object_init calls waiting for
@@ -65,8 +66,9 @@ struct pager
   struct pending_init *init_head, *init_tail;
 #endif
 
-  short *pagemap;
-  int pagemapsize;		/* number of elements in PAGEMAP */
+  void *pagemap;		/* root of the pagemap tree, see pagemap.c */
+  int pagemapheight;		/* levels of interior nodes in PAGEMAP */
+  vm_size_t pagemapbytes;	/* memory used by PAGEMAP */
 };
 
 struct lock_request
@@ -106,8 +108,15 @@ enum page_errors
 
 extern int _pager_page_errors[];
 
+/* Pagemap layout: a radix tree with 2^PAGEMAP_SHIFT entries per node,
+   deep enough to index every page of a vm_offset_t.  */
+#define PAGEMAP_SHIFT 9
+#define PAGEMAP_FANOUT (1 << PAGEMAP_SHIFT)
+#define PAGEMAP_MAX_HEIGHT 6
+
 /* Pagemap format */
 /* These are binary state bits */
+#define PM_READAHEAD  0x0400	/* being read by pager_read_ahead */
 #define PM_WRITEWAIT  0x0200	/* queue wakeup once write is done */
 #define PM_INIT       0x0100    /* data has been written */
 #define PM_INCORE     0x0080	/* kernel might have a copy */
@@ -133,7 +142,12 @@ struct port_class *_pager_class;
 
 void _pager_block_termination (struct pager *);
 void _pager_allow_termination (struct pager *);
-error_t _pager_pagemap_resize (struct pager *, vm_address_t);
+error_t _pager_pagemap_reserve (struct pager *, vm_offset_t, vm_size_t);
+short _pager_pagemap_get (struct pager *, vm_offset_t);
+error_t _pager_pagemap_set (struct pager *, vm_offset_t, short);
+void _pager_pagemap_clear_bits (struct pager *, vm_offset_t, vm_size_t,
+				short);
+void _pager_pagemap_free (struct pager *);
 void _pager_mark_next_request_error (struct pager *, vm_address_t,
 				     vm_size_t, error_t);
 void _pager_mark_object_error (struct pager *, vm_address_t,
@@ -0,0 +1,140 @@
+/* Reading pages before the kernel asks for them
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "priv.h"
+#include <sys/mman.h>
+
+/* Return whether the page at OFFSET is still claimed by the readahead:
+   no data request took it over, and no data return touched it, since.
+   Only one readahead runs at a time, so the claim is ours.  P's
+   interlock must be held.  */
+static inline int
+still_wanted (struct pager *p, vm_offset_t offset)
+{
+  return _pager_pagemap_get (p, offset) & PM_READAHEAD;
+}
+
+/* Read the LENGTH bytes at OFFSET with pager_read_pages and supply
+   those pages that are still wanted to the kernel.  */
+static void
+read_ahead_run (struct pager *p, vm_offset_t offset, vm_size_t length)
+{
+  error_t err;
+  vm_address_t buf;
+  vm_offset_t start, end, page;
+  int write_lock;
+
+  err = pager_read_pages (p->upi, offset, length, &buf, &write_lock);
+
+  pthread_mutex_lock (&p->interlock);
+
+  if (err)
+    /* Let the kernel ask for these pages when it wants them.  */
+    {
+      for (end = offset + length; offset < end; offset += __vm_page_size)
+	_pager_pagemap_set (p, offset,
+			    _pager_pagemap_get (p, offset) & ~PM_READAHEAD);
+      pthread_mutex_unlock (&p->interlock);
+      return;
+    }
+
+  /* Pages taken over by a data request are supplied by it, and pages
+     written since may be stale in our copy; leave those out.  */
+  for (start = offset; start < offset + length; start = end)
+    {
+      end = start + __vm_page_size;
+      if (! still_wanted (p, start))
+	continue;
+      while (end < offset + length && still_wanted (p, end))
+	end += __vm_page_size;
+
+      for (page = start; page < end; page += __vm_page_size)
+	_pager_pagemap_set (p, page, ((_pager_pagemap_get (p, page)
+				       & ~PM_READAHEAD) | PM_INCORE));
+
+      memory_object_data_supply (p->memobjcntl, start,
+				 buf + (start - offset), end - start, 0,
+				 write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
+				 p->notify_on_evict ? 1 : 0,
+				 MACH_PORT_NULL);
+      _pager_mark_object_error (p, start, end - start, 0);
+    }
+
+  pthread_mutex_unlock (&p->interlock);
+
+  munmap ((void *) buf, length);
+}
+
+/* Read the pages of P among the LENGTH bytes at OFFSET that the kernel
+   doesn't have, and supply them to it, as though it had asked.  */
+void
+pager_read_ahead (struct pager *p, vm_offset_t offset, vm_size_t length)
+{
+  vm_offset_t end;
+  char *wanted;
+  int npages, i, j;
+
+  if (length == 0)
+    return;
+
+  pthread_mutex_lock (&p->interlock);
+
+  if (p->pager_state != NORMAL || p->readingahead
+      || _pager_pagemap_reserve (p, offset, length))
+    {
+      pthread_mutex_unlock (&p->interlock);
+      return;
+    }
+
+  p->readingahead = 1;
+  _pager_block_termination (p);
+
+  npages = length / __vm_page_size;
+  wanted = alloca (npages);
+
+  /* Claim the pages nobody has.  A data request coming in meanwhile
+     takes the page over, so that it is never supplied twice.  */
+  for (i = 0; i < npages; i++)
+    {
+      vm_offset_t page = offset + i * __vm_page_size;
+      short pm_entry = _pager_pagemap_get (p, page);
+
+      wanted[i] = !(pm_entry & (PM_INCORE | PM_PAGINGOUT | PM_INVALID));
+      if (wanted[i])
+	_pager_pagemap_set (p, page, pm_entry | PM_READAHEAD);
+    }
+
+  pthread_mutex_unlock (&p->interlock);
+
+  for (i = 0; i < npages; i = j)
+    {
+      j = i + 1;
+      if (! wanted[i])
+	continue;
+      while (j < npages && wanted[j])
+	j++;
+
+      end = offset + j * __vm_page_size;
+      read_ahead_run (p, offset + i * __vm_page_size,
+		      end - (offset + i * __vm_page_size));
+    }
+
+  pthread_mutex_lock (&p->interlock);
+  p->readingahead = 0;
+  _pager_allow_termination (p);
+  pthread_mutex_unlock (&p->interlock);
+}
@@ -0,0 +1,220 @@
+/* Serving a bucket with a bounded pool of threads
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ports.h"
+#include <errno.h>
+#include <error.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+error_t
+ports_set_bucket_pool (struct port_bucket *bucket,
+		       unsigned int min_threads, unsigned int max_threads)
+{
+  struct ports_pool *pool;
+
+  if (min_threads < 1 || max_threads < min_threads)
+    return EINVAL;
+
+  pool = bucket->pool;
+  if (pool == NULL)
+    {
+      pool = calloc (1, sizeof *pool);
+      if (pool == NULL)
+	return ENOMEM;
+      pthread_mutex_init (&pool->lock, NULL);
+      pool->queue_tail = &pool->queue;
+    }
+
+  __atomic_store_n (&pool->min_threads, min_threads, __ATOMIC_RELAXED);
+  __atomic_store_n (&pool->max_threads, max_threads, __ATOMIC_RELAXED);
+
+  /* Buckets are never destroyed, so neither is POOL.  */
+  bucket->pool = pool;
+  return 0;
+}
+
+error_t
+ports_get_bucket_pool_stats (struct port_bucket *bucket,
+			     struct ports_pool_stats *stats)
+{
+  struct ports_pool *pool = bucket->pool;
+  struct ports_pool_thread *t;
+
+  if (pool == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock (&pool->lock);
+  *stats = pool->stats;
+  stats->pending = pool->pending;
+  for (t = pool->threads; t; t = t->next)
+    {
+      stats->requests += t->requests;
+      stats->total_latency += t->total_latency;
+      if (t->max_latency > stats->max_latency)
+	stats->max_latency = t->max_latency;
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return 0;
+}
+
+unsigned long long
+_ports_pool_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+error_t
+_ports_pool_enqueue (struct ports_pool *pool, mach_msg_header_t *inp)
+{
+  struct ports_pool_msg *m;
+
+  m = malloc (offsetof (struct ports_pool_msg, msg) + inp->msgh_size);
+  if (m == NULL)
+    return ENOMEM;
+
+  /* The rights and memory the message carries go with the copy.  */
+  memcpy (&m->msg, inp, inp->msgh_size);
+  m->next = NULL;
+  m->queued_at = _ports_pool_now ();
+
+  pthread_mutex_lock (&pool->lock);
+  *pool->queue_tail = m;
+  pool->queue_tail = &m->next;
+  pool->pending++;
+  pool->stats.queued++;
+  pthread_mutex_unlock (&pool->lock);
+  return 0;
+}
+
+struct ports_pool_msg *
+_ports_pool_dequeue (struct ports_pool *pool)
+{
+  struct ports_pool_msg *m;
+
+  /* Save taking the lock in the usual case.  */
+  if (__atomic_load_n (&pool->queue, __ATOMIC_RELAXED) == NULL)
+    return NULL;
+
+  pthread_mutex_lock (&pool->lock);
+  m = pool->queue;
+  if (m)
+    {
+      pool->queue = m->next;
+      if (pool->queue == NULL)
+	pool->queue_tail = &pool->queue;
+      pool->pending--;
+      pool->stats.total_wait += _ports_pool_now () - m->queued_at;
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return m;
+}
+
+/* This is the second half of mach_msg_server_timeout.  */
+void
+_ports_pool_reply (mach_msg_header_t *request, mig_reply_header_t *reply)
+{
+  error_t err;
+
+  switch (reply->RetCode)
+    {
+    case KERN_SUCCESS:
+      break;
+
+    case MIG_NO_REPLY:
+      /* The server function wanted no reply sent.  */
+      return;
+
+    default:
+      /* Some error; destroy the request message to release any port
+	 rights or VM it holds.  Don't destroy the reply port right, so
+	 we can send an error message.  */
+      request->msgh_remote_port = MACH_PORT_NULL;
+      mach_msg_destroy (request);
+      break;
+    }
+
+  if (reply->Head.msgh_remote_port == MACH_PORT_NULL)
+    {
+      /* No reply port, so destroy the reply.  */
+      if (reply->Head.msgh_bits & MACH_MSGH_BITS_COMPLEX)
+	mach_msg_destroy (&reply->Head);
+      return;
+    }
+
+  /* Don't let a client that doesn't receive its replies hold up the
+     thread, unless the reply port is a send-once right.  */
+  err = mach_msg (&reply->Head,
+		  MACH_SEND_MSG
+		  | (MACH_MSGH_BITS_REMOTE (reply->Head.msgh_bits)
+		     == MACH_MSG_TYPE_MOVE_SEND_ONCE ? 0 : MACH_SEND_TIMEOUT),
+		  reply->Head.msgh_size, 0, MACH_PORT_NULL,
+		  0, MACH_PORT_NULL);
+  switch (err)
+    {
+    case MACH_MSG_SUCCESS:
+      break;
+
+    case MACH_SEND_INVALID_DEST:
+    case MACH_SEND_TIMED_OUT:
+      /* The requester went away or doesn't listen.  */
+      mach_msg_destroy (&reply->Head);
+      break;
+
+    default:
+      error (0, err, "mach_msg");
+    }
+}
+
+void
+_ports_pool_thread_start (struct ports_pool *pool,
+			  struct ports_pool_thread *thread)
+{
+  memset (thread, 0, sizeof *thread);
+
+  pthread_mutex_lock (&pool->lock);
+  thread->next = pool->threads;
+  if (thread->next)
+    thread->next->prevp = &thread->next;
+  thread->prevp = &pool->threads;
+  pool->threads = thread;
+  if (++pool->stats.threads > pool->stats.peak_threads)
+    pool->stats.peak_threads = pool->stats.threads;
+  pthread_mutex_unlock (&pool->lock);
+}
+
+void
+_ports_pool_thread_end (struct ports_pool *pool,
+			struct ports_pool_thread *thread)
+{
+  pthread_mutex_lock (&pool->lock);
+  *thread->prevp = thread->next;
+  if (thread->next)
+    thread->next->prevp = thread->prevp;
+  pool->stats.threads--;
+
+  /* Keep what THREAD did in the totals.  */
+  pool->stats.requests += thread->requests;
+  pool->stats.total_latency += thread->total_latency;
+  if (thread->max_latency > pool->stats.max_latency)
+    pool->stats.max_latency = thread->max_latency;
+  pthread_mutex_unlock (&pool->lock);
+}
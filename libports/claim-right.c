@@ -37,6 +37,7 @@ ports_claim_right (void *portstruct)
   pthread_rwlock_wrlock (&_ports_htable_lock);
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+  _ports_table_remove (pi->bucket, ret);
   pthread_rwlock_unlock (&_ports_htable_lock);
   err = mach_port_move_member (mach_task_self (), ret, MACH_PORT_NULL);
   assert_perror_backtrace (err);
@@ -45,6 +45,7 @@ _ports_complete_deallocate (struct port_info *pi)
 
       hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
       hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+      _ports_table_remove (pi->bucket, pi->port_right);
       pthread_rwlock_unlock (&_ports_htable_lock);
 
       mach_port_mod_refs (mach_task_self (), pi->port_right,
@@ -61,6 +62,7 @@ _ports_complete_deallocate (struct port_info *pi)
 
   if (pi->class->clean_routine)
     (*pi->class->clean_routine)(pi);
-  
-  free (pi);
+
+  /* Threads looking up ports without a lock may still look at PI.  */
+  _ports_free_deferred (&pi->bucket->threadpool, pi);
 }
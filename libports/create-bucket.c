@@ -47,6 +47,10 @@ ports_create_bucket ()
     }
 
   hurd_ihash_init (&ret->htable, offsetof (struct port_info, hentry));
+  hurd_ihash_set_flags (&ret->htable,
+			HURD_IHASH_CONTROL_BYTES | HURD_IHASH_INCREMENTAL);
+  ret->lookup_table = NULL;
+  ret->pool = NULL;
   ret->rpcs = ret->flags = ret->count = 0;
   _ports_threadpool_init (&ret->threadpool);
   return ret;
@@ -94,6 +94,14 @@ _ports_create_port_internal (struct port_class *class,
       pthread_rwlock_unlock (&_ports_htable_lock);
       goto lose;
     }
+  err = _ports_table_add (bucket, port, pi);
+  if (err)
+    {
+      hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
+      hurd_ihash_locp_remove (&bucket->htable, pi->hentry);
+      pthread_rwlock_unlock (&_ports_htable_lock);
+      goto lose;
+    }
   pthread_rwlock_unlock (&_ports_htable_lock);
 
   bucket->count++;
@@ -65,6 +65,7 @@ ports_destroy_right (void *portstruct)
       pthread_rwlock_wrlock (&_ports_htable_lock);
       hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
       hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+      _ports_table_remove (pi->bucket, port_right);
       pthread_rwlock_unlock (&_ports_htable_lock);
     }
   pthread_mutex_unlock (&_ports_lock);
@@ -88,6 +88,14 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
       pthread_rwlock_unlock (&_ports_htable_lock);
       goto lose;
     }
+  err = _ports_table_add (bucket, port, pi);
+  if (err)
+    {
+      hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
+      hurd_ihash_locp_remove (&bucket->htable, pi->hentry);
+      pthread_rwlock_unlock (&_ports_htable_lock);
+      goto lose;
+    }
   pthread_rwlock_unlock (&_ports_htable_lock);
 
   bucket->count++;
@@ -25,7 +25,10 @@ pthread_mutex_t _ports_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t _ports_block = PTHREAD_COND_INITIALIZER;
 
 struct hurd_ihash _ports_htable =
-  HURD_IHASH_INITIALIZER (offsetof (struct port_info, ports_htable_entry));
+  HURD_IHASH_INITIALIZER_FLAGS (offsetof (struct port_info,
+					 ports_htable_entry),
+				HURD_IHASH_CONTROL_BYTES
+				| HURD_IHASH_INCREMENTAL);
 pthread_rwlock_t _ports_htable_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 int _ports_total_rpcs;
@@ -28,6 +28,19 @@ ports_lookup_port (struct port_bucket *bucket,
 {
   struct port_info *pi;
 
+  if (bucket && _ports_current_threadpool == &bucket->threadpool)
+    /* We serve BUCKET, so whatever we find there stays valid until we
+       ask for the next message.  */
+    {
+      pi = _ports_table_lookup (bucket, port);
+      if (pi && class && pi->class != class)
+	{
+	  ports_port_deref (pi);
+	  pi = 0;
+	}
+      return pi;
+    }
+
   pthread_rwlock_rdlock (&_ports_htable_lock);
 
   pi = hurd_ihash_find (&_ports_htable, port);
@@ -22,6 +22,8 @@
 #include <assert-backtrace.h>
 #include <error.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <mach/message.h>
 #include <mach/thread_info.h>
 #include <mach/thread_switch.h>
@@ -112,6 +114,9 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   unsigned int totalthreads = 1;
   unsigned int nreqthreads = 1;
 
+  /* If set, bounds totalthreads, see ports_set_bucket_pool.  */
+  struct ports_pool *pool = bucket->pool;
+
   pthread_attr_t attr;
 
   auto void * thread_function (void *);
@@ -119,9 +124,49 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   pthread_attr_init (&attr);
   pthread_attr_setstacksize (&attr, STACK_SIZE);
 
+  /* Start a listening thread, already counted in totalthreads.  */
+  void
+  spawn_thread (void)
+    {
+      pthread_t pthread_id;
+      error_t err;
+
+      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+
+      err = pthread_create (&pthread_id, &attr, thread_function, NULL);
+      if (!err)
+	pthread_detach (pthread_id);
+      else
+	{
+	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	  /* There is not much we can do at this point.  The code
+	     and design of the Hurd servers just don't handle
+	     thread creation failure.  */
+	  errno = err;
+	  perror ("pthread_create");
+	}
+    }
+
+  /* Count a new thread in totalthreads, unless the pool is full.  */
   int
-  internal_demuxer (mach_msg_header_t *inp,
-		    mach_msg_header_t *outheadp)
+  reserve_thread (void)
+    {
+      unsigned int n = __atomic_load_n (&totalthreads, __ATOMIC_RELAXED);
+
+      do
+	if (n >= __atomic_load_n (&pool->max_threads, __ATOMIC_RELAXED))
+	  return 0;
+      while (! __atomic_compare_exchange_n (&totalthreads, &n, n + 1, 1,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED));
+      return 1;
+    }
+
+  /* Handle INP, with the calling thread already counted busy.  */
+  int
+  dispatch (mach_msg_header_t *inp,
+	    mach_msg_header_t *outheadp)
     {
       int status;
       struct port_info *pi;
@@ -137,30 +182,6 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 		/* msgt_unused = */		0
 	};
 
-      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
-	/* No thread would be listening for requests, spawn one. */
-	{
-	  pthread_t pthread_id;
-	  error_t err;
-
-	  __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	  __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-
-	  err = pthread_create (&pthread_id, &attr, thread_function, NULL);
-	  if (!err)
-	    pthread_detach (pthread_id);
-	  else
-	    {
-	      __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	      __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-	      /* There is not much we can do at this point.  The code
-		 and design of the Hurd servers just don't handle
-		 thread creation failure.  */
-	      errno = err;
-	      perror ("pthread_create");
-	    }
-	}
-      
       /* Fill in default response. */
       outp->Head.msgh_bits 
 	= MACH_MSGH_BITS(MACH_MSGH_BITS_REMOTE(inp->msgh_bits), 0);
@@ -220,15 +241,137 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	  status = 1;
 	}
 
+      return status;
+    }
+
+  int
+  internal_demuxer (mach_msg_header_t *inp,
+		    mach_msg_header_t *outheadp)
+    {
+      int status;
+
+      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
+	/* No thread would be listening for requests, spawn one. */
+	{
+	  __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  spawn_thread ();
+	}
+
+      status = dispatch (inp, outheadp);
+
       __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
 
       return status;
     }
 
+  /* Like mach_msg_server_timeout, but first handle the requests that
+     were queued while POOL was full, and account for the time spent
+     in SELF.  */
+  error_t
+  pool_server (struct ports_thread *thread, struct ports_pool_thread *self,
+	       int timeout)
+    {
+      mach_msg_size_t size = vm_page_size;
+      mach_msg_header_t *request, *inp;
+      mig_reply_header_t *reply;
+      struct ports_pool_msg *queued;
+      unsigned long long start;
+      unsigned long latency;
+      error_t err;
+
+      request = malloc (size);
+      reply = malloc (size);
+      if (request == NULL || reply == NULL)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+
+      for (;;)
+	{
+	  queued = NULL;
+	  if (__atomic_load_n (&pool->queue, __ATOMIC_RELAXED))
+	    {
+	      /* Only take queued requests if another thread keeps
+		 listening.  */
+	      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) > 0)
+		queued = _ports_pool_dequeue (pool);
+	      if (queued == NULL)
+		__atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	    }
+
+	  if (queued)
+	    inp = &queued->msg;
+	  else
+	    {
+	      err = mach_msg (request, MACH_RCV_MSG | MACH_RCV_LARGE
+			      | (timeout ? MACH_RCV_TIMEOUT : 0),
+			      0, size, bucket->portset,
+			      timeout, MACH_PORT_NULL);
+	      if (err == MACH_RCV_TOO_LARGE)
+		{
+		  /* The message is still queued; make room for it.  */
+		  mach_msg_size_t new_size = round_page (request->msgh_size);
+		  void *new_request = realloc (request, new_size);
+		  if (new_request)
+		    request = new_request;
+		  void *new_reply = realloc (reply, new_size);
+		  if (new_reply)
+		    reply = new_reply;
+		  if (new_request == NULL || new_reply == NULL)
+		    {
+		      err = ENOMEM;
+		      goto out;
+		    }
+		  size = new_size;
+		  continue;
+		}
+	      if (err)
+		goto out;
+
+	      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
+		/* No thread would be listening for requests.  */
+		{
+		  if (reserve_thread ())
+		    spawn_thread ();
+		  else if (! _ports_pool_enqueue (pool, request))
+		    {
+		      /* The pool is full.  Leave the request to the next
+			 thread done with its own, and keep listening.  */
+		      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+		      continue;
+		    }
+		}
+	      inp = request;
+	    }
+
+	  start = _ports_pool_now ();
+	  dispatch (inp, &reply->Head);
+	  __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+
+	  _ports_pool_reply (inp, reply);
+	  free (queued);
+
+	  latency = _ports_pool_now () - start;
+	  self->requests++;
+	  self->total_latency += latency;
+	  if (latency > self->max_latency)
+	    self->max_latency = latency;
+
+	  _ports_thread_quiescent (&bucket->threadpool, thread);
+	}
+
+    out:
+      free (request);
+      free (reply);
+      return err;
+    }
+
   void *
   thread_function (void *arg)
     {
       struct ports_thread thread;
+      struct ports_pool_thread self;
       int master = (int) arg;
       int timeout;
       error_t err;
@@ -252,15 +395,28 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	timeout = thread_timeout;
 
       _ports_thread_online (&bucket->threadpool, &thread);
+      if (pool)
+	_ports_pool_thread_start (pool, &self);
 
     startover:
 
-      do
-	err = mach_msg_server_timeout (synchronized_demuxer,
-				       0, bucket->portset,
-				       timeout ? MACH_RCV_TIMEOUT : 0,
-				       timeout);
-      while (err != MACH_RCV_TIMED_OUT);
+      if (pool)
+	{
+	  err = pool_server (&thread, &self, timeout);
+	  if (err && err != MACH_RCV_TIMED_OUT)
+	    {
+	      /* Don't spin on a persistent error.  */
+	      error (0, err, "mach_msg");
+	      sleep (1);
+	    }
+	}
+      else
+	do
+	  err = mach_msg_server_timeout (synchronized_demuxer,
+					 0, bucket->portset,
+					 timeout ? MACH_RCV_TIMEOUT : 0,
+					 timeout);
+	while (err != MACH_RCV_TIMED_OUT);
 
       if (master)
 	{
@@ -275,8 +431,27 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
 	      goto startover;
 	    }
-	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  if (pool)
+	    {
+	      /* Keep the pool at its minimum size.  */
+	      unsigned int n = __atomic_load_n (&totalthreads,
+						__ATOMIC_RELAXED);
+	      do
+		if (n <= __atomic_load_n (&pool->min_threads,
+					  __ATOMIC_RELAXED))
+		  {
+		    __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+		    goto startover;
+		  }
+	      while (! __atomic_compare_exchange_n (&totalthreads, &n, n - 1,
+						    1, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED));
+	    }
+	  else
+	    __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
 	}
+      if (pool)
+	_ports_pool_thread_end (pool, &self);
       _ports_thread_offline (&bucket->threadpool, &thread);
       return NULL;
     }
@@ -287,5 +462,12 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
      master thread from going away.  */
   global_timeout = 0;
 
+  if (pool)
+    /* Start with the smallest pool, counting this thread.  */
+    while (__atomic_load_n (&totalthreads, __ATOMIC_RELAXED)
+	   < __atomic_load_n (&pool->min_threads, __ATOMIC_RELAXED)
+	   && reserve_thread ())
+      spawn_thread ();
+
   thread_function ((void *) 1);
 }
@@ -52,8 +52,10 @@ _ports_threadpool_init (struct ports_threadpool *pool)
   pool->color = COLOR_BLACK;
   pool->old_threads = 0;
   pool->old_objects = NULL;
+  pool->old_frees = NULL;
   pool->young_threads = 0;
   pool->young_objects = NULL;
+  pool->young_frees = NULL;
 }
 
 /* Turn all young objects and threads into old ones.  */
@@ -63,11 +65,15 @@ flip_generations (struct ports_threadpool *pool)
   assert_backtrace (pool->old_threads == 0);
   pool->old_threads = pool->young_threads;
   pool->old_objects = pool->young_objects;
+  pool->old_frees = pool->young_frees;
   pool->young_threads = 0;
   pool->young_objects = NULL;
+  pool->young_frees = NULL;
   pool->color = flip_color (pool->color);
 }
 
+__thread struct ports_threadpool *_ports_current_threadpool;
+
 /* Called by a thread to join a thread pool.  */
 void
 _ports_thread_online (struct ports_threadpool *pool,
@@ -77,6 +83,7 @@ _ports_thread_online (struct ports_threadpool *pool,
   thread->color = flip_color (pool->color);
   pool->young_threads += 1;
   pthread_spin_unlock (&pool->lock);
+  _ports_current_threadpool = pool;
 }
 
 struct pi_list
@@ -85,12 +92,63 @@ struct pi_list
   struct port_info *pi;
 };
 
+/* Release the objects on OBJECTS and free the memory on FREES.  */
+static void
+release (struct pi_list *objects, void *frees)
+{
+  struct pi_list *p;
+  void *next;
+
+  for (p = objects; p;)
+    {
+      struct pi_list *old = p;
+      p = p->next;
+
+      ports_port_deref (old->pi);
+      free (old);
+    }
+
+  for (; frees; frees = next)
+    {
+      next = *(void **) frees;
+      free (frees);
+    }
+}
+
+/* Something was just added to the young generation of POOL, which must
+   be locked.  If no old threads are left, make it old.  If there are
+   no threads at all, nobody can see it anymore; return it in *OBJECTS
+   and *FREES for the caller to release once it has unlocked POOL.  */
+static void
+deferred_locked (struct ports_threadpool *pool,
+		 struct pi_list **objects, void **frees)
+{
+  *objects = NULL;
+  *frees = NULL;
+
+  if (pool->old_threads == 0)
+    {
+      assert_backtrace (pool->old_objects == NULL);
+      assert_backtrace (pool->old_frees == NULL);
+      flip_generations (pool);
+
+      if (pool->old_threads == 0)
+	{
+	  *objects = pool->old_objects;
+	  *frees = pool->old_frees;
+	  pool->old_objects = NULL;
+	  pool->old_frees = NULL;
+	}
+    }
+}
+
 /* Called by a thread that enters its quiescent period.  */
 void
 _ports_thread_quiescent (struct ports_threadpool *pool,
 			 struct ports_thread *thread)
 {
-  struct pi_list *free_list = NULL, *p;
+  struct pi_list *free_list = NULL;
+  void *frees = NULL;
   assert_backtrace (valid_color (thread->color));
 
   pthread_spin_lock (&pool->lock);
@@ -103,19 +161,13 @@ _ports_thread_quiescent (struct ports_threadpool *pool,
       if (pool->old_threads == 0)
 	{
 	  free_list = pool->old_objects;
+	  frees = pool->old_frees;
 	  flip_generations (pool);
 	}
     }
   pthread_spin_unlock (&pool->lock);
 
-  for (p = free_list; p;)
-    {
-      struct pi_list *old = p;
-      p = p->next;
-
-      ports_port_deref (old->pi);
-      free (old);
-    }
+  release (free_list, frees);
 }
 
 /* Called by a thread to leave a thread pool.  */
@@ -136,6 +188,8 @@ _ports_thread_offline (struct ports_threadpool *pool,
   thread->color = COLOR_INVALID;
   pool->young_threads -= 1;
   pthread_spin_unlock (&pool->lock);
+  if (_ports_current_threadpool == pool)
+    _ports_current_threadpool = NULL;
 }
 
 /* Schedule an object for deallocation.  */
@@ -143,6 +197,8 @@ void
 _ports_port_deref_deferred (struct port_info *pi)
 {
   struct ports_threadpool *pool = &pi->bucket->threadpool;
+  struct pi_list *objects;
+  void *frees;
 
   struct pi_list *pl = malloc (sizeof *pl);
   if (pl == NULL)
@@ -152,10 +208,25 @@ _ports_port_deref_deferred (struct port_info *pi)
   pthread_spin_lock (&pool->lock);
   pl->next = pool->young_objects;
   pool->young_objects = pl;
-  if (pool->old_threads == 0)
-    {
-      assert_backtrace (pool->old_objects == NULL);
-      flip_generations (pool);
-    }
+  deferred_locked (pool, &objects, &frees);
+  pthread_spin_unlock (&pool->lock);
+
+  release (objects, frees);
+}
+
+/* Free MEM once all threads in POOL have gone through a quiescent
+   state.  */
+void
+_ports_free_deferred (struct ports_threadpool *pool, void *mem)
+{
+  struct pi_list *objects;
+  void *frees;
+
+  pthread_spin_lock (&pool->lock);
+  *(void **) mem = pool->young_frees;
+  pool->young_frees = mem;
+  deferred_locked (pool, &objects, &frees);
   pthread_spin_unlock (&pool->lock);
+
+  release (objects, frees);
 }
@@ -54,6 +54,10 @@ struct ports_threadpool
      and objects.  */
   struct pi_list *old_objects;
 
+  /* Memory to free along with the old objects, chained through its
+     first word.  */
+  void *old_frees;
+
   /* The number of young threads.  Any thread joining or leaving the
      thread group must be a young thread.  */
   size_t young_threads;
@@ -61,6 +65,9 @@ struct ports_threadpool
   /* The list of young objects.  Any object being marked for delayed
      deallocation is added to this list.  */
   struct pi_list *young_objects;
+
+  /* Memory to free along with the young objects.  */
+  void *young_frees;
 };
 
 /* Per-thread state.  */
@@ -86,4 +93,14 @@ struct port_info;
 /* Schedule an object for deallocation.  */
 void _ports_port_deref_deferred (struct port_info *);
 
+/* Free MEM, which must be at least as big as a pointer, once all
+   threads in POOL have gone through a quiescent state.  MEM may be
+   used in the meantime to keep track of it.  */
+void _ports_free_deferred (struct ports_threadpool *pool, void *mem);
+
+/* The thread pool the calling thread is online in, if any.  Until the
+   thread next enters a quiescent period, memory freed with
+   _ports_free_deferred in that pool stays valid.  */
+extern __thread struct ports_threadpool *_ports_current_threadpool;
+
 #endif	/* _HURD_PORTS_DEREF_DEFERRED_ */
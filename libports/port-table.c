@@ -0,0 +1,210 @@
+/* Looking up ports by name without taking a lock
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ports.h"
+#include <errno.h>
+#include <stdlib.h>
+
+/* Each bucket maps the names of its ports to their port_info in an
+   open-addressed table, which threads serving the bucket read without
+   any lock.  Writers hold _ports_htable_lock.
+
+   A slot, once given a name, keeps it until the table is rebuilt; a
+   removed port merely leaves its pointer cleared.  Readers thus never
+   see a name paired with another name's port.  Rebuilt tables and freed
+   port_info structures are only freed once all the threads of the
+   bucket went through a quiescent state, see port-deref-deferred.c.  */
+
+struct ports_table_slot
+{
+  mach_port_t name;
+  struct port_info *pi;
+};
+
+struct ports_table
+{
+  /* Used to chain the table for _ports_free_deferred.  */
+  void *next;
+
+  size_t mask;			/* Number of slots minus one */
+  size_t used;			/* Slots with a name */
+  size_t live;			/* Slots with a port */
+  struct ports_table_slot slots[];
+};
+
+#define MIN_SLOTS	16
+
+static inline size_t
+slot_index (struct ports_table *table, mach_port_t name)
+{
+  unsigned int h = name * 2654435761U;
+  return (h ^ (h >> 16)) & table->mask;
+}
+
+/* Make a new table for BUCKET with room for COUNT ports, and move its
+   ports there.  */
+static error_t
+rebuild (struct port_bucket *bucket, size_t count)
+{
+  struct ports_table *old = bucket->lookup_table, *new;
+  size_t size, i, j;
+
+  for (size = MIN_SLOTS; size < count * 2; size *= 2)
+    ;
+
+  new = calloc (1, sizeof *new + size * sizeof new->slots[0]);
+  if (new == NULL)
+    return ENOMEM;
+  new->mask = size - 1;
+
+  if (old)
+    for (i = 0; i <= old->mask; i++)
+      if (old->slots[i].pi)
+	{
+	  for (j = slot_index (new, old->slots[i].name);
+	       new->slots[j].name != MACH_PORT_NULL;
+	       j = (j + 1) & new->mask)
+	    ;
+	  new->slots[j] = old->slots[i];
+	  new->used++;
+	  new->live++;
+	}
+
+  __atomic_store_n (&bucket->lookup_table, new, __ATOMIC_RELEASE);
+
+  if (old)
+    _ports_free_deferred (&bucket->threadpool, old);
+  return 0;
+}
+
+/* Make NAME refer to PI in the lookup table of BUCKET.
+   _ports_htable_lock must be held for writing.  */
+error_t
+_ports_table_add (struct port_bucket *bucket, mach_port_t name,
+		  struct port_info *pi)
+{
+  struct ports_table *table = bucket->lookup_table;
+  size_t i;
+  error_t err;
+
+  if (table == NULL || (table->used + 1) * 4 > (table->mask + 1) * 3)
+    {
+      err = rebuild (bucket, table ? table->live + 1 : 1);
+      if (err)
+	return err;
+      table = bucket->lookup_table;
+    }
+
+  for (i = slot_index (table, name);
+       table->slots[i].name != MACH_PORT_NULL
+	 && table->slots[i].name != name;
+       i = (i + 1) & table->mask)
+    ;
+
+  if (table->slots[i].name == MACH_PORT_NULL)
+    {
+      /* Readers look at the port only once they see the name.  */
+      table->slots[i].pi = pi;
+      __atomic_store_n (&table->slots[i].name, name, __ATOMIC_RELEASE);
+      table->used++;
+    }
+  else
+    __atomic_store_n (&table->slots[i].pi, pi, __ATOMIC_RELEASE);
+
+  table->live++;
+  return 0;
+}
+
+/* Remove NAME from the lookup table of BUCKET.  _ports_htable_lock must
+   be held for writing.  */
+void
+_ports_table_remove (struct port_bucket *bucket, mach_port_t name)
+{
+  struct ports_table *table = bucket->lookup_table;
+  size_t i;
+
+  if (table == NULL)
+    return;
+
+  for (i = slot_index (table, name);
+       table->slots[i].name != MACH_PORT_NULL;
+       i = (i + 1) & table->mask)
+    if (table->slots[i].name == name)
+      {
+	if (table->slots[i].pi)
+	  {
+	    __atomic_store_n (&table->slots[i].pi, NULL, __ATOMIC_RELEASE);
+	    table->live--;
+	  }
+	return;
+      }
+}
+
+/* Return the port named NAME in BUCKET, with a new hard reference, or
+   NULL.  The calling thread must be online in the thread pool of
+   BUCKET.  */
+struct port_info *
+_ports_table_lookup (struct port_bucket *bucket, mach_port_t name)
+{
+  struct ports_table *table;
+  struct port_info *pi = NULL;
+  union _references old, new;
+  mach_port_t n;
+  size_t i;
+
+  table = __atomic_load_n (&bucket->lookup_table, __ATOMIC_ACQUIRE);
+  if (table == NULL)
+    return NULL;
+
+  for (i = slot_index (table, name);; i = (i + 1) & table->mask)
+    {
+      n = __atomic_load_n (&table->slots[i].name, __ATOMIC_ACQUIRE);
+      if (n == MACH_PORT_NULL)
+	return NULL;
+      if (n == name)
+	{
+	  pi = __atomic_load_n (&table->slots[i].pi, __ATOMIC_ACQUIRE);
+	  break;
+	}
+    }
+  if (pi == NULL)
+    return NULL;
+
+  /* Take a reference, unless PI is on its way to
+     _ports_complete_deallocate already.  */
+  old.value = __atomic_load_n (&pi->refcounts.value, __ATOMIC_RELAXED);
+  do
+    {
+      if (old.references.hard == 0 && old.references.weak == 0)
+	return NULL;
+      new = old;
+      new.references.hard++;
+    }
+  while (! __atomic_compare_exchange_n (&pi->refcounts.value, &old.value,
+					new.value, 1, __ATOMIC_ACQUIRE,
+					__ATOMIC_RELAXED));
+
+  /* PI may have lost NAME while we looked.  */
+  if (__atomic_load_n (&pi->port_right, __ATOMIC_RELAXED) != name)
+    {
+      ports_port_deref (pi);
+      return NULL;
+    }
+
+  return pi;
+}
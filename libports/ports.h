@@ -76,10 +76,15 @@ struct port_bucket
   /* Per-bucket hash table used for fast iteration.  Access must be
      serialized using _ports_htable_lock.  */
   struct hurd_ihash htable;
+  /* Lock-free index of the same ports by name, see port-table.c.  */
+  struct ports_table *lookup_table;
   int rpcs;
   int flags;
   int count;
   struct ports_threadpool threadpool;
+  /* Bounds on the threads serving the bucket, see
+     ports_set_bucket_pool.  */
+  struct ports_pool *pool;
 };
 /* FLAGS above are the following: */
 #define PORT_BUCKET_INHIBITED	PORTS_INHIBITED
@@ -384,6 +389,36 @@ void ports_manage_port_operations_multithread (struct port_bucket *bucket,
 					       int global_timeout,
 					       void (*hook)(void));
 
+/* Make ports_manage_port_operations_multithread serve BUCKET with at
+   least MIN_THREADS and at most MAX_THREADS threads, instead of starting
+   a new thread whenever all are busy.  Threads beyond MIN_THREADS still
+   die off after the thread timeout.  Requests arriving while
+   MAX_THREADS threads are busy wait in an overflow queue until one is
+   done; only use this for buckets whose RPCs never wait for other RPCs
+   on the same bucket.  This takes effect when serving BUCKET starts;
+   the bounds may be changed at any time.  */
+error_t ports_set_bucket_pool (struct port_bucket *bucket,
+			       unsigned int min_threads,
+			       unsigned int max_threads);
+
+/* Statistics of a bucket served by a bounded pool of threads.  */
+struct ports_pool_stats
+{
+  unsigned int threads;		/* Threads serving the bucket now */
+  unsigned int peak_threads;	/* Most threads at any time */
+  unsigned long requests;	/* Requests handled */
+  unsigned long queued;		/* Requests that waited in the overflow queue */
+  unsigned long pending;	/* Requests waiting there now */
+  unsigned long long total_latency; /* Microseconds spent handling requests */
+  unsigned long max_latency;	/* Longest request, in microseconds */
+  unsigned long long total_wait; /* Microseconds spent in the queue */
+};
+
+/* Return in *STATS the statistics of the thread pool of BUCKET, or
+   EINVAL if BUCKET has none.  */
+error_t ports_get_bucket_pool_stats (struct port_bucket *bucket,
+				     struct ports_pool_stats *stats);
+
 /* Interrupt any pending RPC on PORT.  Wait for all pending RPC's to
    finish, and then block any new RPC's starting on that port. */
 error_t ports_inhibit_port_rpcs (void *port);
@@ -478,6 +513,72 @@ extern struct hurd_ihash _ports_htable;
 /* Access to all hash tables is protected by this lock.  */
 extern pthread_rwlock_t _ports_htable_lock;
 
+/* Make NAME refer to PI in the lock-free lookup table of BUCKET, or
+   remove it from there.  _ports_htable_lock must be held for
+   writing.  */
+error_t _ports_table_add (struct port_bucket *bucket, mach_port_t name,
+			  struct port_info *pi);
+void _ports_table_remove (struct port_bucket *bucket, mach_port_t name);
+
+/* Return the port named NAME in BUCKET, with a new hard reference, or
+   NULL, without taking a lock.  The calling thread must be online in the
+   thread pool of BUCKET.  */
+struct port_info *_ports_table_lookup (struct port_bucket *bucket,
+				       mach_port_t name);
+
+/* A request received while all threads of a pool were busy.  */
+struct ports_pool_msg
+{
+  struct ports_pool_msg *next;
+  unsigned long long queued_at;	/* When, in microseconds */
+  mach_msg_header_t msg;	/* Followed by the rest of the message */
+};
+
+/* What a thread of a pool has done so far.  Each thread updates its own
+   counters without locking.  */
+struct ports_pool_thread
+{
+  struct ports_pool_thread *next, **prevp;
+  unsigned long requests;
+  unsigned long long total_latency;
+  unsigned long max_latency;
+};
+
+struct ports_pool
+{
+  unsigned int min_threads;
+  unsigned int max_threads;
+
+  /* Protects the rest.  */
+  pthread_mutex_t lock;
+  struct ports_pool_msg *queue, **queue_tail;
+  unsigned long pending;
+  struct ports_pool_thread *threads;
+  /* The counters of threads gone and of the queue.  */
+  struct ports_pool_stats stats;
+};
+
+/* Current time in microseconds, for the accounting of pools.  */
+unsigned long long _ports_pool_now (void);
+
+/* Take over the request INP, which a thread of POOL received while all
+   others were busy, for the next thread done with its request.  */
+error_t _ports_pool_enqueue (struct ports_pool *pool, mach_msg_header_t *inp);
+
+/* Return the oldest request queued in POOL, or NULL.  The caller frees
+   it once it is handled.  */
+struct ports_pool_msg *_ports_pool_dequeue (struct ports_pool *pool);
+
+/* Send REPLY, the answer of a demuxer to REQUEST, and release REQUEST,
+   like mach_msg_server does.  */
+void _ports_pool_reply (mach_msg_header_t *request, mig_reply_header_t *reply);
+
+/* Add or remove the calling thread, accounted in THREAD, to POOL.  */
+void _ports_pool_thread_start (struct ports_pool *pool,
+			       struct ports_pool_thread *thread);
+void _ports_pool_thread_end (struct ports_pool *pool,
+			     struct ports_pool_thread *thread);
+
 extern int _ports_total_rpcs;
 extern int _ports_flags;
 #define _PORTS_INHIBITED	PORTS_INHIBITED
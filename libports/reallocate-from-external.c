@@ -46,6 +46,7 @@ ports_reallocate_from_external (void *portstruct, mach_port_t receive)
   pthread_rwlock_wrlock (&_ports_htable_lock);
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+  _ports_table_remove (pi->bucket, pi->port_right);
   pthread_rwlock_unlock (&_ports_htable_lock);
 
   if ((pi->flags & PORT_HAS_SENDRIGHTS) && !stat.mps_srights)
@@ -67,6 +68,8 @@ ports_reallocate_from_external (void *portstruct, mach_port_t receive)
   err = hurd_ihash_add (&_ports_htable, receive, pi);
   assert_perror_backtrace (err);
   err = hurd_ihash_add (&pi->bucket->htable, receive, pi);
+  if (! err)
+    err = _ports_table_add (pi->bucket, receive, pi);
   pthread_rwlock_unlock (&_ports_htable_lock);
   pthread_mutex_unlock (&_ports_lock);
   assert_perror_backtrace (err);
@@ -39,6 +39,7 @@ ports_reallocate_port (void *portstruct)
   pthread_rwlock_wrlock (&_ports_htable_lock);
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+  _ports_table_remove (pi->bucket, pi->port_right);
   pthread_rwlock_unlock (&_ports_htable_lock);
 
   err = mach_port_allocate (mach_task_self (), MACH_PORT_RIGHT_RECEIVE,
@@ -55,6 +56,8 @@ ports_reallocate_port (void *portstruct)
   err = hurd_ihash_add (&_ports_htable, pi->port_right, pi);
   assert_perror_backtrace (err);
   err = hurd_ihash_add (&pi->bucket->htable, pi->port_right, pi);
+  if (! err)
+    err = _ports_table_add (pi->bucket, pi->port_right, pi);
   pthread_rwlock_unlock (&_ports_htable_lock);
   pthread_mutex_unlock (&_ports_lock);
   assert_perror_backtrace (err);
@@ -44,6 +44,7 @@ ports_transfer_right (void *tostruct,
       pthread_rwlock_wrlock (&_ports_htable_lock);
       hurd_ihash_locp_remove (&_ports_htable, frompi->ports_htable_entry);
       hurd_ihash_locp_remove (&frompi->bucket->htable, frompi->hentry);
+      _ports_table_remove (frompi->bucket, port);
       pthread_rwlock_unlock (&_ports_htable_lock);
       frompi->port_right = MACH_PORT_NULL;
       if (frompi->flags & PORT_HAS_SENDRIGHTS)
@@ -60,6 +61,7 @@ ports_transfer_right (void *tostruct,
       pthread_rwlock_wrlock (&_ports_htable_lock);
       hurd_ihash_locp_remove (&_ports_htable, topi->ports_htable_entry);
       hurd_ihash_locp_remove (&topi->bucket->htable, topi->hentry);
+      _ports_table_remove (topi->bucket, topi->port_right);
       pthread_rwlock_unlock (&_ports_htable_lock);
       err = mach_port_mod_refs (mach_task_self (), topi->port_right,
 				MACH_PORT_RIGHT_RECEIVE, -1);
@@ -89,6 +91,8 @@ ports_transfer_right (void *tostruct,
       err = hurd_ihash_add (&_ports_htable, port, topi);
       assert_perror_backtrace (err);
       err = hurd_ihash_add (&topi->bucket->htable, port, topi);
+      if (! err)
+	err = _ports_table_add (topi->bucket, port, topi);
       pthread_rwlock_unlock (&_ports_htable_lock);
       assert_perror_backtrace (err);
       /* This is an optimization.  It may fail.  */
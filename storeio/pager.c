@@ -66,6 +66,44 @@ pager_read_page (struct user_pager_info *upi,
     return 0;
 }
 
+/* For pager PAGER, read LENGTH bytes from offset PAGE with a single device
+   read.  Ranges running more than a page past the end of the store are
+   left to pager_read_page.  */
+error_t
+pager_read_pages (struct user_pager_info *upi, vm_offset_t page,
+		  vm_size_t length, vm_address_t *buf, int *writelock)
+{
+  error_t err;
+  size_t read = 0;		/* bytes actually read */
+  size_t want = length;		/* bytes we want to read */
+  struct dev *dev = (struct dev *)upi;
+  struct store *store = dev->store;
+
+  if (page >= store->size)
+    return EOPNOTSUPP;
+
+  if (page + want > store->size)
+    /* Read a partial range if necessary to avoid reading off the end.  */
+    want = store->size - page;
+
+  if (round_page (want) < length)
+    return EOPNOTSUPP;
+
+  err = dev_read (dev, page, want, (void **)buf, &read);
+
+  if (!err && want < length)
+    /* Zero anything we didn't read.  Allocation only happens in page-size
+       multiples, so we know we can write there.  */
+    memset ((char *)*buf + want, '\0', length - want);
+
+  *writelock = (store->flags & STORE_READONLY);
+
+  if (err || read < want)
+    return EIO;
+  else
+    return 0;
+}
+
 /* For pager PAGER, synchronously write one page from BUF to offset PAGE.  In
    addition, vm_deallocate (or equivalent) BUF.  The only permissible error
    returns are EIO, EDQUOT, and ENOSPC. */
@@ -99,6 +137,39 @@ pager_write_page (struct user_pager_info *upi,
     }
 }
 
+/* For pager PAGER, synchronously write LENGTH bytes from BUF to offset
+   PAGE with a single device write.  */
+error_t
+pager_write_pages (struct user_pager_info *upi,
+		   vm_offset_t page, vm_size_t length, vm_address_t buf)
+{
+  struct dev *dev = (struct dev *)upi;
+  struct store *store = dev->store;
+
+  if (store->flags & STORE_READONLY)
+    return EROFS;
+  else
+    {
+      error_t err;
+      size_t written;
+      size_t want = length;
+
+      if (page >= store->size)
+	return EOPNOTSUPP;
+
+      if (page + want > store->size)
+	/* Write a partial range if necessary to avoid writing off the end.  */
+	want = store->size - page;
+
+      err = dev_write (dev, page, (char *)buf, want, &written);
+
+      if (err || written < want)
+	return EIO;
+      else
+	return 0;
+    }
+}
+
 /* A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *upi, vm_offset_t address)
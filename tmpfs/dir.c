@@ -24,11 +24,94 @@
 #include "tmpfs.h"
 #include <stdlib.h>
 
+static hurd_ihash_key_t
+name_hash (const void *key)
+{
+  const char *name = key;
+  return (hurd_ihash_key_t) hurd_ihash_hash32 (name, strlen (name), 0);
+}
+
+static int
+name_equal (const void *a, const void *b)
+{
+  return strcmp (a, b) == 0;
+}
+
+/* Return the entry of DN numbered ENTRY, or null if there is none.
+   *I is the number of the first entry in the list on entry, and of
+   the returned one on return.  */
+static struct tmpfs_dirent *
+seek_entry (struct disknode *dn, int entry, int *i)
+{
+  struct tmpfs_dirindex *index = dn->u.dir.index;
+  struct tmpfs_dirent *d = dn->u.dir.entries;
+  int k;
+
+  /* Start from the closest place a previous call stopped at.  */
+  if (index)
+    for (k = 0; k < TMPFS_DIR_CURSORS; k++)
+      {
+	struct tmpfs_dircursor *c = &index->cursors[k];
+	if (c->last && c->entry <= entry && c->entry > *i)
+	  {
+	    *i = c->entry;
+	    d = c->last->next;
+	  }
+      }
+
+  for (; *i < entry && d != 0; d = d->next)
+    ++*i;
+  return d;
+}
+
+/* Remember that a listing of DN that started at entry START stopped
+   at entry ENTRY, after LAST.  */
+static void
+remember_cursor (struct disknode *dn, int start, int entry,
+		 struct tmpfs_dirent *last)
+{
+  struct tmpfs_dirindex *index = dn->u.dir.index;
+  struct tmpfs_dircursor *c;
+  int k;
+
+  /* Move the cursor of a reader going through DN in order along.  */
+  for (k = 0; k < TMPFS_DIR_CURSORS; k++)
+    if (index->cursors[k].last && index->cursors[k].entry == start)
+      break;
+  if (k == TMPFS_DIR_CURSORS)
+    k = index->next_cursor++ % TMPFS_DIR_CURSORS;
+
+  c = &index->cursors[k];
+  c->entry = entry;
+  c->last = last;
+}
+
+/* D is about to be removed from DN; fix the cursors.  */
+static void
+forget_entry (struct disknode *dn, struct tmpfs_dirent *d)
+{
+  struct tmpfs_dirindex *index = dn->u.dir.index;
+  struct tmpfs_dircursor *c;
+
+  for (c = index->cursors; c < &index->cursors[TMPFS_DIR_CURSORS]; c++)
+    if (c->last == d)
+      {
+	c->entry--;
+	if (d->prevp == &dn->u.dir.entries)
+	  c->last = 0;
+	else
+	  c->last = (void *) d->prevp - offsetof (struct tmpfs_dirent, next);
+      }
+    else if (c->last && d->seq < c->last->seq)
+      c->entry--;
+}
+
 error_t
 diskfs_init_dir (struct node *dp, struct node *pdp, struct protid *cred)
 {
   dp->dn->u.dir.dotdot = pdp->dn;
   dp->dn->u.dir.entries = 0;
+  dp->dn->u.dir.index = 0;
 
   /* Increase hardlink count for parent directory */
   pdp->dn_stat.st_nlink++;
@@ -66,7 +149,7 @@ diskfs_get_directs (struct node *dp, int entry, int n,
 		    char **data, size_t *datacnt,
 		    vm_size_t bufsiz, int *amt)
 {
-  struct tmpfs_dirent *d;
+  struct tmpfs_dirent *d, *last = 0;
   struct dirent *entp;
   int i;
 
@@ -115,8 +198,7 @@ diskfs_get_directs (struct node *dp, int entry, int n,
     }
 
   /* Skip ahead to the desired entry.  */
-  for (d = dp->dn->u.dir.entries; i < entry && d != 0; d = d->next)
-    ++i;
+  d = seek_entry (dp->dn, entry, &i);
 
   if (i < entry)
     {
@@ -138,8 +220,12 @@ diskfs_get_directs (struct node *dp, int entry, int n,
       memcpy (entp->d_name, d->name, d->namelen + 1);
       entp->d_reclen = rlen;
       entp = (void *) entp + rlen;
+      last = d;
     }
 
+  if (last)
+    remember_cursor (dp->dn, entry, i, last);
+
   *datacnt = (char *) entp - *data;
   *amt = i - entry;
 
@@ -149,7 +235,7 @@ diskfs_get_directs (struct node *dp, int entry, int n,
 
 struct dirstat
 {
-  struct tmpfs_dirent **prevp;
+  struct tmpfs_dirent *entry;	/* The one found, if any */
   int dotdot;
 };
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -157,7 +243,7 @@ const size_t diskfs_dirstat_size = sizeof (struct dirstat);
 void
 diskfs_null_dirstat (struct dirstat *ds)
 {
-  ds->prevp = 0;
+  ds->entry = 0;
 }
 
 error_t
@@ -174,7 +260,7 @@ diskfs_lookup_hard (struct node *dp,
 		    struct protid *cred)
 {
   const size_t namelen = strlen (name);
-  struct tmpfs_dirent *d, **prevp;
+  struct tmpfs_dirent *d = 0;
 
   if (type == REMOVE || type == RENAME)
     assert_backtrace (np);
@@ -225,21 +311,20 @@ diskfs_lookup_hard (struct node *dp,
 	}
     }
 
-  for (d = *(prevp = &dp->dn->u.dir.entries); d != 0;
-       d = *(prevp = &d->next))
-    if (d->namelen == namelen && !memcmp (d->name, name, namelen))
-      {
-	if (ds)
-	  ds->prevp = prevp;
+  if (dp->dn->u.dir.index)
+    d = hurd_ihash_find (&dp->dn->u.dir.index->names,
+			 (hurd_ihash_key_t) name);
+  if (ds)
+    ds->entry = d;
 
-	if (np)
-	  return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
-	else
-	  return 0;
-      }
+  if (d != 0)
+    {
+      if (np)
+	return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
+      else
+	return 0;
+    }
 
-  if (ds)
-    ds->prevp = prevp;
   if (np)
     *np = 0;
   return ENOENT;
@@ -254,6 +339,7 @@ diskfs_direnter_hard (struct node *dp, const char *name,
   const size_t namelen = strlen (name);
   const size_t entsize
 	  = (offsetof (struct dirent, d_name[1]) + namelen + 7) & ~7;
+  struct tmpfs_dirindex *index = dp->dn->u.dir.index;
   struct tmpfs_dirent *new;
 
   if (round_page (tmpfs_space_used + entsize) / vm_page_size
@@ -264,11 +350,42 @@ diskfs_direnter_hard (struct node *dp, const char *name,
   if (new == 0)
     return ENOSPC;
 
-  new->next = 0;
+  if (index == 0)
+    {
+      index = calloc (1, sizeof *index);
+      if (index == 0)
+	{
+	  free (new);
+	  return ENOSPC;
+	}
+      hurd_ihash_init (&index->names, offsetof (struct tmpfs_dirent, locp));
+      hurd_ihash_set_gki (&index->names, name_hash, name_equal);
+      hurd_ihash_set_flags (&index->names,
+			    HURD_IHASH_CONTROL_BYTES | HURD_IHASH_INCREMENTAL);
+      index->tail = &dp->dn->u.dir.entries;
+      dp->dn->u.dir.index = index;
+    }
+
   new->dn = np->dn;
   new->namelen = namelen;
   memcpy (new->name, name, namelen + 1);
-  *ds->prevp = new;
+  if (hurd_ihash_add (&index->names, (hurd_ihash_key_t) new->name, new))
+    {
+      free (new);
+      if (dp->dn->u.dir.entries == 0)
+	{
+	  hurd_ihash_destroy (&index->names);
+	  free (index);
+	  dp->dn->u.dir.index = 0;
+	}
+      return ENOSPC;
+    }
+
+  new->seq = index->next_seq++;
+  new->next = 0;
+  new->prevp = index->tail;
+  *index->tail = new;
+  index->tail = &new->next;
 
   dp->dn_stat.st_size += entsize;
   adjust_used (entsize);
@@ -286,7 +403,7 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
   if (ds->dotdot)
     dp->dn->u.dir.dotdot = np->dn;
   else
-    (*ds->prevp)->dn = np->dn;
+    ds->entry->dn = np->dn;
 
   return 0;
 }
@@ -294,17 +411,32 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
 error_t
 diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
 {
-  struct tmpfs_dirent *d = *ds->prevp;
+  struct tmpfs_dirindex *index = dp->dn->u.dir.index;
+  struct tmpfs_dirent *d = ds->entry;
   const size_t entsize
 	  = (offsetof (struct dirent, d_name[1]) + d->namelen + 7) & ~7;
 
-  *ds->prevp = d->next;
+  hurd_ihash_locp_remove (&index->names, d->locp);
+  forget_entry (dp->dn, d);
+
+  *d->prevp = d->next;
+  if (d->next)
+    d->next->prevp = d->prevp;
+  else
+    index->tail = d->prevp;
 
   if (dp->dirmod_reqs != 0)
     diskfs_notice_dirchange (dp, DIR_CHANGED_UNLINK, d->name);
 
   free (d);
 
+  if (dp->dn->u.dir.entries == 0)
+    {
+      hurd_ihash_destroy (&index->names);
+      free (index);
+      dp->dn->u.dir.index = 0;
+    }
+
   adjust_used (-entsize);
   dp->dn_stat.st_size -= entsize;
   dp->dn_stat.st_blocks = ((sizeof *dp->dn + dp->dn->translen
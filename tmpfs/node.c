@@ -76,6 +76,7 @@ diskfs_free_node (struct node *np, mode_t mode)
 	vm_deallocate (mach_task_self (), np->dn->u.reg.memref, 4096);
 	mach_port_deallocate (mach_task_self (), np->dn->u.reg.memobj);
       }	
+      free (np->dn->u.reg.data);
       break;
     case DT_DIR:
       assert_backtrace (np->dn->u.dir.entries == 0);
@@ -323,6 +324,10 @@ diskfs_try_dropping_softrefs (struct node *np)
 void
 diskfs_lost_hardrefs (struct node *np)
 {
+  /* Give back what diskfs_grow took ahead of writes that did not come.  */
+  if (np->dn->type == DT_REG && np->dn_stat.st_nlink > 0
+      && np->allocsize > round_page (np->dn_stat.st_size))
+    diskfs_truncate (np, np->dn_stat.st_size);
 }
 
 /* The user must define this function.  Node NP has just acquired
@@ -441,6 +446,9 @@ diskfs_truncate (struct node *np, off_t size)
       return 0;
     }
 
+  if (np->dn->type == DT_REG && np->dn->u.reg.datalen > size)
+    np->dn->u.reg.datalen = size;
+
   if (np->allocsize <= size)
     return 0;
 
@@ -495,6 +503,22 @@ diskfs_grow (struct node *np, off_t size, struct protid *cred)
       / vm_page_size > tmpfs_page_limit)
     return ENOSPC;
 
+  if (tmpfs_prealloc)
+    {
+      /* Double the allocation, in steps of at most tmpfs_prealloc, and
+	 keep large files a multiple of that, so that files written in
+	 small pieces need few calls to the default pager, and its
+	 memory can be backed by large pages.  */
+      off_t want = np->allocsize + (np->allocsize < tmpfs_prealloc
+				    ? np->allocsize : tmpfs_prealloc);
+      if (want >= tmpfs_prealloc)
+	want = (want + tmpfs_prealloc - 1) / tmpfs_prealloc * tmpfs_prealloc;
+      if (want > size
+	  && (round_page (get_used () + want - np->allocsize) / vm_page_size
+	      <= tmpfs_page_limit))
+	set_size = size = want;
+    }
+
   if (default_pager == MACH_PORT_NULL)
     return EIO;
 
@@ -514,6 +538,77 @@ diskfs_grow (struct node *np, off_t size, struct protid *cred)
   return 0;
 }
 
+/* Read or write the contents of NP kept in its disknode, for
+   diskfs_rdwr_hook.  Leave anything else to the memory object.  */
+error_t
+rdwr_inline (struct node *np, char *data, off_t offset, size_t *amt, int dir)
+{
+  struct disknode *dn = np->dn;
+  size_t n;
+
+  if (dn->type != DT_REG || dn->u.reg.memobj != MACH_PORT_NULL)
+    return EINVAL;
+
+  if (dir)
+    {
+      size_t end = offset + *amt;
+
+      if (offset + (off_t) *amt > (off_t) tmpfs_inline_max)
+	return EINVAL;		/* diskfs_get_filemap moves the data.  */
+
+      if (end > dn->u.reg.datalen)
+	{
+	  char *new = realloc (dn->u.reg.data, end);
+	  if (new == 0)
+	    return EINVAL;
+	  memset (new + dn->u.reg.datalen, 0, end - dn->u.reg.datalen);
+	  dn->u.reg.data = new;
+	  dn->u.reg.datalen = end;
+	}
+      memcpy (dn->u.reg.data + offset, data, *amt);
+      return 0;
+    }
+
+  /* Nothing was ever written past DATALEN.  */
+  n = 0;
+  if (offset < (off_t) dn->u.reg.datalen)
+    {
+      n = dn->u.reg.datalen - offset;
+      if (n > *amt)
+	n = *amt;
+      memcpy (data, dn->u.reg.data + offset, n);
+    }
+  memset (data + n, 0, *amt - n);
+  return 0;
+}
+
+/* Copy the contents NP keeps in its disknode into MEMOBJ, its new
+   memory object.  */
+static error_t
+move_inline (struct node *np, mach_port_t memobj)
+{
+  struct disknode *dn = np->dn;
+  vm_address_t addr = 0;
+  error_t err;
+
+  if (dn->u.reg.datalen > 0)
+    {
+      err = vm_map (mach_task_self (), &addr,
+		    round_page (dn->u.reg.datalen), 0, 1, memobj, 0, 0,
+		    VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+		    VM_INHERIT_NONE);
+      if (err)
+	return err;
+      memcpy ((void *) addr, dn->u.reg.data, dn->u.reg.datalen);
+      vm_deallocate (mach_task_self (), addr, round_page (dn->u.reg.datalen));
+    }
+
+  free (dn->u.reg.data);
+  dn->u.reg.data = 0;
+  dn->u.reg.datalen = 0;
+  return 0;
+}
+
 mach_port_t
 diskfs_get_filemap (struct node *np, vm_prot_t prot)
 {
@@ -540,15 +635,22 @@ diskfs_get_filemap (struct node *np, vm_prot_t prot)
      so we might never make a memory object at all.) */
   if (np->dn->u.reg.memobj == MACH_PORT_NULL)
     {
-      error_t err = default_pager_object_create (default_pager,
-						 &np->dn->u.reg.memobj,
+      mach_port_t memobj;
+      error_t err = default_pager_object_create (default_pager, &memobj,
 						 np->allocsize);
+      if (!err)
+	{
+	  err = move_inline (np, memobj);
+	  if (err)
+	    mach_port_deallocate (mach_task_self (), memobj);
+	}
       if (err)
 	{
 	  errno = err;
 	  return MACH_PORT_NULL;
 	}
-      assert_backtrace (np->dn->u.reg.memobj != MACH_PORT_NULL);
+      assert_backtrace (memobj != MACH_PORT_NULL);
+      np->dn->u.reg.memobj = memobj;
       
       /* XXX we need to keep a reference to the object, or GNU Mach
 	 will terminate it when we release the map. */
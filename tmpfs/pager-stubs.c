@@ -35,6 +35,19 @@ pager_read_page (struct user_pager_info *pager,
   return EIEIO;
 }
 
+/* The user may define this function.  For pager PAGER, read LENGTH
+   bytes starting at offset OFFSET into a single buffer *BUF.  */
+error_t
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t offset,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *write_lock)
+{
+  abort();
+  return EIEIO;
+}
+
 /* The user must define this function.  For pager PAGER, synchronously
    write one page from BUF to offset PAGE.  In addition, mfree
    (or equivalent) BUF.  The only permissible error returns are EIO,
@@ -48,6 +61,18 @@ pager_write_page (struct user_pager_info *pager,
   return EIEIO;
 }
 
+/* The user may define this function.  For pager PAGER, synchronously
+   write LENGTH bytes from BUF to offset OFFSET.  */
+error_t
+pager_write_pages (struct user_pager_info *pager,
+		   vm_offset_t offset,
+		   vm_size_t length,
+		   vm_address_t buf)
+{
+  abort();
+  return EIEIO;
+}
+
 /* The user must define this function.  A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *pager,
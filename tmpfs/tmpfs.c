@@ -54,7 +54,85 @@ struct node *diskfs_root_node;
 mach_port_t default_pager;
 
 off_t tmpfs_page_limit, tmpfs_space_used;
+off_t tmpfs_prealloc;
+size_t tmpfs_inline_max = 256;
 mode_t tmpfs_root_mode = -1;
+
+__thread struct used_batch tmpfs_used_batch;
+__thread int tmpfs_used_registered;
+
+static pthread_key_t used_key;
+static pthread_once_t used_key_once = PTHREAD_ONCE_INIT;
+
+/* The batches of all threads which adjusted the used space.  */
+static struct used_batch *used_batches;
+static pthread_mutex_t used_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called when a thread which adjusted the used space exits.  */
+static void
+used_thread_exit (void *arg)
+{
+  struct used_batch *b = &tmpfs_used_batch;
+
+  pthread_mutex_lock (&used_batches_lock);
+  __atomic_add_fetch (&tmpfs_space_used,
+		      __atomic_exchange_n (&b->pending, 0, __ATOMIC_RELAXED),
+		      __ATOMIC_RELAXED);
+  *b->prevp = b->next;
+  if (b->next)
+    b->next->prevp = b->prevp;
+  pthread_mutex_unlock (&used_batches_lock);
+}
+
+static void
+create_used_key (void)
+{
+  error_t err = pthread_key_create (&used_key, used_thread_exit);
+  assert_perror_backtrace (err);
+}
+
+/* Add what the calling thread has kept back to tmpfs_space_used.  */
+void
+flush_used (void)
+{
+  struct used_batch *b = &tmpfs_used_batch;
+
+  if (! tmpfs_used_registered)
+    {
+      /* Have used_thread_exit called when the thread exits.  */
+      pthread_once (&used_key_once, create_used_key);
+      pthread_setspecific (used_key, (void *) 1);
+
+      pthread_mutex_lock (&used_batches_lock);
+      b->next = used_batches;
+      if (b->next)
+	b->next->prevp = &b->next;
+      b->prevp = &used_batches;
+      used_batches = b;
+      pthread_mutex_unlock (&used_batches_lock);
+      tmpfs_used_registered = 1;
+    }
+
+  __atomic_add_fetch (&tmpfs_space_used,
+		      __atomic_exchange_n (&b->pending, 0, __ATOMIC_RELAXED),
+		      __ATOMIC_RELAXED);
+}
+
+/* Return tmpfs_space_used, with what every thread kept back.  */
+off_t
+get_used_exact (void)
+{
+  struct used_batch *b;
+  off_t used;
+
+  pthread_mutex_lock (&used_batches_lock);
+  used = __atomic_load_n (&tmpfs_space_used, __ATOMIC_RELAXED);
+  for (b = used_batches; b; b = b->next)
+    used += __atomic_load_n (&b->pending, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&used_batches_lock);
+
+  return used;
+}
 
 error_t
 diskfs_set_statfs (struct statfs *st)
@@ -68,7 +146,7 @@ diskfs_set_statfs (struct statfs *st)
   st->f_blocks = tmpfs_page_limit;
 
   st->f_files = __atomic_load_n (&num_files, __ATOMIC_RELAXED);
-  pages = round_page (get_used ()) / vm_page_size;
+  pages = round_page (get_used_exact ()) / vm_page_size;
 
   st->f_bfree = pages < tmpfs_page_limit ? tmpfs_page_limit - pages : 0;
   st->f_bavail = st->f_bfree;
@@ -99,17 +177,26 @@ diskfs_reload_global_state ()
 int diskfs_synchronous = 0;
 
 #define OPT_SIZE 600	/* --size */
+#define OPT_PREALLOC 601	/* --prealloc */
+#define OPT_INLINE_MAX 602	/* --inline-max */
 
 static const struct argp_option options[] =
 {
   {"mode", 'm', "MODE", 0, "Permissions (octal) for root directory"},
   {"size", OPT_SIZE, "MAX-BYTES", 0, "Maximum size"},
+  {"prealloc", OPT_PREALLOC, "MAX-BYTES", 0,
+   "Grow files ahead of writes by up to MAX-BYTES at a time (0 to not)"},
+  {"inline-max", OPT_INLINE_MAX, "BYTES", 0,
+   "Keep files of up to BYTES bytes in memory of our own, until mapped"
+   " (default 256)"},
   {NULL,}
 };
 
 struct option_values
 {
   off_t size;
+  off_t prealloc;
+  off_t inline_max;
   mode_t mode;
 };
 
@@ -190,6 +277,8 @@ parse_opt (int key, char *arg, struct argp_state *state)
 	return ENOMEM;
       state->hook = values;
       values->size = -1;
+      values->prealloc = -1;
+      values->inline_max = -1;
       values->mode = -1;
       break;
     case ARGP_KEY_FINI:
@@ -223,6 +312,27 @@ parse_opt (int key, char *arg, struct argp_state *state)
       }
       break;
 
+    case OPT_PREALLOC:		/* --prealloc=MAX-BYTES */
+      {
+	error_t err = parse_opt_size (arg, state, &values->prealloc);
+	if (err)
+	  return err;
+      }
+      break;
+
+    case OPT_INLINE_MAX:	/* --inline-max=BYTES */
+      {
+	error_t err = parse_opt_size (arg, state, &values->inline_max);
+	if (err)
+	  return err;
+	if (values->inline_max > vm_page_size)
+	  {
+	    argp_error (state, "inline files must fit in a page");
+	    return EINVAL;
+	  }
+      }
+      break;
+
     case ARGP_KEY_NO_ARGS:
       if (values->size < 0)
 	{
@@ -258,6 +368,10 @@ parse_opt (int key, char *arg, struct argp_state *state)
       /* All options parse successfully, so implement ours if possible.  */
       tmpfs_page_limit = values->size / vm_page_size;
       tmpfs_root_mode = values->mode;
+      if (values->prealloc >= 0)
+	tmpfs_prealloc = round_page (values->prealloc);
+      if (values->inline_max >= 0)
+	tmpfs_inline_max = values->inline_max;
       break;
 
     default:
@@ -286,6 +400,20 @@ diskfs_append_args (char **argz, size_t *argz_len)
       err = argz_add (argz, argz_len, buf);
     }
 
+  if (!err && tmpfs_prealloc)
+    {
+      char buf[100];
+      snprintf (buf, sizeof buf, "--prealloc=%Ld", tmpfs_prealloc);
+      err = argz_add (argz, argz_len, buf);
+    }
+
+  if (!err && tmpfs_inline_max != 256)
+    {
+      char buf[100];
+      snprintf (buf, sizeof buf, "--inline-max=%zu", tmpfs_inline_max);
+      err = argz_add (argz, argz_len, buf);
+    }
+
   return err;
 }
 
@@ -373,6 +501,8 @@ main (int argc, char **argv)
   if (err)
     error (4, err, "init");
 
+  diskfs_rdwr_hook = rdwr_inline;
+
   err = diskfs_alloc_node (0, S_IFDIR, &diskfs_root_node);
   if (err)
     error (4, err, "cannot create root directory");
@@ -21,6 +21,7 @@ the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 #define _tmpfs_h 1
 
 #include <hurd/diskfs.h>
+#include <hurd/ihash.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <stdint.h>
@@ -49,10 +50,13 @@ struct disknode
       mach_port_t memobj;
       vm_address_t memref;
       unsigned int allocpages;	/* largest size while memobj was live */
+      char *data;		/* malloc'd contents while there is no memobj */
+      size_t datalen;		/* the rest of the file is zeros */
     } reg;
     struct
     {
       struct tmpfs_dirent *entries;
+      struct tmpfs_dirindex *index; /* Set while ENTRIES is not empty */
       struct disknode *dotdot;
     } dir;
     dev_t chr, blk;
@@ -63,31 +67,96 @@ struct disknode
 
 struct tmpfs_dirent
 {
-  struct tmpfs_dirent *next;
+  struct tmpfs_dirent *next, **prevp;
+  hurd_ihash_locp_t locp;	/* In the NAMES table of the index */
+  unsigned long seq;		/* Increases along the list */
   struct disknode *dn;
   uint8_t namelen;
   char name[0];
 };
 
+/* The number of readdir positions remembered per directory.  */
+#define TMPFS_DIR_CURSORS	4
+
+/* A readdir position: ENTRY is the number of the entry following
+   LAST, or the cursor is unused if LAST is NULL.  */
+struct tmpfs_dircursor
+{
+  int entry;
+  struct tmpfs_dirent *last;
+};
+
+/* What makes a directory with many entries quick to search and list.
+   Entries are appended to the list, so their order, and thus their
+   entry numbers, only change when one before them is removed.  */
+struct tmpfs_dirindex
+{
+  struct hurd_ihash names;	/* Entries by name */
+  struct tmpfs_dirent **tail;	/* Where the next entry goes */
+  unsigned long next_seq;
+  struct tmpfs_dircursor cursors[TMPFS_DIR_CURSORS];
+  unsigned int next_cursor;	/* The one to reuse next */
+};
+
 extern off_t tmpfs_page_limit;
 extern mach_port_t default_pager;
 
+/* If not zero, files grow by up to this many bytes more than needed,
+   a multiple of the page size.  */
+extern off_t tmpfs_prealloc;
+
+/* Files not larger than this are kept in their disknode, rather than in
+   a memory object, until they are mapped.  */
+extern size_t tmpfs_inline_max;
+
+error_t rdwr_inline (struct node *np, char *data, off_t offset, size_t *amt,
+		     int dir);
+
 /* These two must be accessed using atomic operations.  */
 extern unsigned int num_files;
 extern off_t tmpfs_space_used;
 
+/* Each thread keeps the changes it makes to tmpfs_space_used to itself
+   until they add up to USED_BATCH bytes either way, or it exits.  Close
+   to the size limit, within USED_BATCH_ROOM bytes, changes are not kept
+   back, so that the limit holds.  */
+#define USED_BATCH	(256 * 1024)
+#define USED_BATCH_ROOM	(64 * USED_BATCH)
+
+struct used_batch
+{
+  off_t pending;		/* Accessed using atomic operations */
+  struct used_batch *next, **prevp;
+};
+
+extern __thread struct used_batch tmpfs_used_batch;
+extern __thread int tmpfs_used_registered;
+void flush_used (void);
+off_t get_used_exact (void);
+
 /* Convenience function to adjust tmpfs_space_used.  */
 static inline void
 adjust_used (off_t change)
 {
-  __atomic_add_fetch (&num_files, change, __ATOMIC_RELAXED);
+  off_t pending = tmpfs_used_batch.pending + change;
+
+  __atomic_store_n (&tmpfs_used_batch.pending, pending, __ATOMIC_RELAXED);
+  if (! tmpfs_used_registered
+      || pending > USED_BATCH || pending < -USED_BATCH
+      || (tmpfs_page_limit * (off_t) vm_page_size
+	  - __atomic_load_n (&tmpfs_space_used, __ATOMIC_RELAXED)
+	  < USED_BATCH_ROOM))
+    flush_used ();
 }
 
-/* Convenience function to get tmpfs_space_used.  */
+/* Convenience function to get tmpfs_space_used, as the calling thread
+   changed it.  Other threads may each keep back up to USED_BATCH bytes,
+   though not close to the size limit; see get_used_exact.  */
 static inline off_t
 get_used (void)
 {
-  return __atomic_load_n (&num_files, __ATOMIC_RELAXED);
+  return __atomic_load_n (&tmpfs_space_used, __ATOMIC_RELAXED)
+	 + tmpfs_used_batch.pending;
 }
 
 #endif
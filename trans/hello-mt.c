@@ -42,6 +42,10 @@ static size_t contents_len = sizeof hello - 1;
 /* This lock protects access to contents and contents_len.  */
 static pthread_rwlock_t contents_lock;
 
+/* If MAX_THREADS is set, serve requests with a bounded pool of threads.  */
+static unsigned int min_threads = 1, max_threads;
+static struct port_bucket *bucket;
+
 /* Trivfs hooks. */
 int trivfs_fstype = FSTYPE_MISC;
 int trivfs_fsid = 0;
@@ -233,6 +237,9 @@ void (*trivfs_peropen_destroy_hook) (struct trivfs_peropen *) = close_hook;
 static const struct argp_option options[] =
 {
   {"contents",	'c', "STRING",	0, "Specify the contents of the virtual file"},
+  {"min-threads", 'm', "N",	0, "Keep at least N threads (default 1)"},
+  {"max-threads", 'M', "N",	0,
+   "Serve requests with at most N threads, queueing the rest"},
   {0}
 };
 
@@ -244,10 +251,36 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     default:
       return ARGP_ERR_UNKNOWN;
     case ARGP_KEY_INIT:
-    case ARGP_KEY_SUCCESS:
     case ARGP_KEY_ERROR:
       break;
 
+    case ARGP_KEY_SUCCESS:
+      if (max_threads && bucket)
+	return ports_set_bucket_pool (bucket, min_threads, max_threads);
+      break;
+
+    case 'm':
+    case 'M':
+      {
+	char *end;
+	unsigned long n = strtoul (arg, &end, 0);
+	if (*end != '\0' || n < 1)
+	  {
+	    argp_error (state, "invalid number of threads: %s", arg);
+	    return EINVAL;
+	  }
+	if (opt == 'm')
+	  min_threads = n;
+	else
+	  max_threads = n;
+	if (max_threads && min_threads > max_threads)
+	  {
+	    argp_error (state, "--min-threads is larger than --max-threads");
+	    return EINVAL;
+	  }
+	break;
+      }
+
     case 'c':
       {
 	char *new = strdup (arg);
@@ -300,6 +333,18 @@ trivfs_append_args (struct trivfs_control *fsys,
 
   free (opt);
 
+  if (! err && max_threads)
+    {
+      char buf[60];
+      snprintf (buf, sizeof buf, "--min-threads=%u", min_threads);
+      err = argz_add (argz, argz_len, buf);
+      if (! err)
+	{
+	  snprintf (buf, sizeof buf, "--max-threads=%u", max_threads);
+	  err = argz_add (argz, argz_len, buf);
+	}
+    }
+
   return err;
 }
 
@@ -338,6 +383,14 @@ main (int argc, char **argv)
   if (err)
     error (3, err, "trivfs_startup");
 
+  bucket = fsys->pi.bucket;
+  if (max_threads)
+    {
+      err = ports_set_bucket_pool (bucket, min_threads, max_threads);
+      if (err)
+	error (3, err, "ports_set_bucket_pool");
+    }
+
   /* Launch. */
   ports_manage_port_operations_multithread (fsys->pi.bucket, trivfs_demuxer,
 					    10 * 1000, /* idle thread */